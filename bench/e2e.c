@@ -0,0 +1,1046 @@
+/* MIT License
+ *
+ * Copyright (c) 2026 Arthur Lapz (rLapz)
+ *
+ * See LICENSE file for license details
+ */
+
+/*
+ * bench-e2e: moetranslate against the local mock server, "make bench-e2e"
+ *
+ * Starts the mock server, drives moetranslate in each mode, and writes one JSON document:
+ * per mode, the latency percentiles, the requests per second, the CPU time per request and
+ * the peak RSS of moetranslate.
+ *
+ * oneshot    : one process per request, up to -c at a time, latency: the process' lifetime
+ * interactive: one process, one line at a time, latency: until the next prompt
+ * batch      : one process, -b -j C, latency: of each request, from its capture
+ *              (-o record=DIR, see http_capture_save())
+ * daemon     : one-shot processes forwarded to a daemon, as oneshot: cold (the cache misses),
+ *              hit (the same texts again) and coalesced (C at a time on the same new text)
+ * serve      : the gateway on PORT + 1, C keep-alive connections of POST /translate, one
+ *              request at a time each: cold, hit and coalesced as daemon
+ *
+ * daemon and serve: the CPU time and peak RSS are of the server (and of the one-shot
+ * processes), from /proc.
+ *
+ * Usage: bench/e2e [-b BIN] [-m MOCK] [-M "MOCK ARGS"] [-A "ARGS"] [-p PORT] [-n NUM]
+ *                  [-c NUM] [-x MODES] [-f FILE]
+ */
+
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+
+#define LEN(X) ((sizeof(X)) / (sizeof(*X)))
+#define MIN(A, B) (((A) < (B)) ? (A) : (B))
+#define MAX(A, B) (((A) > (B)) ? (A) : (B))
+
+#define E2E_BIN       "./moetranslate"
+#define E2E_MOCK      "./mockserver"
+#define E2E_MOCK_ARGS "-l lognormal:20:0.5"
+#define E2E_PORT      "18099"
+#define E2E_REQUESTS  (200)
+#define E2E_CONCUR    (8)
+#define E2E_MODES     "oneshot,interactive,batch,daemon,serve"
+#define E2E_ARGS_MAX  (64)
+#define E2E_TIMEOUT   (30000)
+#define E2E_PROMPT    "]->"
+
+
+typedef struct opts {
+	const char *bin;
+	const char *mock;
+	char       *mock_args;
+	char       *args;
+	const char *port;
+	unsigned    requests;
+	unsigned    concurrency;
+	const char *modes;
+	const char *file;
+} Opts;
+
+/* a keep-alive connection to the gateway */
+typedef struct serve_conn {
+	int     fd;
+	int64_t sent;	/* 0: idle */
+	size_t  len;
+	char    buffer[4096];
+} ServeConn;
+
+typedef struct result {
+	const char *mode;
+	unsigned    requests;
+	unsigned    failed;
+	double     *latencies;	/* milliseconds */
+	unsigned    latencies_len;
+	double      wall;	/* seconds */
+	double      cpu;	/* seconds, user + system */
+	long        rss;	/* KiB */
+} Result;
+
+static Opts opts;
+
+static int64_t time_now_ns(void);
+static double  rusage_cpu(const struct rusage *ru);
+static int     args_split(char str[], char *argv[], int argv_size);
+
+/* argv: moetranslate's, then `extra`, NULL-terminated */
+static int     args_build(char *argv[], int argv_size, const char *const extra[]);
+static void    text_get(char buffer[], size_t size, unsigned num);
+
+static pid_t   mock_start(void);
+static int     port_wait(const char port[]);
+
+/* the mock server, the daemon or the gateway, in the background */
+static pid_t   server_start(char *const argv[]);
+static void    server_stop(pid_t pid);
+
+/* of a running child, from /proc: 0 and 0 without it */
+static void    server_usage(pid_t pid, double *cpu, long *rss);
+
+static int     run_oneshot(Result *r);
+static int     run_interactive(Result *r);
+static int     run_batch(Result *r);
+
+/* cold, hit, coalesced: r[0], r[1], r[2] */
+static int     run_daemon(Result r[]);
+static int     run_serve(Result r[]);
+
+/* is_daemon: without -o, forwarded to it; is_same: C at a time on the same text */
+static int     oneshot_run(Result *r, int is_daemon, int is_same);
+static int     serve_run(Result *r, int is_same);
+static int     serve_send(ServeConn *c, const char text[]);
+
+/* 1: a complete reply, 0: not yet */
+static int     serve_recv(ServeConn *c, Result *r);
+
+static int     capture_latencies(const char dir[], Result *r);
+static int     double_cmp(const void *a, const void *b);
+static double  percentile(const double sorted[], unsigned len, double p);
+static void    result_print(FILE *out, Result *r, int is_last);
+
+
+
+static int64_t
+time_now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((int64_t)ts.tv_sec * 1000000000) + ts.tv_nsec;
+}
+
+
+static double
+rusage_cpu(const struct rusage *ru)
+{
+	return (double)ru->ru_utime.tv_sec + ((double)ru->ru_utime.tv_usec / 1e6) +
+	       (double)ru->ru_stime.tv_sec + ((double)ru->ru_stime.tv_usec / 1e6);
+}
+
+
+static int
+args_split(char str[], char *argv[], int argv_size)
+{
+	int argc = 0;
+	char *save;
+	for (char *p = strtok_r(str, " \t", &save); p != NULL; p = strtok_r(NULL, " \t", &save)) {
+		if (argc == argv_size)
+			return -1;
+
+		argv[argc++] = p;
+	}
+
+	return argc;
+}
+
+
+static int
+args_build(char *argv[], int argv_size, const char *const extra[])
+{
+	static char host[] = "host=127.0.0.1";
+	static char port[64];
+	static char args[1024];
+	snprintf(port, sizeof(port), "port=%s", opts.port);
+	snprintf(args, sizeof(args), "%s", opts.args);
+
+	int argc = 0;
+	argv[argc++] = (char *)opts.bin;
+	argv[argc++] = "-o";
+	argv[argc++] = host;
+	argv[argc++] = "-o";
+	argv[argc++] = port;
+
+	const int ret = args_split(args, argv + argc, argv_size - argc - 1);
+	if (ret < 0)
+		return -1;
+
+	argc += ret;
+	for (; *extra != NULL; extra++) {
+		if (argc == (argv_size - 1))
+			return -1;
+
+		argv[argc++] = (char *)*extra;
+	}
+
+	argv[argc] = NULL;
+	return argc;
+}
+
+
+static void
+text_get(char buffer[], size_t size, unsigned num)
+{
+	/* distinct texts: one capture each */
+	snprintf(buffer, size, "%u the quick brown fox jumps over the lazy dog", num);
+}
+
+
+static pid_t
+mock_start(void)
+{
+	static char args[1024];
+	char *argv[E2E_ARGS_MAX];
+	int argc = 0;
+	argv[argc++] = (char *)opts.mock;
+	argv[argc++] = "-p";
+	argv[argc++] = (char *)opts.port;
+
+	snprintf(args, sizeof(args), "%s", opts.mock_args);
+	const int ret = args_split(args, argv + argc, (int)LEN(argv) - argc - 1);
+	if (ret < 0)
+		return -1;
+
+	argv[argc + ret] = NULL;
+
+	const pid_t pid = server_start(argv);
+	if (pid < 0)
+		return -1;
+
+	if (port_wait(opts.port) < 0) {
+		fprintf(stderr, "e2e: %s: not listening on %s\n", opts.mock, opts.port);
+		server_stop(pid);
+		return -1;
+	}
+
+	return pid;
+}
+
+
+static int
+port_wait(const char port[])
+{
+	struct sockaddr_in addr = { .sin_family = AF_INET };
+	addr.sin_port = htons((uint16_t)atoi(port));
+	inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+
+	for (int i = 0; i < 100; i++) {
+		const int fd = socket(AF_INET, SOCK_STREAM, 0);
+		if (fd < 0)
+			return -1;
+
+		const int ret = connect(fd, (struct sockaddr *)&addr, sizeof(addr));
+		close(fd);
+		if (ret == 0)
+			return 0;
+
+		usleep(20000);
+	}
+
+	return -1;
+}
+
+
+static pid_t
+server_start(char *const argv[])
+{
+	const pid_t pid = fork();
+	if (pid < 0) {
+		perror("e2e: fork");
+		return -1;
+	}
+
+	if (pid == 0) {
+		const int fd = open("/dev/null", O_WRONLY);
+		dup2(fd, STDOUT_FILENO);
+		dup2(fd, STDERR_FILENO);
+		execv(argv[0], argv);
+		_exit(127);
+	}
+
+	return pid;
+}
+
+
+static void
+server_stop(pid_t pid)
+{
+	kill(pid, SIGTERM);
+	waitpid(pid, NULL, 0);
+}
+
+
+static void
+server_usage(pid_t pid, double *cpu, long *rss)
+{
+	char path[64], line[1024];
+	*cpu = 0;
+	*rss = 0;
+
+	/* after the command: state, 5 ints, 5 counters, utime, stime (clock ticks) */
+	snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+	FILE *file = fopen(path, "r");
+	if (file != NULL) {
+		unsigned long utime, stime;
+		const char *const p = (fgets(line, sizeof(line), file) != NULL) ? strrchr(line, ')')
+									       : NULL;
+		if ((p != NULL) &&
+		    (sscanf(p + 1, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime,
+			    &stime) == 2))
+			*cpu = (double)(utime + stime) / (double)sysconf(_SC_CLK_TCK);
+
+		fclose(file);
+	}
+
+	snprintf(path, sizeof(path), "/proc/%d/status", (int)pid);
+	file = fopen(path, "r");
+	if (file != NULL) {
+		while (fgets(line, sizeof(line), file) != NULL) {
+			if (sscanf(line, "VmHWM: %ld kB", rss) == 1)
+				break;
+		}
+
+		fclose(file);
+	}
+}
+
+
+static int
+run_oneshot(Result *r)
+{
+	return oneshot_run(r, 0, 0);
+}
+
+
+static int
+oneshot_run(Result *r, int is_daemon, int is_same)
+{
+	char texts[E2E_CONCUR * 8][128];
+	int64_t started[LEN(texts)];
+	pid_t pids[LEN(texts)];
+	const unsigned concurrency = MIN(opts.concurrency, LEN(texts));
+	unsigned next = 0, running = 0;
+
+	unsigned round = 0;
+
+	memset(pids, 0, sizeof(pids));
+	const int64_t start = time_now_ns();
+	while ((next < r->requests) || (running > 0)) {
+		/* is_same: a round of C at once, on a text not seen before */
+		const unsigned spawn = (is_same && (running > 0)) ? 0 : concurrency;
+		for (unsigned i = 0; (i < spawn) && (next < r->requests); i++) {
+			if (pids[i] != 0)
+				continue;
+
+			const unsigned num = (is_same) ? (r->requests + round) : next;
+			text_get(texts[i], sizeof(texts[i]), num);
+			next++;
+
+			char *argv[E2E_ARGS_MAX];
+			char *const daemon_argv[] = {
+				(char *)opts.bin, "-s", "en:id", texts[i], NULL
+			};
+			const char *const extra[] = { "-s", "en:id", texts[i], NULL };
+			if ((is_daemon == 0) && (args_build(argv, (int)LEN(argv), extra) < 0))
+				return -1;
+
+			started[i] = time_now_ns();
+			pids[i] = fork();
+			if (pids[i] < 0) {
+				perror("e2e: fork");
+				return -1;
+			}
+
+			if (pids[i] == 0) {
+				const int fd = open("/dev/null", O_WRONLY);
+				dup2(fd, STDOUT_FILENO);
+				dup2(fd, STDERR_FILENO);
+				if (is_daemon)
+					execv(daemon_argv[0], daemon_argv);
+				else
+					execv(argv[0], argv);
+
+				_exit(127);
+			}
+
+			running++;
+		}
+
+		round += (spawn > 0);
+
+		int status;
+		struct rusage ru;
+		const pid_t pid = wait4(-1, &status, 0, &ru);
+		if (pid < 0) {
+			perror("e2e: wait4");
+			return -1;
+		}
+
+		for (unsigned i = 0; i < concurrency; i++) {
+			if (pids[i] != pid)
+				continue;
+
+			const int64_t now = time_now_ns();
+			r->latencies[r->latencies_len++] = (double)(now - started[i]) / 1e6;
+			r->failed += (WIFEXITED(status) == 0) || (WEXITSTATUS(status) != 0);
+			r->cpu += rusage_cpu(&ru);
+			r->rss = MAX(r->rss, ru.ru_maxrss);
+			pids[i] = 0;
+			running--;
+			break;
+		}
+	}
+
+	r->wall = (double)(time_now_ns() - start) / 1e9;
+	return 0;
+}
+
+
+static int
+run_interactive(Result *r)
+{
+	char *argv[E2E_ARGS_MAX];
+	const char *const extra[] = { "-i", "-s", "en:id", NULL };
+	if (args_build(argv, (int)LEN(argv), extra) < 0)
+		return -1;
+
+	int in[2], out[2];
+	if ((pipe(in) < 0) || (pipe(out) < 0)) {
+		perror("e2e: pipe");
+		return -1;
+	}
+
+	const int64_t start = time_now_ns();
+	const pid_t pid = fork();
+	if (pid < 0) {
+		perror("e2e: fork");
+		return -1;
+	}
+
+	if (pid == 0) {
+		const int fd = open("/dev/null", O_WRONLY);
+		dup2(in[0], STDIN_FILENO);
+		dup2(out[1], STDOUT_FILENO);
+		dup2(fd, STDERR_FILENO);
+		close(in[1]);
+		close(out[0]);
+		execv(argv[0], argv);
+		_exit(127);
+	}
+
+	close(in[0]);
+	close(out[1]);
+
+	/* each reply ends with the next prompt */
+	char buffer[4096];
+	size_t keep = 0;
+	unsigned prompts = 0;
+	for (unsigned i = 0; i <= r->requests; i++) {
+		const int64_t sent = time_now_ns();
+		if (i > 0) {
+			char text[160];
+			text_get(text, sizeof(text) - 1, i - 1);
+			strcat(text, "\n");
+			if (write(in[1], text, strlen(text)) < 0) {
+				perror("e2e: write");
+				break;
+			}
+		}
+
+		while (prompts <= i) {
+			struct pollfd pfd = { .fd = out[0], .events = POLLIN };
+			if (poll(&pfd, 1, E2E_TIMEOUT) <= 0)
+				goto out0;
+
+			const ssize_t rd = read(out[0], buffer + keep, sizeof(buffer) - keep - 1);
+			if (rd <= 0)
+				goto out0;
+
+			const size_t len = keep + (size_t)rd;
+			buffer[len] = '\0';
+			for (const char *p = buffer; (p = strstr(p, E2E_PROMPT)) != NULL; p++)
+				prompts++;
+
+			/* a prompt across two reads */
+			keep = MIN(len, sizeof(E2E_PROMPT) - 2);
+			memmove(buffer, buffer + len - keep, keep);
+			if (strstr(buffer, E2E_PROMPT) != NULL)
+				keep = 0;
+		}
+
+		if (i > 0)
+			r->latencies[r->latencies_len++] = (double)(time_now_ns() - sent) / 1e6;
+	}
+
+out0:
+	r->failed = r->requests - r->latencies_len;
+	close(in[1]);
+
+	int status;
+	struct rusage ru;
+	if (wait4(pid, &status, 0, &ru) < 0) {
+		perror("e2e: wait4");
+		close(out[0]);
+		return -1;
+	}
+
+	close(out[0]);
+	r->wall = (double)(time_now_ns() - start) / 1e9;
+	r->cpu = rusage_cpu(&ru);
+	r->rss = ru.ru_maxrss;
+	return 0;
+}
+
+
+static int
+run_batch(Result *r)
+{
+	char dir[] = "/tmp/moetranslate-e2e-XXXXXX";
+	if (mkdtemp(dir) == NULL) {
+		perror("e2e: mkdtemp");
+		return -1;
+	}
+
+	char record[sizeof(dir) + 16], jobs[16];
+	snprintf(record, sizeof(record), "record=%s", dir);
+	snprintf(jobs, sizeof(jobs), "%u", opts.concurrency);
+
+	char *argv[E2E_ARGS_MAX];
+	const char *const extra[] = { "-o", record, "-b", "-j", jobs, "-s", "en:id", NULL };
+	if (args_build(argv, (int)LEN(argv), extra) < 0)
+		return -1;
+
+	int in[2];
+	FILE *const err = tmpfile();
+	if ((pipe(in) < 0) || (err == NULL)) {
+		perror("e2e: pipe");
+		return -1;
+	}
+
+	const int64_t start = time_now_ns();
+	const pid_t pid = fork();
+	if (pid < 0) {
+		perror("e2e: fork");
+		return -1;
+	}
+
+	if (pid == 0) {
+		const int fd = open("/dev/null", O_WRONLY);
+		dup2(in[0], STDIN_FILENO);
+		dup2(fd, STDOUT_FILENO);
+		dup2(fileno(err), STDERR_FILENO);
+		close(in[1]);
+		execv(argv[0], argv);
+		_exit(127);
+	}
+
+	close(in[0]);
+	FILE *const input = fdopen(in[1], "w");
+	for (unsigned i = 0; (input != NULL) && (i < r->requests); i++) {
+		char text[128];
+		text_get(text, sizeof(text), i);
+		fprintf(input, "%s\n", text);
+	}
+
+	if (input != NULL)
+		fclose(input);
+
+	int status;
+	struct rusage ru;
+	if (wait4(pid, &status, 0, &ru) < 0) {
+		perror("e2e: wait4");
+		fclose(err);
+		return -1;
+	}
+
+	r->wall = (double)(time_now_ns() - start) / 1e9;
+	r->cpu = rusage_cpu(&ru);
+	r->rss = ru.ru_maxrss;
+
+	/* "moetr_batch: N translated, N failed | ..." */
+	char line[1024];
+	unsigned long translated, failed;
+	r->failed = r->requests;
+	rewind(err);
+	while (fgets(line, sizeof(line), err) != NULL) {
+		if (sscanf(line, "moetr_batch: %lu translated, %lu failed", &translated, &failed) == 2)
+			r->failed = (unsigned)failed;
+	}
+
+	fclose(err);
+	return capture_latencies(dir, r);
+}
+
+
+static int
+capture_latencies(const char dir[], Result *r)
+{
+	DIR *const d = opendir(dir);
+	if (d == NULL) {
+		perror("e2e: opendir");
+		return -1;
+	}
+
+	/* "moetranslate-capture-1 REQ_LEN RES_LEN LATENCY_NS" */
+	char path[1024];
+	struct dirent *ent;
+	while ((ent = readdir(d)) != NULL) {
+		if (ent->d_name[0] == '.')
+			continue;
+
+		snprintf(path, sizeof(path), "%s/%s", dir, ent->d_name);
+		FILE *const file = fopen(path, "r");
+		if (file != NULL) {
+			long long latency;
+			if ((fscanf(file, "%*s %*u %*u %lld", &latency) == 1) &&
+			    (r->latencies_len < r->requests))
+				r->latencies[r->latencies_len++] = (double)latency / 1e6;
+
+			fclose(file);
+		}
+
+		unlink(path);
+	}
+
+	closedir(d);
+	rmdir(dir);
+	return 0;
+}
+
+
+static int
+run_daemon(Result r[])
+{
+	/* a runtime directory of its own: no daemon of the user is involved */
+	char dir[] = "/tmp/moetranslate-e2e-XXXXXX";
+	if (mkdtemp(dir) == NULL) {
+		perror("e2e: mkdtemp");
+		return -1;
+	}
+
+	char sock[sizeof(dir) + 32];
+	snprintf(sock, sizeof(sock), "%s/moetranslate.sock", dir);
+
+	char *const runtime = getenv("XDG_RUNTIME_DIR");
+	char *const runtime_old = (runtime != NULL) ? strdup(runtime) : NULL;
+	setenv("XDG_RUNTIME_DIR", dir, 1);
+
+	int ret = -1;
+	char *argv[E2E_ARGS_MAX];
+	const char *const extra[] = { "--daemon", NULL };
+	if (args_build(argv, (int)LEN(argv), extra) < 0)
+		goto out0;
+
+	const pid_t pid = server_start(argv);
+	if (pid < 0)
+		goto out0;
+
+	struct stat st;
+	for (int i = 0; (i < 100) && (stat(sock, &st) < 0); i++)
+		usleep(20000);
+
+	for (int i = 0; i < 3; i++) {
+		double cpu;
+		server_usage(pid, &cpu, &r[i].rss);
+		ret = oneshot_run(&r[i], 1, i == 2);
+		if (ret < 0)
+			break;
+
+		const double processes = r[i].cpu;
+		server_usage(pid, &r[i].cpu, &r[i].rss);
+		r[i].cpu += processes - cpu;
+	}
+
+	server_stop(pid);
+
+out0:
+	if (runtime_old != NULL)
+		setenv("XDG_RUNTIME_DIR", runtime_old, 1);
+	else
+		unsetenv("XDG_RUNTIME_DIR");
+
+	free(runtime_old);
+	unlink(sock);
+	rmdir(dir);
+	return ret;
+}
+
+
+static int
+run_serve(Result r[])
+{
+	char port[16], addr[32];
+	snprintf(port, sizeof(port), "%d", atoi(opts.port) + 1);
+	snprintf(addr, sizeof(addr), "127.0.0.1:%s", port);
+
+	char *argv[E2E_ARGS_MAX];
+	const char *const extra[] = { "--serve", addr, "-s", "en:id", NULL };
+	if (args_build(argv, (int)LEN(argv), extra) < 0)
+		return -1;
+
+	const pid_t pid = server_start(argv);
+	if (pid < 0)
+		return -1;
+
+	int ret = -1;
+	if (port_wait(port) < 0) {
+		fprintf(stderr, "e2e: %s: not listening on %s\n", opts.bin, addr);
+		goto out0;
+	}
+
+	for (int i = 0; i < 3; i++) {
+		double cpu;
+		server_usage(pid, &cpu, &r[i].rss);
+		ret = serve_run(&r[i], i == 2);
+		if (ret < 0)
+			break;
+
+		server_usage(pid, &r[i].cpu, &r[i].rss);
+		r[i].cpu -= cpu;
+	}
+
+out0:
+	server_stop(pid);
+	return ret;
+}
+
+
+static int
+serve_run(Result *r, int is_same)
+{
+	struct sockaddr_in addr = { .sin_family = AF_INET };
+	addr.sin_port = htons((uint16_t)(atoi(opts.port) + 1));
+	inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+
+	const unsigned concurrency = MIN(opts.concurrency, E2E_CONCUR * 8);
+	ServeConn *const conns = calloc(concurrency, sizeof(ServeConn));
+	struct pollfd pfds[E2E_CONCUR * 8];
+	if (conns == NULL) {
+		perror("e2e: calloc");
+		return -1;
+	}
+
+	int ret = -1;
+	unsigned connected = 0;
+	for (; connected < concurrency; connected++) {
+		conns[connected].fd = socket(AF_INET, SOCK_STREAM, 0);
+		if ((conns[connected].fd < 0) ||
+		    (connect(conns[connected].fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)) {
+			perror("e2e: connect");
+			goto out0;
+		}
+	}
+
+	unsigned next = 0, running = 0, round = 0;
+	const int64_t start = time_now_ns();
+	while ((next < r->requests) || (running > 0)) {
+		/* is_same: a round of C at once, on a text not seen before */
+		const unsigned send = (is_same && (running > 0)) ? 0 : concurrency;
+		for (unsigned i = 0; (i < send) && (next < r->requests); i++) {
+			if (conns[i].sent != 0)
+				continue;
+
+			char text[128];
+			const unsigned num = (is_same) ? (r->requests + round) : next;
+			text_get(text, sizeof(text), num);
+			next++;
+			if (serve_send(&conns[i], text) < 0)
+				goto out0;
+
+			running++;
+		}
+
+		round += (send > 0);
+
+		nfds_t nfds = 0;
+		for (unsigned i = 0; i < concurrency; i++) {
+			if (conns[i].sent == 0)
+				continue;
+
+			pfds[nfds].fd = conns[i].fd;
+			pfds[nfds++].events = POLLIN;
+		}
+
+		if (poll(pfds, nfds, E2E_TIMEOUT) <= 0) {
+			fprintf(stderr, "e2e: %s: no reply\n", r->mode);
+			goto out0;
+		}
+
+		for (unsigned i = 0; i < concurrency; i++) {
+			if (conns[i].sent == 0)
+				continue;
+
+			const int done = serve_recv(&conns[i], r);
+			if (done < 0)
+				goto out0;
+
+			running -= (unsigned)done;
+		}
+	}
+
+	r->wall = (double)(time_now_ns() - start) / 1e9;
+	ret = 0;
+
+out0:
+	for (unsigned i = 0; i < connected; i++)
+		close(conns[i].fd);
+
+	free(conns);
+	return ret;
+}
+
+
+static int
+serve_send(ServeConn *c, const char text[])
+{
+	char req[512];
+	const int len = snprintf(req, sizeof(req), "POST /translate HTTP/1.1\r\nHost: e2e\r\n"
+				 "Content-Length: %zu\r\n\r\n{\"text\": \"%s\"}",
+				 strlen(text) + 12, text);
+
+	c->sent = time_now_ns();
+	c->len = 0;
+	if (write(c->fd, req, (size_t)len) != len) {
+		perror("e2e: write");
+		return -1;
+	}
+
+	return 0;
+}
+
+
+static int
+serve_recv(ServeConn *c, Result *r)
+{
+	const ssize_t rd = recv(c->fd, c->buffer + c->len, sizeof(c->buffer) - c->len - 1,
+				MSG_DONTWAIT);
+	if (rd < 0)
+		return ((errno == EAGAIN) || (errno == EWOULDBLOCK)) ? 0 : -1;
+
+	if (rd == 0) {
+		fprintf(stderr, "e2e: %s: connection closed\n", r->mode);
+		return -1;
+	}
+
+	c->len += (size_t)rd;
+	c->buffer[c->len] = '\0';
+
+	/* "HTTP/1.1 200 OK\r\n...Content-Length: N\r\n\r\nBODY" */
+	const char *const body = strstr(c->buffer, "\r\n\r\n");
+	const char *const length = strstr(c->buffer, "Content-Length: ");
+	if ((body == NULL) || (length == NULL) || (length > body)) {
+		if (c->len == (sizeof(c->buffer) - 1))
+			return -1;
+
+		return 0;
+	}
+
+	const size_t total = (size_t)(body + 4 - c->buffer) + strtoul(length + 16, NULL, 10);
+	if (c->len < total)
+		return (total < sizeof(c->buffer)) ? 0 : -1;
+
+	r->latencies[r->latencies_len++] = (double)(time_now_ns() - c->sent) / 1e6;
+	r->failed += (strncmp(c->buffer, "HTTP/1.1 200 ", 13) != 0);
+	c->sent = 0;
+	return 1;
+}
+
+
+static int
+double_cmp(const void *a, const void *b)
+{
+	const double x = *(const double *)a;
+	const double y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+
+static double
+percentile(const double sorted[], unsigned len, double p)
+{
+	if (len == 0)
+		return 0;
+
+	/* nearest rank */
+	unsigned idx = (unsigned)((p * len) + 0.999999);
+	idx = (idx == 0) ? 0 : (idx - 1);
+	return sorted[MIN(idx, len - 1)];
+}
+
+
+static void
+result_print(FILE *out, Result *r, int is_last)
+{
+	qsort(r->latencies, r->latencies_len, sizeof(double), double_cmp);
+
+	const unsigned done = r->requests - r->failed;
+	fprintf(out, "    {\n"
+		"      \"mode\": \"%s\",\n"
+		"      \"requests\": %u,\n"
+		"      \"failed\": %u,\n"
+		"      \"wall_s\": %.3f,\n"
+		"      \"requests_s\": %.1f,\n"
+		"      \"latency_ms\": { \"p50\": %.2f, \"p90\": %.2f, \"p99\": %.2f, \"p999\": %.2f },\n"
+		"      \"cpu_ms_per_request\": %.3f,\n"
+		"      \"peak_rss_kib\": %ld\n"
+		"    }%s\n",
+		r->mode, r->requests, r->failed, r->wall, (r->wall > 0) ? (done / r->wall) : 0.0,
+		percentile(r->latencies, r->latencies_len, 0.50),
+		percentile(r->latencies, r->latencies_len, 0.90),
+		percentile(r->latencies, r->latencies_len, 0.99),
+		percentile(r->latencies, r->latencies_len, 0.999),
+		(r->requests > 0) ? ((r->cpu * 1e3) / r->requests) : 0.0, r->rss,
+		is_last ? "" : ",");
+}
+
+
+int
+main(int argc, char *argv[])
+{
+	static char mock_args[] = E2E_MOCK_ARGS;
+	static char args[] = "";
+	opts.bin = E2E_BIN;
+	opts.mock = E2E_MOCK;
+	opts.mock_args = mock_args;
+	opts.args = args;
+	opts.port = E2E_PORT;
+	opts.requests = E2E_REQUESTS;
+	opts.concurrency = E2E_CONCUR;
+	opts.modes = E2E_MODES;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "b:m:M:A:p:n:c:x:f:")) != -1) {
+		switch (opt) {
+		case 'b': opts.bin = optarg; break;
+		case 'm': opts.mock = optarg; break;
+		case 'M': opts.mock_args = optarg; break;
+		case 'A': opts.args = optarg; break;
+		case 'p': opts.port = optarg; break;
+		case 'n': opts.requests = (unsigned)strtoul(optarg, NULL, 10); break;
+		case 'c': opts.concurrency = MAX((unsigned)strtoul(optarg, NULL, 10), 1u); break;
+		case 'x': opts.modes = optarg; break;
+		case 'f': opts.file = optarg; break;
+		default:
+			fprintf(stderr, "Usage: %s [-b BIN] [-m MOCK] [-M \"MOCK ARGS\"] [-A \"ARGS\"] "
+				"[-p PORT] [-n NUM] [-c NUM] [-x MODES] [-f FILE]\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	const struct {
+		const char *name;
+		int       (*run)(Result r[]);
+		const char *results[3];	/* { NULL }: one, of the mode */
+	} modes[] = {
+		{ "oneshot",     run_oneshot,     { NULL } },
+		{ "interactive", run_interactive, { NULL } },
+		{ "batch",       run_batch,       { NULL } },
+		{ "daemon",      run_daemon,
+		  { "daemon_cold", "daemon_hit", "daemon_coalesced" } },
+		{ "serve",       run_serve,
+		  { "serve_cold", "serve_hit", "serve_coalesced" } },
+	};
+
+	Result results[LEN(modes) * 3];
+	unsigned results_len = 0;
+	int ret = EXIT_FAILURE;
+
+	signal(SIGPIPE, SIG_IGN);
+	const pid_t mock = mock_start();
+	if (mock < 0)
+		return ret;
+
+	for (size_t i = 0; i < LEN(modes); i++) {
+		/* "-x oneshot,batch" */
+		const char *p = strstr(opts.modes, modes[i].name);
+		const size_t len = strlen(modes[i].name);
+		if ((p == NULL) || ((p != opts.modes) && (p[-1] != ',')) ||
+		    ((p[len] != '\0') && (p[len] != ',')))
+			continue;
+
+		Result *const r = &results[results_len];
+		for (size_t j = 0; j < LEN(modes[i].results); j++) {
+			if ((j > 0) && (modes[i].results[j] == NULL))
+				break;
+
+			memset(&r[j], 0, sizeof(*r));
+			const char *const name = modes[i].results[j];
+			r[j].mode = (name != NULL) ? name : modes[i].name;
+			r[j].requests = opts.requests;
+			r[j].latencies = calloc(MAX(opts.requests, 1u), sizeof(double));
+			if (r[j].latencies == NULL) {
+				perror("e2e: calloc");
+				goto out0;
+			}
+
+			results_len++;
+		}
+
+		fprintf(stderr, "e2e: %s: %u requests...\n", modes[i].name, opts.requests);
+		if (modes[i].run(r) < 0)
+			goto out0;
+	}
+
+	FILE *const out = (opts.file != NULL) ? fopen(opts.file, "w") : stdout;
+	if (out == NULL) {
+		perror("e2e: fopen");
+		goto out0;
+	}
+
+	time_t now = time(NULL);
+	char date[32];
+	strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+	fprintf(out, "{\n"
+		"  \"date\": \"%s\",\n"
+		"  \"bin\": \"%s\",\n"
+		"  \"args\": \"%s\",\n"
+		"  \"mock_args\": \"%s\",\n"
+		"  \"concurrency\": %u,\n"
+		"  \"results\": [\n", date, opts.bin, opts.args, opts.mock_args, opts.concurrency);
+
+	for (unsigned i = 0; i < results_len; i++)
+		result_print(out, &results[i], (i + 1) == results_len);
+
+	fprintf(out, "  ]\n}\n");
+	if (out != stdout)
+		fclose(out);
+
+	ret = EXIT_SUCCESS;
+
+out0:
+	for (unsigned i = 0; i < results_len; i++)
+		free(results[i].latencies);
+
+	kill(mock, SIGTERM);
+	waitpid(mock, NULL, 0);
+	return ret;
+}
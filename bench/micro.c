@@ -0,0 +1,519 @@
+/* MIT License
+ *
+ * Copyright (c) 2026 Arthur Lapz (rLapz)
+ *
+ * See LICENSE file for license details
+ */
+
+/*
+ * bench-micro: the hot paths of moetranslate.c, "make bench-micro"
+ *
+ * moetranslate.c is included: its static functions are reachable, its main() is renamed.
+ * The allocations are counted with the linker's --wrap (malloc, calloc, realloc), see the
+ * Makefile.
+ *
+ * Output: one JSON object per benchmark and per line, on stdout:
+ *   {"name": "json_parse/detail", "iters": 65536, "ns_op": 1234.5, "bytes_s": 1.7e+09,
+ *    "allocs_op": 1.00}
+ *
+ * Usage: bench/micro [-t MS] [-d DIR] [FILTER]
+ *   -t MS   : time per benchmark (BENCH_TIME_MS)
+ *   -d DIR  : the payloads, simple.json and detail.json (BENCH_DIR)
+ *   FILTER  : only the benchmarks with FILTER in their name
+ */
+
+#include <limits.h>
+
+#define main moetranslate_main
+#include "../moetranslate.c"
+#undef main
+
+
+#define BENCH_TIME_MS (200)
+#define BENCH_DIR     "bench"
+
+
+typedef struct bench_ctx {
+	MoeTr       moe;
+	Http        http;
+	char       *simple;
+	size_t      simple_len;
+	char       *detail;
+	size_t      detail_len;
+	json_value_t *json;
+	const char *input;
+	size_t      input_len;
+	int         null_fd;
+	int         stdout_fd;
+} BenchCtx;
+
+typedef struct bench {
+	const char *name;
+	/* ret: the bytes of one iteration, 0: not applicable */
+	size_t    (*setup)(BenchCtx *c);
+	void      (*run)(BenchCtx *c, unsigned long iters);
+	void      (*teardown)(BenchCtx *c);
+} Bench;
+
+
+/*
+ * Allocations
+ */
+static unsigned long bench_allocs;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void *__wrap_malloc(size_t size);
+void *__wrap_calloc(size_t nmemb, size_t size);
+void *__wrap_realloc(void *ptr, size_t size);
+
+
+void *
+__wrap_malloc(size_t size)
+{
+	bench_allocs++;
+	return __real_malloc(size);
+}
+
+
+void *
+__wrap_calloc(size_t nmemb, size_t size)
+{
+	bench_allocs++;
+	return __real_calloc(nmemb, size);
+}
+
+
+void *
+__wrap_realloc(void *ptr, size_t size)
+{
+	bench_allocs++;
+	return __real_realloc(ptr, size);
+}
+
+
+/*
+ * Payloads
+ */
+static const char bench_text_short[] = "Hello world";
+static const char bench_text_long[] =
+	"The quick brown fox jumps over the lazy dog. Über den Wolken muss die Freiheit wohl "
+	"grenzenlos sein. 素早い茶色の狐がのろまな犬を飛び越える。 Съешь же ещё этих мягких "
+	"французских булок, да выпей чаю. El veloz murciélago hindú comía feliz cardillo y kiwi.";
+static const char bench_html[] =
+	"she heard someone calling \xe2\x80\x98<b>Hello</b>! <b>Hello</b>!\xe2\x80\x99 from outside";
+static const char *const bench_langs[] = { "en", "id", "zh-TW", "ja", "yo", "auto" };
+
+
+static char *
+bench_load(const char dir[], const char name[], size_t *len)
+{
+	char path[1024];
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+
+	FILE *const file = fopen(path, "r");
+	if (file == NULL) {
+		perror(path);
+		return NULL;
+	}
+
+	fseek(file, 0, SEEK_END);
+	const long size = ftell(file);
+	rewind(file);
+
+	char *const ret = malloc((size_t)size + 1);
+	if ((ret == NULL) || (fread(ret, 1, (size_t)size, file) != (size_t)size)) {
+		fprintf(stderr, "bench_load: %s: failed\n", path);
+		free(ret);
+		fclose(file);
+		return NULL;
+	}
+
+	fclose(file);
+
+	/* the trailing newline */
+	size_t n = (size_t)size;
+	while ((n > 0) && isspace((unsigned char)ret[n - 1]))
+		n--;
+
+	ret[n] = '\0';
+	*len = n;
+	return ret;
+}
+
+
+/*
+ * Benchmarks
+ */
+static size_t
+setup_url_short(BenchCtx *c)
+{
+	c->input = bench_text_short;
+	return (c->input_len = sizeof(bench_text_short) - 1);
+}
+
+
+static size_t
+setup_url_long(BenchCtx *c)
+{
+	c->input = bench_text_long;
+	return (c->input_len = sizeof(bench_text_long) - 1);
+}
+
+
+static void
+run_url_encode(BenchCtx *c, unsigned long iters)
+{
+	for (unsigned long i = 0; i < iters; i++) {
+		if (http_url_encode(&c->http, c->input) == NULL)
+			abort();
+	}
+}
+
+
+static size_t
+bench_set_response(BenchCtx *c, const char json[], size_t json_len)
+{
+	char head[128];
+	const int head_len = snprintf(head, sizeof(head), "HTTP/1.1 200 OK\r\n"
+				      "Content-Type: application/json; charset=UTF-8\r\n"
+				      "Content-Length: %zu\r\n\r\n", json_len);
+
+	const size_t len = (size_t)head_len + json_len;
+	if (buffer_check(&c->http.buffer, len + 1) < 0)
+		abort();
+
+	memcpy(c->http.buffer.ptr, head, (size_t)head_len);
+	memcpy(c->http.buffer.ptr + head_len, json, json_len);
+	c->http.buffer.ptr[len] = '\0';
+	c->http.buffer_len = len;
+	c->http.head_len = (size_t)head_len;
+	c->http.body_len = json_len;
+	c->http.status = 200;
+	c->http.state = HTTP_STATE_DONE;
+	return len;
+}
+
+
+static size_t
+setup_response_simple(BenchCtx *c)
+{
+	return bench_set_response(c, c->simple, c->simple_len);
+}
+
+
+static size_t
+setup_response_detail(BenchCtx *c)
+{
+	return bench_set_response(c, c->detail, c->detail_len);
+}
+
+
+static void
+run_response_get_json(BenchCtx *c, unsigned long iters)
+{
+	size_t len;
+	for (unsigned long i = 0; i < iters; i++) {
+		if (http_response_get_json(&c->http, &len) == NULL)
+			abort();
+	}
+}
+
+
+static size_t
+setup_json_simple(BenchCtx *c)
+{
+	c->input = c->simple;
+	return (c->input_len = c->simple_len);
+}
+
+
+static size_t
+setup_json_detail(BenchCtx *c)
+{
+	c->input = c->detail;
+	return (c->input_len = c->detail_len);
+}
+
+
+static void
+run_json_parse(BenchCtx *c, unsigned long iters)
+{
+	for (unsigned long i = 0; i < iters; i++) {
+		json_value_t *const json = json_parse(c->input, c->input_len);
+		if (json == NULL)
+			abort();
+
+		free(json);
+	}
+}
+
+
+static size_t
+setup_parsed_simple(BenchCtx *c)
+{
+	c->json = json_parse(c->simple, c->simple_len);
+	return c->simple_len;
+}
+
+
+static size_t
+setup_parsed_detail(BenchCtx *c)
+{
+	c->json = json_parse(c->detail, c->detail_len);
+	return c->detail_len;
+}
+
+
+static void
+teardown_parsed(BenchCtx *c)
+{
+	free(c->json);
+	c->json = NULL;
+}
+
+
+static void
+run_json_array_index(BenchCtx *c, unsigned long iters)
+{
+	/* every element of the root, and the sentences in it */
+	json_array_t *const root = json_value_as_array(c->json);
+	for (unsigned long i = 0; i < iters; i++) {
+		for (size_t j = 0; j < root->length; j++) {
+			json_array_t *const arr = json_value_as_array_wrp(json_array_index(root, j));
+			if ((arr != NULL) && (arr->length > 0) &&
+			    (json_array_index(arr, arr->length - 1) == NULL))
+				abort();
+		}
+	}
+}
+
+
+static void
+run_google_parse_simple(BenchCtx *c, unsigned long iters)
+{
+	for (unsigned long i = 0; i < iters; i++) {
+		result_reset(&c->moe.result);
+		if (backend_google_parse(c->json, RESULT_TYPE_SIMPLE, &c->moe.result) < 0)
+			abort();
+	}
+}
+
+
+static void
+run_google_parse_detail(BenchCtx *c, unsigned long iters)
+{
+	for (unsigned long i = 0; i < iters; i++) {
+		result_reset(&c->moe.result);
+		if (backend_google_parse(c->json, RESULT_TYPE_DETAIL, &c->moe.result) < 0)
+			abort();
+	}
+}
+
+
+static size_t
+setup_html(BenchCtx *c)
+{
+	c->input = bench_html;
+	return (c->input_len = sizeof(bench_html) - 1);
+}
+
+
+static void
+run_skip_html_tags(BenchCtx *c, unsigned long iters)
+{
+	char buffer[sizeof(bench_html)];
+	for (unsigned long i = 0; i < iters; i++) {
+		memcpy(buffer, c->input, sizeof(buffer));
+		if (cstr_skip_html_tags(buffer, c->input_len) == NULL)
+			abort();
+	}
+}
+
+
+static void
+run_lang_get_from_key(BenchCtx *c, unsigned long iters)
+{
+	(void)c;
+	for (unsigned long i = 0; i < iters; i++) {
+		if (lang_get_from_key(bench_langs[i % LEN(bench_langs)]) == NULL)
+			abort();
+	}
+}
+
+
+/* the renderers write to /dev/null */
+static size_t
+bench_stdout_null(BenchCtx *c, json_value_t *json, int type)
+{
+	c->json = json;
+	result_reset(&c->moe.result);
+	if (backend_google_parse(c->json, type, &c->moe.result) < 0)
+		abort();
+
+	fflush(stdout);
+	c->stdout_fd = dup(STDOUT_FILENO);
+	dup2(c->null_fd, STDOUT_FILENO);
+	return 0;
+}
+
+
+static size_t
+setup_print_simple(BenchCtx *c)
+{
+	return bench_stdout_null(c, json_parse(c->simple, c->simple_len), RESULT_TYPE_SIMPLE);
+}
+
+
+static size_t
+setup_print_detail(BenchCtx *c)
+{
+	return bench_stdout_null(c, json_parse(c->detail, c->detail_len), RESULT_TYPE_DETAIL);
+}
+
+
+static size_t
+setup_print_lang(BenchCtx *c)
+{
+	return bench_stdout_null(c, json_parse(c->simple, c->simple_len), RESULT_TYPE_LANG);
+}
+
+
+static void
+teardown_print(BenchCtx *c)
+{
+	fflush(stdout);
+	dup2(c->stdout_fd, STDOUT_FILENO);
+	close(c->stdout_fd);
+	teardown_parsed(c);
+}
+
+
+static void
+run_print_simple(BenchCtx *c, unsigned long iters)
+{
+	for (unsigned long i = 0; i < iters; i++)
+		moetr_print_simple(&c->moe.result, stdout);
+}
+
+
+static void
+run_print_detail(BenchCtx *c, unsigned long iters)
+{
+	for (unsigned long i = 0; i < iters; i++)
+		moetr_print_detail(&c->moe, &c->moe.result, "hello", stdout);
+}
+
+
+static void
+run_print_detect_lang(BenchCtx *c, unsigned long iters)
+{
+	for (unsigned long i = 0; i < iters; i++)
+		moetr_print_detect_lang(&c->moe.result, stdout);
+}
+
+
+static const Bench benches[] = {
+	{ "http_url_encode/short",          setup_url_short,       run_url_encode,          NULL },
+	{ "http_url_encode/long",           setup_url_long,        run_url_encode,          NULL },
+	{ "http_response_get_json/simple",  setup_response_simple, run_response_get_json,   NULL },
+	{ "http_response_get_json/detail",  setup_response_detail, run_response_get_json,   NULL },
+	{ "json_parse/simple",              setup_json_simple,     run_json_parse,          NULL },
+	{ "json_parse/detail",              setup_json_detail,     run_json_parse,          NULL },
+	{ "json_array_index/detail",        setup_parsed_detail,   run_json_array_index,    teardown_parsed },
+	{ "backend_google_parse/simple",    setup_parsed_simple,   run_google_parse_simple, teardown_parsed },
+	{ "backend_google_parse/detail",    setup_parsed_detail,   run_google_parse_detail, teardown_parsed },
+	{ "cstr_skip_html_tags",            setup_html,            run_skip_html_tags,      NULL },
+	{ "lang_get_from_key",              NULL,                  run_lang_get_from_key,   NULL },
+	{ "moetr_print_simple",             setup_print_simple,    run_print_simple,        teardown_print },
+	{ "moetr_print_detail",             setup_print_detail,    run_print_detail,        teardown_print },
+	{ "moetr_print_detect_lang",        setup_print_lang,      run_print_detect_lang,   teardown_print },
+};
+
+
+static void
+bench_run(BenchCtx *c, const Bench *b, int64_t time_ns)
+{
+	const size_t bytes = (b->setup != NULL) ? b->setup(c) : 0;
+
+	/* warm up, then grow the iterations until a run lasts long enough */
+	b->run(c, 1);
+
+	unsigned long iters = 1;
+	int64_t elapsed;
+	unsigned long allocs;
+	while (1) {
+		bench_allocs = 0;
+		const int64_t start = time_now_ns();
+		b->run(c, iters);
+		elapsed = time_now_ns() - start;
+		allocs = bench_allocs;
+		if ((elapsed >= time_ns) || (iters >= (ULONG_MAX / 2)))
+			break;
+
+		/* aim at the target time, at most 10x more at a time */
+		const double scale = (elapsed > 0) ? ((double)time_ns / (double)elapsed) * 1.2 : 10.0;
+		iters = (unsigned long)((double)iters * MIN(MAX(scale, 2.0), 10.0));
+	}
+
+	if (b->teardown != NULL)
+		b->teardown(c);
+
+	const double ns_op = (double)elapsed / (double)iters;
+	const double bytes_s = (bytes > 0) ? ((double)bytes * 1e9 / ns_op) : 0.0;
+	printf("{\"name\": \"%s\", \"iters\": %lu, \"ns_op\": %.1f, \"bytes_s\": %.4g, "
+	       "\"allocs_op\": %.2f}\n", b->name, iters, ns_op, bytes_s,
+	       (double)allocs / (double)iters);
+	fflush(stdout);
+}
+
+
+int
+main(int argc, char *argv[])
+{
+	int64_t time_ms = BENCH_TIME_MS;
+	const char *dir = BENCH_DIR;
+	int opt;
+	while ((opt = getopt(argc, argv, "t:d:")) != -1) {
+		switch (opt) {
+		case 't':
+			time_ms = atoi(optarg);
+			break;
+		case 'd':
+			dir = optarg;
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-t MS] [-d DIR] [FILTER]\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	const char *const filter = (optind < argc) ? argv[optind] : NULL;
+
+	static BenchCtx ctx;
+	const Lang *langs[2] = { lang_get_from_key("auto"), lang_get_from_key("id") };
+	if (moetr_init(&ctx.moe, 'd', langs) < 0)
+		return EXIT_FAILURE;
+
+	if (http_init(&ctx.http, &ctx.moe.pool) < 0)
+		return EXIT_FAILURE;
+
+	ctx.simple = bench_load(dir, "simple.json", &ctx.simple_len);
+	ctx.detail = bench_load(dir, "detail.json", &ctx.detail_len);
+	ctx.null_fd = open("/dev/null", O_WRONLY);
+	if ((ctx.simple == NULL) || (ctx.detail == NULL) || (ctx.null_fd < 0))
+		return EXIT_FAILURE;
+
+	for (size_t i = 0; i < LEN(benches); i++) {
+		if ((filter == NULL) || (strstr(benches[i].name, filter) != NULL))
+			bench_run(&ctx, &benches[i], time_ms * 1000000);
+	}
+
+	close(ctx.null_fd);
+	free(ctx.simple);
+	free(ctx.detail);
+	http_deinit(&ctx.http);
+	moetr_deinit(&ctx.moe);
+	return EXIT_SUCCESS;
+}
@@ -25,6 +25,62 @@
 #define CONFIG_INTERACTIVE_HISTORY_SIZE (128u)
 
 
+/*
+ * Batch mode: default number of concurrent requests (-j)
+ */
+#define CONFIG_BATCH_CONCURRENCY (4u)
+
+
+/*
+ * libmoetranslate: max concurrent async requests of a context, the others are queued
+ */
+#define CONFIG_ASYNC_CONCURRENCY (16u)
+
+
+/*
+ * Daemon (--daemon): one process keeps the connections warm, the cache and the stats; the
+ * one-shot invocations without "-o" forward their request to it over a Unix socket, and go
+ * direct when it's not running
+ * DAEMON_SOCKET     : path, "": $XDG_RUNTIME_DIR/moetranslate.sock, or
+ *                     /tmp/moetranslate-UID/daemon.sock (a directory of the user only)
+ * DAEMON_TIMEOUT    : the client waits this long for the reply, then goes direct (milliseconds)
+ * DAEMON_CLIENTS_MAX: max connected clients, the others are refused
+ * CACHE_SIZE        : max cached results, the least recently used ones are evicted, 0: off
+ * CACHE_TTL         : a result is cached this long (seconds)
+ */
+#define CONFIG_DAEMON_SOCKET      ""
+#define CONFIG_DAEMON_TIMEOUT     (20000)
+#define CONFIG_DAEMON_CLIENTS_MAX (256u)
+#define CONFIG_CACHE_SIZE         (4096u)
+#define CONFIG_CACHE_TTL          (3600)
+
+
+/*
+ * Gateway (--serve ADDR:PORT): a JSON API over HTTP/1.1, on the engine, cache and stats of the
+ * daemon, with keep-alive and pipelining; its connections count in DAEMON_CLIENTS_MAX
+ * SERVE_HEAD_MAX    : max size of the head of a request (bytes)
+ * SERVE_IDLE_TIMEOUT: an idle keep-alive connection is closed after (milliseconds)
+ */
+#define CONFIG_SERVE_HEAD_MAX     (8192u)
+#define CONFIG_SERVE_IDLE_TIMEOUT (30000)
+
+
+/*
+ * Scheduler of the daemon: the requests queue per connection and class before the engine,
+ * "interactive" ones go first, "bulk" ones (a /batch) fill the rest of the slots; in a class,
+ * the connections share by their "weight" (fair queuing); an expired request fails with
+ * "deadline exceeded" before it is sent
+ * SCHED_BULK_SLOTS          : max ASYNC_CONCURRENCY slots taken by bulk requests
+ * SCHED_DEADLINE_INTERACTIVE: default deadline of an interactive request (milliseconds, 0: none)
+ * SCHED_DEADLINE_BULK       : default deadline of a bulk request (milliseconds, 0: none)
+ * SCHED_WEIGHT_MAX          : max "weight" of a connection
+ */
+#define CONFIG_SCHED_BULK_SLOTS           (12u)
+#define CONFIG_SCHED_DEADLINE_INTERACTIVE (15000)
+#define CONFIG_SCHED_DEADLINE_BULK        (0)
+#define CONFIG_SCHED_WEIGHT_MAX           (100u)
+
+
 /*
  * DEF: Definition
  * EXM: Example
@@ -58,6 +114,14 @@
 #define CONFIG_BUFFER_MAX_SIZE   ((1024u * 1024u) * 8u)
 #define CONFIG_PRINT_BUFFER_SIZE BUFSIZ
 
+/*
+ * Backends (-o backend=NAME)
+ * BACKEND: the default one: "google" (the HTTP_* below), "libre" (LibreTranslate, the
+ *          LIBRE_* below, a self-hosted instance by default)
+ * LIBRE_API_KEY: "": none
+ */
+#define CONFIG_BACKEND "google"
+
 #define CONFIG_HTTP_HOST   "translate.googleapis.com"
 #define CONFIG_HTTP_PORT   "80"
 #define CONFIG_HTTP_METHOD "GET "
@@ -73,12 +137,193 @@
 #define CONFIG_HTTP_QUERY_HL  "&hl="
 #define CONFIG_HTTP_QUERY_TXT "&q="
 
+#define CONFIG_LIBRE_HOST     "127.0.0.1"
+#define CONFIG_LIBRE_PORT     "5000"
+#define CONFIG_LIBRE_TLS_PORT "443"
+#define CONFIG_LIBRE_API_KEY  ""
+#define CONFIG_LIBRE_METHOD   "POST "
+
+#define CONFIG_LIBRE_PATH_TRANSLATE "/translate"
+#define CONFIG_LIBRE_PATH_DETECT    "/detect"
+
+#define CONFIG_LIBRE_QUERY_TXT    "q="
+#define CONFIG_LIBRE_QUERY_SL     "&source="
+#define CONFIG_LIBRE_QUERY_TL     "&target="
+#define CONFIG_LIBRE_QUERY_FORMAT "&format=text"
+#define CONFIG_LIBRE_QUERY_KEY    "&api_key="
+
+/* every backend, the "Host" header goes before them */
 #define CONFIG_HTTP_PROTOCOL " HTTP/1.1\r\n"
-#define CONFIG_HTTP_HEADER   "Host: " CONFIG_HTTP_HOST "\r\n"\
-                             "User-Agent: Mozilla/5.0 (Macintosh; Intel Mac OS X 10_7_5) "\
+#define CONFIG_HTTP_HEADER   "User-Agent: Mozilla/5.0 (Macintosh; Intel Mac OS X 10_7_5) "\
 			     "AppleWebKit/537.31 (KHTML, like Gecko) "\
 			     "Chrome/26.0.1410.65 Safari/537.31\r\n"\
-                             "Connection: Close\r\n\r\n"
+                             "Connection: keep-alive\r\n"
+
+/*
+ * TCP socket options (can be changed at runtime: -o NAME=VALUE)
+ * FASTOPEN: send the first request along with the SYN (Linux: net.ipv4.tcp_fastopen)
+ * QUICKACK: don't delay the ACKs of the response
+ * RCVBUF  : socket receive buffer size in bytes, 0: system default
+ */
+#define CONFIG_NET_TCP_NODELAY  (1)
+#define CONFIG_NET_TCP_FASTOPEN (1)
+#define CONFIG_NET_TCP_QUICKACK (1)
+#define CONFIG_NET_RCVBUF       (0)
+
+/*
+ * Connection pool
+ * HOST_CONNS_MAX: max connections per host (busy + idle)
+ * IDLE_TIMEOUT  : idle connections are closed after this (milliseconds)
+ */
+#define CONFIG_HTTP_POOL_HOSTS_MAX      (8u)
+#define CONFIG_HTTP_POOL_HOST_SIZE      (256u)
+#define CONFIG_HTTP_POOL_HOST_CONNS_MAX (16u)
+#define CONFIG_HTTP_POOL_IDLE_TIMEOUT   (30000)
+
+/*
+ * Interactive mode: a connection is opened in the background at startup and after
+ * each reply, WARM_TIMEOUT: give up connecting after this (milliseconds)
+ */
+#define CONFIG_HTTP_POOL_WARM_TIMEOUT   (10000)
+
+/*
+ * HTTPS (build with "make WITH_TLS=1")
+ * HTTP_TLS         : 1: use HTTPS by default (-o tls=0/1)
+ * TLS_VERIFY       : verify the server certificate (-o tls_verify=0/1)
+ * TLS_SESSION_CACHE: keep the TLS session (ticket) in ~/.cache/TLS_SESSION_DIR, so a
+ *                    new process resumes instead of doing a full handshake
+ */
+#define CONFIG_HTTP_TLS          (0)
+#define CONFIG_HTTP_TLS_PORT     "443"
+#define CONFIG_TLS_VERIFY        (1)
+#define CONFIG_TLS_SESSION_CACHE (1)
+#define CONFIG_TLS_SESSION_DIR   "moetranslate"
+
+/*
+ * HTTP/2: all of the requests on one connection (-o http2=0/1)
+ * With HTTPS: negotiated via ALPN, falls back to HTTP/1.1, without: h2c (prior knowledge)
+ * STREAMS_MAX: max concurrent requests per connection, the server may allow fewer
+ */
+#define CONFIG_HTTP2             (0)
+#define CONFIG_HTTP2_STREAMS_MAX (100u)
+
+/*
+ * Retry: 429, 5xx, connection resets and timeouts, with exponential backoff + jitter
+ * RETRIES         : max retries per request (-o retries=N), 0: disabled
+ * RETRY_BASE/CAP  : the first/max backoff window (milliseconds), doubled on each retry
+ * RETRY_AFTER_MAX : the longest Retry-After we wait for (milliseconds), otherwise give up
+ * TIMEOUT         : per attempt, including the connect (-o timeout=MS), 0: none
+ */
+#define CONFIG_HTTP_RETRIES         (3)
+#define CONFIG_HTTP_RETRY_BASE      (250)
+#define CONFIG_HTTP_RETRY_CAP       (8000)
+#define CONFIG_HTTP_RETRY_AFTER_MAX (30000)
+#define CONFIG_HTTP_TIMEOUT         (15000)
+
+/*
+ * Hedging: no reply after the HEDGE percentile of the recent latencies (-o hedge=N, 0: off),
+ * the request is sent again on another connection, the first reply wins; off by default, it
+ * puts more load on the server (-o hedge=95)
+ * HEDGE_RATE       : max hedges, percent of the requests (-o hedge_rate=N)
+ * HEDGE_BURST      : max hedges saved up while under the rate
+ * HEDGE_SAMPLES    : the recent latencies kept, HEDGE_SAMPLES_MIN: needed before hedging
+ * HEDGE_DELAY_MIN  : never hedge sooner than this (milliseconds)
+ */
+#define CONFIG_HTTP_HEDGE             (0)
+#define CONFIG_HTTP_HEDGE_RATE        (10)
+#define CONFIG_HTTP_HEDGE_BURST       (10)
+#define CONFIG_HTTP_HEDGE_SAMPLES     (256u)
+#define CONFIG_HTTP_HEDGE_SAMPLES_MIN (20u)
+#define CONFIG_HTTP_HEDGE_DELAY_MIN   (5)
+
+/*
+ * Limits, for every request of the process (batch, interactive, retries and hedges)
+ * LIMIT         : adaptive concurrency (AIMD, -o limit=0/1): the window grows while the
+ *                 replies are fine, and is cut on 429/503, timeouts, or rising latency
+ * LIMIT_INITIAL : the first window, doubled each round trip until the first cut
+ * LIMIT_MAX     : max window (-o limit_max=N)
+ * LIMIT_DECREASE: the window is multiplied by this on a cut
+ * LIMIT_LATENCY_RATIO: "rising": the recent latency over the long term one
+ * LIMIT_TICK    : how often a queued request looks for a free permit (milliseconds)
+ * LIMIT_RPS/CPS : max requests/characters per second (-o rps=N, -o cps=N), 0: no limit
+ */
+#define CONFIG_HTTP_LIMIT                (1)
+#define CONFIG_HTTP_LIMIT_INITIAL        (4)
+#define CONFIG_HTTP_LIMIT_MAX            (256)
+#define CONFIG_HTTP_LIMIT_DECREASE       (0.5)
+#define CONFIG_HTTP_LIMIT_LATENCY_RATIO  (2.0)
+#define CONFIG_HTTP_LIMIT_TICK           (10)
+#define CONFIG_HTTP_LIMIT_RPS            (0)
+#define CONFIG_HTTP_LIMIT_CPS            (0)
+
+/*
+ * Bulk requests (MOETRANSLATE_BULK: the "bulk" ones of --serve)
+ * BULK_RESERVE: percent of the LIMIT window and of POOL_HOST_CONNS_MAX they leave to the others
+ */
+#define CONFIG_HTTP_BULK_RESERVE (25)
+
+/*
+ * Circuit breaker, per host (-o breaker=0/1): while a host is down, the requests fail fast
+ * BREAKER_WINDOW  : the last attempts looked at
+ * BREAKER_VOLUME  : min attempts in the window before it can open
+ * BREAKER_RATE    : opens at this failure rate (percent): errors, timeouts and 5xx
+ * BREAKER_COOLDOWN: open for this long (milliseconds, -o breaker_cooldown=MS), then
+ *                   half-open: BREAKER_PROBES requests are let through, closes if all succeed
+ */
+#define CONFIG_HTTP_BREAKER          (1)
+#define CONFIG_HTTP_BREAKER_WINDOW   (20u)
+#define CONFIG_HTTP_BREAKER_VOLUME   (10u)
+#define CONFIG_HTTP_BREAKER_RATE     (50u)
+#define CONFIG_HTTP_BREAKER_COOLDOWN (5000)
+#define CONFIG_HTTP_BREAKER_PROBES   (2u)
+
+/*
+ * Router (-o endpoints=[BACKEND@]HOST[:PORT],...): each attempt goes to the better of two
+ * random endpoints, scored by latency x error rate x requests in flight
+ * ROUTES_MAX        : max endpoints
+ * ROUTER_DECAY      : the peak EWMA of the latency: up at once, down with this time constant
+ *                     (milliseconds)
+ * ROUTER_ERROR_ALPHA: weight of the last result in the EWMA of the error rate
+ * ROUTER_ERROR_COST : an endpoint failing every attempt scores this many times worse
+ * ROUTER_RACE       : send to the best two endpoints at once, the first reply wins
+ *                     (-o race=0/1), for interactive use
+ */
+#define CONFIG_HTTP_ROUTES_MAX         (8u)
+#define CONFIG_HTTP_ROUTER_DECAY       (2000)
+#define CONFIG_HTTP_ROUTER_ERROR_ALPHA (0.2)
+#define CONFIG_HTTP_ROUTER_ERROR_COST  (20.0)
+#define CONFIG_HTTP_ROUTER_RACE        (0)
+
+/*
+ * Capture: the request/response pairs of the completed attempts, one file per request
+ * (-o record=DIR), served again instead of the network (-o replay=DIR): offline workloads
+ * for profiling the parse and print path, or PGO training
+ * CAPTURE_RECORD      : directory, "": off
+ * CAPTURE_REPLAY      : directory, "": off
+ * CAPTURE_REPLAY_TIMED: 1: each reply after its recorded latency, 0: at full speed
+ */
+#define CONFIG_CAPTURE_RECORD       ""
+#define CONFIG_CAPTURE_REPLAY       ""
+#define CONFIG_CAPTURE_REPLAY_TIMED (0)
+
+/*
+ * Stats (-o stats=1): the time of each phase of the requests (DNS, connect, write, time to
+ * first byte, body, JSON parse, render), the bytes and the connection reuse: a breakdown of
+ * the request in one-shot mode, the histograms of the session in interactive and batch modes
+ * ("/stats" shows them at any time)
+ * STATS_BUCKETS: of the histograms, log2 of the microseconds
+ */
+#define CONFIG_STATS         (0)
+#define CONFIG_STATS_BUCKETS (32)
+
+/*
+ * Trace (-o trace=FILE): a timeline of the requests, Chrome trace-event JSON (Perfetto UI,
+ * chrome://tracing): a span per phase, queue wait, backoff and request, one track per request
+ * slot, with the thread and connection ids; buffered in a ring per thread, written at exit
+ * TRACE_EVENTS: the ring size per thread, the oldest events are dropped
+ */
+#define CONFIG_TRACE        ""
+#define CONFIG_TRACE_EVENTS (65536)
 
 
 /*
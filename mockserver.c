@@ -0,0 +1,1951 @@
+/* MIT License
+ *
+ * Copyright (c) 2026 Arthur Lapz (rLapz)
+ *
+ * See LICENSE file for license details
+ */
+
+/*
+ * mockserver: a local stand-in for translate.googleapis.com, "make mockserver"
+ *
+ * GET /translate_a/single, the same query as moetranslate's: "dt=bd" -> detail, otherwise
+ * simple, "sl=auto" -> detected as MOCK_LANG. The reply is a template filled with the text
+ * upper-cased, or the canned body of "-f FILE".
+ *
+ * The faults are drawn from the seed and the request's number, a run with the same seed
+ * and the same requests in the same order gets the same replies.
+ *
+ * HTTPS with "-t CERT:KEY" ("make mockserver WITH_TLS=1"), HTTP/2 with "-2": h2 through ALPN,
+ * or h2c with prior knowledge. The streams of a connection are replied to when their own
+ * latency is over, a slow one doesn't hold up the others.
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#ifdef WITH_TLS
+#include <openssl/err.h>
+#include <openssl/pem.h>
+#include <openssl/ssl.h>
+#include <openssl/x509v3.h>
+#endif
+
+
+#define LEN(X) ((sizeof(X)) / (sizeof(*X)))
+#define MIN(A, B) (((A) < (B)) ? (A) : (B))
+#define MAX(A, B) (((A) > (B)) ? (A) : (B))
+
+#define MOCK_ADDR        "127.0.0.1"
+#define MOCK_PORT        "8080"
+#define MOCK_LANG        "en"
+#define MOCK_PATH        "/translate_a/single"
+#define MOCK_BACKLOG     128
+#define MOCK_BUFFER_SIZE 16384
+#define MOCK_HEAD_SIZE   512
+
+/* HTTP/2: SETTINGS_MAX_FRAME_SIZE, the default */
+#define MOCK_H2_HEAD_SIZE  9
+#define MOCK_H2_FRAME_SIZE 16384
+#define MOCK_H2_STREAMS    128
+
+
+/*
+ * Latency
+ */
+enum {
+	LATENCY_FIXED,
+	LATENCY_UNIFORM,
+	LATENCY_EXP,
+	LATENCY_LOGNORMAL,
+	LATENCY_PARETO,
+};
+
+typedef struct latency {
+	int    kind;
+	double a;
+	double b;
+} Latency;
+
+/* "fixed:MS", "uniform:MIN:MAX", "exp:MEAN", "lognormal:MEDIAN:SIGMA", "pareto:MIN:ALPHA" */
+static int    latency_parse(Latency *l, const char spec[]);
+
+/* u1, u2: uniform in [0, 1), ret: milliseconds */
+static double latency_sample(const Latency *l, double u1, double u2);
+
+
+/*
+ * Rng: splitmix64, one sequence per request
+ */
+static uint64_t rng_next(uint64_t *state);
+static double   rng_uniform(uint64_t *state);
+
+
+/*
+ * Opts
+ */
+typedef struct opts {
+	const char    *addr;
+	const char    *port;
+	Latency        latency;
+	uint64_t       seed;
+	unsigned long  bandwidth;	/* bytes per second and per connection, 0: unlimited */
+	unsigned       chunk;		/* chunked encoding: the chunk's size, 0: Content-Length */
+	unsigned       keep_alive;	/* requests per connection, 0: unlimited */
+	unsigned       idle;		/* ms without a request before a silent close, 0: never */
+	double         error_pct;	/* 503 */
+	double         busy_pct;	/* 429 */
+	double         drop_pct;	/* closed before or in the middle of the reply */
+	unsigned       retry_after;	/* 429: seconds, 0: no Retry-After */
+	char          *canned;
+	size_t         canned_len;
+	const char    *tls_cert;	/* NULL: no TLS */
+	const char    *tls_key;
+	int            is_h2;
+	int            is_verbose;
+} Opts;
+
+static Opts            opts;
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long   conn_seq;
+static unsigned long   req_seq;
+
+static int  opts_load_canned(const char path[]);
+static void help(const char name[]);
+
+
+/*
+ * Conn: one thread per connection
+ */
+typedef struct conn {
+	int           fd;
+	unsigned long id;
+	unsigned      reqs;
+	size_t        len;
+#ifdef WITH_TLS
+	SSL          *ssl;
+#endif
+	/* a request, or an HTTP/2 frame */
+	char          buffer[MOCK_H2_HEAD_SIZE + MOCK_H2_FRAME_SIZE];
+} Conn;
+
+typedef struct request {
+	char   *method;
+	char   *target;
+	int     is_close;
+	size_t  head_len;
+	size_t  body_len;
+} Request;
+
+typedef struct reply {
+	unsigned long num;
+	double        delay;		/* ms */
+	int           status;		/* 0: dropped */
+	int           is_drop_early;	/* dropped before the reply, or in the middle of it */
+	char         *body;
+	size_t        body_len;
+} Reply;
+
+static void   *conn_run(void *arg);
+static void    conn_close(Conn *c);
+
+/* ret: 1 -> a request, 0 -> closed or idle for too long, -1 -> error */
+static int     conn_read_request(Conn *c, Request *r);
+static int     conn_reply(Conn *c, const Request *r, int is_close);
+
+/* recv() and send(), through TLS if any */
+static ssize_t conn_recv(Conn *c, char buffer[], size_t size);
+static ssize_t conn_send(Conn *c, const char data[], size_t len);
+
+/* read by TLS already, poll() doesn't see it */
+static int     conn_pending(const Conn *c);
+static int     conn_write(Conn *c, const char data[], size_t len);
+static int     conn_write_body(Conn *c, const char body[], size_t len);
+
+/* the fault and the latency drawn, the body made (reply_free()), ret: 0, -1: error */
+static int     reply_new(Reply *rp, const Conn *c, const char method[], const char target[]);
+static void    reply_free(Reply *rp);
+
+/* ret: the status */
+static int     reply_body(const char target[], FILE *out);
+static size_t  query_get(const char query[], const char key[], char buffer[], size_t size);
+static int     query_has(const char query[], const char param[]);
+static void    json_put_str(FILE *out, const char str[], size_t len, int is_upper);
+
+/* json_put_str() without the quotes */
+static void    json_put_chars(FILE *out, const char str[], size_t len, int is_upper);
+static void    sleep_ms(double ms);
+static double  now_ms(void);
+
+
+/*
+ * Http2: the streams of a connection are answered in the order of their due time
+ */
+#define H2_PREFACE "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+
+enum {
+	H2_FRAME_DATA         = 0,
+	H2_FRAME_HEADERS      = 1,
+	H2_FRAME_RST_STREAM   = 3,
+	H2_FRAME_SETTINGS     = 4,
+	H2_FRAME_PING         = 6,
+	H2_FRAME_GOAWAY       = 7,
+	H2_FRAME_CONTINUATION = 9,
+};
+
+enum {
+	H2_FLAG_ACK         = 0x01,
+	H2_FLAG_END_STREAM  = 0x01,
+	H2_FLAG_END_HEADERS = 0x04,
+	H2_FLAG_PADDED      = 0x08,
+	H2_FLAG_PRIORITY    = 0x20,
+};
+
+enum {
+	H2_ERR_NONE           = 0,
+	H2_ERR_PROTOCOL       = 1,
+	H2_ERR_FRAME_SIZE     = 6,
+	H2_ERR_REFUSED_STREAM = 7,
+	H2_ERR_COMPRESSION    = 9,
+};
+
+enum {
+	H2_SETTINGS_MAX_CONCURRENT_STREAMS = 3,
+};
+
+typedef struct h2_stream {
+	uint32_t id;
+	double   due;	/* now_ms() */
+	Reply    reply;
+} H2Stream;
+
+typedef struct h2 {
+	Conn          *conn;
+	uint32_t       last_id;
+	int            is_goaway;
+	H2Stream       streams[MOCK_H2_STREAMS];
+	unsigned       streams_len;
+
+	/* HEADERS + CONTINUATION */
+	uint32_t       block_id;
+	size_t         block_len;
+	unsigned char  block[MOCK_BUFFER_SIZE];
+
+	/* a Huffman string: 8 / 5 bytes per byte at most */
+	char           scratch[MOCK_BUFFER_SIZE * 2];
+	unsigned char  out[MOCK_H2_HEAD_SIZE + MOCK_H2_FRAME_SIZE];
+} H2;
+
+/* ret: 1 -> the preface (consumed), 0 -> HTTP/1.1, -1 -> closed or error */
+static int      h2_preface_read(Conn *c);
+static void     h2_run(Conn *c);
+static int      h2_frame(H2 *s, unsigned type, unsigned flags, uint32_t id,
+			 const unsigned char *payload, size_t len);
+static int      h2_headers_done(H2 *s);
+
+/* the replies due by now, ret: -1 -> close the connection: an error, or a drop */
+static int      h2_replies(H2 *s);
+static int      h2_reply(H2 *s, const H2Stream *st);
+static int      h2_frame_write(H2 *s, unsigned type, unsigned flags, uint32_t id,
+			       const void *payload, size_t len);
+static int      h2_goaway(H2 *s, uint32_t code);
+
+/* ret: -1 -> no timeout */
+static int      h2_timeout(const H2 *s);
+static uint32_t h2_get_u32(const unsigned char p[]);
+static void     h2_put_u32(unsigned char p[], uint32_t val);
+
+
+/*
+ * Hpack: :method and :path of a request, the rest is skipped. moetranslate never indexes
+ * them, the dynamic table is not kept.
+ */
+static int    hpack_request(H2 *s, char method[], size_t method_size, char path[],
+			    size_t path_size);
+static int    hpack_int(const unsigned char **p, const unsigned char *end, unsigned bits,
+			size_t *value);
+
+/* ret: the length, -1: invalid or too long, "out" terminated */
+static long   hpack_str(const unsigned char **p, const unsigned char *end, char out[],
+			size_t size);
+static long   hpack_huff(const unsigned char in[], size_t len, char out[], size_t size);
+
+/* a literal without indexing, the name from the static table, no Huffman */
+static size_t hpack_put(unsigned char out[], size_t len, unsigned idx, const char value[]);
+
+
+/*
+ * Tls
+ */
+#ifdef WITH_TLS
+static SSL_CTX *tls_ctx;
+
+static int tls_init(const char cert[], const char key[]);
+
+/* a self-signed pair: localhost, 127.0.0.1 and ::1 */
+static int tls_cert_new(const char cert[], const char key[]);
+static int tls_alpn_select(SSL *ssl, const unsigned char **out, unsigned char *out_len,
+			   const unsigned char *in, unsigned in_len, void *arg);
+
+/* ret: 0, -1: error, is_h2: h2 through ALPN */
+static int tls_accept(Conn *c, int *is_h2);
+#endif
+
+
+/*
+ * Latency
+ */
+static int
+latency_parse(Latency *l, const char spec[])
+{
+	double a = 0, b = 0;
+	if (sscanf(spec, "fixed:%lf", &a) == 1) {
+		l->kind = LATENCY_FIXED;
+	} else if (sscanf(spec, "uniform:%lf:%lf", &a, &b) == 2) {
+		l->kind = LATENCY_UNIFORM;
+		if (b < a)
+			return -1;
+	} else if (sscanf(spec, "exp:%lf", &a) == 1) {
+		l->kind = LATENCY_EXP;
+	} else if (sscanf(spec, "lognormal:%lf:%lf", &a, &b) == 2) {
+		l->kind = LATENCY_LOGNORMAL;
+	} else if (sscanf(spec, "pareto:%lf:%lf", &a, &b) == 2) {
+		l->kind = LATENCY_PARETO;
+		if (b <= 0)
+			return -1;
+	} else {
+		return -1;
+	}
+
+	if ((a < 0) || (b < 0))
+		return -1;
+
+	l->a = a;
+	l->b = b;
+	return 0;
+}
+
+
+static double
+latency_sample(const Latency *l, double u1, double u2)
+{
+	switch (l->kind) {
+	case LATENCY_UNIFORM:
+		return l->a + (u1 * (l->b - l->a));
+	case LATENCY_EXP:
+		return -l->a * log(1.0 - u1);
+	case LATENCY_LOGNORMAL:
+		/* Box-Muller */
+		return l->a * exp(l->b * sqrt(-2.0 * log(1.0 - u1)) * cos(2.0 * M_PI * u2));
+	case LATENCY_PARETO:
+		return l->a / pow(1.0 - u1, 1.0 / l->b);
+	}
+
+	return l->a;
+}
+
+
+/*
+ * Rng
+ */
+static uint64_t
+rng_next(uint64_t *state)
+{
+	uint64_t z = (*state += 0x9e3779b97f4a7c15ull);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+	return z ^ (z >> 31);
+}
+
+
+static double
+rng_uniform(uint64_t *state)
+{
+	return (double)(rng_next(state) >> 11) / 9007199254740992.0;
+}
+
+
+/*
+ * Opts
+ */
+static int
+opts_load_canned(const char path[])
+{
+	FILE *const f = fopen(path, "r");
+	if (f == NULL) {
+		perror("mockserver: fopen");
+		return -1;
+	}
+
+	char *ptr = NULL;
+	size_t len = 0;
+	FILE *const out = open_memstream(&ptr, &len);
+	if (out == NULL) {
+		perror("mockserver: open_memstream");
+		fclose(f);
+		return -1;
+	}
+
+	char buffer[4096];
+	size_t rd;
+	while ((rd = fread(buffer, 1, sizeof(buffer), f)) > 0)
+		fwrite(buffer, 1, rd, out);
+
+	fclose(out);
+	fclose(f);
+
+	/* the trailing newline of a text file is not a part of the JSON */
+	while ((len > 0) && isspace((unsigned char)ptr[len - 1]))
+		len--;
+
+	opts.canned = ptr;
+	opts.canned_len = len;
+	return 0;
+}
+
+
+static void
+help(const char name[])
+{
+	printf("%s - a local mock of the translate server\n\n"
+	       "Usage: %s [OPTIONS]\n"
+	       "   -a ADDR       Listen address (" MOCK_ADDR ")\n"
+	       "   -p PORT       Listen port (" MOCK_PORT ")\n"
+	       "   -l SPEC       Latency, ms: fixed:MS, uniform:MIN:MAX, exp:MEAN,\n"
+	       "                 lognormal:MEDIAN:SIGMA, pareto:MIN:ALPHA (fixed:0)\n"
+	       "   -b BYTES      Bandwidth cap per connection, bytes per second (0: none)\n"
+	       "   -c SIZE       Chunked encoding, SIZE bytes per chunk (0: Content-Length)\n"
+	       "   -k NUM        Requests per keep-alive connection (0: unlimited, 1: close)\n"
+	       "   -i MS         Close idle connections silently after MS (0: never)\n"
+	       "   -e PCT        503 responses, percent of the requests\n"
+	       "   -r PCT        429 responses, percent of the requests\n"
+	       "   -R SECS       429: Retry-After (1, 0: none)\n"
+	       "   -d PCT        Dropped connections, percent of the requests\n"
+	       "   -f FILE       Canned body, instead of the template\n"
+	       "   -t CERT:KEY   HTTPS, PEM files, a self-signed pair for localhost is made if\n"
+	       "                 they don't exist (a WITH_TLS=1 build)\n"
+	       "   -2            HTTP/2: h2 (ALPN) with -t, h2c (prior knowledge) without\n"
+	       "   -s SEED       Random seed (1)\n"
+	       "   -v            Log the requests\n"
+	       "   -h            Show help\n\n"
+	       "Example:\n"
+	       "   %s -p 8080 -l lognormal:40:0.5 -e 2 -r 3 -d 1 &\n"
+	       "   ./moetranslate -o host=127.0.0.1 -o port=8080 -b -j 8 -s en:id < lines.txt\n"
+	       "   %s -p 8443 -t /tmp/mock.crt:/tmp/mock.key -2 &\n"
+	       "   SSL_CERT_FILE=/tmp/mock.crt ./moetranslate -o host=localhost -o port=8443 \\\n"
+	       "       -o tls=1 -o http2=1 -b -s en:id < lines.txt\n",
+	       name, name, name, name);
+}
+
+
+/*
+ * Conn
+ */
+static void *
+conn_run(void *arg)
+{
+	Conn *const c = arg;
+	Request r;
+	int is_alpn_h2 = 0;
+
+#ifdef WITH_TLS
+	if ((tls_ctx != NULL) && (tls_accept(c, &is_alpn_h2) < 0))
+		goto out0;
+#endif
+
+	/* h2c: the preface instead of a request, h2: nothing else */
+	if (is_alpn_h2 || (opts.is_h2 && (opts.tls_cert == NULL))) {
+		const int ret = h2_preface_read(c);
+		if (ret > 0)
+			h2_run(c);
+
+		if ((ret != 0) || is_alpn_h2)
+			goto out0;
+	}
+
+	while (conn_read_request(c, &r) > 0) {
+		c->reqs++;
+		const int is_close = r.is_close ||
+				     ((opts.keep_alive > 0) && (c->reqs >= opts.keep_alive));
+		if (conn_reply(c, &r, is_close) < 0 || is_close)
+			break;
+
+		/* pipelining: the next request may be there already */
+		const size_t used = r.head_len + r.body_len;
+		memmove(c->buffer, c->buffer + used, c->len - used);
+		c->len -= used;
+	}
+
+out0:
+	conn_close(c);
+	return NULL;
+}
+
+
+static void
+conn_close(Conn *c)
+{
+#ifdef WITH_TLS
+	if (c->ssl != NULL) {
+		/* best effort close_notify */
+		SSL_shutdown(c->ssl);
+		SSL_free(c->ssl);
+	}
+#endif
+	close(c->fd);
+	free(c);
+}
+
+
+static int
+conn_read_request(Conn *c, Request *r)
+{
+	char *end;
+	while (1) {
+		c->buffer[c->len] = '\0';
+		end = strstr(c->buffer, "\r\n\r\n");
+		if (end != NULL)
+			break;
+
+		if (c->len == (sizeof(c->buffer) - 1)) {
+			fprintf(stderr, "mockserver: conn %lu: request too large\n", c->id);
+			return -1;
+		}
+
+		if ((opts.idle > 0) && (c->len == 0) && (conn_pending(c) == 0)) {
+			struct pollfd pfd = { .fd = c->fd, .events = POLLIN };
+			if (poll(&pfd, 1, (int)opts.idle) == 0)
+				return 0;
+		}
+
+		const ssize_t rd = conn_recv(c, c->buffer + c->len, sizeof(c->buffer) - 1 - c->len);
+		if (rd < 0) {
+			if (errno == EINTR)
+				continue;
+
+			return -1;
+		}
+
+		if (rd == 0)
+			return 0;
+
+		c->len += (size_t)rd;
+	}
+
+	memset(r, 0, sizeof(*r));
+	r->head_len = (size_t)(end - c->buffer) + 4;
+	*end = '\0';
+
+	/* METHOD TARGET VERSION */
+	char *line_end = strstr(c->buffer, "\r\n");
+	if (line_end != NULL)
+		*line_end = '\0';
+
+	char *save;
+	r->method = strtok_r(c->buffer, " ", &save);
+	r->target = strtok_r(NULL, " ", &save);
+	const char *const version = strtok_r(NULL, " ", &save);
+	if ((r->method == NULL) || (r->target == NULL) || (version == NULL))
+		return -1;
+
+	r->is_close = (strcmp(version, "HTTP/1.0") == 0);
+	for (char *h = (line_end != NULL) ? (line_end + 2) : end; h < end; ) {
+		char *const h_end = strstr(h, "\r\n");
+		if (h_end != NULL)
+			*h_end = '\0';
+
+		if (strncasecmp(h, "Connection:", 11) == 0)
+			r->is_close = (strncasecmp(h + 11 + strspn(h + 11, " \t"), "close", 5) == 0);
+		else if (strncasecmp(h, "Content-Length:", 15) == 0)
+			r->body_len = strtoul(h + 15, NULL, 10);
+
+		if (h_end == NULL)
+			break;
+
+		h = h_end + 2;
+	}
+
+	/* the body: not used, but it has to be read */
+	if (r->body_len > (sizeof(c->buffer) - 1 - r->head_len)) {
+		fprintf(stderr, "mockserver: conn %lu: body too large\n", c->id);
+		return -1;
+	}
+
+	while (c->len < (r->head_len + r->body_len)) {
+		const ssize_t rd = conn_recv(c, c->buffer + c->len, sizeof(c->buffer) - 1 - c->len);
+		if (rd <= 0) {
+			if ((rd < 0) && (errno == EINTR))
+				continue;
+
+			return (rd == 0) ? 0 : -1;
+		}
+
+		c->len += (size_t)rd;
+	}
+
+	return 1;
+}
+
+
+static int
+conn_reply(Conn *c, const Request *r, int is_close)
+{
+	Reply rp;
+	if (reply_new(&rp, c, r->method, r->target) < 0)
+		return -1;
+
+	sleep_ms(rp.delay);
+
+	int ret = -1;
+	const int status = rp.status;
+	if (status == 0) {
+		if (rp.is_drop_early == 0) {
+			const char head[] = "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n"
+					    "Content-Length: 64\r\n\r\n[[[\"";
+			conn_write(c, head, sizeof(head) - 1);
+		}
+
+		goto out0;
+	}
+
+	const char *reason = "OK";
+	switch (status) {
+	case 404: reason = "Not Found"; break;
+	case 405: reason = "Method Not Allowed"; break;
+	case 429: reason = "Too Many Requests"; break;
+	case 503: reason = "Service Unavailable"; break;
+	}
+
+	char head[MOCK_HEAD_SIZE];
+	int head_len = snprintf(head, sizeof(head), "HTTP/1.1 %d %s\r\n"
+				"Content-Type: application/json; charset=UTF-8\r\n"
+				"Connection: %s\r\n", status, reason,
+				is_close ? "close" : "keep-alive");
+	if ((status == 429) && (opts.retry_after > 0)) {
+		head_len += snprintf(head + head_len, sizeof(head) - (size_t)head_len,
+				     "Retry-After: %u\r\n", opts.retry_after);
+	}
+
+	if ((opts.chunk > 0) && (rp.body_len > 0)) {
+		head_len += snprintf(head + head_len, sizeof(head) - (size_t)head_len,
+				     "Transfer-Encoding: chunked\r\n\r\n");
+	} else {
+		head_len += snprintf(head + head_len, sizeof(head) - (size_t)head_len,
+				     "Content-Length: %zu\r\n\r\n", rp.body_len);
+	}
+
+	if (conn_write(c, head, (size_t)head_len) < 0)
+		goto out0;
+
+	if (conn_write_body(c, rp.body, rp.body_len) < 0)
+		goto out0;
+
+	ret = 0;
+
+out0:
+	reply_free(&rp);
+	return ret;
+}
+
+
+static ssize_t
+conn_recv(Conn *c, char buffer[], size_t size)
+{
+#ifdef WITH_TLS
+	if (c->ssl != NULL) {
+		size_t rd;
+		errno = 0;
+		ERR_clear_error();
+		const int ret = SSL_read_ex(c->ssl, buffer, size, &rd);
+		if (ret == 1)
+			return (ssize_t)rd;
+
+		/* close_notify, or closed without one */
+		const int err = SSL_get_error(c->ssl, ret);
+		if ((err == SSL_ERROR_ZERO_RETURN) || ((err == SSL_ERROR_SYSCALL) && (errno == 0)))
+			return 0;
+
+		if (err != SSL_ERROR_SYSCALL)
+			errno = EPROTO;
+
+		return -1;
+	}
+#endif
+	return recv(c->fd, buffer, size, 0);
+}
+
+
+static ssize_t
+conn_send(Conn *c, const char data[], size_t len)
+{
+#ifdef WITH_TLS
+	if (c->ssl != NULL) {
+		size_t wr;
+		errno = 0;
+		ERR_clear_error();
+		if (SSL_write_ex(c->ssl, data, len, &wr) == 1)
+			return (ssize_t)wr;
+
+		if (errno == 0)
+			errno = EPIPE;
+
+		return -1;
+	}
+#endif
+	return send(c->fd, data, len, MSG_NOSIGNAL);
+}
+
+
+static int
+conn_pending(const Conn *c)
+{
+#ifdef WITH_TLS
+	if (c->ssl != NULL)
+		return SSL_pending(c->ssl) > 0;
+#endif
+	(void)c;
+	return 0;
+}
+
+
+static int
+conn_write(Conn *c, const char data[], size_t len)
+{
+	/* the cap: 10 ms worth of bytes at a time */
+	const size_t slice = (opts.bandwidth > 0) ? MAX(opts.bandwidth / 100, 1) : len;
+	while (len > 0) {
+		const ssize_t wr = conn_send(c, data, MIN(len, slice));
+		if (wr < 0) {
+			if (errno == EINTR)
+				continue;
+
+			return -1;
+		}
+
+		data += wr;
+		len -= (size_t)wr;
+		if (opts.bandwidth > 0)
+			sleep_ms(((double)wr * 1000.0) / (double)opts.bandwidth);
+	}
+
+	return 0;
+}
+
+
+static int
+conn_write_body(Conn *c, const char body[], size_t len)
+{
+	if ((opts.chunk == 0) || (len == 0))
+		return conn_write(c, body, len);
+
+	/* one write per chunk: the client sees them arrive one by one */
+	char size[32];
+	for (size_t i = 0; i < len; i += opts.chunk) {
+		const size_t n = MIN(opts.chunk, len - i);
+		const int size_len = snprintf(size, sizeof(size), "%zx\r\n", n);
+		if ((conn_write(c, size, (size_t)size_len) < 0) || (conn_write(c, body + i, n) < 0) ||
+		    (conn_write(c, "\r\n", 2) < 0))
+			return -1;
+	}
+
+	return conn_write(c, "0\r\n\r\n", 5);
+}
+
+
+/*
+ * Reply
+ */
+static int
+reply_new(Reply *rp, const Conn *c, const char method[], const char target[])
+{
+	pthread_mutex_lock(&mutex);
+	const unsigned long num = ++req_seq;
+	pthread_mutex_unlock(&mutex);
+
+	/* the same draws in the same order for every request */
+	uint64_t rng = opts.seed ^ (num * 0xd1b54a32d192ed03ull);
+	const double u_fault = rng_uniform(&rng) * 100.0;
+	const double u_lat1 = rng_uniform(&rng);
+	const double u_lat2 = rng_uniform(&rng);
+
+	memset(rp, 0, sizeof(*rp));
+	rp->num = num;
+	rp->is_drop_early = (rng_uniform(&rng) < 0.5);
+	rp->delay = latency_sample(&opts.latency, u_lat1, u_lat2);
+
+	FILE *const out = open_memstream(&rp->body, &rp->body_len);
+	if (out == NULL) {
+		perror("mockserver: open_memstream");
+		return -1;
+	}
+
+	if (u_fault < opts.drop_pct)
+		rp->status = 0;
+	else if (u_fault < (opts.drop_pct + opts.error_pct))
+		rp->status = 503;
+	else if (u_fault < (opts.drop_pct + opts.error_pct + opts.busy_pct))
+		rp->status = 429;
+	else if (strcmp(method, "GET") != 0)
+		rp->status = 405;
+	else
+		rp->status = reply_body(target, out);
+
+	fclose(out);
+	if (rp->status != 200)
+		rp->body_len = 0;
+
+	if (opts.is_verbose) {
+		fprintf(stderr, "mockserver: #%lu conn %lu: %s %.64s -> %d (%.1f ms)\n", num, c->id,
+			method, target, rp->status, rp->delay);
+	}
+
+	return 0;
+}
+
+
+static void
+reply_free(Reply *rp)
+{
+	free(rp->body);
+	rp->body = NULL;
+}
+
+
+static int
+reply_body(const char target[], FILE *out)
+{
+	const size_t path_len = sizeof(MOCK_PATH) - 1;
+	if ((strncmp(target, MOCK_PATH, path_len) != 0) ||
+	    ((target[path_len] != '?') && (target[path_len] != '\0')))
+		return 404;
+
+	if (opts.canned != NULL) {
+		fwrite(opts.canned, 1, opts.canned_len, out);
+		return 200;
+	}
+
+	const char *const query = target + path_len;
+	char text[MOCK_BUFFER_SIZE];
+	char sl[16];
+	const size_t text_len = query_get(query, "q", text, sizeof(text));
+	if (query_get(query, "sl", sl, sizeof(sl)) == 0 || (strcmp(sl, "auto") == 0))
+		strcpy(sl, MOCK_LANG);
+
+	/* the sentence, its source, and the spellings */
+	fputs("[[[", out);
+	json_put_str(out, text, text_len, 1);
+	fputc(',', out);
+	json_put_str(out, text, text_len, 0);
+	fputs(",null,null,10]", out);
+	if (query_has(query, "dt=bd") == 0) {
+		fprintf(out, "],null,\"%s\",null,null,null,null,[]]", sl);
+		return 200;
+	}
+
+	fputs(",[null,null,", out);
+	json_put_str(out, text, text_len, 1);
+	fputc(',', out);
+	json_put_str(out, text, text_len, 0);
+
+	/* synonyms */
+	fputs("]],[[\"noun\",[", out);
+	json_put_str(out, text, text_len, 1);
+	fputs("],[[", out);
+	json_put_str(out, text, text_len, 1);
+	fputs(",[", out);
+	json_put_str(out, text, text_len, 0);
+	fputs("],null,0.5]],", out);
+	json_put_str(out, text, text_len, 0);
+	fprintf(out, ",1]],\"%s\",null,null,null,null,null,null,null,null,null,", sl);
+
+	/* definitions and examples */
+	fputs("[[\"noun\",[[\"The meaning of ", out);
+	json_put_chars(out, text, text_len, 0);
+	fputs(".\",\"mock.0\",\"An example of it\"]],", out);
+	json_put_str(out, text, text_len, 0);
+	fputs("]],[[[\"This is an <b>example</b> of it\",null,null,null,3,\"mock.1\"]]]]", out);
+	return 200;
+}
+
+
+static size_t
+query_get(const char query[], const char key[], char buffer[], size_t size)
+{
+	const size_t key_len = strlen(key);
+	const char *p = query;
+	while ((p = strpbrk(p, "?&")) != NULL) {
+		p++;
+		if ((strncmp(p, key, key_len) == 0) && (p[key_len] == '='))
+			break;
+	}
+
+	if (p == NULL) {
+		buffer[0] = '\0';
+		return 0;
+	}
+
+	/* URL decoding */
+	size_t len = 0;
+	for (p += key_len + 1; (*p != '\0') && (*p != '&') && (len < (size - 1)); p++) {
+		if (*p == '+') {
+			buffer[len++] = ' ';
+		} else if ((*p == '%') && isxdigit((unsigned char)p[1]) &&
+			   isxdigit((unsigned char)p[2])) {
+			const char hex[3] = { p[1], p[2], '\0' };
+			buffer[len++] = (char)strtol(hex, NULL, 16);
+			p += 2;
+		} else {
+			buffer[len++] = *p;
+		}
+	}
+
+	buffer[len] = '\0';
+	return len;
+}
+
+
+static int
+query_has(const char query[], const char param[])
+{
+	const size_t param_len = strlen(param);
+	for (const char *p = query; (p = strpbrk(p, "?&")) != NULL; ) {
+		p++;
+		if ((strncmp(p, param, param_len) == 0) &&
+		    ((p[param_len] == '&') || (p[param_len] == '\0')))
+			return 1;
+	}
+
+	return 0;
+}
+
+
+static void
+json_put_str(FILE *out, const char str[], size_t len, int is_upper)
+{
+	fputc('"', out);
+	json_put_chars(out, str, len, is_upper);
+	fputc('"', out);
+}
+
+
+static void
+json_put_chars(FILE *out, const char str[], size_t len, int is_upper)
+{
+	for (size_t i = 0; i < len; i++) {
+		const unsigned char ch = (unsigned char)str[i];
+		if ((ch == '"') || (ch == '\\'))
+			fprintf(out, "\\%c", ch);
+		else if (ch < 0x20)
+			fprintf(out, "\\u%04x", ch);
+		else
+			fputc((is_upper && (ch < 0x80)) ? toupper(ch) : ch, out);
+	}
+}
+
+
+static void
+sleep_ms(double ms)
+{
+	if (ms <= 0)
+		return;
+
+	struct timespec ts = {
+		.tv_sec = (time_t)(ms / 1000),
+		.tv_nsec = (long)(fmod(ms, 1000) * 1000000),
+	};
+
+	while ((nanosleep(&ts, &ts) < 0) && (errno == EINTR))
+		;
+}
+
+
+static double
+now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((double)ts.tv_sec * 1000.0) + ((double)ts.tv_nsec / 1000000.0);
+}
+
+
+/*
+ * Http2
+ */
+static int
+h2_preface_read(Conn *c)
+{
+	const size_t len = sizeof(H2_PREFACE) - 1;
+	while (memcmp(c->buffer, H2_PREFACE, MIN(c->len, len)) == 0) {
+		if (c->len >= len) {
+			c->len -= len;
+			memmove(c->buffer, c->buffer + len, c->len);
+			return 1;
+		}
+
+		if ((opts.idle > 0) && (c->len == 0) && (conn_pending(c) == 0)) {
+			struct pollfd pfd = { .fd = c->fd, .events = POLLIN };
+			if (poll(&pfd, 1, (int)opts.idle) == 0)
+				return -1;
+		}
+
+		const ssize_t rd = conn_recv(c, c->buffer + c->len, sizeof(c->buffer) - 1 - c->len);
+		if ((rd < 0) && (errno == EINTR))
+			continue;
+
+		if (rd <= 0)
+			return -1;
+
+		c->len += (size_t)rd;
+	}
+
+	return 0;
+}
+
+
+static void
+h2_run(Conn *c)
+{
+	H2 *const s = malloc(sizeof(*s));
+	if (s == NULL) {
+		perror("mockserver: malloc");
+		return;
+	}
+
+	s->conn = c;
+	s->last_id = 0;
+	s->is_goaway = 0;
+	s->streams_len = 0;
+	s->block_id = 0;
+	s->block_len = 0;
+
+	unsigned char settings[6] = { 0, H2_SETTINGS_MAX_CONCURRENT_STREAMS };
+	h2_put_u32(settings + 2, MOCK_H2_STREAMS);
+	if (h2_frame_write(s, H2_FRAME_SETTINGS, 0, 0, settings, sizeof(settings)) < 0)
+		goto out0;
+
+	while (1) {
+		if (h2_replies(s) < 0)
+			break;
+
+		/* -k: the last one has been replied to */
+		if (s->is_goaway && (s->streams_len == 0))
+			break;
+
+		if (c->len >= MOCK_H2_HEAD_SIZE) {
+			const unsigned char *const f = (const unsigned char *)c->buffer;
+			const size_t len = ((size_t)f[0] << 16) | ((size_t)f[1] << 8) | f[2];
+			if (len > MOCK_H2_FRAME_SIZE) {
+				h2_goaway(s, H2_ERR_FRAME_SIZE);
+				break;
+			}
+
+			if (c->len >= (MOCK_H2_HEAD_SIZE + len)) {
+				const uint32_t id = h2_get_u32(f + 5) & 0x7fffffff;
+				if (h2_frame(s, f[3], f[4], id, f + MOCK_H2_HEAD_SIZE, len) < 0)
+					break;
+
+				c->len -= MOCK_H2_HEAD_SIZE + len;
+				memmove(c->buffer, c->buffer + MOCK_H2_HEAD_SIZE + len, c->len);
+				continue;
+			}
+		}
+
+		if (conn_pending(c) == 0) {
+			struct pollfd pfd = { .fd = c->fd, .events = POLLIN };
+			const int ret = poll(&pfd, 1, h2_timeout(s));
+			if (ret < 0) {
+				if (errno == EINTR)
+					continue;
+
+				break;
+			}
+
+			/* a reply due, or idle for too long */
+			if (ret == 0) {
+				if (s->streams_len == 0)
+					break;
+
+				continue;
+			}
+		}
+
+		const ssize_t rd = conn_recv(c, c->buffer + c->len, sizeof(c->buffer) - c->len);
+		if (rd < 0) {
+			if (errno == EINTR)
+				continue;
+
+			break;
+		}
+
+		if (rd == 0)
+			break;
+
+		c->len += (size_t)rd;
+	}
+
+out0:
+	for (unsigned i = 0; i < s->streams_len; i++)
+		reply_free(&s->streams[i].reply);
+
+	free(s);
+}
+
+
+static int
+h2_frame(H2 *s, unsigned type, unsigned flags, uint32_t id, const unsigned char *payload,
+	 size_t len)
+{
+	size_t pad = 0;
+	uint32_t code = H2_ERR_PROTOCOL;
+
+	/* a header block can't be interleaved */
+	if ((s->block_id != 0) && (type != H2_FRAME_CONTINUATION))
+		goto err0;
+
+	switch (type) {
+	case H2_FRAME_HEADERS:
+		/* a new stream: odd, and increasing */
+		if (((id & 1) == 0) || (id <= s->last_id))
+			goto err0;
+
+		if (flags & H2_FLAG_PADDED) {
+			if (len == 0)
+				goto err0;
+
+			pad = payload[0];
+			payload++;
+			len--;
+		}
+
+		if (flags & H2_FLAG_PRIORITY) {
+			if (len < 5)
+				goto err0;
+
+			payload += 5;
+			len -= 5;
+		}
+
+		if (pad > len)
+			goto err0;
+
+		s->block_id = id;
+		s->block_len = 0;
+		len -= pad;
+		/* FALLTHROUGH */
+	case H2_FRAME_CONTINUATION:
+		if ((id == 0) || (id != s->block_id))
+			goto err0;
+
+		if (len > (sizeof(s->block) - s->block_len)) {
+			fprintf(stderr, "mockserver: conn %lu: request too large\n", s->conn->id);
+			return -1;
+		}
+
+		memcpy(s->block + s->block_len, payload, len);
+		s->block_len += len;
+		if (flags & H2_FLAG_END_HEADERS)
+			return h2_headers_done(s);
+
+		return 0;
+	case H2_FRAME_RST_STREAM:
+		if ((id == 0) || (len != 4))
+			goto err0;
+
+		/* cancelled, a hedge that lost: no reply */
+		for (unsigned i = 0; i < s->streams_len; i++) {
+			if (s->streams[i].id != id)
+				continue;
+
+			reply_free(&s->streams[i].reply);
+			s->streams[i] = s->streams[--s->streams_len];
+			break;
+		}
+
+		return 0;
+	case H2_FRAME_SETTINGS:
+		if (id != 0)
+			goto err0;
+
+		if (flags & H2_FLAG_ACK)
+			return 0;
+
+		if ((len % 6) != 0) {
+			code = H2_ERR_FRAME_SIZE;
+			goto err0;
+		}
+
+		return h2_frame_write(s, H2_FRAME_SETTINGS, H2_FLAG_ACK, 0, NULL, 0);
+	case H2_FRAME_PING:
+		if (id != 0)
+			goto err0;
+
+		if (len != 8) {
+			code = H2_ERR_FRAME_SIZE;
+			goto err0;
+		}
+
+		if (flags & H2_FLAG_ACK)
+			return 0;
+
+		return h2_frame_write(s, H2_FRAME_PING, H2_FLAG_ACK, 0, payload, len);
+	case H2_FRAME_GOAWAY:
+		/* the client is done */
+		return -1;
+	}
+
+	/* DATA: no request has a body, WINDOW_UPDATE: the replies are much smaller than the
+	 * client's windows, PRIORITY, and the unknown ones */
+	return 0;
+
+err0:
+	fprintf(stderr, "mockserver: conn %lu: HTTP/2: invalid frame: type: %u\n", s->conn->id,
+		type);
+	h2_goaway(s, code);
+	return -1;
+}
+
+
+static int
+h2_headers_done(H2 *s)
+{
+	Conn *const c = s->conn;
+	const uint32_t id = s->block_id;
+	char method[16];
+	char path[MOCK_BUFFER_SIZE];
+
+	s->block_id = 0;
+	s->last_id = id;
+	if (hpack_request(s, method, sizeof(method), path, sizeof(path)) < 0) {
+		fprintf(stderr, "mockserver: conn %lu: HTTP/2: invalid header block\n", c->id);
+		h2_goaway(s, H2_ERR_COMPRESSION);
+		return -1;
+	}
+
+	/* after the GOAWAY of -k, or no room: sent again by the client, on another connection */
+	if (s->is_goaway || (s->streams_len == MOCK_H2_STREAMS)) {
+		unsigned char payload[4];
+		h2_put_u32(payload, H2_ERR_REFUSED_STREAM);
+		return h2_frame_write(s, H2_FRAME_RST_STREAM, 0, id, payload, sizeof(payload));
+	}
+
+	H2Stream *const st = &s->streams[s->streams_len];
+	if (reply_new(&st->reply, c, method, path) < 0)
+		return -1;
+
+	st->id = id;
+	st->due = now_ms() + st->reply.delay;
+	s->streams_len++;
+
+	c->reqs++;
+	if ((opts.keep_alive > 0) && (c->reqs >= opts.keep_alive)) {
+		/* -k: this one is the last, the ones in flight are still replied to */
+		s->is_goaway = 1;
+		return h2_goaway(s, H2_ERR_NONE);
+	}
+
+	return 0;
+}
+
+
+static int
+h2_replies(H2 *s)
+{
+	const double now = now_ms();
+	for (unsigned i = 0; i < s->streams_len;) {
+		H2Stream *const st = &s->streams[i];
+		if (st->due > now) {
+			i++;
+			continue;
+		}
+
+		const int ret = h2_reply(s, st);
+		reply_free(&st->reply);
+		*st = s->streams[--s->streams_len];
+		if (ret < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+
+static int
+h2_reply(H2 *s, const H2Stream *st)
+{
+	const Reply *const rp = &st->reply;
+	unsigned char head[MOCK_HEAD_SIZE];
+	size_t head_len = 0;
+	char num[32];
+
+	/* dropped: the whole connection, before the reply or in the middle of it */
+	if ((rp->status == 0) && rp->is_drop_early)
+		return -1;
+
+	/* the static table: 8: ":status: 200", 28: content-length, 31: content-type,
+	 * 53: retry-after */
+	if ((rp->status == 200) || (rp->status == 0)) {
+		head[head_len++] = 0x88;
+	} else {
+		snprintf(num, sizeof(num), "%d", rp->status);
+		head_len = hpack_put(head, head_len, 8, num);
+	}
+
+	head_len = hpack_put(head, head_len, 31, "application/json; charset=UTF-8");
+	if ((rp->status == 429) && (opts.retry_after > 0)) {
+		snprintf(num, sizeof(num), "%u", opts.retry_after);
+		head_len = hpack_put(head, head_len, 53, num);
+	}
+
+	snprintf(num, sizeof(num), "%zu", (rp->status == 0) ? (size_t)64 : rp->body_len);
+	head_len = hpack_put(head, head_len, 28, num);
+
+	const int is_end = (rp->status != 0) && (rp->body_len == 0);
+	const unsigned flags = H2_FLAG_END_HEADERS | ((is_end) ? H2_FLAG_END_STREAM : 0);
+	if (h2_frame_write(s, H2_FRAME_HEADERS, flags, st->id, head, head_len) < 0)
+		return -1;
+
+	if (rp->status == 0) {
+		h2_frame_write(s, H2_FRAME_DATA, 0, st->id, "[[[\"", 4);
+		return -1;
+	}
+
+	/* -c: a DATA frame per chunk */
+	const size_t chunk = (opts.chunk > 0) ? MIN(opts.chunk, MOCK_H2_FRAME_SIZE)
+					      : MOCK_H2_FRAME_SIZE;
+	for (size_t i = 0; i < rp->body_len; i += chunk) {
+		const size_t n = MIN(chunk, rp->body_len - i);
+		const unsigned end = ((i + n) == rp->body_len) ? H2_FLAG_END_STREAM : 0;
+		if (h2_frame_write(s, H2_FRAME_DATA, end, st->id, rp->body + i, n) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+
+static int
+h2_frame_write(H2 *s, unsigned type, unsigned flags, uint32_t id, const void *payload, size_t len)
+{
+	unsigned char *const f = s->out;
+	f[0] = (unsigned char)(len >> 16);
+	f[1] = (unsigned char)(len >> 8);
+	f[2] = (unsigned char)len;
+	f[3] = (unsigned char)type;
+	f[4] = (unsigned char)flags;
+	h2_put_u32(f + 5, id);
+	if (len > 0)
+		memcpy(f + MOCK_H2_HEAD_SIZE, payload, len);
+
+	/* one write per frame: the bandwidth cap applies as with HTTP/1.1 */
+	return conn_write(s->conn, (const char *)f, MOCK_H2_HEAD_SIZE + len);
+}
+
+
+static int
+h2_goaway(H2 *s, uint32_t code)
+{
+	unsigned char payload[8];
+	h2_put_u32(payload, s->last_id);
+	h2_put_u32(payload + 4, code);
+	return h2_frame_write(s, H2_FRAME_GOAWAY, 0, 0, payload, sizeof(payload));
+}
+
+
+static int
+h2_timeout(const H2 *s)
+{
+	if (s->streams_len == 0)
+		return (opts.idle > 0) ? (int)opts.idle : -1;
+
+	double due = s->streams[0].due;
+	for (unsigned i = 1; i < s->streams_len; i++)
+		due = MIN(due, s->streams[i].due);
+
+	const double ms = due - now_ms();
+	return (ms > 0) ? (int)ceil(ms) : 0;
+}
+
+
+static uint32_t
+h2_get_u32(const unsigned char p[])
+{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+
+static void
+h2_put_u32(unsigned char p[], uint32_t val)
+{
+	p[0] = (unsigned char)(val >> 24);
+	p[1] = (unsigned char)(val >> 16);
+	p[2] = (unsigned char)(val >> 8);
+	p[3] = (unsigned char)val;
+}
+
+
+/*
+ * Hpack
+ */
+static int
+hpack_request(H2 *s, char method[], size_t method_size, char path[], size_t path_size)
+{
+	/* the static table: 2, 3: ":method", 4, 5: ":path" */
+	static const char *const values[] = { "GET", "POST", "/", "/index.html" };
+	const unsigned char *p = s->block;
+	const unsigned char *const end = s->block + s->block_len;
+
+	method[0] = '\0';
+	path[0] = '\0';
+	while (p < end) {
+		size_t idx;
+		const unsigned char c = *p;
+		if (c & 0x80) {
+			/* indexed: 1xxxxxxx */
+			if ((hpack_int(&p, end, 7, &idx) < 0) || (idx == 0))
+				return -1;
+
+			if ((idx >= 2) && (idx <= 3))
+				snprintf(method, method_size, "%s", values[idx - 2]);
+			else if ((idx >= 4) && (idx <= 5))
+				snprintf(path, path_size, "%s", values[idx - 2]);
+
+			continue;
+		}
+
+		if ((c & 0xe0) == 0x20) {
+			/* dynamic table size update: 001xxxxx */
+			if (hpack_int(&p, end, 5, &idx) < 0)
+				return -1;
+
+			continue;
+		}
+
+		/* literal: with incremental indexing 01xxxxxx, without or never indexed 000xxxxx */
+		if (hpack_int(&p, end, (c & 0x40) ? 6 : 4, &idx) < 0)
+			return -1;
+
+		if ((idx == 0) && (hpack_str(&p, end, s->scratch, sizeof(s->scratch)) < 0))
+			return -1;
+
+		const char *const name = (idx == 0) ? s->scratch : "";
+		char *dst = NULL;
+		size_t dst_size = 0;
+		if (((idx >= 2) && (idx <= 3)) || (strcmp(name, ":method") == 0)) {
+			dst = method;
+			dst_size = method_size;
+		} else if (((idx >= 4) && (idx <= 5)) || (strcmp(name, ":path") == 0)) {
+			dst = path;
+			dst_size = path_size;
+		}
+
+		const long len = hpack_str(&p, end, s->scratch, sizeof(s->scratch));
+		if (len < 0)
+			return -1;
+
+		if (dst != NULL) {
+			if ((size_t)len >= dst_size)
+				return -1;
+
+			memcpy(dst, s->scratch, (size_t)len + 1);
+		}
+	}
+
+	return 0;
+}
+
+
+static int
+hpack_int(const unsigned char **p, const unsigned char *end, unsigned bits, size_t *value)
+{
+	const unsigned char *ptr = *p;
+	if (ptr >= end)
+		return -1;
+
+	const size_t max = (1u << bits) - 1;
+	size_t val = *(ptr++) & max;
+	if (val == max) {
+		unsigned shift = 0;
+		while (1) {
+			if ((ptr >= end) || (shift > 21))
+				return -1;
+
+			const unsigned char c = *(ptr++);
+			val += (size_t)(c & 127) << shift;
+			shift += 7;
+			if ((c & 128) == 0)
+				break;
+		}
+	}
+
+	*p = ptr;
+	*value = val;
+	return 0;
+}
+
+
+static long
+hpack_str(const unsigned char **p, const unsigned char *end, char out[], size_t size)
+{
+	if (*p >= end)
+		return -1;
+
+	const int is_huff = (**p & 0x80);
+	size_t len;
+	if (hpack_int(p, end, 7, &len) < 0)
+		return -1;
+
+	if (len > (size_t)(end - *p))
+		return -1;
+
+	const unsigned char *const str = *p;
+	*p += len;
+	if (is_huff)
+		return hpack_huff(str, len, out, size);
+
+	if (len >= size)
+		return -1;
+
+	memcpy(out, str, len);
+	out[len] = '\0';
+	return (long)len;
+}
+
+
+static long
+hpack_huff(const unsigned char in[], size_t len, char out[], size_t size)
+{
+	/* canonical: the symbols sorted by code, the number of codes of each length */
+	static const unsigned char syms[256] = {
+		 48,  49,  50,  97,  99, 101, 105, 111, 115, 116,  32,  37,  45,  46,  47,  51,
+		 52,  53,  54,  55,  56,  57,  61,  65,  95,  98, 100, 102, 103, 104, 108, 109,
+		110, 112, 114, 117,  58,  66,  67,  68,  69,  70,  71,  72,  73,  74,  75,  76,
+		 77,  78,  79,  80,  81,  82,  83,  84,  85,  86,  87,  89, 106, 107, 113, 118,
+		119, 120, 121, 122,  38,  42,  44,  59,  88,  90,  33,  34,  40,  41,  63,  39,
+		 43, 124,  35,  62,   0,  36,  64,  91,  93, 126,  94, 125,  60,  96, 123,  92,
+		195, 208, 128, 130, 131, 162, 184, 194, 224, 226, 153, 161, 167, 172, 176, 177,
+		179, 209, 216, 217, 227, 229, 230, 129, 132, 133, 134, 136, 146, 154, 156, 160,
+		163, 164, 169, 170, 173, 178, 181, 185, 186, 187, 189, 190, 196, 198, 228, 232,
+		233,   1, 135, 137, 138, 139, 140, 141, 143, 147, 149, 150, 151, 152, 155, 157,
+		158, 165, 166, 168, 174, 175, 180, 182, 183, 188, 191, 197, 231, 239,   9, 142,
+		144, 145, 148, 159, 171, 206, 215, 225, 236, 237, 199, 207, 234, 235, 192, 193,
+		200, 201, 202, 205, 210, 213, 218, 219, 238, 240, 242, 243, 255, 203, 204, 211,
+		212, 214, 221, 222, 223, 241, 244, 245, 246, 247, 248, 250, 251, 252, 253, 254,
+		  2,   3,   4,   5,   6,   7,   8,  11,  12,  14,  15,  16,  17,  18,  19,  20,
+		 21,  23,  24,  25,  26,  27,  28,  29,  30,  31, 127, 220, 249,  10,  13,  22,
+	};
+
+	static const unsigned short counts[31] = {
+		 0,  0,  0,  0,  0, 10, 26, 32,  6,  0,  5,  3,  2,  6,  2,  3,
+		 0,  0,  0,  3,  8, 13, 26, 29, 12,  4, 15, 19, 29,  0,  3,
+	};
+
+	size_t out_len = 0;
+	unsigned code = 0, first = 0, index = 0, bits = 0;
+	int is_ones = 1;
+	for (size_t i = 0; i < len; i++) {
+		for (int j = 7; j >= 0; j--) {
+			const unsigned bit = (in[i] >> j) & 1u;
+			code |= bit;
+			is_ones &= (int)bit;
+			bits++;
+
+			const unsigned count = counts[bits];
+			if ((code - first) < count) {
+				if (out_len == (size - 1))
+					return -1;
+
+				out[out_len++] = (char)syms[index + (code - first)];
+				code = first = index = bits = 0;
+				is_ones = 1;
+				continue;
+			}
+
+			/* EOS, or garbage */
+			if (bits == (LEN(counts) - 1))
+				return -1;
+
+			index += count;
+			first = (first + count) << 1;
+			code <<= 1;
+		}
+	}
+
+	/* padding: shorter than 8 bits, all ones */
+	if ((bits >= 8) || (is_ones == 0))
+		return -1;
+
+	out[out_len] = '\0';
+	return (long)out_len;
+}
+
+
+static size_t
+hpack_put(unsigned char out[], size_t len, unsigned idx, const char value[])
+{
+	/* 0000xxxx: the indexes and the values here fit in two and one bytes */
+	if (idx < 15) {
+		out[len++] = (unsigned char)idx;
+	} else {
+		out[len++] = 0x0f;
+		out[len++] = (unsigned char)(idx - 15);
+	}
+
+	const size_t value_len = strlen(value);
+	out[len++] = (unsigned char)value_len;
+	memcpy(out + len, value, value_len);
+	return len + value_len;
+}
+
+
+/*
+ * Tls
+ */
+#ifdef WITH_TLS
+static int
+tls_init(const char cert[], const char key[])
+{
+	if (((access(cert, F_OK) < 0) || (access(key, F_OK) < 0)) && (tls_cert_new(cert, key) < 0))
+		return -1;
+
+	SSL_CTX *const ctx = SSL_CTX_new(TLS_server_method());
+	if (ctx == NULL)
+		goto err0;
+
+	SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+
+	/* resumption: the session cache (TLS 1.2) and the tickets, both on by default, valid
+	 * for as long as the server runs */
+	SSL_CTX_set_session_id_context(ctx, (const unsigned char *)"mockserver", 10);
+	if ((SSL_CTX_use_certificate_chain_file(ctx, cert) != 1) ||
+	    (SSL_CTX_use_PrivateKey_file(ctx, key, SSL_FILETYPE_PEM) != 1) ||
+	    (SSL_CTX_check_private_key(ctx) != 1)) {
+		SSL_CTX_free(ctx);
+		goto err0;
+	}
+
+	SSL_CTX_set_alpn_select_cb(ctx, tls_alpn_select, NULL);
+	tls_ctx = ctx;
+	return 0;
+
+err0:
+	fprintf(stderr, "mockserver: tls: %s\n", ERR_error_string(ERR_get_error(), NULL));
+	return -1;
+}
+
+
+static int
+tls_cert_new(const char cert[], const char key[])
+{
+	static const struct {
+		int         nid;
+		const char *value;
+	} exts[] = {
+		/* its own CA: SSL_CERT_FILE=CERT for the client */
+		{ NID_basic_constraints, "critical,CA:TRUE" },
+		{ NID_subject_alt_name, "DNS:localhost,IP:127.0.0.1,IP:::1" },
+	};
+
+	int ret = -1;
+	EVP_PKEY *pkey = NULL;
+	X509 *x = NULL;
+	FILE *f;
+
+	EVP_PKEY_CTX *const kctx = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, NULL);
+	if ((kctx == NULL) || (EVP_PKEY_keygen_init(kctx) != 1) ||
+	    (EVP_PKEY_CTX_set_ec_paramgen_curve_nid(kctx, NID_X9_62_prime256v1) != 1) ||
+	    (EVP_PKEY_keygen(kctx, &pkey) != 1))
+		goto err0;
+
+	if ((x = X509_new()) == NULL)
+		goto err0;
+
+	/* a year */
+	X509_set_version(x, 2);
+	ASN1_INTEGER_set(X509_get_serialNumber(x), (long)time(NULL));
+	X509_gmtime_adj(X509_getm_notBefore(x), 0);
+	X509_gmtime_adj(X509_getm_notAfter(x), 365L * 24 * 60 * 60);
+	X509_set_pubkey(x, pkey);
+
+	X509_NAME *const name = X509_get_subject_name(x);
+	X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const unsigned char *)"localhost",
+				   -1, -1, 0);
+	X509_set_issuer_name(x, name);
+
+	X509V3_CTX v3;
+	X509V3_set_ctx_nodb(&v3);
+	X509V3_set_ctx(&v3, x, x, NULL, NULL, 0);
+	for (size_t i = 0; i < LEN(exts); i++) {
+		X509_EXTENSION *const ext = X509V3_EXT_conf_nid(NULL, &v3, exts[i].nid,
+								exts[i].value);
+		if (ext == NULL)
+			goto err0;
+
+		const int is_added = X509_add_ext(x, ext, -1);
+		X509_EXTENSION_free(ext);
+		if (is_added == 0)
+			goto err0;
+	}
+
+	if (X509_sign(x, pkey, EVP_sha256()) == 0)
+		goto err0;
+
+	/* the key: the owner's only */
+	const int fd = open(key, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if ((fd < 0) || ((f = fdopen(fd, "w")) == NULL)) {
+		perror("mockserver: open");
+		if (fd >= 0)
+			close(fd);
+
+		goto out0;
+	}
+
+	const int is_key = PEM_write_PrivateKey(f, pkey, NULL, NULL, 0, NULL, NULL);
+	if ((fclose(f) != 0) || (is_key != 1))
+		goto err0;
+
+	if ((f = fopen(cert, "w")) == NULL) {
+		perror("mockserver: fopen");
+		goto out0;
+	}
+
+	const int is_cert = PEM_write_X509(f, x);
+	if ((fclose(f) != 0) || (is_cert != 1))
+		goto err0;
+
+	fprintf(stderr, "mockserver: tls: a self-signed certificate: %s\n", cert);
+	ret = 0;
+	goto out0;
+
+err0:
+	fprintf(stderr, "mockserver: tls: %s\n", ERR_error_string(ERR_get_error(), NULL));
+out0:
+	X509_free(x);
+	EVP_PKEY_free(pkey);
+	EVP_PKEY_CTX_free(kctx);
+	return ret;
+}
+
+
+static int
+tls_alpn_select(SSL *ssl, const unsigned char **out, unsigned char *out_len,
+		const unsigned char *in, unsigned in_len, void *arg)
+{
+	/* ours first, h2 with -2 only */
+	static const unsigned char protos[] = "\x02h2\x08http/1.1";
+	const unsigned skip = (opts.is_h2) ? 0 : 3;
+
+	(void)ssl;
+	(void)arg;
+	if (SSL_select_next_proto((unsigned char **)out, out_len, protos + skip,
+				  (unsigned)(sizeof(protos) - 1 - skip), in,
+				  in_len) != OPENSSL_NPN_NEGOTIATED)
+		return SSL_TLSEXT_ERR_NOACK;
+
+	return SSL_TLSEXT_ERR_OK;
+}
+
+
+static int
+tls_accept(Conn *c, int *is_h2)
+{
+	c->ssl = SSL_new(tls_ctx);
+	if ((c->ssl == NULL) || (SSL_set_fd(c->ssl, c->fd) != 1)) {
+		fprintf(stderr, "mockserver: conn %lu: SSL_new: failed\n", c->id);
+		goto err0;
+	}
+
+	ERR_clear_error();
+	if (SSL_accept(c->ssl) != 1) {
+		if (opts.is_verbose) {
+			fprintf(stderr, "mockserver: conn %lu: handshake: %s\n", c->id,
+				ERR_error_string(ERR_get_error(), NULL));
+		}
+
+		goto err0;
+	}
+
+	const unsigned char *alpn;
+	unsigned alpn_len;
+	SSL_get0_alpn_selected(c->ssl, &alpn, &alpn_len);
+	*is_h2 = (alpn_len == 2) && (memcmp(alpn, "h2", 2) == 0);
+	if (opts.is_verbose) {
+		fprintf(stderr, "mockserver: conn %lu: %s, %s%s\n", c->id, SSL_get_version(c->ssl),
+			(*is_h2) ? "h2" : "http/1.1",
+			(SSL_session_reused(c->ssl) == 1) ? ", resumed" : "");
+	}
+
+	return 0;
+
+err0:
+	/* no close_notify after a failed handshake */
+	SSL_free(c->ssl);
+	c->ssl = NULL;
+	return -1;
+}
+#endif
+
+
+/*
+ * Main
+ */
+int
+main(int argc, char *argv[])
+{
+	opts.addr = MOCK_ADDR;
+	opts.port = MOCK_PORT;
+	opts.seed = 1;
+	opts.retry_after = 1;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "a:p:l:b:c:k:i:e:r:R:d:f:t:2s:vh")) != -1) {
+		switch (opt) {
+		case 'a': opts.addr = optarg; break;
+		case 'p': opts.port = optarg; break;
+		case 'l':
+			if (latency_parse(&opts.latency, optarg) < 0) {
+				fprintf(stderr, "mockserver: invalid latency: \"%s\"\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'b': opts.bandwidth = strtoul(optarg, NULL, 10); break;
+		case 'c': opts.chunk = (unsigned)strtoul(optarg, NULL, 10); break;
+		case 'k': opts.keep_alive = (unsigned)strtoul(optarg, NULL, 10); break;
+		case 'i': opts.idle = (unsigned)strtoul(optarg, NULL, 10); break;
+		case 'e': opts.error_pct = atof(optarg); break;
+		case 'r': opts.busy_pct = atof(optarg); break;
+		case 'R': opts.retry_after = (unsigned)strtoul(optarg, NULL, 10); break;
+		case 'd': opts.drop_pct = atof(optarg); break;
+		case 'f':
+			if (opts_load_canned(optarg) < 0)
+				return EXIT_FAILURE;
+			break;
+		case 't': {
+			char *const sep = strchr(optarg, ':');
+			if (sep == NULL) {
+				fprintf(stderr, "mockserver: invalid TLS files: \"%s\"\n", optarg);
+				return EXIT_FAILURE;
+			}
+
+			*sep = '\0';
+			opts.tls_cert = optarg;
+			opts.tls_key = sep + 1;
+			break;
+		}
+		case '2': opts.is_h2 = 1; break;
+		case 's': opts.seed = strtoull(optarg, NULL, 10); break;
+		case 'v': opts.is_verbose = 1; break;
+		case 'h':
+			help(argv[0]);
+			return EXIT_SUCCESS;
+		default:
+			help(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (opts.tls_cert != NULL) {
+#ifdef WITH_TLS
+		if (tls_init(opts.tls_cert, opts.tls_key) < 0)
+			return EXIT_FAILURE;
+#else
+		fprintf(stderr, "mockserver: no TLS, built without WITH_TLS=1\n");
+		return EXIT_FAILURE;
+#endif
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+
+	struct addrinfo *ai;
+	const struct addrinfo hints = {
+		.ai_family = AF_UNSPEC,
+		.ai_socktype = SOCK_STREAM,
+		.ai_flags = AI_PASSIVE,
+	};
+
+	const int err = getaddrinfo(opts.addr, opts.port, &hints, &ai);
+	if (err != 0) {
+		fprintf(stderr, "mockserver: getaddrinfo: %s\n", gai_strerror(err));
+		return EXIT_FAILURE;
+	}
+
+	const int fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+	if (fd < 0) {
+		perror("mockserver: socket");
+		freeaddrinfo(ai);
+		return EXIT_FAILURE;
+	}
+
+	const int yes = 1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+	if ((bind(fd, ai->ai_addr, ai->ai_addrlen) < 0) || (listen(fd, MOCK_BACKLOG) < 0)) {
+		perror("mockserver: bind");
+		freeaddrinfo(ai);
+		close(fd);
+		return EXIT_FAILURE;
+	}
+
+	freeaddrinfo(ai);
+	fprintf(stderr, "mockserver: listening on %s:%s (%s%s)\n", opts.addr, opts.port,
+		(opts.tls_cert != NULL) ? "https" : "http", (opts.is_h2) ? ", HTTP/2" : "");
+
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+	while (1) {
+		const int cfd = accept(fd, NULL, NULL);
+		if (cfd < 0) {
+			if ((errno == EINTR) || (errno == ECONNABORTED))
+				continue;
+
+			perror("mockserver: accept");
+			break;
+		}
+
+		/* a chunk or a slice per packet, as written */
+		setsockopt(cfd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+
+		Conn *const c = malloc(sizeof(*c));
+		if (c == NULL) {
+			perror("mockserver: malloc");
+			close(cfd);
+			continue;
+		}
+
+		c->fd = cfd;
+		c->id = ++conn_seq;
+		c->reqs = 0;
+		c->len = 0;
+#ifdef WITH_TLS
+		c->ssl = NULL;
+#endif
+
+		pthread_t thread;
+		if (pthread_create(&thread, &attr, conn_run, c) != 0) {
+			fprintf(stderr, "mockserver: pthread_create: failed\n");
+			close(cfd);
+			free(c);
+		}
+	}
+
+	pthread_attr_destroy(&attr);
+	close(fd);
+	return EXIT_FAILURE;
+}
@@ -7,32 +7,70 @@
 
 #include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
 #include <locale.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <sys/types.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
 #include <sys/uio.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#ifdef WITH_TLS
+#include <openssl/err.h>
+#include <openssl/pem.h>
+#include <openssl/ssl.h>
+#include <openssl/x509v3.h>
+#endif
 
-#ifndef WNO_INTERACTIVE_MODE
+#if !defined(WNO_INTERACTIVE_MODE) && !defined(MOETR_LIB)
 #include <readline/readline.h>
 #include <readline/history.h>
 #endif
 
+#ifdef WITH_USDT
+#include <sys/sdt.h>
+#endif
+
 #include "json.h"
 #include "config.h"
+#include "moetranslate.h"
 
 
 
 #define LEN(X) ((sizeof(X)) / (sizeof(*X)))
+#define MIN(A, B) (((A) < (B)) ? (A) : (B))
+#define MAX(A, B) (((A) > (B)) ? (A) : (B))
+
+/* USDT probes: "usdt:moetranslate:moetranslate:NAME", only with WITH_USDT=1, the arguments are
+ * not even evaluated otherwise
+ */
+#ifdef WITH_USDT
+	#define PROBE(...) STAP_PROBEV(moetranslate, __VA_ARGS__)
+#else
+	#define PROBE(...) ((void)0)
+#endif
 
 
-#if (CONFIG_COLOR_ENABLED != 0)
+#if (CONFIG_COLOR_ENABLED != 0) && !defined(MOETR_LIB)
 	#define COLOR_REGULAR_GREEN(X)  "\033[00;" CONFIG_COLOR_GREEN  "m" X "\033[00m"
 	#define COLOR_REGULAR_YELLOW(X) "\033[00;" CONFIG_COLOR_YELLOW "m" X "\033[00m"
 
@@ -50,6 +88,12 @@
 	#define COLOR_BOLD_YELLOW(X)    X
 #endif
 
+/* the errors of the engine: the last one of the thread is kept, for the results of the
+ * library and the daemon, and printed to stderr, but by the library (MOETR_LIB: no stdio)
+ */
+#define LOG_ERR(...)   moetr_error_set(0, __VA_ARGS__)
+#define LOG_ERRNO(STR) moetr_error_set(1, "%s", STR)
+
 
 /*
  * cstr
@@ -89,7 +133,9 @@ typedef struct {
 
 static const Lang lang_pack[] = CONFIG_LANG_PACK;
 
+#ifndef MOETR_LIB
 static void        lang_show_list(int max_col);
+#endif
 static const Lang *lang_get_from_key(const char key[]);
 static int         lang_get_from_key_s(const char key[], size_t len, const Lang **lang);
 
@@ -110,54 +156,1073 @@ static int         lang_get_from_key_s(const char key[], size_t len, const Lang
 static int lang_parse(const Lang *l[2], const char keys[]);
 
 
+/*
+ * Time
+ */
+/* monotonic clock, in nanoseconds */
+static int64_t time_now_ns(void);
+
+
+/*
+ * Trace: Chrome trace-event JSON, the spans are buffered in a ring per thread (no lock but on
+ * the first event of a thread), and written by trace_deinit()
+ */
+typedef struct {
+	const char   *name;
+	const char   *cat;
+	int64_t       start;
+	int64_t       end;
+	unsigned      lane;	/* the track: a request slot, 0: the warmer */
+	unsigned long req;
+	unsigned long conn;
+	const char   *val_name;	/* NULL: no value */
+	long          val;
+} TraceEvent;
+
+typedef struct TraceRing {
+	TraceEvent        events[CONFIG_TRACE_EVENTS];
+	size_t            len;
+	size_t            pos;
+	unsigned long     dropped;
+	unsigned          thread;
+	struct TraceRing *next;
+} TraceRing;
+
+typedef struct {
+	const char     *path;	/* "": off */
+	int64_t         start;
+	pthread_key_t   key;
+	pthread_mutex_t mutex;
+	TraceRing      *rings;
+	unsigned        rings_len;
+} Trace;
+
+static int         trace_init(Trace *t);
+
+/* writes the file, if any */
+static void        trace_deinit(Trace *t);
+static int         trace_is_on(const Trace *t);
+
+/* a complete event: start, end: nanoseconds, time_now_ns() */
+static void        trace_span(Trace *t, const char name[], const char cat[], int64_t start,
+			      int64_t end, unsigned lane, unsigned long req, unsigned long conn,
+			      const char val_name[], long val);
+
+/* the ring of the calling thread, created on first use */
+static TraceRing  *trace_ring(Trace *t);
+static int         trace_write(Trace *t, FILE *file);
+
+
 /*
  * Net
  */
-static int net_tcp_connect(const char host[], const char port[]);
+typedef struct {
+	int tcp_nodelay;
+	int tcp_fastopen;
+	int tcp_quickack;
+	int rcvbuf;
+	int tls_verify;
+	int tls_session_cache;
+} NetOpts;
+
+static int net_resolve(const char host[], const char port[], struct addrinfo **ai);
+
+/* non-blocking connect
+ * is_fastopen: in : try TCP Fast Open, the SYN is deferred until the first write
+ *              out: 0 if not supported
+ *
+ * ret: -1 -> failed
+ *       0 -> connected (or deferred: TCP Fast Open)
+ *       1 -> in progress, wait for POLLOUT then call net_tcp_connect_check()
+ */
+static int net_tcp_connect(const struct addrinfo *ai, const NetOpts *opts, int *is_fastopen,
+			   int *fd);
+static int net_tcp_connect_check(int fd);
+
+/* ret: 1 -> the data was sent along with the SYN, and acknowledged */
+static int net_tcp_is_fastopen_used(int fd);
+static void net_tcp_quickack(int fd, const NetOpts *opts);
+
+/* ret: 1 -> idle socket is still usable, 0 -> closed by peer, or has unexpected data */
+static int net_is_alive(int fd);
 
 
 /*
- * Http
+ * Tls
+ */
+#ifdef WITH_TLS
+static SSL_CTX     *tls_ctx_new(int is_verify);
+/* alpn: protocol list in the wire format, NULL: none */
+static SSL         *tls_new(SSL_CTX *ctx, int fd, const char host[], SSL_SESSION *session,
+				 const char alpn[]);
+static void         tls_free(SSL *ssl, int is_graceful);
+
+/* ret: -1 -> failed, 0 -> done, 1 -> again: wait for `events` */
+static int          tls_handshake(SSL *ssl, short *events);
+
+/* ret: -1 + errno == EAGAIN -> again: wait for `events` */
+static ssize_t      tls_write(SSL *ssl, const void *buf, size_t len, short *events);
+static ssize_t      tls_read(SSL *ssl, void *buf, size_t len, short *events);
+static int          tls_is_alive(SSL *ssl, int fd);
+
+/* resumption across process runs: ~/.cache/moetranslate/tls_HOST_PORT.pem */
+static int          tls_session_path(char buffer[], size_t size, const char host[], const char port[],
+				     int is_mkdir);
+static SSL_SESSION *tls_session_load(const char host[], const char port[]);
+static void         tls_session_save(SSL_SESSION *session, const char host[], const char port[]);
+#endif
+
+
+/*
+ * Hpack: HTTP/2 header compression (RFC 7541)
  */
 enum {
-	HTTP_IOV_METHOD = 0,
-	HTTP_IOV_PATH_BASE,
-	HTTP_IOV_PATH_SPEC,
-	HTTP_IOV_SRC_LANG_KEY,
-	HTTP_IOV_SRC_LANG_VAL,
-	HTTP_IOV_TRG_LANG_KEY,
-	HTTP_IOV_TRG_LANG_VAL,
-	HTTP_IOV_HL_LANG_KEY,
-	HTTP_IOV_HL_LANG_VAL,
-	HTTP_IOV_TEXT_KEY,
-	HTTP_IOV_TEXT_VAL,
-	HTTP_IOV_PROTOCOL,
-	HTTP_IOV_HEADER,
+	/* SETTINGS_HEADER_TABLE_SIZE: the default, both directions */
+	HPACK_TABLE_SIZE     = 4096,
+	HPACK_ENTRY_OVERHEAD = 32,
+};
+
+typedef struct {
+	char   *ptr;	/* name + value, no separator */
+	size_t  name_len;
+	size_t  value_len;
+} HpackField;
+
+typedef struct {
+	HpackField fields[HPACK_TABLE_SIZE / HPACK_ENTRY_OVERHEAD];
+	unsigned   first;	/* the oldest */
+	unsigned   len;
+	size_t     size;
+	size_t     size_max;
+} HpackTable;
+
+static void hpack_table_init(HpackTable *t);
+static void hpack_table_deinit(HpackTable *t);
+static void hpack_table_evict(HpackTable *t, size_t size_max);
+static int  hpack_table_add(HpackTable *t, const char name[], size_t name_len, const char value[],
+			    size_t value_len);
+
+/* idx: 1..61: the static table, 62..: the dynamic table, the newest first */
+static int  hpack_table_get(const HpackTable *t, size_t idx, HpackField *field);
+
+/* ret: 0: not found, > 0: the index, *is_full: both name and value match */
+static unsigned hpack_static_find(const char name[], size_t name_len, const char value[],
+				  size_t value_len, int *is_full);
+
+/* append to `b` at `*len` */
+static int  hpack_int_encode(Buffer *b, size_t *len, unsigned char first, unsigned bits, size_t value);
+static int  hpack_str_encode(Buffer *b, size_t *len, const char str[], size_t str_len);
+
+/* is_indexing: literal with incremental indexing, the caller mirrors the peer's table */
+static int  hpack_field_encode(Buffer *b, size_t *len, const char name[], size_t name_len,
+			       const char value[], size_t value_len, int is_indexing);
+
+/* ret: -1 -> malformed */
+static int  hpack_int_decode(const unsigned char **p, const unsigned char *end, unsigned bits,
+			     size_t *value);
+static int  hpack_str_decode(const unsigned char **p, const unsigned char *end, Buffer *b,
+			     size_t *len);
+static size_t hpack_huff_len(const char str[], size_t len);
+static void   hpack_huff_encode(unsigned char out[], const char str[], size_t len);
+static int    hpack_huff_decode(Buffer *b, size_t *len, const unsigned char in[], size_t in_len);
+
+/* decode a header block into "name: value\r\n" lines, appended to `out` at `*out_len`
+ * scratch: for the strings
+ * ret: -1 -> COMPRESSION_ERROR
+ */
+static int  hpack_decode(HpackTable *t, const unsigned char in[], size_t in_len, Buffer *out,
+			 size_t *out_len, Buffer *scratch);
+
+
+/*
+ * Backend
+ */
+typedef struct Http Http;
 
-	HTTP_IOVS_SIZE,
+enum {
+	BACKEND_CAP_SIMPLE = (1u << 0),
+	BACKEND_CAP_DETAIL = (1u << 1),
+	BACKEND_CAP_LANG   = (1u << 2),
+	BACKEND_CAP_H2     = (1u << 3),	/* no request body: HTTP/2 can be used */
 };
 
+/* the common result model: filled by Backend.parse(), the strings point into the JSON */
+typedef struct {
+	Buffer         text;	/* the translation */
+	size_t         text_len;
+	json_string_t *lang;	/* the detected source language */
+	int            confidence;	/* percent, -1: unknown */
+
+	/* RESULT_TYPE_DETAIL */
+	json_string_t *correction;
+	json_string_t *src_spelling;
+	json_string_t *trg_spelling;
+	json_array_t  *synonyms;	/* Google's layout, see moetr_print_detail_*() */
+	json_array_t  *defs;
+	json_array_t  *examples;
+} Result;
+
 typedef struct {
+	const char *name;
 	const char *host;
 	const char *port;
+	const char *tls_port;
+	const char *content_type;	/* of the request body */
+	unsigned    caps;
 
-	Buffer buffer;
-	size_t buffer_len;
+	/* the method, the path and the body of the request: the HTTP_IOV_* of `h`
+	 * text: url encoded
+	 */
+	void (*build)(Http *h, int type, const char sl[], const char tl[], const char hl[],
+		      const char text[], size_t text_len);
+
+	/* ret: -1 -> unexpected response */
+	int  (*parse)(json_value_t *json, int type, Result *res);
+} Backend;
+
+static const Backend *backend_get(const char name[]);
+static int            backend_is_capable(const Backend *b, int type);
+static void           backend_google_build(Http *h, int type, const char sl[], const char tl[],
+					   const char hl[], const char text[], size_t text_len);
+static int            backend_google_parse(json_value_t *json, int type, Result *res);
+static void           backend_libre_build(Http *h, int type, const char sl[], const char tl[],
+					  const char hl[], const char text[], size_t text_len);
+static int            backend_libre_parse(json_value_t *json, int type, Result *res);
+
+static const Backend backends[] = {
+	{
+		.name         = "google",
+		.host         = CONFIG_HTTP_HOST,
+		.port         = CONFIG_HTTP_PORT,
+		.tls_port     = CONFIG_HTTP_TLS_PORT,
+		.caps         = BACKEND_CAP_SIMPLE | BACKEND_CAP_DETAIL | BACKEND_CAP_LANG | BACKEND_CAP_H2,
+		.build        = backend_google_build,
+		.parse        = backend_google_parse,
+	},
+	{
+		.name         = "libre",
+		.host         = CONFIG_LIBRE_HOST,
+		.port         = CONFIG_LIBRE_PORT,
+		.tls_port     = CONFIG_LIBRE_TLS_PORT,
+		.content_type = "application/x-www-form-urlencoded",
+		.caps         = BACKEND_CAP_SIMPLE | BACKEND_CAP_LANG,
+		.build        = backend_libre_build,
+		.parse        = backend_libre_parse,
+	},
+};
+
+static void result_reset(Result *res);
+
+/* appends a segment of the translation, ret: -1 -> failed to realloc */
+static int  result_text_add(Result *res, const char str[], size_t len);
+
+
+/*
+ * Http Pool: keep-alive connections, shared by all Http requests
+ */
+typedef struct H2 H2;
+
+typedef struct {
+	int           fd;
+	int           is_connecting;
+	int           is_fastopen;
+	int           is_tls;
+	int           is_ready;
+	short         events;
+	unsigned      host_idx;
+	unsigned      addr_idx;
+	unsigned long id;
+	unsigned long reqs;
+	int64_t       idle_since;
+	int64_t       dns_ns;	/* resolving the host for this connection, 0: cached */
+#ifdef WITH_TLS
+	SSL          *ssl;
+#endif
+} HttpConn;
+
+typedef struct {
+	char             host[CONFIG_HTTP_POOL_HOST_SIZE];
+	char             port[8];
+	int              is_tls;
+	int              is_h2;
+	struct addrinfo *ai;
+
+	/* HTTP/2: one multiplexed connection, driven by the requesting thread only */
+	H2 *h2;
+
+	/* LIFO: the most recently used connection is on the top */
+	HttpConn *idle[CONFIG_HTTP_POOL_HOST_CONNS_MAX];
+	unsigned  idle_len;
+	unsigned  busy_len;
+	unsigned  warming;
+	int       wake_fd;	/* eventfd: a connection is given back, or warmed up */
+
+#ifdef WITH_TLS
+	SSL_SESSION *session;
+	int          is_session_dirty;
+#endif
+
+	/* circuit breaker: the results of the last attempts (1: failed) */
+	int      breaker;
+	uint8_t  results[CONFIG_HTTP_BREAKER_WINDOW];
+	unsigned results_len;
+	unsigned results_pos;
+	unsigned failures;
+	unsigned probes;
+	unsigned probes_ok;
+	int64_t  open_until;
+} HttpPoolHost;
+
+/* router: an endpoint, scored by its peak EWMA latency, error rate and requests in flight */
+typedef struct {
+	const Backend *backend;
+	char           host[CONFIG_HTTP_POOL_HOST_SIZE];
+	char           port[8];	/* "": the backend's */
+	double         lat;	/* nanoseconds, 0: no sample yet */
+	double         err;	/* 0..1 */
+	int64_t        lat_at;
+	unsigned       inflight;
+	unsigned long  picks;
+	unsigned long  fails;
+} HttpPoolRoute;
+
+enum {
+	HTTP_POOL_BREAKER_CLOSED = 0,
+	HTTP_POOL_BREAKER_HALF_OPEN,	/* probing: a few attempts are let through */
+	HTTP_POOL_BREAKER_OPEN,		/* failing fast */
+};
+
+static const char *const http_pool_breaker_str[] = {
+	[HTTP_POOL_BREAKER_CLOSED]    = "closed",
+	[HTTP_POOL_BREAKER_HALF_OPEN] = "half-open",
+	[HTTP_POOL_BREAKER_OPEN]      = "open",
+};
+
+typedef struct {
+	unsigned long checkouts;
+	unsigned long reuses;
+	unsigned long new_connects;
+	unsigned long waits;
+	unsigned long dead;
+	unsigned long reaped;
+	unsigned long warmed;
+	unsigned long tfo_attempts;
+	unsigned long tfo_used;
+	unsigned long tls_handshakes;
+	unsigned long tls_resumed;
+	unsigned long h2_streams;
+	unsigned long hedges;
+	unsigned long hedge_wins;
+	unsigned long limit_window;
+	unsigned long limit_cuts;
+	unsigned long limit_queued;
+	unsigned long breaker_trips;
+	unsigned long breaker_rejects;
+	int           breaker;	/* the worst of the hosts */
+} HttpPoolStats;
+
+/* how an attempt ended, for the adaptive concurrency limit */
+enum {
+	HTTP_POOL_LIMIT_NONE = 0,	/* no signal: cancelled, or a client side error */
+	HTTP_POOL_LIMIT_OK,
+	HTTP_POOL_LIMIT_OVERLOAD,	/* 429, 503, or a timeout */
+};
+
+typedef struct {
+	pthread_mutex_t mutex;
+	unsigned long   conn_id;
+	HttpPoolHost    hosts[CONFIG_HTTP_POOL_HOSTS_MAX];
+	unsigned        hosts_len;
+	HttpPoolStats   stats;
+	NetOpts         net_opts;
+#ifdef WITH_TLS
+	SSL_CTX        *tls_ctx;
+#endif
+
+	/* hedging: the recent response latencies (microseconds), a ring, and its sorted copy */
+	uint32_t        lat[CONFIG_HTTP_HEDGE_SAMPLES];
+	uint32_t        lat_sorted[CONFIG_HTTP_HEDGE_SAMPLES];
+	unsigned        lat_len;
+	unsigned long   lat_count;
+	unsigned long   lat_sorted_count;
+	int             hedge_rate;
+	int             hedge_tokens;	/* 1/100 hedge */
+
+	/* the requests in flight, under an AIMD window, and the rate limits (token buckets) */
+	int             is_limit;
+	int             limit_max;
+	int             rps;
+	int             cps;
+	double          limit;
+	unsigned        limit_inflight;
+	int             is_limit_cut;	/* slow start: until the first cut */
+	int64_t         limit_hold_until;
+	double          lat_fast;	/* EWMAs of the latency (nanoseconds) */
+	double          lat_slow;
+	double          rps_tokens;
+	double          cps_tokens;
+	int64_t         bucket_at;
+
+	int             is_breaker;
+	int             breaker_cooldown;
+
+	/* router: each attempt goes to one of the endpoints, race: to the best two at once */
+	HttpPoolRoute   routes[CONFIG_HTTP_ROUTES_MAX];
+	unsigned        routes_len;
+	int             is_race;
+	unsigned        route_seed;
+
+	/* capture: record the request/response pairs, or replay them instead of the network */
+	const char     *record_dir;
+	const char     *replay_dir;
+	int             is_replay_timed;
+
+	/* trace: the lanes (tracks) of the Http requests, and the request ids */
+	Trace           trace;
+	unsigned        trace_lanes;
+	unsigned long   trace_reqs;
+} HttpPool;
+
+/* a warmer: detached, one per host at most, http_pool_deinit() waits for them */
+typedef struct {
+	HttpPool *pool;
+	unsigned  host_idx;
+} HttpPoolWarm;
+
+static int           http_pool_init(HttpPool *p);
+static void          http_pool_deinit(HttpPool *p);
+/* is_h2: HTTP/2 connections are kept apart from the HTTP/1.1 ones */
+static HttpPoolHost *http_pool_host_get(HttpPool *p, const char host[], const char port[], int is_tls,
+					int is_h2);
+
+/* without p->mutex: the DNS lookup and the connect don't hold up the other users of the pool */
+static int           http_pool_connect(HttpPool *p, HttpPoolHost *host, HttpConn *c);
+
+/* ret: NULL + errno == EAGAIN -> per host limit reached, or warming up: try again when
+ *                               `wake_fd` is readable (NULL: not needed)
+ *      NULL                   -> failed
+ *
+ * is_waiting: the caller is retrying after EAGAIN (only the first wait is counted)
+ * is_bulk   : MOETRANSLATE_BULK, CONFIG_HTTP_BULK_RESERVE of the connections are left to the others
+ */
+static HttpConn *http_pool_get(HttpPool *p, const char host[], const char port[], int is_tls,
+			       int is_h2, int is_waiting, int is_bulk, int *is_reused,
+			       int *wake_fd);
+static void      http_pool_put(HttpPool *p, HttpConn *c, int is_reusable);
+
+/* the waiters of the host try again: after the state they wait on has changed (under
+ * p->mutex for the pool, by the thread driving them for HTTP/2 streams)
+ */
+static void      http_pool_wake(HttpPoolHost *host);
+
+/* before checking that state: an http_pool_wake() from then on makes `wake_fd` readable */
+static void      http_pool_wait(HttpPoolHost *host, int *wake_fd);
+
+/* on failure, connect to the next address of the same host */
+static int       http_pool_reconnect(HttpPool *p, HttpConn *c);
+static void      http_pool_reap(HttpPool *p);
+static void      http_pool_get_stats(HttpPool *p, HttpPoolStats *s);
+
+/* the first request on a TCP Fast Open connection has been answered */
+static void      http_pool_fastopen_done(HttpPool *p, HttpConn *c);
+
+/* hedging: a response arrived after `ns` nanoseconds */
+static void      http_pool_latency_add(HttpPool *p, int64_t ns);
+
+/* a request starts: the `pct` percentile of the recent latencies, and the hedge budget grows
+ * ret: nanoseconds, -1: not enough samples yet
+ */
+static int64_t   http_pool_hedge_delay(HttpPool *p, int pct);
+
+/* ret: 1 -> a hedge may be sent, 0 -> over the hedge rate
+ * is_race: always, the hedge rate is not for the races
+ */
+static int       http_pool_hedge_take(HttpPool *p, int is_race);
+static int       http_pool_lat_cmp(const void *a, const void *b);
+
+/* a permit to start a request: under the concurrency window, and the rate limits
+ * chars     : of the text, for the characters/s limit
+ * is_waiting: the caller is trying again (only the first wait is counted)
+ * is_bulk   : MOETRANSLATE_BULK, CONFIG_HTTP_BULK_RESERVE of the window is left to the others
+ * ret: 0 -> taken, > 0 -> over the rate, try again after this (nanoseconds),
+ *      -1 -> the window is full, try again after http_pool_limit_put()
+ */
+static int64_t   http_pool_limit_take(HttpPool *p, size_t chars, int is_waiting, int is_bulk);
+
+/* the attempt has ended: signal: HTTP_POOL_LIMIT_*, latency: nanoseconds */
+static void      http_pool_limit_put(HttpPool *p, int signal, int64_t latency);
+static void      http_pool_bucket_fill(HttpPool *p, int64_t now);
+
+/* circuit breaker, per host: ret: 1 -> go on, 0 -> open: fail fast
+ * ret_host: the attempt is accounted to it, NULL: not accounted
+ * is_probe: half-open, the attempt is one of the probes
+ */
+static int       http_pool_breaker_take(HttpPool *p, const char host[], const char port[], int is_tls,
+					int is_h2, HttpPoolHost **ret_host, int *is_probe);
+
+/* result: 1 -> ok, 0 -> failed, -1 -> no result (cancelled) */
+static void      http_pool_breaker_put(HttpPool *p, HttpPoolHost *host, int is_probe, int result);
+static void      http_pool_breaker_reset(HttpPoolHost *host, int state);
+
+/* router: spec: "[BACKEND@]HOST[:PORT]", backend: without "BACKEND@"
+ * ret: -1 -> invalid, or too many
+ */
+static int       http_pool_route_add(HttpPool *p, const char spec[], const Backend *backend);
+
+/* the better of two random endpoints (power of two choices), or the best one (is_best), of the
+ * ones able to do `type` but `exclude`, the attempt is counted in flight until
+ * http_pool_route_put()
+ * ret: the index, -1: none
+ */
+static int       http_pool_route_pick(HttpPool *p, int type, int exclude, int is_best);
+
+/* the best one, not counted in flight (prewarming) */
+static int       http_pool_route_peek(HttpPool *p, int type);
+static int       http_pool_route_find(HttpPool *p, int type, int exclude, int is_best);
+static double    http_pool_route_score(const HttpPoolRoute *r);
+
+/* the attempt has ended: latency: nanoseconds, -1: none
+ * result: 1 -> ok, 0 -> failed, -1 -> no result (cancelled)
+ */
+static void      http_pool_route_put(HttpPool *p, int idx, int64_t latency, int result);
+
+/* the HTTP/2 session of a host, created on first use (not connected yet) */
+static H2       *http_pool_h2_get(HttpPool *p, const char host[], const char port[], int is_tls);
+
+/* open a connection (DNS + TCP + TLS) in the background, ready for the next http_pool_get()
+ * no-op: if the host already has an idle connection, or one is being warmed up
+ */
+static void      http_pool_prewarm(HttpPool *p, const char host[], const char port[], int is_tls,
+				   int is_h2);
+static void     *http_pool_prewarm_thrd(void *udata);
+
+static void      http_conn_free(HttpConn *c, int is_graceful);
+static int       http_conn_is_alive(HttpConn *c);
+
+/* TLS handshake (no-op for plain TCP)
+ * ret: -1 -> failed, 0 -> done, 1 -> again: wait for c->events
+ */
+static int       http_conn_handshake(HttpPool *p, HttpConn *c);
+
+/* ret: -1 + errno == EAGAIN -> again: wait for c->events
+ * flat: TLS: scratch buffer, the iovs are written as one record (unused for one iov)
+ */
+static ssize_t   http_conn_writev(HttpConn *c, const struct iovec iovs[], int iovs_len, Buffer *flat);
+static ssize_t   http_conn_read(HttpConn *c, void *buf, size_t len);
+static size_t    http_conn_pending(HttpConn *c);
+
+
+/*
+ * Http
+ */
+enum { HTTP_IOV_PARTS_SIZE = 10 };
+
+enum {
+	HTTP_IOV_METHOD = 0,
+	HTTP_IOV_PATH,		/* the path and the query: HTTP_IOV_PARTS_SIZE iovs */
+	HTTP_IOV_PROTOCOL = HTTP_IOV_PATH + HTTP_IOV_PARTS_SIZE,
+	HTTP_IOV_HOST_KEY,
+	HTTP_IOV_HOST_VAL,
+	HTTP_IOV_HOST_END,
+	HTTP_IOV_HEADER,
+	HTTP_IOV_CONTENT,	/* Content-Type and Content-Length, when there is a body */
+	HTTP_IOV_HEADER_END,
+	HTTP_IOV_BODY,		/* HTTP_IOV_PARTS_SIZE iovs */
+
+	HTTP_IOVS_SIZE = HTTP_IOV_BODY + HTTP_IOV_PARTS_SIZE,
+};
+
+enum {
+	HTTP_STATE_POOL = 0,
+	HTTP_STATE_CONNECT,
+	HTTP_STATE_HANDSHAKE,
+	HTTP_STATE_WRITE,
+	HTTP_STATE_READ,
+	HTTP_STATE_BACKOFF,	/* waiting to retry, until `deadline` */
+	HTTP_STATE_QUEUE,	/* waiting for a permit of the pool's limits, see http_dequeue() */
+	HTTP_STATE_REPLAY,	/* a captured reply, due at `deadline`, see http_replay() */
+	HTTP_STATE_DONE,
+	HTTP_STATE_ERROR,
+};
+
+/* stats: the phases of a request, the network ones are timed by Http, see http_phase() */
+enum {
+	HTTP_PHASE_DNS = 0,
+	HTTP_PHASE_CONNECT,	/* TCP + TLS handshake, or the checkout of an idle connection */
+	HTTP_PHASE_WRITE,
+	HTTP_PHASE_TTFB,	/* request written -> the first byte of the response */
+	HTTP_PHASE_BODY,
+	HTTP_PHASE_PARSE,	/* JSON + backend, see moetr_print_response() */
+	HTTP_PHASE_RENDER,
+
+	HTTP_PHASES_SIZE,
+};
 
+static const char *const http_phase_str[] = {
+	[HTTP_PHASE_DNS]     = "dns",
+	[HTTP_PHASE_CONNECT] = "connect",
+	[HTTP_PHASE_WRITE]   = "write",
+	[HTTP_PHASE_TTFB]    = "ttfb",
+	[HTTP_PHASE_BODY]    = "body",
+	[HTTP_PHASE_PARSE]   = "parse",
+	[HTTP_PHASE_RENDER]  = "render",
+};
+
+/* of the request, all of its attempts: nanoseconds, total: http_begin() -> the last
+ * http_end(), the rest of it is queueing and backoff
+ */
+typedef struct {
+	int64_t phases[HTTP_PHASES_SIZE];
+	int64_t begin_at;
+	int64_t total;
+	size_t  sent;
+	size_t  received;
+	int     is_reused;	/* the connection of the last attempt */
+	int     attempts;
+} HttpTiming;
+
+struct Http {
+	const Backend *backend;
+	const char    *host;	/* NULL: the backend's, see http_host() */
+	const char    *port;
+	const char    *api_key;
+	int            is_tls;
+	int            is_h2;
+
+	HttpPool *pool;
+	HttpConn *conn;
+	int       state;
+	int       is_reused;
+	int       wake_fd;	/* HTTP_STATE_POOL, no connection: the pool's, see http_pool_get() */
+	int       is_bulk;	/* MOETRANSLATE_BULK: after the others, see http_pool_limit_take() */
+
+	/* HTTP/2: the session, instead of `conn` */
+	H2       *h2;
+	uint32_t  stream_id;
+
+	/* request */
+	Buffer       text;
+	size_t       text_len;
+	Buffer       flat;
 	struct iovec iovs[HTTP_IOVS_SIZE];
-} Http;
+	char         content[128];
+
+	/* the parameters: the request is built again for another backend, see http_route() */
+	int          type;
+	const char  *sl;
+	const char  *tl;
+	const char  *hl;
+	const char  *text_enc;
+	const char  *api_key_enc;	/* "": none */
+	size_t       req_len;
+	size_t       req_written;
+
+	/* response */
+	Buffer buffer;
+	size_t buffer_len;
+	size_t head_len;
+	size_t body_len;
+	size_t content_len;
+	size_t chunk_pos;
+	int    is_chunked;
+	int    is_keep_alive;
+	int    status;
+
+	/* retry: transient failures, see http_end() */
+	int         retries;
+	int         timeout;
+	int         attempt;
+	int         error;
+	const char *error_what;
+	int64_t     deadline;	/* the attempt times out, or the backoff ends, 0: none */
+	int64_t     sent_at;
+	unsigned    seed;
+	size_t      chars;
+	int         has_permit;
+
+	/* circuit breaker: the pool host the attempt is accounted to */
+	HttpPoolHost *breaker;
+	int           is_probe;
+
+	/* router: the endpoint of the attempt, -1: none, has_route: counted in flight */
+	int route;
+	int has_route;
+
+	/* hedging: a duplicate request, when there is no reply after the hedge_pct percentile
+	 * of the recent latencies, the first reply wins, see http_hedge_settle()
+	 */
+	int      hedge_pct;
+	int64_t  hedge_at;
+	int      is_hedged;	/* the hedge is in flight */
+	Http    *hedge;
+	Http    *parent;	/* of a hedge */
+
+	/* stats: the current phase started at `phase_at` */
+	HttpTiming timing;
+	int64_t    phase_at;
+
+	/* trace: the track, the request (a hedge: its parent's), queue or backoff since `wait_at` */
+	unsigned      lane;
+	unsigned long req_id;
+	int64_t       wait_at;
+};
 
-static int         http_init(Http *h);
+static int         http_init(Http *h, HttpPool *pool);
 static void        http_deinit(Http *h);
+static const char *http_host(const Http *h);
+/* NULL: the backend's port of the scheme */
+static const char *http_port(const Http *h);
+
+/* HTTP/2 is off for a backend that sends a request body */
+static int         http_is_h2(const Http *h);
+static void        http_iov_set(Http *h, int idx, const char str[], size_t len);
+
+/* into h->text: `plain`, then h->api_key after it (h->api_key_enc), ret: NULL -> failed */
 static const char *http_url_encode(Http *h, const char plain[]);
+
+/* `dst`: (len * 3) + 1 bytes, NUL terminated, ret: the length */
+static size_t      http_url_encode_to(char dst[], const char plain[], size_t len);
+
+/* blocking request: http_begin() + http_poll_step() until done */
 static int         http_request(Http *h, int type, const char sl[], const char tl[],
 							    const char hl[], const char text[]);
+
+/* the backend's request, the Host header, and the body's headers */
 static void        http_build_request(Http *h, int type, const char sl[], const char tl[],
 									  const char hl[], const char text[], size_t text_len);
+
+/* non-blocking request state machine
+ * http_begin(): ret: -1 -> failed, 0 -> started
+ * http_step():  drives the request, call it when http_events() are ready on http_fd(),
+ *               when the state is HTTP_STATE_POOL, or when http_timeout() has expired,
+ *               see http_poll_step(): the same for the request and its hedge
+ */
+static int         http_begin(Http *h, int type, const char sl[], const char tl[], const char hl[],
+			      const char text[]);
+
+/* a new attempt of the built request */
+static void        http_attempt(Http *h);
+
+/* the router's endpoint for the attempt, another one than exclude if there is one
+ * ret: -1 -> none is able to do the request */
+static int         http_route(Http *h, int exclude);
+
+/* starts the attempt when the pool's limits allow it, otherwise it stays queued */
+static void        http_dequeue(Http *h, int is_waiting);
+
+/* the attempt has ended: its result goes to the pool's limits and circuit breaker */
+static void        http_attempt_done(Http *h);
+static void        http_step(Http *h, short revents);
+static int         http_fd(const Http *h);
+static short       http_events(const Http *h);
+static int         http_is_done(const Http *h);
+
+/* a request and its hedge: HTTP_POLLFDS pollfds, the unused ones have fd -1
+ * http_poll_set():  ret: 1 -> one of them is in HTTP_STATE_POOL, not parked on the pool's
+ *                   eventfd (to be sent again), don't wait on poll() for it
+ * http_poll_step(): steps the ones with revents, in HTTP_STATE_POOL, or with an expired timer
+ */
+enum { HTTP_POLLFDS = 2 };
+static int         http_poll_set(const Http *h, struct pollfd pfds[HTTP_POLLFDS]);
+static void        http_poll_step(Http *h, const struct pollfd pfds[HTTP_POLLFDS]);
+static void        http_acquire(Http *h, int is_waiting);
+static void        http_release(Http *h, int is_reusable);
+
+#define HTTP_CAPTURE_MAGIC "moetranslate-capture-1"
+
+/* capture: "DIR/KEY.http": "HTTP_CAPTURE_MAGIC REQ_LEN RES_LEN LATENCY_NS\n", the request (in
+ * HTTP/1.1 form) and the response (the head and the decoded body)
+ * KEY: the backend, the method, the path and the body, not the host nor the headers, a
+ * capture is valid for any endpoint of the backend
+ */
+static int         http_capture_path(const Http *h, const char dir[], char buffer[], size_t size);
+static void        http_capture_save(const Http *h, int64_t latency);
+
+/* ret: the recorded latency, -1 -> none (errno: ENOENT) or invalid */
+static int64_t     http_capture_load(Http *h);
+
+/* instead of the network: HTTP_STATE_DONE, or HTTP_STATE_REPLAY until the recorded latency */
+static void        http_replay(Http *h);
+
+/* the current phase ends: its time is added to `phase`, the next one starts */
+static void        http_phase(Http *h, int phase);
+
+/* a span on the track of `h`, if tracing */
+static void        http_trace(const Http *h, const char name[], int64_t start, int64_t end,
+			      const char val_name[], long val);
+static void        http_fail(Http *h, const char what[]);
+
+/* state: HTTP_STATE_DONE or HTTP_STATE_ERROR, or HTTP_STATE_BACKOFF when it is retryable */
+static void        http_end(Http *h, int state);
+static int         http_is_retryable(const Http *h);
+
+/* stops the request, its result is dropped */
+static void        http_cancel(Http *h);
+static void        http_hedge_start(Http *h);
+
+/* the request or its hedge has ended: the first reply wins, the other one is cancelled */
+static void        http_hedge_settle(Http *h);
+
+/* milliseconds, -1: don't retry */
+static int64_t     http_retry_delay(Http *h);
+
+/* milliseconds until http_step() has to be called without events, -1: no timer */
+static int         http_timeout(const Http *h);
+static int         http_parse_head(Http *h);
+
+/* the response status code, 0: invalid */
+static int         http_status(const Http *h);
+
+/* the value of a response header field, terminated by "\r\n", NULL: not found */
+static const char *http_head_field(const Http *h, const char name[]);
+
+/* Retry-After: delay-seconds or an HTTP-date, ret: milliseconds, -1: invalid */
+static int64_t     http_retry_after(const char val[]);
+
+/* ret: -1 -> malformed, 0 -> incomplete, 1 -> complete */
+static int         http_chunked_scan(Http *h);
+static void        http_chunked_decode(Http *h);
 /* Don't free() the returned memory! */
 static char *http_response_get_json(Http *h, size_t *ret_len);
 
 
+/*
+ * Alloc: allocation accounting (make WITH_ALLOC_STATS=1), the allocator entry points are
+ * wrapped (-Wl,--wrap), each allocation is charged to the subsystem and the request phase
+ * the calling thread is in, see ALLOC_SUB_BEGIN() and ALLOC_PHASE()
+ */
+enum {
+	ALLOC_SUB_OTHER = 0,
+	ALLOC_SUB_BUFFER,	/* buffer_init(), buffer_check() */
+	ALLOC_SUB_JSON,		/* the DOM of json_parse() */
+	ALLOC_SUB_HTTP,		/* connections, hedges, HTTP/2 sessions, batch slots */
+	ALLOC_SUB_HPACK,
+	ALLOC_SUB_TRACE,
+
+	ALLOC_SUBS_SIZE,
+};
+
+#ifdef WITH_ALLOC_STATS
+	#define ALLOC_SUB_BEGIN(SUB) const int alloc_sub_ = alloc_sub_set(SUB)
+	#define ALLOC_SUB_END()      alloc_sub_set(alloc_sub_)
+	#define ALLOC_PHASE(PHASE)   alloc_phase_set(PHASE)
+#else
+	#define ALLOC_SUB_BEGIN(SUB) ((void)0)
+	#define ALLOC_SUB_END()      ((void)0)
+	#define ALLOC_PHASE(PHASE)   ((void)0)
+#endif
+
+static const char *const alloc_sub_str[] = {
+	[ALLOC_SUB_OTHER]  = "other",
+	[ALLOC_SUB_BUFFER] = "buffer",
+	[ALLOC_SUB_JSON]   = "json",
+	[ALLOC_SUB_HTTP]   = "http",
+	[ALLOC_SUB_HPACK]  = "hpack",
+	[ALLOC_SUB_TRACE]  = "trace",
+};
+
+typedef struct {
+	unsigned long      allocs;
+	unsigned long long bytes;
+	size_t             live;
+	size_t             peak;	/* high-water mark of `live` */
+} AllocCounter;
+
+/* phases: HTTP_PHASE_*, and HTTP_PHASES_SIZE: outside of a request */
+typedef struct {
+	AllocCounter  total;
+	AllocCounter  subs[ALLOC_SUBS_SIZE];
+	AllocCounter  phases[HTTP_PHASES_SIZE + 1];
+	unsigned long untracked;	/* the table was full: not in `live` */
+} AllocStats;
+
+#ifdef WITH_ALLOC_STATS
+/* ret: the previous one */
+static int   alloc_sub_set(int sub);
+static void  alloc_phase_set(int phase);
+
+/* the live allocations: pointer -> size and subsystem, for free() and realloc() */
+static void  alloc_add(void *ptr, size_t size, int sub, int phase);
+
+/* ret: -1 -> not ours, its size: `size` */
+static int   alloc_del(void *ptr, size_t *size);
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void  __real_free(void *ptr);
+void *__wrap_malloc(size_t size);
+void *__wrap_calloc(size_t nmemb, size_t size);
+void *__wrap_realloc(void *ptr, size_t size);
+void  __wrap_free(void *ptr);
+#endif
+
+/* a copy, all zeroes without WITH_ALLOC_STATS */
+static void  alloc_get_stats(AllocStats *s);
+
+
+/*
+ * Http2: one multiplexed connection per pool host (h2c: prior knowledge, h2: TLS + ALPN),
+ *        the Http requests are its streams, their responses are stored as HTTP/1.1 ones:
+ *        "HTTP/2 STATUS\r\n" + header lines + "\r\n" + body
+ */
+enum {
+	H2_FRAME_DATA = 0,
+	H2_FRAME_HEADERS,
+	H2_FRAME_PRIORITY,
+	H2_FRAME_RST_STREAM,
+	H2_FRAME_SETTINGS,
+	H2_FRAME_PUSH_PROMISE,
+	H2_FRAME_PING,
+	H2_FRAME_GOAWAY,
+	H2_FRAME_WINDOW_UPDATE,
+	H2_FRAME_CONTINUATION,
+};
+
+enum {
+	H2_FLAG_ACK         = 0x01,
+	H2_FLAG_END_STREAM  = 0x01,
+	H2_FLAG_END_HEADERS = 0x04,
+	H2_FLAG_PADDED      = 0x08,
+	H2_FLAG_PRIORITY    = 0x20,
+};
+
+enum {
+	H2_SETTINGS_HEADER_TABLE_SIZE      = 1,
+	H2_SETTINGS_ENABLE_PUSH            = 2,
+	H2_SETTINGS_MAX_CONCURRENT_STREAMS = 3,
+	H2_SETTINGS_INITIAL_WINDOW_SIZE    = 4,
+	H2_SETTINGS_MAX_FRAME_SIZE         = 5,
+};
+
+enum {
+	H2_ERR_NONE           = 0,
+	H2_ERR_PROTOCOL       = 1,
+	H2_ERR_FLOW_CONTROL   = 3,
+	H2_ERR_FRAME_SIZE     = 6,
+	H2_ERR_REFUSED_STREAM = 7,
+	H2_ERR_CANCEL         = 8,
+	H2_ERR_COMPRESSION    = 9,
+};
+
+enum {
+	H2_FRAME_HEAD_SIZE     = 9,
+	/* SETTINGS_MAX_FRAME_SIZE: the default, we never raise it */
+	H2_FRAME_SIZE          = 16384,
+	H2_WINDOW_SIZE_DEFAULT = 65535,
+	H2_WINDOW_SIZE_MAX     = 0x7fffffff,
+	/* the connection receive window, topped up when half of it is used */
+	H2_WINDOW_SIZE         = (1 << 30),
+	H2_STREAM_ID_MAX       = 0x7fffffff,
+};
+
+enum {
+	H2_STATE_IDLE = 0,	/* no connection */
+	H2_STATE_CONNECT,
+	H2_STATE_HANDSHAKE,
+	H2_STATE_OPEN,
+};
+
+enum {
+	H2_ENC_NONE = 0,	/* the fixed headers are not in the peer's table (yet) */
+	H2_ENC_INDEXED,
+	H2_ENC_OFF,
+};
+
+typedef struct {
+	const char *name;
+	size_t      name_len;
+	const char *value;
+	size_t      value_len;
+	unsigned    idx;
+} H2Header;
+
+struct H2 {
+	HttpPool     *pool;
+	HttpPoolHost *host;
+	HttpConn     *conn;
+	int           state;
+	int           is_reused;
+	int           is_goaway;
+	int           is_refused;
+	uint32_t      next_id;
+	uint32_t      goaway_id;
+	uint32_t      peer_streams_max;
+	uint32_t      recv_unacked;
+
+	Http     *streams[CONFIG_HTTP2_STREAMS_MAX];
+	unsigned  streams_len;
+
+	Buffer out;
+	size_t out_len;
+	size_t out_sent;
+	Buffer in;
+	size_t in_len;
+
+	/* HEADERS + CONTINUATION */
+	Buffer   block;
+	size_t   block_len;
+	uint32_t block_id;
+	int      is_block_end;
+
+	/* response heads: decoder, the request: encoder */
+	HpackTable dec;
+	Buffer     head;
+	Buffer     scratch;
+	int        enc_state;
+	size_t     enc_size;
+	size_t     enc_size_max;
+	int        is_enc_resize;
+
+	/* CONFIG_HTTP_HEADER: the same on every request, the names in lower case */
+	char     hdrs_buf[sizeof(CONFIG_HTTP_HEADER)];
+	H2Header hdrs[16];
+	unsigned hdrs_len;
+};
+
+static uint32_t h2_get_u32(const unsigned char p[]);
+static void     h2_put_u32(unsigned char p[], uint32_t val);
+
+static H2   *h2_new(HttpPool *p, HttpPoolHost *host);
+static void  h2_free(H2 *s);
+static int   h2_is_connected(const H2 *s);
+/* wake_fd: see http_pool_get() */
+static int   h2_connect(H2 *s, int *wake_fd);
+
+/* what: the reason (NULL: graceful), the streams are failed, or retried on a new connection */
+static void  h2_close(H2 *s, const char what[]);
+static int   h2_fd(const H2 *s);
+static short h2_events(const H2 *s);
+static void  h2_step(H2 *s, short revents);
+
+/* h2c: always 1 */
+static int   h2_is_alpn_h2(const H2 *s);
+
+/* ret: -1 + errno == EAGAIN          -> no stream available, try again later
+ *      -1 + errno == EPROTONOSUPPORT -> the server speaks HTTP/1.1 only (ALPN)
+ */
+static int   h2_stream_open(H2 *s, Http *h);
+
+/* state: HTTP_STATE_POOL: sent again right away, otherwise see http_end() */
+static void  h2_stream_end(H2 *s, Http *h, int state);
+static void  h2_stream_done(H2 *s, Http *h);
+static void  h2_stream_cancel(H2 *s, Http *h);
+static Http *h2_stream_find(const H2 *s, uint32_t id);
+
+static int   h2_preface(H2 *s);
+
+/* also flushes, best effort */
+static int   h2_goaway(H2 *s, uint32_t code);
+static int   h2_frame_write(H2 *s, unsigned type, unsigned flags, uint32_t id, const void *payload,
+			    size_t len);
+static int   h2_headers_write(H2 *s, Http *h, uint32_t id);
+static int   h2_flush(H2 *s);
+static int   h2_recv(H2 *s);
+static int   h2_frame(H2 *s, unsigned type, unsigned flags, uint32_t id, const unsigned char *payload,
+		      size_t len);
+static int   h2_headers_done(H2 *s);
+
+
 /*
  * Json
  */
@@ -165,6 +1230,7 @@ static json_value_t  *json_array_index(json_array_t *arr, size_t index);
 static json_array_t  *json_value_as_array_wrp(json_value_t *val);
 static json_string_t *json_value_as_string_wrp(json_value_t *val);
 static size_t         json_array_fills(json_value_t *values[], size_t size, json_array_t *arr);
+static json_value_t  *json_object_get(json_value_t *val, const char name[]);
 
 
 /*
@@ -189,63 +1255,505 @@ enum {
 	MOETR_INTR_CODE_CHANGE_RESTYPE,
 	MOETR_INTR_CODE_LANG_LIST,
 	MOETR_INTR_CODE_HELP,
+	MOETR_INTR_CODE_STATS,
 	MOETR_INTR_CODE_QUIT,
 	MOETR_INTR_CODE_INVAL,
 };
 
+/* stats: log2 buckets of the microseconds */
+typedef struct {
+	unsigned long count;
+	int64_t       sum;
+	int64_t       max;
+	unsigned long buckets[CONFIG_STATS_BUCKETS];
+} MoeTrHist;
+
+typedef struct {
+	MoeTrHist          phases[HTTP_PHASES_SIZE];
+	MoeTrHist          total;
+	unsigned long      requests;
+	unsigned long      failed;
+	unsigned long      reused;
+	unsigned long long sent;
+	unsigned long long received;
+} MoeTrStats;
+
 typedef struct {
 	int         result_type;
 	const Lang *langs[2];
-	char        prompt[64];
+	char        prompt[128];
+	HttpPool    pool;
 	Http        http;
+	Result      result;
+	const char *backend;
+	const char *endpoints;
+	int         is_stats;
+	MoeTrStats  stats;
+	json_value_t *json;	/* of the last response: the strings of `result` point into it */
 } MoeTr;
 
 static int  moetr_init(MoeTr *m, char default_result_type, const Lang *default_langs[2]);
 static void moetr_deinit(MoeTr *m);
+
+/* another request on the pool of `m`, with the settings of m->http: batch mode, async */
+static int  moetr_http_init(MoeTr *m, Http *h);
 static int  moetr_set_langs(MoeTr *m, const char keys[]);
 static int  moetr_set_result_type(MoeTr *m, int type);
-static void moetr_print_simple(json_value_t *json);
-static void moetr_print_detail_synonyms(const json_array_t *synonyms_a);
-static void moetr_print_detail_defs(const json_array_t *defs_a);
-static void moetr_print_detail_examples(json_array_t *examples_a);
-static void moetr_print_detail(const MoeTr *m, json_value_t *json, const char src_text[]);
-static void moetr_print_detect_lang(json_value_t *json);
-static int  moetr_translate(MoeTr *m, const char text[]);
+
+/* runtime tunables: "NAME=VALUE", "help" shows the list */
+static int  moetr_set_opt(MoeTr *m, const char opt[]);
+
+/* "google", "libre" */
+static int  moetr_set_backend(MoeTr *m, const char name[]);
+
+/* the router's endpoints: "[BACKEND@]HOST[:PORT],..." */
+static int  moetr_set_endpoints(MoeTr *m, const char list[]);
+static void moetr_print_simple(const Result *res, FILE *out);
+static void moetr_print_detail_synonyms(const json_array_t *synonyms_a, FILE *out);
+static void moetr_print_detail_defs(const json_array_t *defs_a, FILE *out);
+static void moetr_print_detail_examples(json_array_t *examples_a, FILE *out);
+static void moetr_print_detail(const MoeTr *m, const Result *res, const char src_text[], FILE *out);
+static void moetr_print_detect_lang(const Result *res, FILE *out);
+
+/* the backend of `h` parses the response into m->result, rendered to `out`, the request is
+ * added to m->stats
+ */
+static int  moetr_print_response(MoeTr *m, Http *h, const char text[], FILE *out);
+static int  moetr_translate(MoeTr *m, const char text[], FILE *out);
+static void moetr_stats_add(MoeTr *m, const HttpTiming *t);
+static void moetr_stats_hist_add(MoeTrHist *hist, int64_t ns);
+
+/* the front end: the command line, batch and interactive modes */
+#ifndef MOETR_LIB
+/* ret: nanoseconds, the upper bound of the bucket */
+static int64_t moetr_stats_hist_pct(const MoeTrHist *hist, double pct);
+
+/* one request: the phases, the bytes and the connection */
+static void moetr_stats_print_request(const HttpTiming *t);
+
+/* the session: a line per phase, and the histogram of the totals */
+static void moetr_stats_print(const MoeTr *m, FILE *out);
+
+/* the peak RSS, and with WITH_ALLOC_STATS: the allocations per phase and subsystem */
+static void moetr_stats_print_alloc(const MoeTr *m, FILE *out);
+static void moetr_batch(MoeTr *m, FILE *input, unsigned concurrency);
 static void moetr_interactive_banner(const MoeTr *m);
 static void moetr_interactive_help(void);
 static int  moetr_interactive_parse(char *cmd[]);
 static void moetr_interactive_set_prompt(MoeTr *m);
+
+/* a connection to the default host, or to the router's best endpoint */
+static void moetr_interactive_prewarm(MoeTr *m);
 static void moetr_interactive(MoeTr *m, const char text[]);
 static void moetr_help(const char name[]);
 static void moetr_load_default_opts(char *type, const Lang *langs[2]);
+#endif
 
 
-/********************************************************************************
- *                                    IMPL                                      *
- ********************************************************************************/
 /*
- * cstr
+ * Lib: libmoetranslate, moetranslate.h over MoeTr, the front end is built on it too
  */
-static size_t
-cstr_trim_right(const char cstr[], size_t len)
-{
-	if ((len == 0) || ((len == 1) && (isspace(cstr[0]))))
-		return 0;
+/* async: a worker thread drives up to CONFIG_ASYNC_CONCURRENCY requests with the state machine
+ * of Http, the others wait in `pending`; the finished ones are queued in `done`, and signaled
+ * on `fd`
+ */
+typedef struct MoeTrAsyncReq {
+	unsigned long         id;
+	void                 *udata;
+	int                   type;
+	int                   is_bulk;	/* MOETRANSLATE_BULK */
+	const Lang           *langs[2];
+	char                 *text;
+	int64_t               deadline;	/* 0: none */
+	int                   is_cancelled;
+	MoeTranslateResult    result;
+	struct MoeTrAsyncReq *next;
+} MoeTrAsyncReq;
 
-	const char *p = cstr + (len - 1);
-	while ((*p != '\0') && (p > cstr) && (isspace(*p)))
-		p--;
+typedef struct {
+	Http           http;
+	MoeTrAsyncReq *req;	/* NULL: free */
+	int            is_begun;
+} MoeTrAsyncSlot;
 
-	return (p - cstr) + 1;
-}
+typedef struct {
+	pthread_t       worker;
+	pthread_mutex_t mutex;	/* the queues, the requests of the slots, is_stopping */
+	int             fd;	/* eventfd: the completions */
+	int             wake_fd;	/* eventfd: the worker, a new request or a cancellation */
+	int             is_stopping;
+	unsigned long   ids;
+	MoeTrAsyncReq  *pending;
+	MoeTrAsyncReq **pending_tail;
+	int64_t         pending_deadline;	/* the nearest one of `pending`, 0: none */
+	MoeTrAsyncReq  *done;
+	MoeTrAsyncReq **done_tail;
+	MoeTrAsyncSlot  slots[CONFIG_ASYNC_CONCURRENCY];
+	unsigned        slots_len;
+} MoeTrAsync;
+
+struct MoeTranslate {
+	MoeTr           moe;
+	pthread_mutex_t lock;	/* `moe`, its connections: one thread drives them at a time */
+	MoeTrAsync     *async;	/* NULL: not used yet */
+	char          **opts;	/* the strings of "NAME=VALUE": MoeTr keeps pointers into them */
+	size_t          opts_len;
+	char            error[512];
+};
 
+/* LOG_ERR(), LOG_ERRNO(): the last error of the thread, the engine doesn't know the context */
+static void moetr_error_set(int is_errno, const char fmt[], ...);
 
-static const char *
-cstr_trim_left(const char cstr[], size_t *len)
-{
-	const size_t _len = *len;
-	if (_len == 0)
-		return cstr;
+/* the response of `h`: rendered and copied to `res`, with m->lock */
+static int  moetr_result_render(MoeTranslate *m, Http *h, int type, const Lang *langs[2],
+				const char text[], MoeTranslateResult *res);
+
+/* "sl", "tl": the keys, ret: -1 -> invalid */
+static int  moetr_langs_get(const char sl[], const char tl[], const Lang *langs[2]);
+
+/* the strings of `result` are copied, ret: -1 -> failed to allocate */
+static int  moetr_result_copy(MoeTranslateResult *res, const Result *result, int type);
+
+/* started on the first use: the worker and its slots, ret: NULL -> failed */
+static MoeTrAsync *moetr_async_get(MoeTranslate *m);
+static void        moetr_async_free(MoeTranslate *m);
+static void       *moetr_async_thrd(void *udata);
+
+/* `r` is done: error, or the response of `h` (NULL: none), the slot is freed by the caller */
+static void        moetr_async_finish(MoeTranslate *m, MoeTrAsyncReq *r, Http *h,
+				      const char error[]);
+
+/* with a->mutex: the pending requests go to the free slots, in order, the expired ones are
+ * finished; a->pending_deadline is updated
+ */
+static void        moetr_async_dispatch(MoeTrAsync *a, int64_t now);
+
+/* with a->mutex: `r` is queued in `done`, and signaled */
+static void        moetr_async_done(MoeTrAsync *a, MoeTrAsyncReq *r);
+static void        moetr_async_req_free(MoeTrAsyncReq *r);
+static void        moetr_async_signal(int fd);
+
+
+/* the front end: the daemon */
+#ifndef MOETR_LIB
+/*
+ * Cache: the results of the daemon, by request, the least recently used ones are evicted
+ */
+typedef struct CacheEntry {
+	struct CacheEntry *next;	/* of the bucket */
+	struct CacheEntry *lru_prev;
+	struct CacheEntry *lru_next;
+	uint64_t           hash;
+	int64_t            expires;
+	MoeTranslateResult result;
+	size_t             key_len;
+	char               key[];
+} CacheEntry;
+
+typedef struct {
+	CacheEntry  **buckets;
+	size_t        buckets_len;	/* a power of 2 */
+	CacheEntry   *lru_head;	/* the most recent one */
+	CacheEntry   *lru_tail;
+	size_t        len;
+	size_t        size;		/* max entries, 0: off */
+	int64_t       ttl;		/* nanoseconds */
+	unsigned long hits;
+	unsigned long misses;
+	unsigned long evictions;
+} Cache;
+
+static int       cache_init(Cache *c, size_t size, int64_t ttl);
+static void      cache_deinit(Cache *c);
+
+/* FNV-1a */
+static uint64_t  cache_hash(const char key[], size_t len);
+
+/* ret: NULL -> not found, or expired */
+static const MoeTranslateResult *cache_get(Cache *c, const char key[], size_t len, uint64_t hash);
+
+/* `res` is moved into the cache, ret: -1 -> not cached, it's still the caller's */
+static int       cache_put(Cache *c, const char key[], size_t len, uint64_t hash,
+			   MoeTranslateResult *res);
+static void      cache_remove(Cache *c, CacheEntry *e);
+
+/* the head of the LRU list: the most recent one */
+static void      cache_lru_push(Cache *c, CacheEntry *e);
+static void      cache_lru_unlink(Cache *c, CacheEntry *e);
+
+
+/*
+ * Server: the daemon (--daemon) and the gateway (--serve), an epoll loop over the listening
+ * sockets, the clients, and the completions of the async API
+ *
+ * The protocol of the daemon's socket, native byte order, `len`: of the whole message
+ * request : u32 len | u32 id | u8 version | u8 type | u8 sl_len | u8 tl_len | sl | tl | text
+ * response: u32 len | u32 id | u8 status | payload: the output, or the error
+ *
+ * The gateway: HTTP/1.1, keep-alive and pipelining, JSON bodies
+ * POST /translate {"text": "...", "sl": "en", "tl": "id", "type": "simple" | "detail"}
+ * POST /detect    {"text": "..."}
+ * POST /batch     {"texts": ["...", ...], "sl": ..., "tl": ..., "type": ...}
+ * GET  /stats
+ * sl, tl, type: the defaults of the daemon when missing
+ * "priority": "interactive" | "bulk", "deadline": milliseconds, "weight": the scheduler below
+ *
+ * The scheduler: a request waits in the queue of its connection and class until a slot of the
+ * async API is free; the interactive class (the daemon's, /translate and /detect) goes first,
+ * the bulk one (/batch) is kept out of some of the slots; in a class, the connections are
+ * served by weighted fair queuing (self-clocked: the smallest virtual finish time first). The
+ * expired requests are dropped before they are sent.
+ *
+ * Single-flight: a request like one in flight (the key of the cache) doesn't go upstream, it
+ * waits on that one, and all of them get its result, or its error; only the first one is cached.
+ */
+enum {
+	SERVER_MSG_VERSION = 1,
+	SERVER_MSG_REQ_HDR = 12,
+	SERVER_MSG_RES_HDR = 9,
+};
+
+enum {
+	SERVER_MSG_STATUS_OK = 0,
+	SERVER_MSG_STATUS_ERR,
+};
+
+enum {
+	SERVER_PROTO_MSG = 0,
+	SERVER_PROTO_HTTP,
+};
+
+enum {
+	SERVER_API_TRANSLATE = 0,
+	SERVER_API_DETECT,
+	SERVER_API_BATCH,
+	SERVER_API_NONE,	/* a reply without texts: an error, the stats */
+};
+
+enum {
+	SERVER_PRIO_INTERACTIVE = 0,
+	SERVER_PRIO_BULK,
+	SERVER_PRIO_SIZE,
+};
+
+/* the virtual time of a request of weight 1 */
+#define SERVER_SCHED_COST (1u << 20)
+
+/* epoll_event.data.u64: the generation and the index of a client, or one of these */
+#define SERVER_EV_LISTEN (UINT64_MAX)
+#define SERVER_EV_HTTP   (UINT64_MAX - 1)
+#define SERVER_EV_ASYNC  (UINT64_MAX - 2)
+
+typedef struct {
+	char   *json;
+	size_t  len;
+} ServerHttpItem;
+
+/* an HTTP request: replied in order, once all of its texts are done */
+typedef struct ServerHttpReq {
+	struct ServerHttpReq *next;
+	int                   api;
+	int                   status;
+	int                   is_keep_alive;
+	size_t                items_len;
+	size_t                items_left;
+	ServerHttpItem        items[];	/* SERVER_API_NONE: the body */
+} ServerHttpReq;
+
+struct ServerTag;
+
+/* the queue of a connection in a class */
+typedef struct {
+	struct ServerTag  *head;
+	struct ServerTag **tail;
+	uint64_t           finish;	/* virtual, of the last queued one */
+	unsigned           weight;
+} ServerFlow;
+
+typedef struct {
+	int             fd;		/* -1: free */
+	int             proto;
+	uint32_t        gen;		/* of the slot: the replies to a previous client are dropped */
+	int             is_writing;	/* EPOLLOUT: `out` is not flushed */
+	int             is_closing;	/* no more requests: closed when the replies are flushed */
+	int             is_continued;	/* HTTP: "100 Continue" sent for the current request */
+	int64_t         active;		/* the last read */
+	Buffer          in;
+	size_t          in_len;
+	Buffer          out;
+	size_t          out_len;
+	size_t          out_off;
+	ServerHttpReq  *reqs;
+	ServerHttpReq **reqs_tail;
+	ServerFlow      flows[SERVER_PRIO_SIZE];
+} ServerClient;
+
+/* a request: where the reply goes, when, and its cache key; queued in its flow, then the udata
+ * of the submitted one
+ */
+typedef struct ServerTag {
+	struct ServerTag *prev;	/* in flight */
+	struct ServerTag *next;	/* in flight, the queue of its flow, or the waiters */
+	struct ServerTag *waiters;	/* in flight: the same requests, coalesced */
+	uint32_t          client;
+	uint32_t          gen;
+	uint32_t          id;	/* the message */
+	ServerHttpReq    *req;	/* HTTP: its item */
+	size_t            item;
+	int               prio;
+	int64_t           deadline;	/* 0: none */
+	uint64_t          finish;	/* virtual */
+	uint64_t          hash;
+	size_t            key_len;
+	char              key[];	/* type, sl, tl, text: NUL separated */
+} ServerTag;
+
+typedef struct {
+	MoeTranslate      *ctx;
+	int                epfd;
+	int                listen_fd;	/* -1: no daemon */
+	int                http_fd;	/* -1: no gateway */
+	struct sockaddr_un addr;
+	Cache              cache;
+	ServerClient      *clients;	/* CONFIG_DAEMON_CLIENTS_MAX */
+	ServerTag         *inflight;
+	unsigned           running[SERVER_PRIO_SIZE];	/* in flight */
+	unsigned           queued[SERVER_PRIO_SIZE];
+	uint64_t           vtime[SERVER_PRIO_SIZE];	/* the finish time of the last sent one */
+	int64_t            expired;	/* the last look for idle HTTP clients, expired requests */
+	unsigned long      requests;
+	unsigned long      http_requests;
+	unsigned long      errors;
+	unsigned long      refused;
+	unsigned long      dropped;	/* expired in a queue */
+	unsigned long      coalesced;	/* answered by one in flight */
+} Server;
+
+/* the socket: CONFIG_DAEMON_SOCKET, or in $XDG_RUNTIME_DIR, or in a directory of /tmp
+ * private to the user (created with is_daemon), ret: -1 -> too long, or not private (errno)
+ */
+static int  server_addr(struct sockaddr_un *addr, int is_daemon);
+
+/* ret: -1 -> failed, or the peer is another user */
+static int  server_connect(const struct sockaddr_un *addr);
+
+/* "ADDR:PORT", "[ADDR]:PORT", ":PORT": any address, ret: the socket, -1 -> failed */
+static int  server_listen_tcp(const char addr[]);
+
+/* is_daemon: the Unix socket, serve: the address of the gateway, NULL: none
+ * ret: -1 -> failed, a daemon is running already
+ */
+static int  server_init(Server *s, MoeTranslate *ctx, int is_daemon, const char serve[]);
+static void server_deinit(Server *s);
+
+/* until SIGINT or SIGTERM, ret: -1 -> failed to start */
+static int  server_run(MoeTranslate *ctx, int is_daemon, const char serve[]);
+static void server_on_signal(int sig);
+static void server_accept(Server *s, int fd, int proto);
+static void server_close(Server *s, ServerClient *c);
+
+/* every second: the keep-alive HTTP clients idle for CONFIG_SERVE_IDLE_TIMEOUT, the expired
+ * requests of the queues, and the coalesced ones
+ */
+static void server_expire(Server *s, int64_t now);
+
+/* ret: -1 -> the client is gone, or broke the protocol: closed by the caller */
+static int  server_read(Server *s, ServerClient *c);
+
+/* a request at the start of `buf`, ret: its size, 0 -> incomplete, -1 -> as above */
+static long server_on_msg(Server *s, ServerClient *c, const char buf[], size_t len);
+static long server_on_http(Server *s, ServerClient *c, const char buf[], size_t len);
+
+/* the complete HTTP request, ret: -1 -> as above */
+static int  server_http_request(Server *s, ServerClient *c, const char method[],
+				const char path[], const char body[], size_t body_len,
+				int is_keep_alive);
+
+/* a reply without texts, `body`: JSON, or an error message, in order with the others */
+static int  server_http_status(Server *s, ServerClient *c, int status, int is_keep_alive,
+			       const char body[]);
+static ServerHttpReq *server_http_req_new(ServerClient *c, int api, size_t items_len,
+					  int is_keep_alive);
+static void server_http_req_free(ServerHttpReq *r);
+
+/* the complete ones at the head of c->reqs, ret: -1 -> as above */
+static int  server_http_reply(Server *s, ServerClient *c);
+static const char *server_http_reason(int status);
+static int  server_http_item(ServerHttpItem *item, int api, const MoeTranslateResult *res);
+static void server_json_str(FILE *out, const char str[]);
+
+/* from the cache, or queued: `w`, where it goes (id, req and item), when (prio and deadline)
+ * ret: -1 -> as above
+ */
+static int  server_submit(Server *s, ServerClient *c, const ServerTag *w, int type,
+			  const char sl[], size_t sl_len, const char tl[], size_t tl_len,
+			  const char text[], size_t text_len);
+
+/* the queued ones to the free slots, after the events: the deliveries may close the clients */
+static void server_dispatch(Server *s, int64_t now);
+
+/* the one in flight with the key of `t`, NULL: none */
+static ServerTag *server_flight_get(Server *s, const ServerTag *t);
+
+/* the head of the queues of `prio` with the smallest finish time, NULL: none */
+static ServerFlow *server_sched_pick(Server *s, int prio);
+
+/* to the queue of its flow */
+static void server_sched_push(Server *s, ServerClient *c, ServerTag *t);
+
+/* the request is delivered the error, and freed */
+static void server_sched_drop(Server *s, ServerTag *t, const char error[]);
+
+/* the request is delivered `res`, when its client is still there, and freed */
+static void server_sched_done(Server *s, ServerTag *t, const MoeTranslateResult *res);
+static int  server_deliver(Server *s, ServerClient *c, const ServerTag *t,
+			   const MoeTranslateResult *res);
+static int  server_reply(Server *s, ServerClient *c, uint32_t id, int status, const char payload[],
+			 size_t len);
+static int  server_flush(Server *s, ServerClient *c);
+
+/* the completions: delivered to the request and its waiters, and cached */
+static void server_drain(Server *s);
+
+/* the client side: the request of a one-shot invocation, the reply is printed
+ * ret: -1 -> no daemon, or no reply: the caller goes direct
+ *       0 -> the output
+ *       1 -> the error
+ */
+static int  server_forward(const MoeTr *m, const char text[]);
+
+/* blocking, ret: -1 -> failed, or the peer is gone */
+static int  server_send_all(int fd, const char buf[], size_t len);
+static int  server_recv_all(int fd, char buf[], size_t len);
+#endif
+
+
+/********************************************************************************
+ *                                    IMPL                                      *
+ ********************************************************************************/
+/*
+ * cstr
+ */
+static size_t
+cstr_trim_right(const char cstr[], size_t len)
+{
+	if ((len == 0) || ((len == 1) && (isspace(cstr[0]))))
+		return 0;
+
+	const char *p = cstr + (len - 1);
+	while ((*p != '\0') && (p > cstr) && (isspace(*p)))
+		p--;
+
+	return (p - cstr) + 1;
+}
+
+
+static const char *
+cstr_trim_left(const char cstr[], size_t *len)
+{
+	const size_t _len = *len;
+	if (_len == 0)
+		return cstr;
 
 	size_t i = 0;
 	while ((cstr[i] != '\0') && (isspace(cstr[i])))
@@ -264,10 +1772,13 @@ cstr_trim_right_mut(char cstr[])
 		return cstr;
 
 	char *end = cstr + (len - 1);
-	while ((*end != '\0') && (end > cstr) && (isspace(*cstr)))
+	while ((end > cstr) && (isspace(*end)))
 		end--;
 
-	*(end + 1) = '\0';
+	if (isspace(*end))
+		*end = '\0';
+	else
+		*(end + 1) = '\0';
 	return cstr;
 }
 
@@ -336,7 +1847,9 @@ buffer_init(Buffer *b, size_t size)
 		return -1;
 	}
 
+	ALLOC_SUB_BEGIN(ALLOC_SUB_BUFFER);
 	char *const buffer = malloc(size);
+	ALLOC_SUB_END();
 	if (buffer == NULL)
 		return -1;
 
@@ -365,7 +1878,9 @@ buffer_check(Buffer *b, size_t len)
 		return -1;
 	}
 
+	ALLOC_SUB_BEGIN(ALLOC_SUB_BUFFER);
 	char *const new_buffer = realloc(b->ptr, new_size);
+	ALLOC_SUB_END();
 	if (new_buffer == NULL)
 		return -1;
 
@@ -378,6 +1893,7 @@ buffer_check(Buffer *b, size_t len)
 /*
  * Lang
  */
+#ifndef MOETR_LIB
 static void
 lang_show_list(int max_col)
 {
@@ -409,6 +1925,7 @@ lang_show_list(int max_col)
 	if (col != 0)
 		putchar('\n');
 }
+#endif
 
 
 static const Lang *
@@ -485,845 +2002,6213 @@ out0:
 
 
 /*
- * Net
+ * Time
  */
-static int
-net_tcp_connect(const char host[], const char port[])
+static int64_t
+time_now_ns(void)
 {
-	int fd, ret;
-	struct addrinfo *ai, *p = NULL;
-	struct addrinfo hints = {
-		.ai_family   = AF_UNSPEC,
-		.ai_socktype = SOCK_STREAM,
-	};
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((int64_t)ts.tv_sec * 1000000000) + ts.tv_nsec;
+}
 
 
-	ret = getaddrinfo(host, port, &hints, &ai);
-	if (ret != 0) {
-		fprintf(stderr, COLOR_REGULAR_YELLOW("net_tcp_connect: getaddrinfo: %s") "\n",
-			gai_strerror(ret));
+/*
+ * Trace
+ */
+static int
+trace_init(Trace *t)
+{
+	memset(t, 0, sizeof(*t));
+	t->path = CONFIG_TRACE;
+	t->start = time_now_ns();
+	if (pthread_key_create(&t->key, NULL) != 0) {
+		LOG_ERR(COLOR_REGULAR_YELLOW("trace_init: pthread_key_create: failed") "\n");
 		return -1;
 	}
 
-	for (p = ai; p != NULL; p = p->ai_next) {
-		fd = socket(p->ai_family, p->ai_socktype, p->ai_protocol);
-		if (fd < 0) {
-			perror(COLOR_REGULAR_YELLOW("net_tcp_connect: socket"));
-			continue;
-		}
+	if (pthread_mutex_init(&t->mutex, NULL) != 0) {
+		LOG_ERR(COLOR_REGULAR_YELLOW("trace_init: pthread_mutex_init: failed") "\n");
+		pthread_key_delete(t->key);
+		return -1;
+	}
 
-		if (connect(fd, p->ai_addr, p->ai_addrlen) < 0) {
-			perror(COLOR_REGULAR_YELLOW("net_tcp_connect: connect"));
+	return 0;
+}
 
-			close(fd);
-			continue;
-		}
 
-		break;
+static void
+trace_deinit(Trace *t)
+{
+	if (trace_is_on(t) && (t->rings != NULL)) {
+		FILE *const file = fopen(t->path, "w");
+		if (file == NULL) {
+			LOG_ERRNO(COLOR_REGULAR_YELLOW("trace_deinit: fopen"));
+		} else if ((trace_write(t, file) < 0) | (fclose(file) != 0)) {
+			LOG_ERRNO(COLOR_REGULAR_YELLOW("trace_deinit: write"));
+		}
 	}
 
-	freeaddrinfo(ai);
-	if (p == NULL) {
-		fprintf(stderr, COLOR_REGULAR_YELLOW("net_tcp_connect: failed to connect\n"));
-		return -1;
+	while (t->rings != NULL) {
+		TraceRing *const next = t->rings->next;
+		free(t->rings);
+		t->rings = next;
 	}
 
-	return fd;
+	pthread_mutex_destroy(&t->mutex);
+	pthread_key_delete(t->key);
 }
 
 
-/*
- * Http
- */
 static int
-http_init(Http *h)
+trace_is_on(const Trace *t)
 {
-	if (buffer_init(&h->buffer, CONFIG_BUFFER_SIZE * 3) < 0) {
-		perror(COLOR_REGULAR_YELLOW("http_init: str_init"));
-		return -1;
-	}
-
-	h->buffer_len = 0;
-
-	h->host = CONFIG_HTTP_HOST;
-	h->port = CONFIG_HTTP_PORT;
-
-	h->iovs[HTTP_IOV_METHOD].iov_base    = CONFIG_HTTP_METHOD;
-	h->iovs[HTTP_IOV_METHOD].iov_len     = sizeof(CONFIG_HTTP_METHOD) - 1;
-	h->iovs[HTTP_IOV_PATH_BASE].iov_base = CONFIG_HTTP_PATH_BASE;
-	h->iovs[HTTP_IOV_PATH_BASE].iov_len  = sizeof(CONFIG_HTTP_PATH_BASE) - 1;
-	h->iovs[HTTP_IOV_PROTOCOL].iov_base  = CONFIG_HTTP_PROTOCOL;
-	h->iovs[HTTP_IOV_PROTOCOL].iov_len   = sizeof(CONFIG_HTTP_PROTOCOL) - 1;
-	h->iovs[HTTP_IOV_HEADER].iov_base    = CONFIG_HTTP_HEADER;
-	h->iovs[HTTP_IOV_HEADER].iov_len     = sizeof(CONFIG_HTTP_HEADER) - 1;
-	return 0;
+	return (t->path[0] != '\0');
 }
 
 
 static void
-http_deinit(Http *h)
+trace_span(Trace *t, const char name[], const char cat[], int64_t start, int64_t end,
+	   unsigned lane, unsigned long req, unsigned long conn, const char val_name[], long val)
 {
-	buffer_deinit(&h->buffer);
+	TraceRing *const r = trace_ring(t);
+	if (r == NULL)
+		return;
+
+	/* full: the oldest one goes */
+	TraceEvent *const e = &r->events[r->pos];
+	r->pos = (r->pos + 1) % LEN(r->events);
+	if (r->len < LEN(r->events))
+		r->len++;
+	else
+		r->dropped++;
+
+	e->name = name;
+	e->cat = cat;
+	e->start = start;
+	e->end = end;
+	e->lane = lane;
+	e->req = req;
+	e->conn = conn;
+	e->val_name = val_name;
+	e->val = val;
 }
 
 
-static const char *
-http_url_encode(Http *h, const char plain[])
+static TraceRing *
+trace_ring(Trace *t)
 {
-	const size_t plain_len = strlen(plain);
-	if (plain_len == 0)
+	TraceRing *r = pthread_getspecific(t->key);
+	if (r != NULL)
+		return r;
+
+	ALLOC_SUB_BEGIN(ALLOC_SUB_TRACE);
+	r = calloc(1, sizeof(*r));
+	ALLOC_SUB_END();
+	if (r == NULL) {
+		LOG_ERRNO(COLOR_REGULAR_YELLOW("trace_ring: calloc"));
 		return NULL;
+	}
 
-	if (buffer_check(&h->buffer, (plain_len * 3) + 1) < 0)
+	if (pthread_setspecific(t->key, r) != 0) {
+		free(r);
 		return NULL;
+	}
 
-	char *const buffer = h->buffer.ptr;
-	const size_t buffer_size = h->buffer.size;
+	pthread_mutex_lock(&t->mutex);
+	r->thread = ++t->rings_len;
+	r->next = t->rings;
+	t->rings = r;
+	pthread_mutex_unlock(&t->mutex);
+	return r;
+}
 
-	const char *const hex  = "0123456789abcdef";
-	const unsigned char *p = (const unsigned char *)plain;
 
-	size_t i = 0, pos = 0;
-	while ((p[i] != '\0') && (i < buffer_size || pos < buffer_size) && (i < plain_len)) {
-		if (!isalnum(p[i])) {
-			buffer[pos++] = '%';
-			buffer[pos++] = hex[(p[i] >> 4u) & 15u];
-			buffer[pos++] = hex[p[i] & 15u];
+static int
+trace_write(Trace *t, FILE *file)
+{
+	/* the tracks: named after their lane */
+	unsigned lanes = 0;
+	unsigned long dropped = 0;
+	for (const TraceRing *r = t->rings; r != NULL; r = r->next) {
+		for (size_t i = 0; i < r->len; i++)
+			lanes = MAX(lanes, r->events[i].lane + 1);
+
+		dropped += r->dropped;
+	}
 
-			i++;
-			continue;
-		}
+	unsigned char *const is_lane = calloc(MAX(lanes, 1u), 1);
+	if (is_lane == NULL)
+		return -1;
 
-		buffer[pos++] = p[i++];
+	fprintf(file, "{\"traceEvents\":[\n");
+	int is_first = 1;
+	for (const TraceRing *r = t->rings; r != NULL; r = r->next) {
+		/* oldest first */
+		const size_t first = (r->len < LEN(r->events)) ? 0 : r->pos;
+		for (size_t i = 0; i < r->len; i++) {
+			const TraceEvent *const e = &r->events[(first + i) % LEN(r->events)];
+			if (is_lane[e->lane] == 0) {
+				is_lane[e->lane] = 1;
+				fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+					"\"tid\":%u,\"args\":{\"name\":\"%s %u\"}}", (is_first) ? "" : ",\n",
+					e->lane, (e->lane == 0) ? "warmer" : "request slot", e->lane);
+				is_first = 0;
+			}
+
+			fprintf(file, "%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,"
+				"\"dur\":%.3f,\"pid\":1,\"tid\":%u,\"args\":{\"thread\":%u,"
+				"\"request\":%lu,\"conn\":%lu", (is_first) ? "" : ",\n", e->name, e->cat,
+				(double)(e->start - t->start) / 1e3, (double)(e->end - e->start) / 1e3,
+				e->lane, r->thread, e->req, e->conn);
+			if (e->val_name != NULL)
+				fprintf(file, ",\"%s\":%ld", e->val_name, e->val);
+
+			fputs("}}", file);
+			is_first = 0;
+		}
 	}
 
-	h->buffer_len = pos;
-	buffer[pos] = '\0';
-	return buffer;
+	fprintf(file, "\n],\"displayTimeUnit\":\"ms\",\"otherData\":{\"dropped\":%lu}}\n",
+		dropped);
+	free(is_lane);
+	return ferror(file) ? -1 : 0;
 }
 
 
-static void
-http_build_request(Http *h, int type, const char sl[], const char tl[], const char hl[],
-		     const char text[], size_t text_len)
-{
-	/*
-	 * iovs[0]  = METHOD
-	 * iovs[1]  = path base
-	 * iovs[2]  = specific path
-	 * iovs[3]  = source lang key
-	 * iovs[4]  = source lang val
-	 * iovs[5]  = target lang key
-	 * iovs[6]  = target lang val
-	 * iovs[7]  = highlight lang key
-	 * iovs[8]  = highlight lang val
-	 * iovs[9]  = text key
-	 * iovs[10] = text val
-	 * iovs[11] = PROTOCOL
-	 * iovs[12] = header
-	 */
+/*
+ * Alloc
+ */
+#ifdef WITH_ALLOC_STATS
+enum { ALLOC_TABLE_SIZE = 1 << 16 };
 
-	h->iovs[HTTP_IOV_PATH_SPEC].iov_len    = 0;
-	h->iovs[HTTP_IOV_SRC_LANG_KEY].iov_len = 0;
-	h->iovs[HTTP_IOV_SRC_LANG_VAL].iov_len = 0;
-	h->iovs[HTTP_IOV_TRG_LANG_KEY].iov_len = 0;
-	h->iovs[HTTP_IOV_TRG_LANG_VAL].iov_len = 0;
-	h->iovs[HTTP_IOV_HL_LANG_KEY].iov_len  = 0;
-	h->iovs[HTTP_IOV_HL_LANG_VAL].iov_len  = 0;
+static struct {
+	void   *ptr;
+	size_t  size;
+	uint8_t sub;
+} alloc_table[ALLOC_TABLE_SIZE];
 
+static unsigned        alloc_table_len;
+static AllocStats      alloc_stats;
+static pthread_mutex_t alloc_mutex = PTHREAD_MUTEX_INITIALIZER;
 
-	h->iovs[HTTP_IOV_TEXT_KEY].iov_base = CONFIG_HTTP_QUERY_TXT;
-	h->iovs[HTTP_IOV_TEXT_KEY].iov_len  = sizeof(CONFIG_HTTP_QUERY_TXT) - 1;
-	h->iovs[HTTP_IOV_TEXT_VAL].iov_base = (char *)text;
-	h->iovs[HTTP_IOV_TEXT_VAL].iov_len  = text_len;
+/* volatile: malloc() is a leaf to the compiler, the stores around it would be dropped */
+static __thread volatile int alloc_sub = ALLOC_SUB_OTHER;
+static __thread volatile int alloc_phase = HTTP_PHASES_SIZE;
 
+static int
+alloc_sub_set(int sub)
+{
+	const int prev = alloc_sub;
+	alloc_sub = sub;
+	return prev;
+}
 
-	switch (type) {
-	case RESULT_TYPE_LANG:
-		h->iovs[HTTP_IOV_PATH_SPEC].iov_base = CONFIG_HTTP_PATH_LANG;
-		h->iovs[HTTP_IOV_PATH_SPEC].iov_len  = sizeof(CONFIG_HTTP_PATH_LANG) - 1;
-		break;
-	case RESULT_TYPE_DETAIL:
-		h->iovs[HTTP_IOV_PATH_SPEC].iov_base = CONFIG_HTTP_PATH_DETAIL;
-		h->iovs[HTTP_IOV_PATH_SPEC].iov_len  = sizeof(CONFIG_HTTP_PATH_DETAIL) - 1;
 
-		h->iovs[HTTP_IOV_HL_LANG_KEY].iov_base = CONFIG_HTTP_QUERY_HL;
-		h->iovs[HTTP_IOV_HL_LANG_KEY].iov_len  = sizeof(CONFIG_HTTP_QUERY_HL) - 1;
-		h->iovs[HTTP_IOV_HL_LANG_VAL].iov_base = (char *)hl;
-		h->iovs[HTTP_IOV_HL_LANG_VAL].iov_len  = strlen(hl);
+static void
+alloc_phase_set(int phase)
+{
+	alloc_phase = phase;
+}
 
-		/* FALLTHROUGH */
-	case RESULT_TYPE_SIMPLE:
-		if (type == RESULT_TYPE_SIMPLE) {
-			h->iovs[HTTP_IOV_PATH_SPEC].iov_base = CONFIG_HTTP_PATH_SIMPLE;
-			h->iovs[HTTP_IOV_PATH_SPEC].iov_len  = sizeof(CONFIG_HTTP_PATH_SIMPLE) - 1;
-		}
 
-		h->iovs[HTTP_IOV_SRC_LANG_KEY].iov_base = CONFIG_HTTP_QUERY_SL;
-		h->iovs[HTTP_IOV_SRC_LANG_KEY].iov_len  = sizeof(CONFIG_HTTP_QUERY_SL) - 1;
-		h->iovs[HTTP_IOV_SRC_LANG_VAL].iov_base = (char *)sl;
-		h->iovs[HTTP_IOV_SRC_LANG_VAL].iov_len  = strlen(sl);
+static size_t
+alloc_hash(const void *ptr)
+{
+	return (size_t)((((uintptr_t)ptr >> 4) * 0x9e3779b97f4a7c15ull) >> 48) &
+	       (ALLOC_TABLE_SIZE - 1);
+}
 
-		h->iovs[HTTP_IOV_TRG_LANG_KEY].iov_base = CONFIG_HTTP_QUERY_TL;
-		h->iovs[HTTP_IOV_TRG_LANG_KEY].iov_len  = sizeof(CONFIG_HTTP_QUERY_TL) - 1;
-		h->iovs[HTTP_IOV_TRG_LANG_VAL].iov_base = (char *)tl;
-		h->iovs[HTTP_IOV_TRG_LANG_VAL].iov_len  = strlen(tl);
-		break;
+
+static void
+alloc_counter_add(AllocCounter *c, size_t size, int is_live)
+{
+	c->allocs++;
+	c->bytes += size;
+	if (is_live) {
+		c->live += size;
+		c->peak = MAX(c->peak, c->live);
 	}
 }
 
 
-static int
-http_request(Http *h, int type, const char sl[], const char tl[], const char hl[], const char text[])
+static void
+alloc_add(void *ptr, size_t size, int sub, int phase)
 {
-	const char *const text_enc = http_url_encode(h, text);
-	if (text_enc == NULL)
-		return -1;
+	pthread_mutex_lock(&alloc_mutex);
+
+	/* up to 3/4 full: the probes stay short */
+	const int is_live = (alloc_table_len < ((ALLOC_TABLE_SIZE / 4) * 3));
+	if (is_live) {
+		size_t i = alloc_hash(ptr);
+		while (alloc_table[i].ptr != NULL)
+			i = (i + 1) & (ALLOC_TABLE_SIZE - 1);
+
+		alloc_table[i].ptr = ptr;
+		alloc_table[i].size = size;
+		alloc_table[i].sub = (uint8_t)sub;
+		alloc_table_len++;
+	} else {
+		alloc_stats.untracked++;
+	}
 
-	const int fd = net_tcp_connect(h->host, h->port);
-	if (fd < 0)
-		return -1;
+	alloc_counter_add(&alloc_stats.total, size, is_live);
+	alloc_counter_add(&alloc_stats.subs[sub], size, is_live);
+	alloc_counter_add(&alloc_stats.phases[phase], size, 0);
+	pthread_mutex_unlock(&alloc_mutex);
+}
 
-	http_build_request(h, type, sl, tl, hl, text_enc, h->buffer_len);
 
-	const ssize_t written = writev(fd, h->iovs, HTTP_IOVS_SIZE);
-	if (written < 0) {
-		perror(COLOR_REGULAR_YELLOW("http_request: writev"));
-		goto err0;
+static int
+alloc_del(void *ptr, size_t *size)
+{
+	pthread_mutex_lock(&alloc_mutex);
+	size_t i = alloc_hash(ptr);
+	while ((alloc_table[i].ptr != NULL) && (alloc_table[i].ptr != ptr))
+		i = (i + 1) & (ALLOC_TABLE_SIZE - 1);
+
+	/* not ours: allocated by libc (getline(), readline(), ...), or untracked */
+	if (alloc_table[i].ptr == NULL) {
+		pthread_mutex_unlock(&alloc_mutex);
+		return -1;
 	}
 
-	size_t total_len = 0;
-	for (size_t i = 0; i < LEN(h->iovs); i++)
-		total_len += h->iovs[i].iov_len;
+	const int sub = alloc_table[i].sub;
+	*size = alloc_table[i].size;
+	alloc_stats.total.live -= alloc_table[i].size;
+	alloc_stats.subs[sub].live -= alloc_table[i].size;
+	alloc_table_len--;
+
+	/* linear probing: the entries after it move back, no tombstones */
+	for (size_t j = (i + 1) & (ALLOC_TABLE_SIZE - 1); alloc_table[j].ptr != NULL;
+	     j = (j + 1) & (ALLOC_TABLE_SIZE - 1)) {
+		const size_t k = alloc_hash(alloc_table[j].ptr);
+		const int is_between = (i <= j) ? ((i < k) && (k <= j)) : ((i < k) || (k <= j));
+		if (is_between)
+			continue;
 
-	if (total_len != (size_t)written) {
-		fprintf(stderr, COLOR_REGULAR_YELLOW("http_request: writev: incomplete: [%zu:%zu]") "\n",
-			written, total_len);
-		goto err0;
+		alloc_table[i] = alloc_table[j];
+		i = j;
 	}
 
+	alloc_table[i].ptr = NULL;
+	pthread_mutex_unlock(&alloc_mutex);
+	return sub;
+}
 
-	char *buffer = h->buffer.ptr;
-	size_t buffer_len = h->buffer.size;
-	size_t recvd = 0;
-	while (1) {
-		const ssize_t rv = recv(fd, buffer + recvd, buffer_len - recvd, 0);
-		if (rv < 0) {
-			perror(COLOR_REGULAR_YELLOW("http_request: recv"));
-			goto err0;
-		}
-
-		if (rv == 0)
-			break;
-
-		recvd += (size_t)rv;
-		switch (buffer_check(&h->buffer, recvd + 1)) {
-		case 0:
-			break;
-		case 1:
-			buffer = h->buffer.ptr;
-			buffer_len = h->buffer.size;
-			break;
-		case -1:
-			goto err0;
-		}
-	}
 
-	h->buffer_len = recvd;
-	buffer[recvd] = '\0';
-	close(fd);
-	return 0;
+void *
+__wrap_malloc(size_t size)
+{
+	void *const ptr = __real_malloc(size);
+	if (ptr != NULL)
+		alloc_add(ptr, size, alloc_sub, alloc_phase);
 
-err0:
-	close(fd);
-	return -1;
+	return ptr;
 }
 
 
-static char *
-http_response_get_json(Http *h, size_t *ret_len)
+void *
+__wrap_calloc(size_t nmemb, size_t size)
 {
-	char *const buffer = h->buffer.ptr;
-	if (h->buffer_len == 0)
-		goto err0;
+	void *const ptr = __real_calloc(nmemb, size);
+	if (ptr != NULL)
+		alloc_add(ptr, nmemb * size, alloc_sub, alloc_phase);
 
-	char *const first = strstr(buffer, "\r\n");
-	if (first == NULL)
-		goto err0;
+	return ptr;
+}
 
-	*first = '\0';
-	if (strstr(buffer, "200") == NULL)
-		goto err0;
 
-	char *const end = strstr(first + 2, "\r\n\r\n");
-	if (end == NULL)
-		goto err0;
+void *
+__wrap_realloc(void *ptr, size_t size)
+{
+	/* the old block is gone, unless it fails */
+	size_t old_size = 0;
+	const int old_sub = (ptr != NULL) ? alloc_del(ptr, &old_size) : -1;
 
-	char *const json_start = strchr(end + 4, '[');
-	if (json_start == NULL)
-		goto err0;
+	void *const new_ptr = __real_realloc(ptr, size);
+	if (new_ptr != NULL)
+		alloc_add(new_ptr, size, alloc_sub, alloc_phase);
+	else if (old_sub >= 0)
+		alloc_add(ptr, old_size, old_sub, alloc_phase);
 
-	char *const json_end = strrchr(json_start + 1, ']');
-	if (json_end == NULL)
-		goto err0;
+	return new_ptr;
+}
 
-	const size_t len = ((json_end + 1) - json_start);
-	json_end[len] = '\0';
 
-	*ret_len = len;
-	return json_start;
+void
+__wrap_free(void *ptr)
+{
+	size_t size;
+	if (ptr != NULL)
+		alloc_del(ptr, &size);
 
-err0:
-	fprintf(stderr, COLOR_REGULAR_YELLOW("http_response_get_json: invalid reponse") "\n");
-	return NULL;
+	__real_free(ptr);
 }
+#endif
 
 
+static void
+alloc_get_stats(AllocStats *s)
+{
+#ifdef WITH_ALLOC_STATS
+	pthread_mutex_lock(&alloc_mutex);
+	*s = alloc_stats;
+	pthread_mutex_unlock(&alloc_mutex);
+#else
+	memset(s, 0, sizeof(*s));
+#endif
+}
+
 
 /*
- * Json
+ * Net
  */
-static json_value_t *
-json_array_index(json_array_t *arr, size_t index)
+static int
+net_resolve(const char host[], const char port[], struct addrinfo **ai)
 {
-	if (arr != NULL) {
-		size_t i = 0;
-		for (json_array_element_t *e = arr->start; e != NULL; e = e->next) {
-			if (i == index)
-				return e->value;
+	const struct addrinfo hints = {
+		.ai_family   = AF_UNSPEC,
+		.ai_socktype = SOCK_STREAM,
+	};
 
-			i++;
-		}
+	const int ret = getaddrinfo(host, port, &hints, ai);
+	if (ret != 0) {
+		LOG_ERR(COLOR_REGULAR_YELLOW("net_resolve: getaddrinfo: %s") "\n",
+			gai_strerror(ret));
+
+		/* not EAGAIN from an earlier call: the pool would wait for it */
+		if (ret == EAI_AGAIN)
+			errno = EHOSTUNREACH;
+		else if (ret != EAI_SYSTEM)
+			errno = EINVAL;
+
+		return -1;
 	}
 
-	return NULL;
+	return 0;
 }
 
 
-static json_array_t *
-json_value_as_array_wrp(json_value_t *val)
+static int
+net_tcp_connect(const struct addrinfo *ai, const NetOpts *opts, int *is_fastopen, int *fd)
 {
-	if (val != NULL)
-		return json_value_as_array(val);
-
-	return NULL;
-}
+	const int _fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+	if (_fd < 0) {
+		LOG_ERRNO(COLOR_REGULAR_YELLOW("net_tcp_connect: socket"));
+		return -1;
+	}
 
+	const int flags = fcntl(_fd, F_GETFL);
+	if ((flags < 0) || (fcntl(_fd, F_SETFL, flags | O_NONBLOCK) < 0)) {
+		LOG_ERRNO(COLOR_REGULAR_YELLOW("net_tcp_connect: fcntl"));
+		goto err0;
+	}
 
-static json_string_t *
-json_value_as_string_wrp(json_value_t *val)
-{
-	if (val != NULL)
-		return json_value_as_string(val);
+	const int on = 1;
+	if (opts->tcp_nodelay)
+		setsockopt(_fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
 
-	return NULL;
-}
+	if (opts->rcvbuf > 0)
+		setsockopt(_fd, SOL_SOCKET, SO_RCVBUF, &opts->rcvbuf, sizeof(opts->rcvbuf));
 
+#ifdef TCP_FASTOPEN_CONNECT
+	if ((*is_fastopen) && (opts->tcp_fastopen)) {
+		if (setsockopt(_fd, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, &on, sizeof(on)) < 0)
+			*is_fastopen = 0;
+	} else {
+		*is_fastopen = 0;
+	}
+#else
+	*is_fastopen = 0;
+#endif
 
-static size_t
-json_array_fills(json_value_t *values[], size_t size, json_array_t *arr)
-{
-	size_t i = 0;
-	if (arr != NULL) {
-		for (json_array_element_t *e = arr->start; e != NULL; e = e->next) {
-			values[i] = e->value;
-			i++;
+	if (connect(_fd, ai->ai_addr, ai->ai_addrlen) < 0) {
+		if (errno == EINPROGRESS) {
+			*fd = _fd;
+			return 1;
 		}
+
+		LOG_ERRNO(COLOR_REGULAR_YELLOW("net_tcp_connect: connect"));
+		goto err0;
 	}
 
-	for (size_t j = i; j < size; j++)
-		values[j] = NULL;
+	*fd = _fd;
+	return 0;
 
-	return i;
+err0:
+	close(_fd);
+	return -1;
 }
 
 
-/*
- * MoeTr
- */
 static int
-moetr_init(MoeTr *m, char default_result_type, const Lang *default_langs[2])
+net_tcp_connect_check(int fd)
 {
-	memset(m, 0, sizeof(*m));
-	m->langs[0] = default_langs[0];
-	m->langs[1] = default_langs[1];
-
-	if (moetr_set_result_type(m, default_result_type) < 0)
+	int err = 0;
+	socklen_t err_len = sizeof(err);
+	if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &err_len) < 0)
+		err = errno;
+
+	if (err != 0) {
+		errno = err;
+		LOG_ERRNO(COLOR_REGULAR_YELLOW("net_tcp_connect_check: connect"));
 		return -1;
+	}
 
-	if (http_init(&m->http) < 0)
-		return -1;
+	return 0;
+}
 
+
+static int
+net_tcp_is_fastopen_used(int fd)
+{
+#if defined(TCP_INFO) && defined(TCPI_OPT_SYN_DATA)
+	struct tcp_info info;
+	socklen_t info_len = sizeof(info);
+	if (getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &info_len) < 0)
+		return 0;
+
+	return ((info.tcpi_options & TCPI_OPT_SYN_DATA) != 0);
+#else
+	(void)fd;
 	return 0;
+#endif
 }
 
 
 static void
-moetr_deinit(MoeTr *m)
+net_tcp_quickack(int fd, const NetOpts *opts)
 {
-	http_deinit(&m->http);
+#ifdef TCP_QUICKACK
+	/* not permanent: the kernel may turn it off again */
+	if (opts->tcp_quickack) {
+		const int on = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_QUICKACK, &on, sizeof(on));
+	}
+#else
+	(void)fd;
+	(void)opts;
+#endif
 }
 
 
 static int
-moetr_set_langs(MoeTr *m, const char keys[])
+net_is_alive(int fd)
 {
-	const int ret = lang_parse(m->langs, keys);
-	switch (ret) {
-	case -1:
-		fprintf(stderr, COLOR_REGULAR_YELLOW("moetr_set_langs: invalid keys format") "\n");
-		break;
-	case -2:
-		fprintf(stderr, COLOR_REGULAR_YELLOW("moetr_set_langs: invalid source lang") "\n");
-		break;
-	case -3:
-		fprintf(stderr, COLOR_REGULAR_YELLOW("moetr_set_langs: invalid target lang") "\n");
-		break;
-	case -4:
-		fprintf(stderr, COLOR_REGULAR_YELLOW("moetr_set_langs: invalid source and target langs") "\n");
-		break;
+	char c;
+	const ssize_t rv = recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+	if (rv < 0)
+		return ((errno == EAGAIN) || (errno == EWOULDBLOCK));
+
+	/* 0: closed by peer, > 0: stray data on an idle connection */
+	return 0;
+}
+
+
+/*
+ * Tls
+ */
+#ifdef WITH_TLS
+static SSL_CTX *
+tls_ctx_new(int is_verify)
+{
+	SSL_CTX *const ctx = SSL_CTX_new(TLS_client_method());
+	if (ctx == NULL) {
+		LOG_ERR(COLOR_REGULAR_YELLOW("tls_ctx_new: SSL_CTX_new: failed") "\n");
+		return NULL;
 	}
 
-	return ret;
+	SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+	SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+
+	/* the pool keeps the sessions (one per host), not OpenSSL */
+	SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+
+	if (is_verify) {
+		SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER, NULL);
+		if (SSL_CTX_set_default_verify_paths(ctx) != 1)
+			LOG_ERR(COLOR_REGULAR_YELLOW("tls_ctx_new: no CA certificates") "\n");
+	} else {
+		SSL_CTX_set_verify(ctx, SSL_VERIFY_NONE, NULL);
+	}
+
+	return ctx;
 }
 
 
-static int
-moetr_set_result_type(MoeTr *m, int type)
+static SSL *
+tls_new(SSL_CTX *ctx, int fd, const char host[], SSL_SESSION *session, const char alpn[])
 {
-	switch (type) {
-	case 's':
-		m->result_type = RESULT_TYPE_SIMPLE;
-		break;
-	case 'd':
-		m->result_type = RESULT_TYPE_DETAIL;
-		break;
-	case 'l':
-		m->result_type = RESULT_TYPE_LANG;
-		break;
-	default:
-		fprintf(stderr, COLOR_REGULAR_YELLOW("moetr_set_result_type: invalid result type") "\n");
-		return -1;
+	SSL *const ssl = SSL_new(ctx);
+	if (ssl == NULL) {
+		LOG_ERR(COLOR_REGULAR_YELLOW("tls_new: SSL_new: failed") "\n");
+		return NULL;
 	}
 
-	return 0;
+	if ((SSL_set_fd(ssl, fd) != 1) || (SSL_set_tlsext_host_name(ssl, host) != 1) ||
+	    (SSL_set1_host(ssl, host) != 1)) {
+		LOG_ERR(COLOR_REGULAR_YELLOW("tls_new: failed to setup") "\n");
+		SSL_free(ssl);
+		return NULL;
+	}
+
+	if ((alpn != NULL) && (SSL_set_alpn_protos(ssl, (const unsigned char *)alpn,
+						  (unsigned)strlen(alpn)) != 0)) {
+		LOG_ERR(COLOR_REGULAR_YELLOW("tls_new: failed to set ALPN") "\n");
+		SSL_free(ssl);
+		return NULL;
+	}
+
+	if (session != NULL)
+		SSL_set_session(ssl, session);
+
+	SSL_set_connect_state(ssl);
+	return ssl;
 }
 
 
 static void
-moetr_print_simple(json_value_t *json)
+tls_free(SSL *ssl, int is_graceful)
 {
-	json_array_t *arr = json_value_as_array(json);
-	if (arr == NULL)
-		return;
+	/* best effort close_notify, don't wait for the peer's */
+	if (is_graceful)
+		SSL_shutdown(ssl);
 
-	arr = json_value_as_array_wrp(json_array_index(arr, 0));
-	if (arr == NULL)
-		return;
+	SSL_free(ssl);
+}
 
-	for (json_array_element_t *e = arr->start; e != NULL; e = e->next) {
-		arr = json_value_as_array(e->value);
-		if (arr == NULL)
-			continue;
 
-		json_string_t *const str = json_value_as_string_wrp(json_array_index(arr, 0));
-		if (str == NULL)
-			continue;
+static int
+tls_handshake(SSL *ssl, short *events)
+{
+	ERR_clear_error();
+	const int ret = SSL_do_handshake(ssl);
+	if (ret == 1)
+		return 0;
+
+	switch (SSL_get_error(ssl, ret)) {
+	case SSL_ERROR_WANT_READ:
+		*events = POLLIN;
+		return 1;
+	case SSL_ERROR_WANT_WRITE:
+		*events = POLLOUT;
+		return 1;
+	}
 
-		printf("%.*s", (int)str->string_size, str->string);
+	const long verify = SSL_get_verify_result(ssl);
+	if (verify != X509_V_OK) {
+		LOG_ERR(COLOR_REGULAR_YELLOW("tls_handshake: %s") "\n",
+			X509_verify_cert_error_string(verify));
+	} else {
+		LOG_ERR(COLOR_REGULAR_YELLOW("tls_handshake: %s") "\n",
+			ERR_reason_error_string(ERR_get_error()));
 	}
 
-	putchar('\n');
+	return -1;
 }
 
 
-static void
-moetr_print_detail_synonyms(const json_array_t *synonyms_a)
+static ssize_t
+tls_write(SSL *ssl, const void *buf, size_t len, short *events)
 {
-	json_array_t *arr;
-	json_string_t *str;
-	json_value_t *values[3];
+	size_t written;
+	errno = 0;
+	ERR_clear_error();
+	const int ret = SSL_write_ex(ssl, buf, len, &written);
+	if (ret == 1)
+		return (ssize_t)written;
+
+	switch (SSL_get_error(ssl, ret)) {
+	case SSL_ERROR_WANT_READ:
+		*events = POLLIN;
+		errno = EAGAIN;
+		return -1;
+	case SSL_ERROR_WANT_WRITE:
+		*events = POLLOUT;
+		errno = EAGAIN;
+		return -1;
+	case SSL_ERROR_SYSCALL:
+		if (errno == 0)
+			errno = ECONNRESET;
 
+		return -1;
+	}
 
-	printf("\n------------------------");
-	for (json_array_element_t *e = synonyms_a->start; e != NULL; e = e->next) {
-		arr = json_value_as_array(e->value);
-		if (arr == NULL)
-			continue;
+	errno = EPROTO;
+	return -1;
+}
 
-		if (json_array_fills(values, LEN(values), arr) == 0)
-			continue;
 
+static ssize_t
+tls_read(SSL *ssl, void *buf, size_t len, short *events)
+{
+	size_t recvd;
+	errno = 0;
+	ERR_clear_error();
+	const int ret = SSL_read_ex(ssl, buf, len, &recvd);
+	if (ret == 1)
+		return (ssize_t)recvd;
+
+	switch (SSL_get_error(ssl, ret)) {
+	case SSL_ERROR_WANT_READ:
+		*events = POLLIN;
+		errno = EAGAIN;
+		return -1;
+	case SSL_ERROR_WANT_WRITE:
+		*events = POLLOUT;
+		errno = EAGAIN;
+		return -1;
+	case SSL_ERROR_ZERO_RETURN:
+		return 0;
+	case SSL_ERROR_SYSCALL:
+		/* EOF without close_notify */
+		if (errno == 0)
+			return 0;
 
-		/* verbs, nouns, etc. */
-		str = json_value_as_string_wrp(values[0]);
-		if (str != NULL) {
-			/* no label */
-			if (str->string_size == 0) {
-				printf("\n" COLOR_BOLD_BLUE("[?]"));
-			} else {
-				printf("\n" COLOR_BOLD_BLUE("[%c%.*s]"), toupper(str->string[0]),
-				       (int)str->string_size - 1, &str->string[1]);
-			}
-		}
+		return -1;
+	}
 
+	errno = EPROTO;
+	return -1;
+}
 
-		/* target alternative(s) */
-		arr = json_value_as_array_wrp(values[2]);
-		if (arr == NULL)
-			continue;
 
-		int iter = 1;
-		for (json_array_element_t *ee = arr->start; ee != NULL; ee = ee->next) {
-			if (json_array_fills(values, LEN(values), json_value_as_array(ee->value)) == 0)
-				continue;
+static int
+tls_is_alive(SSL *ssl, int fd)
+{
+	char c;
+	const ssize_t rv = recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+	if (rv < 0)
+		return ((errno == EAGAIN) || (errno == EWOULDBLOCK));
 
-			str = json_value_as_string_wrp(values[0]);
-			if (str == NULL)
-				continue;
+	if (rv == 0)
+		return 0;
 
-			printf("\n" COLOR_BOLD_WHITE("%d. %c%.*s:") "\n   "
-			       COLOR_REGULAR_YELLOW("-> "), iter, toupper(str->string[0]),
-			       (int)str->string_size, &str->string[1]);
+	/* a late session ticket is fine, a close_notify or stray data is not */
+	ERR_clear_error();
+	const int ret = SSL_peek(ssl, &c, 1);
+	if (ret > 0)
+		return 0;
 
-			/* source alternatives */
-			arr = json_value_as_array_wrp(values[1]);
-			if (arr == NULL)
-				continue;
+	return (SSL_get_error(ssl, ret) == SSL_ERROR_WANT_READ);
+}
 
-			int _len = (int)arr->length;
-			for (json_array_element_t *eee = arr->start; eee != NULL; eee = eee->next) {
-				str = json_value_as_string(eee->value);
-				if (str == NULL)
-					continue;
 
-				printf("%.*s", (int)str->string_size, str->string);
+static int
+tls_session_path(char buffer[], size_t size, const char host[], const char port[], int is_mkdir)
+{
+	int ret;
+	const char *const xdg = getenv("XDG_CACHE_HOME");
+	const char *const home = getenv("HOME");
+	if ((xdg != NULL) && (xdg[0] != '\0'))
+		ret = snprintf(buffer, size, "%s/" CONFIG_TLS_SESSION_DIR, xdg);
+	else if ((home != NULL) && (home[0] != '\0'))
+		ret = snprintf(buffer, size, "%s/.cache/" CONFIG_TLS_SESSION_DIR, home);
+	else
+		return -1;
 
-				if (_len-- > 1)
-					printf(", ");
-			}
+	if ((ret < 0) || ((size_t)ret >= size))
+		return -1;
 
-			if (_len == 0)
-				printf(".");
+	if (is_mkdir) {
+		/* the parent (~/.cache) may not exist either */
+		char *const sep = strrchr(buffer, '/');
+		*sep = '\0';
+		mkdir(buffer, 0700);
+		*sep = '/';
+		mkdir(buffer, 0700);
+	}
 
-			if (iter == CONFIG_SYN_LINES_MAX)
-				break;
+	const size_t len = (size_t)ret;
+	ret = snprintf(buffer + len, size - len, "/tls_%s_%s.pem", host, port);
+	if ((ret < 0) || ((size_t)ret >= (size - len)))
+		return -1;
 
-			iter++;
-		}
-		putchar('\n');
+	return 0;
+}
+
+
+static SSL_SESSION *
+tls_session_load(const char host[], const char port[])
+{
+	char path[1024];
+	if (tls_session_path(path, sizeof(path), host, port, 0) < 0)
+		return NULL;
+
+	FILE *const file = fopen(path, "r");
+	if (file == NULL)
+		return NULL;
+
+	SSL_SESSION *session = PEM_read_SSL_SESSION(file, NULL, NULL, NULL);
+	fclose(file);
+
+	if ((session != NULL) && (SSL_SESSION_is_resumable(session) == 0)) {
+		SSL_SESSION_free(session);
+		session = NULL;
 	}
-	putchar('\n');
+
+	return session;
 }
 
 
 static void
-moetr_print_detail_defs(const json_array_t *defs_a)
+tls_session_save(SSL_SESSION *session, const char host[], const char port[])
 {
-	json_array_t *arr;
-	json_string_t *str;
-	json_value_t *values[4];
+	char path[1024];
+	if (tls_session_path(path, sizeof(path), host, port, 1) < 0)
+		return;
 
+	const int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0)
+		return;
 
-	printf("\n------------------------");
-	for (json_array_element_t *e = defs_a->start; e != NULL; e = e->next) {
-		arr = json_value_as_array(e->value);
-		if (arr == NULL)
-			continue;
+	FILE *const file = fdopen(fd, "w");
+	if (file == NULL) {
+		close(fd);
+		return;
+	}
 
-		if (json_array_fills(values, LEN(values), arr) == 0)
-			continue;
-
-		/* verbs, nouns, etc. */
-		str = json_value_as_string_wrp(values[0]);
-		if (str != NULL) {
-			/* no label */
-			if (str->string_size == 0) {
-				printf("\n" COLOR_BOLD_YELLOW("[?]"));
-			} else {
-				printf("\n" COLOR_BOLD_YELLOW("[%c%.*s]"), toupper(str->string[0]),
-				       (int)str->string_size - 1, &str->string[1]);
-			}
-		}
+	PEM_write_SSL_SESSION(file, session);
+	fclose(file);
+}
+#endif
 
-		arr = json_value_as_array_wrp(values[1]);
-		if (arr == NULL)
-			continue;
 
-		int iter = 1;
-		for (json_array_element_t *ee = arr->start; ee != NULL; ee = ee->next) {
-			if (json_array_fills(values, LEN(values), json_value_as_array(ee->value)) == 0)
-				continue;
+/*
+ * Hpack
+ */
+static const struct {
+	const char *name;
+	const char *value;
+} hpack_static[] = {
+	{ ":authority",                  ""               },
+	{ ":method",                     "GET"            },
+	{ ":method",                     "POST"           },
+	{ ":path",                       "/"              },
+	{ ":path",                       "/index.html"    },
+	{ ":scheme",                     "http"           },
+	{ ":scheme",                     "https"          },
+	{ ":status",                     "200"            },
+	{ ":status",                     "204"            },
+	{ ":status",                     "206"            },
+	{ ":status",                     "304"            },
+	{ ":status",                     "400"            },
+	{ ":status",                     "404"            },
+	{ ":status",                     "500"            },
+	{ "accept-charset",              ""               },
+	{ "accept-encoding",             "gzip, deflate"  },
+	{ "accept-language",             ""               },
+	{ "accept-ranges",               ""               },
+	{ "accept",                      ""               },
+	{ "access-control-allow-origin", ""               },
+	{ "age",                         ""               },
+	{ "allow",                       ""               },
+	{ "authorization",               ""               },
+	{ "cache-control",               ""               },
+	{ "content-disposition",         ""               },
+	{ "content-encoding",            ""               },
+	{ "content-language",            ""               },
+	{ "content-length",              ""               },
+	{ "content-location",            ""               },
+	{ "content-range",               ""               },
+	{ "content-type",                ""               },
+	{ "cookie",                      ""               },
+	{ "date",                        ""               },
+	{ "etag",                        ""               },
+	{ "expect",                      ""               },
+	{ "expires",                     ""               },
+	{ "from",                        ""               },
+	{ "host",                        ""               },
+	{ "if-match",                    ""               },
+	{ "if-modified-since",           ""               },
+	{ "if-none-match",               ""               },
+	{ "if-range",                    ""               },
+	{ "if-unmodified-since",         ""               },
+	{ "last-modified",               ""               },
+	{ "link",                        ""               },
+	{ "location",                    ""               },
+	{ "max-forwards",                ""               },
+	{ "proxy-authenticate",          ""               },
+	{ "proxy-authorization",         ""               },
+	{ "range",                       ""               },
+	{ "referer",                     ""               },
+	{ "refresh",                     ""               },
+	{ "retry-after",                 ""               },
+	{ "server",                      ""               },
+	{ "set-cookie",                  ""               },
+	{ "strict-transport-security",   ""               },
+	{ "transfer-encoding",           ""               },
+	{ "user-agent",                  ""               },
+	{ "vary",                        ""               },
+	{ "via",                         ""               },
+	{ "www-authenticate",            ""               },
+};
 
-			str = json_value_as_string_wrp(values[0]);
-			if (str == NULL)
-				continue;
+/* RFC 7541, Appendix B: canonical, the codes of each length are consecutive */
+static const uint32_t hpack_huff_codes[256] = {
+	0x00001ff8, 0x007fffd8, 0x0fffffe2, 0x0fffffe3, 0x0fffffe4, 0x0fffffe5, 0x0fffffe6, 0x0fffffe7,
+	0x0fffffe8, 0x00ffffea, 0x3ffffffc, 0x0fffffe9, 0x0fffffea, 0x3ffffffd, 0x0fffffeb, 0x0fffffec,
+	0x0fffffed, 0x0fffffee, 0x0fffffef, 0x0ffffff0, 0x0ffffff1, 0x0ffffff2, 0x3ffffffe, 0x0ffffff3,
+	0x0ffffff4, 0x0ffffff5, 0x0ffffff6, 0x0ffffff7, 0x0ffffff8, 0x0ffffff9, 0x0ffffffa, 0x0ffffffb,
+	0x00000014, 0x000003f8, 0x000003f9, 0x00000ffa, 0x00001ff9, 0x00000015, 0x000000f8, 0x000007fa,
+	0x000003fa, 0x000003fb, 0x000000f9, 0x000007fb, 0x000000fa, 0x00000016, 0x00000017, 0x00000018,
+	0x00000000, 0x00000001, 0x00000002, 0x00000019, 0x0000001a, 0x0000001b, 0x0000001c, 0x0000001d,
+	0x0000001e, 0x0000001f, 0x0000005c, 0x000000fb, 0x00007ffc, 0x00000020, 0x00000ffb, 0x000003fc,
+	0x00001ffa, 0x00000021, 0x0000005d, 0x0000005e, 0x0000005f, 0x00000060, 0x00000061, 0x00000062,
+	0x00000063, 0x00000064, 0x00000065, 0x00000066, 0x00000067, 0x00000068, 0x00000069, 0x0000006a,
+	0x0000006b, 0x0000006c, 0x0000006d, 0x0000006e, 0x0000006f, 0x00000070, 0x00000071, 0x00000072,
+	0x000000fc, 0x00000073, 0x000000fd, 0x00001ffb, 0x0007fff0, 0x00001ffc, 0x00003ffc, 0x00000022,
+	0x00007ffd, 0x00000003, 0x00000023, 0x00000004, 0x00000024, 0x00000005, 0x00000025, 0x00000026,
+	0x00000027, 0x00000006, 0x00000074, 0x00000075, 0x00000028, 0x00000029, 0x0000002a, 0x00000007,
+	0x0000002b, 0x00000076, 0x0000002c, 0x00000008, 0x00000009, 0x0000002d, 0x00000077, 0x00000078,
+	0x00000079, 0x0000007a, 0x0000007b, 0x00007ffe, 0x000007fc, 0x00003ffd, 0x00001ffd, 0x0ffffffc,
+	0x000fffe6, 0x003fffd2, 0x000fffe7, 0x000fffe8, 0x003fffd3, 0x003fffd4, 0x003fffd5, 0x007fffd9,
+	0x003fffd6, 0x007fffda, 0x007fffdb, 0x007fffdc, 0x007fffdd, 0x007fffde, 0x00ffffeb, 0x007fffdf,
+	0x00ffffec, 0x00ffffed, 0x003fffd7, 0x007fffe0, 0x00ffffee, 0x007fffe1, 0x007fffe2, 0x007fffe3,
+	0x007fffe4, 0x001fffdc, 0x003fffd8, 0x007fffe5, 0x003fffd9, 0x007fffe6, 0x007fffe7, 0x00ffffef,
+	0x003fffda, 0x001fffdd, 0x000fffe9, 0x003fffdb, 0x003fffdc, 0x007fffe8, 0x007fffe9, 0x001fffde,
+	0x007fffea, 0x003fffdd, 0x003fffde, 0x00fffff0, 0x001fffdf, 0x003fffdf, 0x007fffeb, 0x007fffec,
+	0x001fffe0, 0x001fffe1, 0x003fffe0, 0x001fffe2, 0x007fffed, 0x003fffe1, 0x007fffee, 0x007fffef,
+	0x000fffea, 0x003fffe2, 0x003fffe3, 0x003fffe4, 0x007ffff0, 0x003fffe5, 0x003fffe6, 0x007ffff1,
+	0x03ffffe0, 0x03ffffe1, 0x000fffeb, 0x0007fff1, 0x003fffe7, 0x007ffff2, 0x003fffe8, 0x01ffffec,
+	0x03ffffe2, 0x03ffffe3, 0x03ffffe4, 0x07ffffde, 0x07ffffdf, 0x03ffffe5, 0x00fffff1, 0x01ffffed,
+	0x0007fff2, 0x001fffe3, 0x03ffffe6, 0x07ffffe0, 0x07ffffe1, 0x03ffffe7, 0x07ffffe2, 0x00fffff2,
+	0x001fffe4, 0x001fffe5, 0x03ffffe8, 0x03ffffe9, 0x0ffffffd, 0x07ffffe3, 0x07ffffe4, 0x07ffffe5,
+	0x000fffec, 0x00fffff3, 0x000fffed, 0x001fffe6, 0x003fffe9, 0x001fffe7, 0x001fffe8, 0x007ffff3,
+	0x003fffea, 0x003fffeb, 0x01ffffee, 0x01ffffef, 0x00fffff4, 0x00fffff5, 0x03ffffea, 0x007ffff4,
+	0x03ffffeb, 0x07ffffe6, 0x03ffffec, 0x03ffffed, 0x07ffffe7, 0x07ffffe8, 0x07ffffe9, 0x07ffffea,
+	0x07ffffeb, 0x0ffffffe, 0x07ffffec, 0x07ffffed, 0x07ffffee, 0x07ffffef, 0x07fffff0, 0x03ffffee,
+};
 
-			printf("\n" COLOR_BOLD_WHITE("%d. %c%.*s"), iter, toupper(str->string[0]),
-			       (int)str->string_size, &str->string[1]);
+static const unsigned char hpack_huff_lens[256] = {
+	13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+	28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+	 6, 10, 10, 12, 13,  6,  8, 11, 10, 10,  8, 11,  8,  6,  6,  6,
+	 5,  5,  5,  6,  6,  6,  6,  6,  6,  6,  7,  8, 15,  6, 12, 10,
+	13,  6,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,
+	 7,  7,  7,  7,  7,  7,  7,  7,  8,  7,  8, 13, 19, 13, 14,  6,
+	15,  5,  6,  5,  6,  5,  6,  6,  6,  5,  7,  7,  6,  6,  6,  5,
+	 6,  7,  6,  5,  5,  6,  7,  7,  7,  7,  7, 15, 11, 14, 13, 28,
+	20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+	24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+	22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+	21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+	26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+	19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+	20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+	26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+};
 
-			arr = json_value_as_array_wrp(values[3]);
-			if (arr != NULL) {
-				arr = json_value_as_array_wrp(json_array_index(arr, 0));
-				str = json_value_as_string_wrp(json_array_index(arr, 0));
-				if (str != NULL)
-					printf(COLOR_REGULAR_GREEN(" [%.*s] "), (int)str->string_size, str->string);
-			}
+/* the decoder: the symbols sorted by code, the number of codes of each length */
+static const unsigned char hpack_huff_syms[256] = {
+	 48,  49,  50,  97,  99, 101, 105, 111, 115, 116,  32,  37,  45,  46,  47,  51,
+	 52,  53,  54,  55,  56,  57,  61,  65,  95,  98, 100, 102, 103, 104, 108, 109,
+	110, 112, 114, 117,  58,  66,  67,  68,  69,  70,  71,  72,  73,  74,  75,  76,
+	 77,  78,  79,  80,  81,  82,  83,  84,  85,  86,  87,  89, 106, 107, 113, 118,
+	119, 120, 121, 122,  38,  42,  44,  59,  88,  90,  33,  34,  40,  41,  63,  39,
+	 43, 124,  35,  62,   0,  36,  64,  91,  93, 126,  94, 125,  60,  96, 123,  92,
+	195, 208, 128, 130, 131, 162, 184, 194, 224, 226, 153, 161, 167, 172, 176, 177,
+	179, 209, 216, 217, 227, 229, 230, 129, 132, 133, 134, 136, 146, 154, 156, 160,
+	163, 164, 169, 170, 173, 178, 181, 185, 186, 187, 189, 190, 196, 198, 228, 232,
+	233,   1, 135, 137, 138, 139, 140, 141, 143, 147, 149, 150, 151, 152, 155, 157,
+	158, 165, 166, 168, 174, 175, 180, 182, 183, 188, 191, 197, 231, 239,   9, 142,
+	144, 145, 148, 159, 171, 206, 215, 225, 236, 237, 199, 207, 234, 235, 192, 193,
+	200, 201, 202, 205, 210, 213, 218, 219, 238, 240, 242, 243, 255, 203, 204, 211,
+	212, 214, 221, 222, 223, 241, 244, 245, 246, 247, 248, 250, 251, 252, 253, 254,
+	  2,   3,   4,   5,   6,   7,   8,  11,  12,  14,  15,  16,  17,  18,  19,  20,
+	 21,  23,  24,  25,  26,  27,  28,  29,  30,  31, 127, 220, 249,  10,  13,  22,
+};
 
-			str = json_value_as_string_wrp(values[2]);
-			if (str != NULL) {
-				printf("\n" COLOR_REGULAR_YELLOW("   ->") " %c%.*s.",
-				       toupper(str->string[0]), (int)str->string_size, &str->string[1]);
-			}
+static const unsigned short hpack_huff_counts[31] = {
+	 0,  0,  0,  0,  0, 10, 26, 32,  6,  0,  5,  3,  2,  6,  2,  3,
+	 0,  0,  0,  3,  8, 13, 26, 29, 12,  4, 15, 19, 29,  0,  3,
+};
 
-			if (iter == CONFIG_DEF_LINES_MAX)
-				break;
 
-			iter++;
-		}
-		putchar('\n');
-	}
-	putchar('\n');
+static void
+hpack_table_init(HpackTable *t)
+{
+	memset(t, 0, sizeof(*t));
+	t->size_max = HPACK_TABLE_SIZE;
 }
 
 
 static void
-moetr_print_detail_examples(json_array_t *examples_a)
+hpack_table_deinit(HpackTable *t)
 {
-	char buffer[CONFIG_EXM_BUFFER_SIZE];
+	hpack_table_evict(t, 0);
+}
 
 
-	printf("\n------------------------\n");
-	for (json_array_element_t *e = examples_a->start; e != NULL; e = e->next) {
-		json_array_t *arr = json_value_as_array(e->value);
-		if (arr == NULL)
-			continue;
+static void
+hpack_table_evict(HpackTable *t, size_t size_max)
+{
+	while ((t->len > 0) && (t->size > size_max)) {
+		HpackField *const f = &t->fields[t->first];
+		t->size -= f->name_len + f->value_len + HPACK_ENTRY_OVERHEAD;
+		free(f->ptr);
+		f->ptr = NULL;
+
+		t->first = (t->first + 1) % LEN(t->fields);
+		t->len--;
+	}
+}
 
-		int iter = 1;
-		for (json_array_element_t *ee = arr->start; ee != NULL; ee = ee->next) {
-			arr = json_value_as_array(ee->value);
-			if (arr == NULL)
-				continue;
 
-			json_string_t *const str = json_value_as_string_wrp(json_array_index(arr, 0));
-			if (str == NULL)
-				continue;
+static int
+hpack_table_add(HpackTable *t, const char name[], size_t name_len, const char value[],
+		size_t value_len)
+{
+	const size_t size = name_len + value_len + HPACK_ENTRY_OVERHEAD;
+	if (size > t->size_max) {
+		/* not an error: the table is just emptied */
+		hpack_table_evict(t, 0);
+		return 0;
+	}
 
-			const size_t len = str->string_size;
-			if (len >= sizeof(buffer))
-				continue;
+	hpack_table_evict(t, t->size_max - size);
 
-			memcpy(buffer, str->string, len);
-			buffer[len] = '\0';
+	ALLOC_SUB_BEGIN(ALLOC_SUB_HPACK);
+	char *const ptr = malloc(name_len + value_len + 1);
+	ALLOC_SUB_END();
+	if (ptr == NULL)
+		return -1;
 
-			char *const res = cstr_skip_html_tags(buffer, len);
-			res[0] = toupper(res[0]);
+	memcpy(ptr, name, name_len);
+	memcpy(ptr + name_len, value, value_len);
 
-			printf("%d. " COLOR_REGULAR_YELLOW("%s.") "\n", iter, res);
+	/* size_max / HPACK_ENTRY_OVERHEAD entries at most, there is always a free one */
+	HpackField *const f = &t->fields[(t->first + t->len) % LEN(t->fields)];
+	f->ptr = ptr;
+	f->name_len = name_len;
+	f->value_len = value_len;
 
-			if (iter == CONFIG_EXM_LINES_MAX)
-				break;
+	t->size += size;
+	t->len++;
+	return 0;
+}
 
-			iter++;
-		}
 
-		putchar('\n');
+static int
+hpack_table_get(const HpackTable *t, size_t idx, HpackField *field)
+{
+	if (idx == 0)
+		return -1;
+
+	if (idx <= LEN(hpack_static)) {
+		field->ptr = NULL;
+		field->name_len = strlen(hpack_static[idx - 1].name);
+		field->value_len = strlen(hpack_static[idx - 1].value);
+		return (int)idx;
 	}
+
+	idx -= LEN(hpack_static) + 1;
+	if (idx >= t->len)
+		return -1;
+
+	*field = t->fields[(t->first + t->len - 1 - idx) % LEN(t->fields)];
+	return 0;
 }
 
 
-static void
-moetr_print_detail(const MoeTr *m, json_value_t *json, const char src_text[])
+static unsigned
+hpack_static_find(const char name[], size_t name_len, const char value[], size_t value_len,
+		  int *is_full)
 {
-	json_array_t *const root_a = json_value_as_array(json);
-	if (root_a == NULL)
-		return;
+	unsigned ret = 0;
+	*is_full = 0;
+	for (unsigned i = 0; i < LEN(hpack_static); i++) {
+		if ((strlen(hpack_static[i].name) != name_len) ||
+		    (memcmp(hpack_static[i].name, name, name_len) != 0))
+			continue;
 
-	json_value_t *root_v[14];
-	if (json_array_fills(root_v, LEN(root_v), root_a) == 0)
-		return;
+		if ((strlen(hpack_static[i].value) == value_len) &&
+		    (memcmp(hpack_static[i].value, value, value_len) == 0)) {
+			*is_full = 1;
+			return i + 1;
+		}
 
+		if (ret == 0)
+			ret = i + 1;
+	}
 
-	/* bufferred print */
-	char buffer[CONFIG_PRINT_BUFFER_SIZE];
-	const int buffer_set = setvbuf(stdout, buffer, _IOFBF, CONFIG_PRINT_BUFFER_SIZE);
-	/* bufferred print */
+	return ret;
+}
 
 
-	json_array_t *const text_a = json_value_as_array_wrp(root_v[0]);
-	json_value_t *splls_v[4];
+static int
+hpack_int_encode(Buffer *b, size_t *len, unsigned char first, unsigned bits, size_t value)
+{
+	if (buffer_check(b, *len + 16) < 0)
+		return -1;
 
+	unsigned char *const ptr = (unsigned char *)b->ptr;
+	const size_t max = (1u << bits) - 1;
+	if (value < max) {
+		ptr[(*len)++] = first | (unsigned char)value;
+		return 0;
+	}
 
-	json_array_t *splls_a = NULL;
-	if (text_a->length > 1)
-		splls_a = json_value_as_array_wrp(json_array_index(text_a, (text_a->length - 1)));
+	ptr[(*len)++] = first | (unsigned char)max;
+	value -= max;
+	while (value >= 128) {
+		ptr[(*len)++] = (unsigned char)((value & 127) | 128);
+		value >>= 7;
+	}
 
-	json_array_fills(splls_v, LEN(splls_v), splls_a);
+	ptr[(*len)++] = (unsigned char)value;
+	return 0;
+}
 
 
-	/* source: correction */
-	json_array_t *const src_cor_a = json_value_as_array_wrp(root_v[7]);
-	json_string_t *const src_cor_s = json_value_as_string_wrp(json_array_index(src_cor_a, 1));
-	if (src_cor_s != NULL) {
-		printf(COLOR_BOLD_GREEN("Did you mean: ") "\"%.*s\" " COLOR_BOLD_GREEN("?") "\n\n",
-		       (int)src_cor_s->string_size, src_cor_s->string);
-	}
+static int
+hpack_str_encode(Buffer *b, size_t *len, const char str[], size_t str_len)
+{
+	const size_t huff_len = hpack_huff_len(str, str_len);
+	const int is_huff = (huff_len < str_len);
+	const size_t enc_len = (is_huff) ? huff_len : str_len;
 
+	if (hpack_int_encode(b, len, (is_huff) ? 0x80 : 0x00, 7, enc_len) < 0)
+		return -1;
 
-	/* source: text */
-	printf(COLOR_REGULAR_YELLOW("%s") "\n", src_text);
+	if (buffer_check(b, *len + enc_len) < 0)
+		return -1;
 
+	if (is_huff)
+		hpack_huff_encode((unsigned char *)b->ptr + *len, str, str_len);
+	else
+		memcpy(b->ptr + *len, str, str_len);
 
-	/* source: spelling */
-	json_string_t *const src_splls_s = json_value_as_string_wrp(splls_v[3]);
-	if (src_splls_s != NULL) {
-		printf("(" COLOR_REGULAR_GREEN("%.*s") ")\n", (int)src_splls_s->string_size,
-		       src_splls_s->string);
-	}
+	*len += enc_len;
+	return 0;
+}
 
 
-	/* source: language */
-	json_string_t *const src_lang_s = json_value_as_string_wrp(root_v[2]);
-	if ((src_lang_s != NULL) && (strcasecmp("auto", m->langs[0]->key) == 0)) {
-		const Lang *lang = NULL;
-		const char *lang_val = "Unknown";
-		if (lang_get_from_key_s(src_lang_s->string, src_lang_s->string_size, &lang) == 0)
-			lang_val = lang->value;
+static int
+hpack_field_encode(Buffer *b, size_t *len, const char name[], size_t name_len, const char value[],
+		   size_t value_len, int is_indexing)
+{
+	int is_full;
+	const unsigned idx = hpack_static_find(name, name_len, value, value_len, &is_full);
+	if (is_full)
+		return hpack_int_encode(b, len, 0x80, 7, idx);
+
+	/* with incremental indexing: 01xxxxxx, without indexing: 0000xxxx */
+	const int ret = (is_indexing) ? hpack_int_encode(b, len, 0x40, 6, idx)
+				      : hpack_int_encode(b, len, 0x00, 4, idx);
+	if (ret < 0)
+		return -1;
 
-		printf(COLOR_BOLD_GREEN("[%.*s]:") COLOR_BOLD_WHITE(" %s") "\n",
-		       (int)src_lang_s->string_size, src_lang_s->string, lang_val);
-	}
-	printf("\n------------------------\n");
+	if ((idx == 0) && (hpack_str_encode(b, len, name, name_len) < 0))
+		return -1;
 
+	return hpack_str_encode(b, len, value, value_len);
+}
 
-	/* target: text */
-	if (text_a != NULL) {
-		for (json_array_element_t *e = text_a->start; e != NULL; e = e->next) {
-			json_array_t *const arr = json_value_as_array(e->value);
-			if (arr == NULL)
-				continue;
 
-			json_string_t *const str = json_value_as_string_wrp(json_array_index(arr, 0));
-			if (str == NULL)
-				continue;
+static int
+hpack_int_decode(const unsigned char **p, const unsigned char *end, unsigned bits, size_t *value)
+{
+	const unsigned char *ptr = *p;
+	if (ptr >= end)
+		return -1;
 
-			printf("%.*s", (int)str->string_size, str->string);
+	const size_t max = (1u << bits) - 1;
+	size_t val = *(ptr++) & max;
+	if (val == max) {
+		unsigned shift = 0;
+		while (1) {
+			/* 2^28: way more than anything valid here */
+			if ((ptr >= end) || (shift > 21))
+				return -1;
+
+			const unsigned char c = *(ptr++);
+			val += (size_t)(c & 127) << shift;
+			shift += 7;
+			if ((c & 128) == 0)
+				break;
 		}
-
-		putchar('\n');
 	}
 
+	*p = ptr;
+	*value = val;
+	return 0;
+}
 
-	/* target: spelling */
-	json_string_t *const trg_splls_s = json_value_as_string_wrp(splls_v[2]);
-	if (trg_splls_s != NULL)
-		printf("( " COLOR_REGULAR_GREEN("%.*s") " )\n", (int)trg_splls_s->string_size, trg_splls_s->string);
 
+static int
+hpack_str_decode(const unsigned char **p, const unsigned char *end, Buffer *b, size_t *len)
+{
+	if (*p >= end)
+		return -1;
 
-	/* synonyms */
-	json_array_t *const synonyms_a = json_value_as_array_wrp(root_v[1]);
-	if ((synonyms_a != NULL) && (CONFIG_SYN_LINES_MAX != 0))
-		moetr_print_detail_synonyms(synonyms_a);
+	const int is_huff = (**p & 0x80);
+	size_t str_len;
+	if (hpack_int_decode(p, end, 7, &str_len) < 0)
+		return -1;
 
+	if (str_len > (size_t)(end - *p))
+		return -1;
 
-	/* definitions */
-	json_array_t *const defs_a = json_value_as_array_wrp(root_v[12]);
-	if ((defs_a != NULL) && (CONFIG_DEF_LINES_MAX != 0))
-		moetr_print_detail_defs(defs_a);
+	const unsigned char *const str = *p;
+	*p += str_len;
+	if (is_huff)
+		return hpack_huff_decode(b, len, str, str_len);
 
+	if (buffer_check(b, *len + str_len) < 0)
+		return -1;
 
-	/* examples */
-	json_array_t *const examples_a = json_value_as_array_wrp(root_v[13]);
-	if ((examples_a != NULL) && (CONFIG_EXM_LINES_MAX != 0))
-		moetr_print_detail_examples(examples_a);
+	memcpy(b->ptr + *len, str, str_len);
+	*len += str_len;
+	return 0;
+}
 
 
-	/* bufferred print */
-	if (buffer_set == 0) {
-		fflush(stdout);
-		setvbuf(stdout, NULL, _IOLBF, 0);
-	}
-	/* bufferred print */
+static size_t
+hpack_huff_len(const char str[], size_t len)
+{
+	size_t bits = 0;
+	for (size_t i = 0; i < len; i++)
+		bits += hpack_huff_lens[(unsigned char)str[i]];
+
+	return (bits + 7) / 8;
 }
 
 
 static void
-moetr_print_detect_lang(json_value_t *json)
+hpack_huff_encode(unsigned char out[], const char str[], size_t len)
 {
-	json_array_t *const arr = json_value_as_array(json);
-	if (arr == NULL)
-		return;
-
-	json_string_t *const str = json_value_as_string_wrp(json_array_index(arr, 2));
-	if (str == NULL)
-		return;
-
-	const Lang *lang = NULL;
-	const char *lang_val = "Unknown";
-	if (lang_get_from_key_s(str->string, str->string_size, &lang) == 0)
-		lang_val = lang->value;
+	uint64_t acc = 0;
+	unsigned acc_bits = 0;
+	size_t pos = 0;
+	for (size_t i = 0; i < len; i++) {
+		const unsigned char c = (unsigned char)str[i];
+		acc = (acc << hpack_huff_lens[c]) | hpack_huff_codes[c];
+		acc_bits += hpack_huff_lens[c];
+		while (acc_bits >= 8) {
+			acc_bits -= 8;
+			out[pos++] = (unsigned char)(acc >> acc_bits);
+		}
+	}
 
-	printf("%.*s (%s)\n", (int)str->string_size, str->string, lang_val);
+	/* padding: the most significant bits of EOS (all ones) */
+	if (acc_bits > 0)
+		out[pos] = (unsigned char)((acc << (8 - acc_bits)) | (0xffu >> acc_bits));
 }
 
 
 static int
-moetr_translate(MoeTr *m, const char text[])
+hpack_huff_decode(Buffer *b, size_t *len, const unsigned char in[], size_t in_len)
 {
-	const char *const src = m->langs[0]->key;
-	const char *const trg = m->langs[1]->key;
-	if (http_request(&m->http, m->result_type, src, trg, trg, text) < 0)
+	/* at most 8 / 5 bytes per byte, 5 bits: the shortest code */
+	if (buffer_check(b, *len + ((in_len * 8) / 5) + 1) < 0)
 		return -1;
 
-	size_t len;
-	char *const res = http_response_get_json(&m->http, &len);
-	if (res == NULL)
-		return -1;
+	unsigned code = 0, first = 0, index = 0, bits = 0;
+	int is_ones = 1;
+	for (size_t i = 0; i < in_len; i++) {
+		for (int j = 7; j >= 0; j--) {
+			const unsigned bit = (in[i] >> j) & 1u;
+			code |= bit;
+			is_ones &= (int)bit;
+			bits++;
+
+			const unsigned count = hpack_huff_counts[bits];
+			if ((code - first) < count) {
+				b->ptr[(*len)++] = (char)hpack_huff_syms[index + (code - first)];
+				code = first = index = bits = 0;
+				is_ones = 1;
+				continue;
+			}
 
-	json_value_t *const json = json_parse(res, len);
-	if (json == NULL) {
-		fprintf(stderr, COLOR_REGULAR_YELLOW("moetr_translate: json_parse: failed to parse") "\n");
-		return -1;
+			/* EOS, or garbage */
+			if (bits == (LEN(hpack_huff_counts) - 1))
+				return -1;
+
+			index += count;
+			first = (first + count) << 1;
+			code <<= 1;
+		}
 	}
 
-	switch (m->result_type) {
-	case RESULT_TYPE_SIMPLE:
-		moetr_print_simple(json);
-		break;
-	case RESULT_TYPE_DETAIL:
-		moetr_print_detail(m, json, text);
-		break;
-	case RESULT_TYPE_LANG:
-		moetr_print_detect_lang(json);
-		break;
+	/* padding: shorter than 8 bits, all ones */
+	return ((bits < 8) && is_ones) ? 0 : -1;
+}
+
+
+static int
+hpack_decode(HpackTable *t, const unsigned char in[], size_t in_len, Buffer *out, size_t *out_len,
+	     Buffer *scratch)
+{
+	const unsigned char *p = in;
+	const unsigned char *const end = in + in_len;
+	while (p < end) {
+		size_t idx;
+		HpackField field;
+		const char *name, *value;
+		size_t name_len, value_len;
+		int is_indexing = 0;
+
+		const unsigned char c = *p;
+		if (c & 0x80) {
+			/* indexed: 1xxxxxxx */
+			if (hpack_int_decode(&p, end, 7, &idx) < 0)
+				return -1;
+
+			const int ret = hpack_table_get(t, idx, &field);
+			if (ret < 0)
+				return -1;
+
+			if (ret > 0) {
+				name = hpack_static[ret - 1].name;
+				value = hpack_static[ret - 1].value;
+			} else {
+				name = field.ptr;
+				value = field.ptr + field.name_len;
+			}
+
+			name_len = field.name_len;
+			value_len = field.value_len;
+			goto emit;
+		}
+
+		if ((c & 0xe0) == 0x20) {
+			/* dynamic table size update: 001xxxxx */
+			if ((hpack_int_decode(&p, end, 5, &idx) < 0) || (idx > HPACK_TABLE_SIZE))
+				return -1;
+
+			t->size_max = idx;
+			hpack_table_evict(t, idx);
+			continue;
+		}
+
+		/* literal: with incremental indexing: 01xxxxxx, without / never indexed: 000xxxxx */
+		is_indexing = (c & 0x40);
+		if (hpack_int_decode(&p, end, (is_indexing) ? 6 : 4, &idx) < 0)
+			return -1;
+
+		size_t scratch_len = 0;
+		if (idx == 0) {
+			if (hpack_str_decode(&p, end, scratch, &scratch_len) < 0)
+				return -1;
+		} else {
+			const int ret = hpack_table_get(t, idx, &field);
+			if (ret < 0)
+				return -1;
+
+			const char *const src = (ret > 0) ? hpack_static[ret - 1].name : field.ptr;
+			if (buffer_check(scratch, field.name_len) < 0)
+				return -1;
+
+			memcpy(scratch->ptr, src, field.name_len);
+			scratch_len = field.name_len;
+		}
+
+		name_len = scratch_len;
+		if (hpack_str_decode(&p, end, scratch, &scratch_len) < 0)
+			return -1;
+
+		name = scratch->ptr;
+		value = scratch->ptr + name_len;
+		value_len = scratch_len - name_len;
+
+emit:
+		if (buffer_check(out, *out_len + name_len + value_len + 4) < 0)
+			return -1;
+
+		memcpy(out->ptr + *out_len, name, name_len);
+		*out_len += name_len;
+		memcpy(out->ptr + *out_len, ": ", 2);
+		*out_len += 2;
+		memcpy(out->ptr + *out_len, value, value_len);
+		*out_len += value_len;
+		memcpy(out->ptr + *out_len, "\r\n", 2);
+		*out_len += 2;
+
+		if (is_indexing && (hpack_table_add(t, name, name_len, value, value_len) < 0))
+			return -1;
 	}
 
-	free(json);
 	return 0;
 }
 
 
-static void
-moetr_interactive_banner(const MoeTr *m)
+/*
+ * Http Pool
+ */
+static int
+http_pool_init(HttpPool *p)
 {
-	printf(COLOR_BOLD_WHITE("---[ Moetranslate ]---") "\n"
-	       COLOR_BOLD_GREEN("Languages:         ") "%s (%s) -> %s (%s)\n"
-	       COLOR_BOLD_GREEN("Result type:       ") "%s (%s)\n"
-	       COLOR_BOLD_GREEN("Show command list: ") "Type '/' and [Enter]\n\n",
-	       m->langs[0]->value, m->langs[0]->key, m->langs[1]->value, m->langs[1]->key,
-	       result_type_str[m->result_type][0], result_type_str[m->result_type][1]);
+	memset(p, 0, sizeof(*p));
+	p->net_opts.tcp_nodelay = CONFIG_NET_TCP_NODELAY;
+	p->net_opts.tcp_fastopen = CONFIG_NET_TCP_FASTOPEN;
+	p->net_opts.tcp_quickack = CONFIG_NET_TCP_QUICKACK;
+	p->net_opts.rcvbuf = CONFIG_NET_RCVBUF;
+	p->net_opts.tls_verify = CONFIG_TLS_VERIFY;
+	p->net_opts.tls_session_cache = CONFIG_TLS_SESSION_CACHE;
+	p->hedge_rate = CONFIG_HTTP_HEDGE_RATE;
+	p->is_limit = CONFIG_HTTP_LIMIT;
+	p->limit_max = CONFIG_HTTP_LIMIT_MAX;
+	p->rps = CONFIG_HTTP_LIMIT_RPS;
+	p->cps = CONFIG_HTTP_LIMIT_CPS;
+	p->limit = CONFIG_HTTP_LIMIT_INITIAL;
+	p->is_breaker = CONFIG_HTTP_BREAKER;
+	p->breaker_cooldown = CONFIG_HTTP_BREAKER_COOLDOWN;
+	p->is_race = CONFIG_HTTP_ROUTER_RACE;
+	p->route_seed = (unsigned)time_now_ns();
+	p->record_dir = CONFIG_CAPTURE_RECORD;
+	p->replay_dir = CONFIG_CAPTURE_REPLAY;
+	p->is_replay_timed = CONFIG_CAPTURE_REPLAY_TIMED;
+
+	if (pthread_mutex_init(&p->mutex, NULL) != 0) {
+		LOG_ERR(COLOR_REGULAR_YELLOW("http_pool_init: pthread_mutex_init: failed") "\n");
+		return -1;
+	}
+
+	if (trace_init(&p->trace) < 0) {
+		pthread_mutex_destroy(&p->mutex);
+		return -1;
+	}
+
+	return 0;
 }
 
 
 static void
-moetr_interactive_help(void)
+http_pool_deinit(HttpPool *p)
 {
-	printf(COLOR_BOLD_GREEN("Change languages: ") COLOR_REGULAR_YELLOW("/c") " [SOURCE]:[TARGET]\n"
-	       COLOR_BOLD_GREEN("Result type:      ") COLOR_REGULAR_YELLOW("/r") " [TYPE]\n"
-	                        "                      %s = %s\n"
-	                        "                      %s = %s\n"
-	                        "                      %s = %s\n"
-	       COLOR_BOLD_GREEN("Show languages:   ") COLOR_REGULAR_YELLOW("/l") " [NUM]\n"
+	/* the warmers: until the last one is done with its host */
+	for (unsigned i = 0; i < p->hosts_len; i++) {
+		HttpPoolHost *const host = &p->hosts[i];
+		pthread_mutex_lock(&p->mutex);
+		while (host->warming > 0) {
+			int wake_fd;
+			http_pool_wait(host, &wake_fd);
+			pthread_mutex_unlock(&p->mutex);
+
+			struct pollfd pfd = { .fd = wake_fd, .events = POLLIN };
+			if ((poll(&pfd, 1, -1) < 0) && (errno != EINTR))
+				LOG_ERRNO(COLOR_REGULAR_YELLOW("http_pool_deinit: poll"));
+
+			pthread_mutex_lock(&p->mutex);
+		}
+		pthread_mutex_unlock(&p->mutex);
+	}
+
+	/* the sessions give their connections back to the pool */
+	for (unsigned i = 0; i < p->hosts_len; i++) {
+		if (p->hosts[i].h2 != NULL)
+			h2_free(p->hosts[i].h2);
+	}
+
+	for (unsigned i = 0; i < p->hosts_len; i++) {
+		HttpPoolHost *const host = &p->hosts[i];
+		for (unsigned j = 0; j < host->idle_len; j++)
+			http_conn_free(host->idle[j], 1);
+
+		if (host->ai != NULL)
+			freeaddrinfo(host->ai);
+
+		close(host->wake_fd);
+
+#ifdef WITH_TLS
+		if (host->session != NULL) {
+			if (host->is_session_dirty && p->net_opts.tls_session_cache &&
+			    p->net_opts.tls_verify)
+				tls_session_save(host->session, host->host, host->port);
+
+			SSL_SESSION_free(host->session);
+		}
+#endif
+	}
+
+#ifdef WITH_TLS
+	if (p->tls_ctx != NULL)
+		SSL_CTX_free(p->tls_ctx);
+#endif
+
+	trace_deinit(&p->trace);
+	pthread_mutex_destroy(&p->mutex);
+}
+
+
+static HttpPoolHost *
+http_pool_host_get(HttpPool *p, const char host[], const char port[], int is_tls, int is_h2)
+{
+	for (unsigned i = 0; i < p->hosts_len; i++) {
+		HttpPoolHost *const h = &p->hosts[i];
+		if ((h->is_tls == is_tls) && (h->is_h2 == is_h2) && (strcmp(h->host, host) == 0) &&
+		    (strcmp(h->port, port) == 0))
+			return h;
+	}
+
+	if (p->hosts_len == LEN(p->hosts)) {
+		LOG_ERR(COLOR_REGULAR_YELLOW("http_pool_host_get: too many hosts") "\n");
+		return NULL;
+	}
+
+	if ((strlen(host) >= sizeof(p->hosts[0].host)) || (strlen(port) >= sizeof(p->hosts[0].port))) {
+		LOG_ERR(COLOR_REGULAR_YELLOW("http_pool_host_get: host/port too long") "\n");
+		return NULL;
+	}
+
+#ifdef WITH_TLS
+	if (is_tls && (p->tls_ctx == NULL)) {
+		p->tls_ctx = tls_ctx_new(p->net_opts.tls_verify);
+		if (p->tls_ctx == NULL)
+			return NULL;
+	}
+#else
+	if (is_tls) {
+		LOG_ERR(COLOR_REGULAR_YELLOW("http_pool_host_get: TLS: not supported, "
+			"please rebuild with \"WITH_TLS=1\"") "\n");
+		return NULL;
+	}
+#endif
+
+	HttpPoolHost *const h = &p->hosts[p->hosts_len];
+	memset(h, 0, sizeof(*h));
+	h->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (h->wake_fd < 0) {
+		LOG_ERRNO(COLOR_REGULAR_YELLOW("http_pool_host_get: eventfd"));
+		return NULL;
+	}
+
+	strcpy(h->host, host);
+	strcpy(h->port, port);
+	h->is_tls = is_tls;
+	h->is_h2 = is_h2;
+
+#ifdef WITH_TLS
+	/* a session from an unverified run must not skip a later verification */
+	if (is_tls && p->net_opts.tls_session_cache && p->net_opts.tls_verify)
+		h->session = tls_session_load(host, port);
+#endif
+
+	p->hosts_len++;
+	return h;
+}
+
+
+static int
+http_pool_connect(HttpPool *p, HttpPoolHost *host, HttpConn *c)
+{
+	c->dns_ns = 0;
+	pthread_mutex_lock(&p->mutex);
+	const int is_resolved = (host->ai != NULL);
+	pthread_mutex_unlock(&p->mutex);
+
+	if (is_resolved) {
+		PROBE(cache_hit, "dns", host->host);
+	} else {
+		/* DNS: resolve once, until all of the addresses fail */
+		PROBE(cache_miss, "dns", host->host);
+		struct addrinfo *ai;
+		const int64_t start = time_now_ns();
+		if (net_resolve(host->host, host->port, &ai) < 0)
+			return -1;
+
+		c->dns_ns = time_now_ns() - start;
+
+		/* resolved by another one meanwhile: the first one is kept */
+		pthread_mutex_lock(&p->mutex);
+		if (host->ai == NULL) {
+			host->ai = ai;
+			ai = NULL;
+		}
+		pthread_mutex_unlock(&p->mutex);
+
+		if (ai != NULL)
+			freeaddrinfo(ai);
+	}
+
+	for (unsigned i = c->addr_idx;; i++) {
+		/* a copy: the list is freed by the one that finds all of its addresses failing */
+		struct sockaddr_storage addr;
+		struct addrinfo ai;
+		pthread_mutex_lock(&p->mutex);
+		const struct addrinfo *cur = host->ai;
+		for (unsigned j = 0; (cur != NULL) && (j < i); j++)
+			cur = cur->ai_next;
+
+		if (cur != NULL) {
+			ai = *cur;
+			memcpy(&addr, cur->ai_addr, cur->ai_addrlen);
+			ai.ai_addr = (struct sockaddr *)&addr;
+			ai.ai_next = NULL;
+		}
+		pthread_mutex_unlock(&p->mutex);
+
+		if (cur == NULL)
+			break;
+
+		int is_fastopen = c->is_fastopen;
+		const int ret = net_tcp_connect(&ai, &p->net_opts, &is_fastopen, &c->fd);
+		if (ret < 0)
+			continue;
+
+		c->addr_idx = i;
+		c->is_connecting = ret;
+		c->is_fastopen = is_fastopen;
+		c->is_tls = host->is_tls;
+		c->is_ready = !host->is_tls;
+
+		pthread_mutex_lock(&p->mutex);
+#ifdef WITH_TLS
+		if (host->is_tls) {
+			const char *const alpn = (host->is_h2) ? "\x02h2\x08http/1.1" : NULL;
+			c->ssl = tls_new(p->tls_ctx, c->fd, host->host, host->session, alpn);
+			if (c->ssl == NULL) {
+				pthread_mutex_unlock(&p->mutex);
+				close(c->fd);
+				errno = EPROTO;
+				break;
+			}
+		}
+#endif
+
+		p->stats.new_connects++;
+		p->stats.tfo_attempts += is_fastopen;
+		pthread_mutex_unlock(&p->mutex);
+		return 0;
+	}
+
+	const int errnum = errno;
+	LOG_ERR(COLOR_REGULAR_YELLOW("http_pool_connect: failed to connect") "\n");
+	pthread_mutex_lock(&p->mutex);
+	if (host->ai != NULL)
+		freeaddrinfo(host->ai);
+
+	host->ai = NULL;
+	pthread_mutex_unlock(&p->mutex);
+	errno = errnum;
+	return -1;
+}
+
+
+static HttpConn *
+http_pool_get(HttpPool *p, const char host[], const char port[], int is_tls, int is_h2,
+	      int is_waiting, int is_bulk, int *is_reused, int *wake_fd)
+{
+	HttpConn *c = NULL;
+	pthread_mutex_lock(&p->mutex);
+
+	HttpPoolHost *const ph = http_pool_host_get(p, host, port, is_tls, is_h2);
+	if (ph == NULL)
+		goto out0;
+
+	/* a connection is being warmed up, it will be ready sooner than a new one */
+	if ((ph->warming > 0) && (ph->idle_len == 0))
+		goto wait0;
+
+	/* the reserve: an idle one too, it would be the next interactive request's */
+	const unsigned bulk_max = CONFIG_HTTP_POOL_HOST_CONNS_MAX -
+				  ((CONFIG_HTTP_POOL_HOST_CONNS_MAX * CONFIG_HTTP_BULK_RESERVE) / 100);
+	if (is_bulk && (ph->busy_len >= bulk_max)) {
+		if (is_waiting == 0)
+			p->stats.waits++;
+
+		goto wait0;
+	}
+
+	while (ph->idle_len > 0) {
+		/* HTTP/2: the server preface may be waiting already, a dead one fails the session */
+		c = ph->idle[--ph->idle_len];
+		if (ph->is_h2 || http_conn_is_alive(c))
+			break;
+
+		p->stats.dead++;
+		http_conn_free(c, 0);
+		c = NULL;
+	}
+
+	if (c != NULL) {
+		/* resolved already: by an earlier request, or the warmer */
+		PROBE(cache_hit, "conn", host);
+		c->dns_ns = 0;
+		p->stats.reuses += (c->reqs > 0);
+		*is_reused = (c->reqs > 0);
+		goto out1;
+	}
+
+	if (ph->busy_len >= CONFIG_HTTP_POOL_HOST_CONNS_MAX) {
+		if (is_waiting == 0)
+			p->stats.waits++;
+
+		goto wait0;
+	}
+
+	PROBE(cache_miss, "conn", host);
+	ALLOC_SUB_BEGIN(ALLOC_SUB_HTTP);
+	c = calloc(1, sizeof(*c));
+	ALLOC_SUB_END();
+	if (c == NULL) {
+		LOG_ERRNO(COLOR_REGULAR_YELLOW("http_pool_get: calloc"));
+		goto out0;
+	}
+
+	c->host_idx = (unsigned)(ph - p->hosts);
+	c->id = ++p->conn_id;
+	c->is_fastopen = 1;
+	*is_reused = 0;
+
+	/* the slot is taken, the DNS lookup and the connect go without the lock */
+	ph->busy_len++;
+	p->stats.checkouts++;
+	pthread_mutex_unlock(&p->mutex);
+
+	if (http_pool_connect(p, ph, c) < 0) {
+		const int errnum = errno;
+		pthread_mutex_lock(&p->mutex);
+		ph->busy_len--;
+		p->stats.checkouts--;
+		http_pool_wake(ph);
+		pthread_mutex_unlock(&p->mutex);
+
+		free(c);
+		errno = errnum;
+		return NULL;
+	}
+
+	return c;
+
+out1:
+	ph->busy_len++;
+	p->stats.checkouts++;
+	goto out0;
+
+wait0:
+	/* emptied and filled under the lock: no wake up is lost */
+	http_pool_wait(ph, wake_fd);
+	errno = EAGAIN;
+
+out0:
+	pthread_mutex_unlock(&p->mutex);
+	return c;
+}
+
+
+static void
+http_pool_put(HttpPool *p, HttpConn *c, int is_reusable)
+{
+	pthread_mutex_lock(&p->mutex);
+
+	HttpPoolHost *const ph = &p->hosts[c->host_idx];
+	ph->busy_len--;
+	http_pool_wake(ph);
+
+#ifdef WITH_TLS
+	/* TLS 1.3: the tickets arrive after the handshake, take the latest one */
+	if ((c->ssl != NULL) && c->is_ready) {
+		SSL_SESSION *const session = SSL_get1_session(c->ssl);
+		if ((session != NULL) && (session != ph->session) && SSL_SESSION_is_resumable(session)) {
+			if (ph->session != NULL)
+				SSL_SESSION_free(ph->session);
+
+			ph->session = session;
+			ph->is_session_dirty = 1;
+		} else if (session != NULL) {
+			SSL_SESSION_free(session);
+		}
+	}
+#endif
+
+	if (is_reusable && (ph->idle_len < LEN(ph->idle))) {
+		c->reqs++;
+		c->idle_since = time_now_ns();
+		ph->idle[ph->idle_len++] = c;
+		c = NULL;
+	}
+
+	pthread_mutex_unlock(&p->mutex);
+
+	if (c != NULL)
+		http_conn_free(c, is_reusable);
+
+	http_pool_reap(p);
+}
+
+
+static void
+http_pool_wake(HttpPoolHost *host)
+{
+	const uint64_t val = 1;
+	if (write(host->wake_fd, &val, sizeof(val)) < 0) {
+		/* EAGAIN: full, still readable */
+	}
+}
+
+
+static void
+http_pool_wait(HttpPoolHost *host, int *wake_fd)
+{
+	if (wake_fd == NULL)
+		return;
+
+	uint64_t val;
+	if (read(host->wake_fd, &val, sizeof(val)) < 0) {
+		/* EAGAIN: empty already */
+	}
+
+	*wake_fd = host->wake_fd;
+}
+
+
+static int
+http_pool_reconnect(HttpPool *p, HttpConn *c)
+{
+#ifdef WITH_TLS
+	if (c->ssl != NULL) {
+		tls_free(c->ssl, 0);
+		c->ssl = NULL;
+	}
+#endif
+
+	close(c->fd);
+	c->fd = -1;
+	c->addr_idx++;
+
+	return http_pool_connect(p, &p->hosts[c->host_idx], c);
+}
+
+
+static void
+http_pool_reap(HttpPool *p)
+{
+	const int64_t deadline = time_now_ns() - ((int64_t)CONFIG_HTTP_POOL_IDLE_TIMEOUT * 1000000);
+	pthread_mutex_lock(&p->mutex);
+
+	for (unsigned i = 0; i < p->hosts_len; i++) {
+		HttpPoolHost *const ph = &p->hosts[i];
+
+		/* the oldest connections are on the bottom */
+		unsigned count = 0;
+		while ((count < ph->idle_len) && (ph->idle[count]->idle_since < deadline)) {
+			http_conn_free(ph->idle[count], 1);
+			count++;
+		}
+
+		if (count == 0)
+			continue;
+
+		ph->idle_len -= count;
+		memmove(ph->idle, ph->idle + count, ph->idle_len * sizeof(*ph->idle));
+		p->stats.reaped += count;
+	}
+
+	pthread_mutex_unlock(&p->mutex);
+}
+
+
+static void
+http_pool_get_stats(HttpPool *p, HttpPoolStats *s)
+{
+	pthread_mutex_lock(&p->mutex);
+	*s = p->stats;
+	s->limit_window = (unsigned long)p->limit;
+	s->breaker = HTTP_POOL_BREAKER_CLOSED;
+	for (unsigned i = 0; i < p->hosts_len; i++)
+		s->breaker = MAX(s->breaker, p->hosts[i].breaker);
+
+	pthread_mutex_unlock(&p->mutex);
+}
+
+
+static void
+http_pool_fastopen_done(HttpPool *p, HttpConn *c)
+{
+	const int is_used = net_tcp_is_fastopen_used(c->fd);
+	c->is_fastopen = 0;
+
+	pthread_mutex_lock(&p->mutex);
+	p->stats.tfo_used += is_used;
+	pthread_mutex_unlock(&p->mutex);
+}
+
+
+static int
+http_pool_lat_cmp(const void *a, const void *b)
+{
+	const uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+	return (x > y) - (x < y);
+}
+
+
+static void
+http_pool_latency_add(HttpPool *p, int64_t ns)
+{
+	const int64_t us = ns / 1000;
+	pthread_mutex_lock(&p->mutex);
+
+	p->lat[p->lat_count % LEN(p->lat)] = (uint32_t)MIN(us, (int64_t)UINT32_MAX);
+	p->lat_count++;
+	if (p->lat_len < LEN(p->lat))
+		p->lat_len++;
+
+	pthread_mutex_unlock(&p->mutex);
+}
+
+
+static int64_t
+http_pool_hedge_delay(HttpPool *p, int pct)
+{
+	int64_t ret = -1;
+	pthread_mutex_lock(&p->mutex);
+
+	p->hedge_tokens = MIN(p->hedge_tokens + p->hedge_rate, 100 * CONFIG_HTTP_HEDGE_BURST);
+	if (p->lat_len < CONFIG_HTTP_HEDGE_SAMPLES_MIN)
+		goto out0;
+
+	/* sorted again after every 16 new samples */
+	if ((p->lat_sorted_count == 0) || ((p->lat_count - p->lat_sorted_count) >= 16)) {
+		memcpy(p->lat_sorted, p->lat, p->lat_len * sizeof(*p->lat));
+		qsort(p->lat_sorted, p->lat_len, sizeof(*p->lat_sorted), http_pool_lat_cmp);
+		p->lat_sorted_count = p->lat_count;
+	}
+
+	const unsigned idx = (unsigned)(((unsigned long)(p->lat_len - 1) * (unsigned)pct) / 100);
+	ret = MAX((int64_t)p->lat_sorted[idx] * 1000, (int64_t)CONFIG_HTTP_HEDGE_DELAY_MIN * 1000000);
+
+out0:
+	pthread_mutex_unlock(&p->mutex);
+	return ret;
+}
+
+
+static int
+http_pool_hedge_take(HttpPool *p, int is_race)
+{
+	int ret = 0;
+	pthread_mutex_lock(&p->mutex);
+
+	if (is_race) {
+		p->stats.hedges++;
+		ret = 1;
+	} else if (p->hedge_tokens >= 100) {
+		p->hedge_tokens -= 100;
+		p->stats.hedges++;
+		ret = 1;
+	}
+
+	pthread_mutex_unlock(&p->mutex);
+	return ret;
+}
+
+
+static int64_t
+http_pool_limit_take(HttpPool *p, size_t chars, int is_waiting, int is_bulk)
+{
+	int64_t ret = 0;
+	pthread_mutex_lock(&p->mutex);
+
+	unsigned window = (p->is_limit) ? (unsigned)p->limit : UINT32_MAX;
+	if (is_bulk && p->is_limit)
+		window -= (window * CONFIG_HTTP_BULK_RESERVE) / 100;
+
+	if (p->limit_inflight >= window) {
+		ret = -1;
+		goto out0;
+	}
+
+	if ((p->rps > 0) || (p->cps > 0)) {
+		const int64_t now = time_now_ns();
+		http_pool_bucket_fill(p, now);
+
+		/* a text longer than the burst: when the bucket is full, it goes into debt */
+		const double need = (p->cps > 0) ? MIN((double)chars, (double)p->cps) : 0.0;
+		double wait = 0.0;
+		if ((p->rps > 0) && (p->rps_tokens < 1.0))
+			wait = (1.0 - p->rps_tokens) / p->rps;
+
+		if ((p->cps > 0) && (p->cps_tokens < need))
+			wait = MAX(wait, (need - p->cps_tokens) / p->cps);
+
+		if (wait > 0.0) {
+			ret = MAX((int64_t)(wait * 1e9), 1);
+			goto out0;
+		}
+
+		p->rps_tokens -= 1.0;
+		p->cps_tokens -= (double)chars;
+	}
+
+	p->limit_inflight++;
+
+out0:
+	if ((ret != 0) && (is_waiting == 0))
+		p->stats.limit_queued++;
+
+	pthread_mutex_unlock(&p->mutex);
+	return ret;
+}
+
+
+static void
+http_pool_limit_put(HttpPool *p, int signal, int64_t latency)
+{
+	const int64_t now = time_now_ns();
+	pthread_mutex_lock(&p->mutex);
+
+	p->limit_inflight--;
+	if (signal == HTTP_POOL_LIMIT_OK) {
+		p->lat_fast = (p->lat_fast == 0.0) ? latency : ((p->lat_fast * 0.8) + (latency * 0.2));
+		p->lat_slow = (p->lat_slow == 0.0) ? latency : ((p->lat_slow * 0.98) + (latency * 0.02));
+
+		/* the latency is rising: the server is queueing */
+		if (p->lat_fast > (p->lat_slow * CONFIG_HTTP_LIMIT_LATENCY_RATIO))
+			signal = HTTP_POOL_LIMIT_OVERLOAD;
+	}
+
+	switch (signal) {
+	case HTTP_POOL_LIMIT_OK:
+		/* slow start: +1 per reply, then +1 per window */
+		p->limit += (p->is_limit_cut) ? (1.0 / p->limit) : 1.0;
+		p->limit = MIN(p->limit, (double)MAX(p->limit_max, 1));
+		break;
+	case HTTP_POOL_LIMIT_OVERLOAD:
+		/* once per round trip: the replies of the same window carry the same news */
+		if (now < p->limit_hold_until)
+			break;
+
+		p->limit = MAX(p->limit * CONFIG_HTTP_LIMIT_DECREASE, 1.0);
+		p->is_limit_cut = 1;
+		p->limit_hold_until = now + (int64_t)MAX(p->lat_fast, 1e6);
+		p->lat_slow = MAX(p->lat_slow, p->lat_fast);
+		p->stats.limit_cuts++;
+		break;
+	}
+
+	pthread_mutex_unlock(&p->mutex);
+}
+
+
+static void
+http_pool_bucket_fill(HttpPool *p, int64_t now)
+{
+	/* one second of burst */
+	const double elapsed = (p->bucket_at == 0) ? 1.0 : ((double)(now - p->bucket_at) / 1e9);
+	p->bucket_at = now;
+	p->rps_tokens = MIN(p->rps_tokens + (elapsed * p->rps), (double)p->rps);
+	p->cps_tokens = MIN(p->cps_tokens + (elapsed * p->cps), (double)p->cps);
+}
+
+
+static int
+http_pool_breaker_take(HttpPool *p, const char host[], const char port[], int is_tls, int is_h2,
+		       HttpPoolHost **ret_host, int *is_probe)
+{
+	int ret = 1;
+	*ret_host = NULL;
+	*is_probe = 0;
+	if (p->is_breaker == 0)
+		return 1;
+
+	pthread_mutex_lock(&p->mutex);
+
+	HttpPoolHost *const ph = http_pool_host_get(p, host, port, is_tls, is_h2);
+	if (ph == NULL)
+		goto out0;
+
+	if ((ph->breaker == HTTP_POOL_BREAKER_OPEN) && (time_now_ns() >= ph->open_until))
+		http_pool_breaker_reset(ph, HTTP_POOL_BREAKER_HALF_OPEN);
+
+	switch (ph->breaker) {
+	case HTTP_POOL_BREAKER_HALF_OPEN:
+		if (ph->probes >= CONFIG_HTTP_BREAKER_PROBES) {
+			ret = 0;
+			break;
+		}
+
+		ph->probes++;
+		*is_probe = 1;
+		/* FALLTHROUGH */
+	case HTTP_POOL_BREAKER_CLOSED:
+		*ret_host = ph;
+		break;
+	default:
+		ret = 0;
+		break;
+	}
+
+	p->stats.breaker_rejects += (ret == 0);
+
+out0:
+	pthread_mutex_unlock(&p->mutex);
+	return ret;
+}
+
+
+static void
+http_pool_breaker_put(HttpPool *p, HttpPoolHost *host, int is_probe, int result)
+{
+	pthread_mutex_lock(&p->mutex);
+
+	if (is_probe && (host->probes > 0))
+		host->probes--;
+
+	if (result < 0)
+		goto out0;
+
+	switch (host->breaker) {
+	case HTTP_POOL_BREAKER_HALF_OPEN:
+		if (is_probe == 0)
+			break;
+
+		if (result == 0)
+			goto trip0;
+
+		if (++host->probes_ok >= CONFIG_HTTP_BREAKER_PROBES)
+			http_pool_breaker_reset(host, HTTP_POOL_BREAKER_CLOSED);
+
+		break;
+	case HTTP_POOL_BREAKER_CLOSED:
+		if (host->results_len == LEN(host->results))
+			host->failures -= host->results[host->results_pos];
+		else
+			host->results_len++;
+
+		host->results[host->results_pos] = (result == 0);
+		host->results_pos = (host->results_pos + 1) % LEN(host->results);
+		host->failures += (result == 0);
+
+		if ((host->results_len >= CONFIG_HTTP_BREAKER_VOLUME) &&
+		    ((host->failures * 100) >= (host->results_len * CONFIG_HTTP_BREAKER_RATE)))
+			goto trip0;
+
+		break;
+	}
+
+out0:
+	pthread_mutex_unlock(&p->mutex);
+	return;
+
+trip0:
+	http_pool_breaker_reset(host, HTTP_POOL_BREAKER_OPEN);
+	host->open_until = time_now_ns() + ((int64_t)p->breaker_cooldown * 1000000);
+	p->stats.breaker_trips++;
+	pthread_mutex_unlock(&p->mutex);
+}
+
+
+static void
+http_pool_breaker_reset(HttpPoolHost *host, int state)
+{
+	host->breaker = state;
+	host->results_len = 0;
+	host->results_pos = 0;
+	host->failures = 0;
+	host->probes_ok = 0;
+}
+
+
+static H2 *
+http_pool_h2_get(HttpPool *p, const char host[], const char port[], int is_tls)
+{
+	H2 *s = NULL;
+	pthread_mutex_lock(&p->mutex);
+
+	HttpPoolHost *const ph = http_pool_host_get(p, host, port, is_tls, 1);
+	if (ph == NULL)
+		goto out0;
+
+	if (ph->h2 == NULL)
+		ph->h2 = h2_new(p, ph);
+
+	s = ph->h2;
+
+out0:
+	pthread_mutex_unlock(&p->mutex);
+	return s;
+}
+
+
+static int
+http_pool_route_add(HttpPool *p, const char spec[], const Backend *backend)
+{
+	if (p->routes_len == LEN(p->routes)) {
+		LOG_ERR(COLOR_REGULAR_YELLOW("http_pool_route_add: too many endpoints") "\n");
+		return -1;
+	}
+
+	const char *host = spec;
+	const char *const at = strchr(spec, '@');
+	if (at != NULL) {
+		char name[16];
+		const size_t name_len = (size_t)(at - spec);
+		if (name_len >= sizeof(name))
+			goto err0;
+
+		memcpy(name, spec, name_len);
+		name[name_len] = '\0';
+		if ((backend = backend_get(name)) == NULL)
+			goto err0;
+
+		host = at + 1;
+	}
+
+	HttpPoolRoute *const r = &p->routes[p->routes_len];
+	const char *const sep = strrchr(host, ':');
+	const size_t host_len = (sep != NULL) ? (size_t)(sep - host) : strlen(host);
+	const size_t port_len = (sep != NULL) ? strlen(sep + 1) : 0;
+	if ((host_len == 0) || (host_len >= sizeof(r->host)) || (port_len >= sizeof(r->port)))
+		goto err0;
+
+	if ((sep != NULL) && ((port_len == 0) || (strspn(sep + 1, "0123456789") != port_len)))
+		goto err0;
+
+	memset(r, 0, sizeof(*r));
+	r->backend = backend;
+	memcpy(r->host, host, host_len);
+	if (sep != NULL)
+		memcpy(r->port, sep + 1, port_len);
+
+	p->routes_len++;
+	return 0;
+
+err0:
+	LOG_ERR(COLOR_REGULAR_YELLOW("http_pool_route_add: invalid endpoint: \"%s\"") "\n",
+		spec);
+	return -1;
+}
+
+
+static int
+http_pool_route_pick(HttpPool *p, int type, int exclude, int is_best)
+{
+	pthread_mutex_lock(&p->mutex);
+
+	const int ret = http_pool_route_find(p, type, exclude, is_best);
+	if (ret >= 0) {
+		p->routes[ret].inflight++;
+		p->routes[ret].picks++;
+	}
+
+	pthread_mutex_unlock(&p->mutex);
+	return ret;
+}
+
+
+static int
+http_pool_route_peek(HttpPool *p, int type)
+{
+	pthread_mutex_lock(&p->mutex);
+	const int ret = http_pool_route_find(p, type, -1, 1);
+	pthread_mutex_unlock(&p->mutex);
+	return ret;
+}
+
+
+static int
+http_pool_route_find(HttpPool *p, int type, int exclude, int is_best)
+{
+	int cands[CONFIG_HTTP_ROUTES_MAX];
+	unsigned cands_len = 0;
+	for (unsigned i = 0; i < p->routes_len; i++) {
+		if (((int)i != exclude) && backend_is_capable(p->routes[i].backend, type))
+			cands[cands_len++] = (int)i;
+	}
+
+	if (cands_len == 0)
+		return -1;
+
+	/* two of them: both are the random choices */
+	if (is_best || (cands_len <= 2)) {
+		int ret = cands[0];
+		for (unsigned i = 1; i < cands_len; i++) {
+			if (http_pool_route_score(&p->routes[cands[i]]) <
+			    http_pool_route_score(&p->routes[ret]))
+				ret = cands[i];
+		}
+
+		return ret;
+	}
+
+	const unsigned a = (unsigned)rand_r(&p->route_seed) % cands_len;
+	unsigned b = (unsigned)rand_r(&p->route_seed) % (cands_len - 1);
+	if (b >= a)
+		b++;
+
+	if (http_pool_route_score(&p->routes[cands[b]]) < http_pool_route_score(&p->routes[cands[a]]))
+		return cands[b];
+
+	return cands[a];
+}
+
+
+static double
+http_pool_route_score(const HttpPoolRoute *r)
+{
+	/* no sample yet: 0, so every endpoint is tried */
+	const double lat = (r->lat / 1e6) + 1.0;
+	const double err = 1.0 + ((CONFIG_HTTP_ROUTER_ERROR_COST - 1.0) * r->err);
+	return lat * err * (double)(r->inflight + 1);
+}
+
+
+static void
+http_pool_route_put(HttpPool *p, int idx, int64_t latency, int result)
+{
+	pthread_mutex_lock(&p->mutex);
+
+	HttpPoolRoute *const r = &p->routes[idx];
+	r->inflight--;
+	if (result >= 0) {
+		r->err += CONFIG_HTTP_ROUTER_ERROR_ALPHA * ((double)(result == 0) - r->err);
+		r->fails += (result == 0);
+	}
+
+	if (latency >= 0) {
+		/* peak EWMA: up at once, down with the time since the last sample */
+		const int64_t now = time_now_ns();
+		if ((r->lat_at == 0) || ((double)latency > r->lat)) {
+			r->lat = (double)latency;
+		} else {
+			const double decay = (double)CONFIG_HTTP_ROUTER_DECAY * 1e6;
+			const double w = decay / (decay + (double)(now - r->lat_at));
+			r->lat = (r->lat * w) + ((double)latency * (1.0 - w));
+		}
+
+		r->lat_at = now;
+	}
+
+	pthread_mutex_unlock(&p->mutex);
+}
+
+
+static void
+http_pool_prewarm(HttpPool *p, const char host[], const char port[], int is_tls, int is_h2)
+{
+	pthread_mutex_lock(&p->mutex);
+
+	HttpPoolHost *const ph = http_pool_host_get(p, host, port, is_tls, is_h2);
+	if ((ph == NULL) || (ph->idle_len > 0) || (ph->warming > 0))
+		goto out0;
+
+	/* the session holds its connection as long as it's usable */
+	if ((ph->h2 != NULL) && h2_is_connected(ph->h2))
+		goto out0;
+
+	if ((ph->busy_len + ph->idle_len) >= CONFIG_HTTP_POOL_HOST_CONNS_MAX)
+		goto out0;
+
+	ALLOC_SUB_BEGIN(ALLOC_SUB_HTTP);
+	HttpPoolWarm *const w = malloc(sizeof(*w));
+	ALLOC_SUB_END();
+	if (w == NULL)
+		goto out0;
+
+	w->pool = p;
+	w->host_idx = (unsigned)(ph - p->hosts);
+
+	/* detached: nothing waits for it here, the other hosts are warmed up in parallel */
+	pthread_t warmer;
+	pthread_attr_t attr;
+	int ret = pthread_attr_init(&attr);
+	if (ret == 0) {
+		ret = pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+		if (ret == 0)
+			ret = pthread_create(&warmer, &attr, http_pool_prewarm_thrd, w);
+
+		pthread_attr_destroy(&attr);
+	}
+
+	if (ret != 0) {
+		LOG_ERR(COLOR_REGULAR_YELLOW("http_pool_prewarm: pthread_create: failed") "\n");
+		free(w);
+		goto out0;
+	}
+
+	ph->warming++;
+
+out0:
+	pthread_mutex_unlock(&p->mutex);
+}
+
+
+static void *
+http_pool_prewarm_thrd(void *udata)
+{
+	HttpPoolWarm *const w = (HttpPoolWarm *)udata;
+	HttpPool *const p = w->pool;
+	const unsigned host_idx = w->host_idx;
+	free(w);
+
+	ALLOC_SUB_BEGIN(ALLOC_SUB_HTTP);
+	HttpConn *c = calloc(1, sizeof(*c));
+	ALLOC_SUB_END();
+	const int64_t start = time_now_ns();
+
+	pthread_mutex_lock(&p->mutex);
+	HttpPoolHost *const ph = &p->hosts[host_idx];
+	if (c != NULL) {
+		c->host_idx = host_idx;
+		c->id = ++p->conn_id;
+	}
+	pthread_mutex_unlock(&p->mutex);
+
+	/* no TCP Fast Open: the handshake must happen now, not on the first write */
+	if ((c != NULL) && (http_pool_connect(p, ph, c) < 0)) {
+		free(c);
+		c = NULL;
+	}
+
+	while (c != NULL) {
+		int ret;
+		struct pollfd pfd = { .fd = c->fd };
+		if (c->is_connecting)
+			pfd.events = POLLOUT;
+		else if ((ret = http_conn_handshake(p, c)) == 1)
+			pfd.events = c->events;
+		else if (ret == 0)
+			break;
+		else
+			goto err0;
+
+		const int rv = poll(&pfd, 1, CONFIG_HTTP_POOL_WARM_TIMEOUT);
+		if ((rv < 0) && (errno == EINTR))
+			continue;
+
+		if (rv <= 0)
+			goto err0;
+
+		if (c->is_connecting) {
+			if (net_tcp_connect_check(c->fd) < 0)
+				goto err0;
+
+			c->is_connecting = 0;
+		}
+	}
+
+	if ((c != NULL) && trace_is_on(&p->trace))
+		trace_span(&p->trace, "prewarm", "pool", start, time_now_ns(), 0, 0, c->id, NULL, 0);
+
+	pthread_mutex_lock(&p->mutex);
+	if ((c != NULL) && (ph->idle_len < LEN(ph->idle))) {
+		c->idle_since = time_now_ns();
+		ph->idle[ph->idle_len++] = c;
+		p->stats.warmed++;
+		c = NULL;
+	}
+	goto out0;
+
+err0:
+	pthread_mutex_lock(&p->mutex);
+
+out0:
+	/* the pool may be freed as soon as warming drops to 0: nothing of it after that */
+	if (c != NULL)
+		http_conn_free(c, 0);
+
+	ph->warming--;
+	http_pool_wake(ph);
+	pthread_mutex_unlock(&p->mutex);
+	return NULL;
+}
+
+
+static void
+http_conn_free(HttpConn *c, int is_graceful)
+{
+#ifdef WITH_TLS
+	if (c->ssl != NULL)
+		tls_free(c->ssl, is_graceful && c->is_ready);
+#else
+	(void)is_graceful;
+#endif
+
+	close(c->fd);
+	free(c);
+}
+
+
+static int
+http_conn_is_alive(HttpConn *c)
+{
+#ifdef WITH_TLS
+	if (c->ssl != NULL)
+		return tls_is_alive(c->ssl, c->fd);
+#endif
+
+	return net_is_alive(c->fd);
+}
+
+
+static int
+http_conn_handshake(HttpPool *p, HttpConn *c)
+{
+	if (c->is_ready)
+		return 0;
+
+#ifdef WITH_TLS
+	const int ret = tls_handshake(c->ssl, &c->events);
+	if (ret != 0)
+		return ret;
+
+	c->is_ready = 1;
+	c->events = 0;
+
+	pthread_mutex_lock(&p->mutex);
+	p->stats.tls_handshakes++;
+	p->stats.tls_resumed += (SSL_session_reused(c->ssl) == 1);
+	pthread_mutex_unlock(&p->mutex);
+	return 0;
+#else
+	(void)p;
+	return -1;
+#endif
+}
+
+
+static ssize_t
+http_conn_writev(HttpConn *c, const struct iovec iovs[], int iovs_len, Buffer *flat)
+{
+#ifdef WITH_TLS
+	if (c->ssl != NULL) {
+		if (iovs_len == 1)
+			return tls_write(c->ssl, iovs[0].iov_base, iovs[0].iov_len, &c->events);
+
+		size_t len = 0;
+		for (int i = 0; i < iovs_len; i++)
+			len += iovs[i].iov_len;
+
+		if (buffer_check(flat, len + 1) < 0)
+			return -1;
+
+		len = 0;
+		for (int i = 0; i < iovs_len; i++) {
+			memcpy(flat->ptr + len, iovs[i].iov_base, iovs[i].iov_len);
+			len += iovs[i].iov_len;
+		}
+
+		return tls_write(c->ssl, flat->ptr, len, &c->events);
+	}
+#else
+	(void)flat;
+#endif
+
+	const struct msghdr msg = {
+		.msg_iov    = (struct iovec *)iovs,
+		.msg_iovlen = (size_t)iovs_len,
+	};
+
+	c->events = POLLOUT;
+	return sendmsg(c->fd, &msg, MSG_NOSIGNAL);
+}
+
+
+static ssize_t
+http_conn_read(HttpConn *c, void *buf, size_t len)
+{
+#ifdef WITH_TLS
+	if (c->ssl != NULL)
+		return tls_read(c->ssl, buf, len, &c->events);
+#endif
+
+	c->events = POLLIN;
+	return recv(c->fd, buf, len, 0);
+}
+
+
+static size_t
+http_conn_pending(HttpConn *c)
+{
+#ifdef WITH_TLS
+	if (c->ssl != NULL)
+		return (size_t)SSL_pending(c->ssl);
+#else
+	(void)c;
+#endif
+
+	return 0;
+}
+
+
+/*
+ * Http
+ */
+static int
+http_init(Http *h, HttpPool *pool)
+{
+	memset(h, 0, sizeof(*h));
+	if (buffer_init(&h->buffer, CONFIG_BUFFER_SIZE * 3) < 0) {
+		LOG_ERRNO(COLOR_REGULAR_YELLOW("http_init: buffer_init"));
+		return -1;
+	}
+
+	if (buffer_init(&h->text, CONFIG_BUFFER_SIZE) < 0) {
+		LOG_ERRNO(COLOR_REGULAR_YELLOW("http_init: buffer_init"));
+		buffer_deinit(&h->buffer);
+		return -1;
+	}
+
+	if (buffer_init(&h->flat, CONFIG_BUFFER_SIZE) < 0) {
+		LOG_ERRNO(COLOR_REGULAR_YELLOW("http_init: buffer_init"));
+		buffer_deinit(&h->text);
+		buffer_deinit(&h->buffer);
+		return -1;
+	}
+
+	h->pool = pool;
+	h->state = HTTP_STATE_DONE;
+	h->wake_fd = -1;
+	h->lane = ++pool->trace_lanes;
+
+	h->backend = backend_get(CONFIG_BACKEND);
+	h->host = NULL;
+	h->port = NULL;
+	h->api_key = CONFIG_LIBRE_API_KEY;
+	h->is_tls = CONFIG_HTTP_TLS;
+	h->is_h2 = CONFIG_HTTP2;
+	h->retries = CONFIG_HTTP_RETRIES;
+	h->timeout = CONFIG_HTTP_TIMEOUT;
+	h->hedge_pct = CONFIG_HTTP_HEDGE;
+	h->seed = (unsigned)time_now_ns() ^ (unsigned)(uintptr_t)h;
+
+	http_iov_set(h, HTTP_IOV_PROTOCOL, CONFIG_HTTP_PROTOCOL, sizeof(CONFIG_HTTP_PROTOCOL) - 1);
+	http_iov_set(h, HTTP_IOV_HOST_KEY, "Host: ", 6);
+	http_iov_set(h, HTTP_IOV_HOST_END, "\r\n", 2);
+	http_iov_set(h, HTTP_IOV_HEADER, CONFIG_HTTP_HEADER, sizeof(CONFIG_HTTP_HEADER) - 1);
+	http_iov_set(h, HTTP_IOV_HEADER_END, "\r\n", 2);
+	return 0;
+}
+
+
+static void
+http_deinit(Http *h)
+{
+	h->is_hedged = 0;
+	if (h->hedge != NULL) {
+		http_deinit(h->hedge);
+		free(h->hedge);
+	}
+
+	if (h->h2 != NULL)
+		h2_stream_cancel(h->h2, h);
+
+	if (h->conn != NULL)
+		http_release(h, 0);
+
+	buffer_deinit(&h->flat);
+	buffer_deinit(&h->text);
+	buffer_deinit(&h->buffer);
+}
+
+
+static const char *
+http_host(const Http *h)
+{
+	if (h->host != NULL)
+		return h->host;
+
+	return h->backend->host;
+}
+
+
+static const char *
+http_port(const Http *h)
+{
+	if (h->port != NULL)
+		return h->port;
+
+	return (h->is_tls) ? h->backend->tls_port : h->backend->port;
+}
+
+
+static int
+http_is_h2(const Http *h)
+{
+	return h->is_h2 && (h->backend->caps & BACKEND_CAP_H2);
+}
+
+
+static void
+http_iov_set(Http *h, int idx, const char str[], size_t len)
+{
+	h->iovs[idx].iov_base = (char *)str;
+	h->iovs[idx].iov_len = len;
+}
+
+
+static const char *
+http_url_encode(Http *h, const char plain[])
+{
+	const size_t plain_len = strlen(plain);
+	if (plain_len == 0)
+		return NULL;
+
+	/* the API key goes in the query too, encoded the same */
+	const size_t key_len = strlen(h->api_key);
+	if (buffer_check(&h->text, ((plain_len + key_len) * 3) + 2) < 0)
+		return NULL;
+
+	char *const buffer = h->text.ptr;
+	h->text_len = http_url_encode_to(buffer, plain, plain_len);
+
+	char *const key = buffer + h->text_len + 1;
+	http_url_encode_to(key, h->api_key, key_len);
+	h->api_key_enc = key;
+	return buffer;
+}
+
+
+static size_t
+http_url_encode_to(char dst[], const char plain[], size_t len)
+{
+	const char *const hex  = "0123456789abcdef";
+	const unsigned char *p = (const unsigned char *)plain;
+
+	size_t pos = 0;
+	for (size_t i = 0; i < len; i++) {
+		if (!isalnum(p[i])) {
+			dst[pos++] = '%';
+			dst[pos++] = hex[(p[i] >> 4u) & 15u];
+			dst[pos++] = hex[p[i] & 15u];
+			continue;
+		}
+
+		dst[pos++] = (char)p[i];
+	}
+
+	dst[pos] = '\0';
+	return pos;
+}
+
+
+static void
+http_build_request(Http *h, int type, const char sl[], const char tl[], const char hl[],
+		     const char text[], size_t text_len)
+{
+	/*
+	 * METHOD path[HTTP_IOV_PARTS_SIZE] PROTOCOL
+	 * Host: host
+	 * header
+	 * content (Content-Type, Content-Length)
+	 *
+	 * body[HTTP_IOV_PARTS_SIZE]
+	 */
+	for (int i = 0; i < HTTP_IOV_PARTS_SIZE; i++) {
+		h->iovs[HTTP_IOV_PATH + i].iov_len = 0;
+		h->iovs[HTTP_IOV_BODY + i].iov_len = 0;
+	}
+
+	h->backend->build(h, type, sl, tl, hl, text, text_len);
+
+	const char *const host = http_host(h);
+	http_iov_set(h, HTTP_IOV_HOST_VAL, host, strlen(host));
+
+	size_t body_len = 0;
+	for (int i = 0; i < HTTP_IOV_PARTS_SIZE; i++)
+		body_len += h->iovs[HTTP_IOV_BODY + i].iov_len;
+
+	h->iovs[HTTP_IOV_CONTENT].iov_len = 0;
+	if (body_len > 0) {
+		const int ret = snprintf(h->content, sizeof(h->content),
+					 "Content-Type: %s\r\nContent-Length: %zu\r\n",
+					 h->backend->content_type, body_len);
+		http_iov_set(h, HTTP_IOV_CONTENT, h->content, (size_t)ret);
+	}
+
+	h->req_len = 0;
+	for (size_t i = 0; i < LEN(h->iovs); i++)
+		h->req_len += h->iovs[i].iov_len;
+}
+
+
+static int
+http_request(Http *h, int type, const char sl[], const char tl[], const char hl[], const char text[])
+{
+	if (http_begin(h, type, sl, tl, hl, text) < 0)
+		return -1;
+
+	while (http_is_done(h) == 0) {
+		/* HTTP/2: the stream is sent again, HTTP_STATE_BACKOFF: no fd, just sleep */
+		struct pollfd pfds[HTTP_POLLFDS];
+		if ((http_poll_set(h, pfds) == 0) && (poll(pfds, LEN(pfds), http_timeout(h)) < 0)) {
+			if (errno == EINTR)
+				continue;
+
+			const int err = errno;
+			http_cancel(h);
+			errno = err;
+			LOG_ERRNO(COLOR_REGULAR_YELLOW("http_request: poll"));
+			break;
+		}
+
+		http_poll_step(h, pfds);
+	}
+
+	return (h->state == HTTP_STATE_DONE) ? 0 : -1;
+}
+
+
+static int
+http_begin(Http *h, int type, const char sl[], const char tl[], const char hl[], const char text[])
+{
+	/* the router: one of the endpoints able to do it, see http_route() */
+	const int is_routed = (h->pool->routes_len > 0);
+	if ((is_routed == 0) && (backend_is_capable(h->backend, type) == 0)) {
+		LOG_ERR(COLOR_REGULAR_YELLOW("http_begin: %s: \"%s\" is not supported") "\n",
+			h->backend->name, result_type_str[type][1]);
+		h->state = HTTP_STATE_ERROR;
+		return -1;
+	}
+
+	ALLOC_PHASE(HTTP_PHASE_WRITE);
+	const char *const text_enc = http_url_encode(h, text);
+	if (text_enc == NULL) {
+		h->state = HTTP_STATE_ERROR;
+		return -1;
+	}
+
+	h->type = type;
+	h->sl = sl;
+	h->tl = tl;
+	h->hl = hl;
+	h->text_enc = text_enc;
+	h->route = -1;
+	if (is_routed == 0)
+		http_build_request(h, type, sl, tl, hl, text_enc, h->text_len);
+
+	/* UTF-8: the continuation bytes are not counted */
+	h->chars = 0;
+	for (const unsigned char *p = (const unsigned char *)text; *p != '\0'; p++)
+		h->chars += ((*p & 0xc0) != 0x80);
+
+	h->attempt = 0;
+	h->is_hedged = 0;
+	memset(&h->timing, 0, sizeof(h->timing));
+	h->timing.begin_at = time_now_ns();
+	h->req_id = ++h->pool->trace_reqs;
+	PROBE(request_start, h->req_id, sl, tl, h->chars, type);
+	http_attempt(h);
+	return (h->state == HTTP_STATE_ERROR) ? -1 : 0;
+}
+
+
+static void
+http_attempt(Http *h)
+{
+	h->error = 0;
+	h->error_what = NULL;
+	h->hedge_at = 0;
+
+	/* a retry: the endpoint that failed is the last choice, a hedge: the request's one */
+	int exclude = (h->parent != NULL) ? h->parent->route : ((h->attempt > 0) ? h->route : -1);
+	for (unsigned i = 0; ; i++) {
+		if (http_route(h, exclude) < 0) {
+			LOG_ERR(COLOR_REGULAR_YELLOW("http_attempt: no endpoint for \"%s\"") "\n",
+				result_type_str[h->type][1]);
+			h->state = HTTP_STATE_ERROR;
+			return;
+		}
+
+		if (http_pool_breaker_take(h->pool, http_host(h), http_port(h), h->is_tls,
+					   http_is_h2(h), &h->breaker, &h->is_probe))
+			break;
+
+		h->error = EHOSTDOWN;
+		h->error_what = "circuit open";
+		if ((h->has_route == 0) || ((i + 1) >= h->pool->routes_len)) {
+			http_end(h, HTTP_STATE_ERROR);
+			return;
+		}
+
+		/* the router: an open circuit counts as a failure of the endpoint */
+		http_attempt_done(h);
+		exclude = h->route;
+	}
+
+	h->error = 0;
+	h->error_what = NULL;
+
+	h->state = HTTP_STATE_QUEUE;
+	h->wait_at = time_now_ns();
+	http_dequeue(h, 0);
+}
+
+
+static int
+http_route(Http *h, int exclude)
+{
+	HttpPool *const p = h->pool;
+	if (p->routes_len == 0)
+		return 0;
+
+	int idx = http_pool_route_pick(p, h->type, exclude, p->is_race);
+	if ((idx < 0) && (exclude >= 0))
+		idx = http_pool_route_pick(p, h->type, -1, p->is_race);
+
+	if (idx < 0)
+		return -1;
+
+	h->has_route = 1;
+	if (idx == h->route)
+		return 0;
+
+	const HttpPoolRoute *const r = &p->routes[idx];
+	h->route = idx;
+	h->backend = r->backend;
+	h->host = r->host;
+	h->port = (r->port[0] != '\0') ? r->port : NULL;
+	http_build_request(h, h->type, h->sl, h->tl, h->hl, h->text_enc, h->text_len);
+	return 0;
+}
+
+
+static void
+http_dequeue(Http *h, int is_waiting)
+{
+	const int64_t wait = http_pool_limit_take(h->pool, h->chars, is_waiting, h->is_bulk);
+	h->sent_at = time_now_ns();
+	if (wait != 0) {
+		/* the window: no telling when, another thread may give a permit back */
+		h->deadline = h->sent_at + ((wait > 0) ? wait : (CONFIG_HTTP_LIMIT_TICK * 1000000));
+		return;
+	}
+
+	h->has_permit = 1;
+	h->phase_at = h->sent_at;
+	if (is_waiting)
+		http_trace(h, "queue", h->wait_at, h->sent_at, NULL, 0);
+	h->deadline = (h->timeout > 0) ? (h->sent_at + ((int64_t)h->timeout * 1000000)) : 0;
+
+	/* one hedge per request */
+	const int is_race = h->pool->is_race && (h->pool->routes_len > 1);
+	if ((h->hedge_pct > 0) && (h->parent == NULL) && (h->is_hedged == 0) && (is_race == 0)) {
+		const int64_t delay = http_pool_hedge_delay(h->pool, MIN(h->hedge_pct, 100));
+		if (delay >= 0)
+			h->hedge_at = h->sent_at + delay;
+	}
+
+	h->state = HTTP_STATE_POOL;
+	http_acquire(h, 0);
+
+	/* race: the second best endpoint at once */
+	if (is_race && (h->parent == NULL) && (h->is_hedged == 0) && (http_is_done(h) == 0) &&
+	    (h->state != HTTP_STATE_BACKOFF))
+		http_hedge_start(h);
+}
+
+
+static void
+http_attempt_done(Http *h)
+{
+	const int is_done = (h->state == HTTP_STATE_DONE);
+	if (h->has_permit) {
+		int signal = HTTP_POOL_LIMIT_NONE;
+		if (is_done) {
+			signal = ((h->status == 429) || (h->status == 503)) ? HTTP_POOL_LIMIT_OVERLOAD
+									     : HTTP_POOL_LIMIT_OK;
+		} else if (h->error == ETIMEDOUT) {
+			signal = HTTP_POOL_LIMIT_OVERLOAD;
+		}
+
+		h->has_permit = 0;
+		http_pool_limit_put(h->pool, signal, time_now_ns() - h->sent_at);
+	}
+
+	if (h->breaker != NULL) {
+		/* a 429 is the limit's business, the server is up */
+		int result = -1;
+		if (is_done)
+			result = (h->status < 500);
+		else if (h->error != 0)
+			result = 0;
+
+		http_pool_breaker_put(h->pool, h->breaker, h->is_probe, result);
+		h->breaker = NULL;
+	}
+
+	if (h->has_route) {
+		/* a 429 too: the other endpoints are preferred meanwhile */
+		int result = -1;
+		int64_t latency = -1;
+		if (is_done) {
+			result = (h->status < 500) && (h->status != 429);
+			latency = time_now_ns() - h->sent_at;
+		} else if (h->error != 0) {
+			result = 0;
+			if (h->error == ETIMEDOUT)
+				latency = time_now_ns() - h->sent_at;
+		}
+
+		h->has_route = 0;
+		http_pool_route_put(h->pool, h->route, latency, result);
+	}
+}
+
+
+static void
+http_acquire(Http *h, int is_waiting)
+{
+	h->buffer_len = 0;
+	h->head_len = 0;
+	h->body_len = 0;
+	h->status = 0;
+	h->wake_fd = -1;
+	if (h->pool->replay_dir[0] != '\0') {
+		http_replay(h);
+		return;
+	}
+
+	if (http_is_h2(h)) {
+		H2 *const s = http_pool_h2_get(h->pool, http_host(h), http_port(h), h->is_tls);
+		if ((s != NULL) && (h2_stream_open(s, h) == 0)) {
+			h->timing.sent += h->req_len;
+			http_phase(h, HTTP_PHASE_WRITE);
+			h->state = HTTP_STATE_READ;
+			return;
+		}
+
+		if ((s != NULL) && (errno == EAGAIN))
+			return;
+
+		if ((s == NULL) || (errno != EPROTONOSUPPORT)) {
+			h->error = errno;
+			http_end(h, HTTP_STATE_ERROR);
+			return;
+		}
+
+		/* ALPN: HTTP/1.1 only */
+		h->is_h2 = 0;
+	}
+
+	h->conn = http_pool_get(h->pool, http_host(h), http_port(h), h->is_tls, 0, is_waiting,
+				h->is_bulk, &h->is_reused, &h->wake_fd);
+	if (h->conn == NULL) {
+		if (errno != EAGAIN) {
+			h->error = errno;
+			http_end(h, HTTP_STATE_ERROR);
+		}
+
+		return;
+	}
+
+	/* a new connection: resolved in http_pool_get() */
+	http_phase(h, HTTP_PHASE_CONNECT);
+	if (h->is_reused == 0) {
+		h->timing.phases[HTTP_PHASE_CONNECT] -= h->conn->dns_ns;
+		h->timing.phases[HTTP_PHASE_DNS] += h->conn->dns_ns;
+	}
+
+	h->req_written = 0;
+	h->conn->events = 0;
+	if (h->conn->is_connecting) {
+		h->state = HTTP_STATE_CONNECT;
+	} else if (h->conn->is_ready == 0) {
+		h->state = HTTP_STATE_HANDSHAKE;
+	} else {
+		/* connected at once, or warmed up */
+		if (h->is_reused == 0) {
+			PROBE(connect, h->conn->id, http_host(h), http_port(h),
+			      h->timing.phases[HTTP_PHASE_DNS] + h->timing.phases[HTTP_PHASE_CONNECT]);
+		}
+
+		h->state = HTTP_STATE_WRITE;
+	}
+}
+
+
+static void
+http_release(Http *h, int is_reusable)
+{
+	http_pool_put(h->pool, h->conn, is_reusable);
+	h->conn = NULL;
+}
+
+
+static int
+http_capture_path(const Http *h, const char dir[], char buffer[], size_t size)
+{
+	/* FNV-1a */
+	uint64_t key = 0xcbf29ce484222325ull;
+	const struct iovec name = { (char *)h->backend->name, strlen(h->backend->name) + 1 };
+	for (int i = -1; i < HTTP_IOVS_SIZE; i++) {
+		const int is_path = (i >= HTTP_IOV_PATH) && (i < HTTP_IOV_PROTOCOL);
+		if ((i >= 0) && (i != HTTP_IOV_METHOD) && (is_path == 0) && (i < HTTP_IOV_BODY))
+			continue;
+
+		const struct iovec *const iov = (i < 0) ? &name : &h->iovs[i];
+		const unsigned char *const p = iov->iov_base;
+		for (size_t j = 0; j < iov->iov_len; j++)
+			key = (key ^ p[j]) * 0x100000001b3ull;
+	}
+
+	const int ret = snprintf(buffer, size, "%s/%016llx.http", dir, (unsigned long long)key);
+	if ((ret < 0) || ((size_t)ret >= size))
+		return -1;
+
+	return 0;
+}
+
+
+static void
+http_capture_save(const Http *h, int64_t latency)
+{
+	char path[1024];
+	char tmp[sizeof(path) + 8];
+	if (http_capture_path(h, h->pool->record_dir, path, sizeof(path)) < 0)
+		return;
+
+	/* concurrent requests may be the same: the file is replaced as a whole */
+	snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path);
+	const int fd = mkstemp(tmp);
+	if (fd < 0) {
+		LOG_ERRNO(COLOR_REGULAR_YELLOW("http_capture_save: mkstemp"));
+		return;
+	}
+
+	FILE *const file = fdopen(fd, "w");
+	if (file == NULL) {
+		LOG_ERRNO(COLOR_REGULAR_YELLOW("http_capture_save: fdopen"));
+		close(fd);
+		unlink(tmp);
+		return;
+	}
+
+	const size_t res_len = h->head_len + h->body_len;
+	fprintf(file, HTTP_CAPTURE_MAGIC " %zu %zu %lld\n", h->req_len, res_len,
+		(long long)latency);
+	for (size_t i = 0; i < LEN(h->iovs); i++)
+		fwrite(h->iovs[i].iov_base, 1, h->iovs[i].iov_len, file);
+
+	fwrite(h->buffer.ptr, 1, res_len, file);
+	if ((fclose(file) != 0) || (rename(tmp, path) < 0)) {
+		LOG_ERRNO(COLOR_REGULAR_YELLOW("http_capture_save"));
+		unlink(tmp);
+	}
+}
+
+
+static int64_t
+http_capture_load(Http *h)
+{
+	char path[1024];
+	if (http_capture_path(h, h->pool->replay_dir, path, sizeof(path)) < 0) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+
+	FILE *const file = fopen(path, "r");
+	if (file == NULL)
+		return -1;
+
+	int64_t ret = -1;
+	size_t req_len, res_len;
+	long long latency;
+	if ((fscanf(file, HTTP_CAPTURE_MAGIC " %zu %zu %lld", &req_len, &res_len, &latency) != 3) ||
+	    (fgetc(file) != '\n') || (latency < 0))
+		goto out0;
+
+	if ((fseek(file, (long)req_len, SEEK_CUR) < 0) || (buffer_check(&h->buffer, res_len + 1) < 0))
+		goto out0;
+
+	if (fread(h->buffer.ptr, 1, res_len, file) != res_len)
+		goto out0;
+
+	/* HTTP/1.1 or HTTP/2, see h2_headers_done() */
+	h->buffer.ptr[res_len] = '\0';
+	const char *const head_end = strstr(h->buffer.ptr, "\r\n\r\n");
+	if (head_end == NULL)
+		goto out0;
+
+	h->buffer_len = res_len;
+	h->head_len = (size_t)(head_end - h->buffer.ptr) + 4;
+	h->body_len = res_len - h->head_len;
+	ret = latency;
+
+out0:
+	fclose(file);
+	if (ret < 0)
+		errno = EPROTO;
+
+	return ret;
+}
+
+
+static void
+http_replay(Http *h)
+{
+	const int64_t latency = http_capture_load(h);
+	if (latency < 0) {
+		PROBE(cache_miss, "replay", h->pool->replay_dir);
+		h->error = errno;
+		h->error_what = "replay";
+		http_end(h, HTTP_STATE_ERROR);
+		return;
+	}
+
+	PROBE(cache_hit, "replay", h->pool->replay_dir);
+
+	if (h->pool->is_replay_timed == 0) {
+		http_end(h, HTTP_STATE_DONE);
+		return;
+	}
+
+	/* the same reply again: no hedge */
+	h->deadline = h->sent_at + latency;
+	h->hedge_at = 0;
+	h->state = HTTP_STATE_REPLAY;
+}
+
+
+static void
+http_phase(Http *h, int phase)
+{
+	const int64_t now = time_now_ns();
+	ALLOC_PHASE(phase + 1);
+	h->timing.phases[phase] += now - h->phase_at;
+	http_trace(h, http_phase_str[phase], h->phase_at, now, NULL, 0);
+	h->phase_at = now;
+}
+
+
+static void
+http_trace(const Http *h, const char name[], int64_t start, int64_t end, const char val_name[],
+	   long val)
+{
+	Trace *const t = &h->pool->trace;
+	if (trace_is_on(t) == 0)
+		return;
+
+	unsigned long conn = 0;
+	if (h->conn != NULL)
+		conn = h->conn->id;
+	else if ((h->h2 != NULL) && (h->h2->conn != NULL))
+		conn = h->h2->conn->id;
+
+	trace_span(t, name, "http", start, end, h->lane, h->req_id, conn, val_name, val);
+}
+
+
+static void
+http_fail(Http *h, const char what[])
+{
+	/* a reused connection may have been closed by the server while idle: start over */
+	if (h->is_reused && (h->buffer_len == 0) && (h->state != HTTP_STATE_POOL)) {
+		http_release(h, 0);
+		h->state = HTTP_STATE_POOL;
+		http_acquire(h, 0);
+		return;
+	}
+
+	h->error = errno;
+	h->error_what = what;
+	if (h->conn != NULL)
+		http_release(h, 0);
+
+	http_end(h, HTTP_STATE_ERROR);
+}
+
+
+static void
+http_end(Http *h, int state)
+{
+	h->state = state;
+	h->deadline = 0;
+	h->hedge_at = 0;
+	if (state == HTTP_STATE_DONE) {
+		const int64_t latency = time_now_ns() - h->sent_at;
+		h->status = http_status(h);
+		http_pool_latency_add(h->pool, latency);
+		if ((h->pool->record_dir[0] != '\0') && (h->pool->replay_dir[0] == '\0'))
+			http_capture_save(h, latency);
+	}
+
+	http_attempt_done(h);
+
+	if (http_is_retryable(h) && (h->attempt < h->retries)) {
+		const int64_t delay = http_retry_delay(h);
+		if (delay >= 0) {
+			h->attempt++;
+			PROBE(retry, h->req_id, h->attempt, delay, h->status, h->error);
+			h->wait_at = time_now_ns();
+			h->deadline = h->wait_at + (delay * 1000000);
+			h->state = HTTP_STATE_BACKOFF;
+			return;
+		}
+	}
+
+	h->timing.total = time_now_ns() - h->timing.begin_at;
+	h->timing.is_reused = h->is_reused;
+	h->timing.attempts = h->attempt + 1;
+	PROBE(request_end, h->req_id, h->status, h->timing.total, h->timing.received,
+	      h->timing.attempts);
+	http_trace(h, (h->parent != NULL) ? "hedge" : "request", h->timing.begin_at,
+		   h->timing.begin_at + h->timing.total, "status", h->status);
+
+	if ((state == HTTP_STATE_ERROR) && (h->error_what != NULL) && (h->parent == NULL)) {
+		LOG_ERR(COLOR_REGULAR_YELLOW("http_request: %s: %s") "\n", h->error_what,
+			strerror(h->error));
+	}
+
+	if (h->parent != NULL)
+		http_hedge_settle(h->parent);
+	else if (h->is_hedged)
+		http_hedge_settle(h);
+}
+
+
+static void
+http_cancel(Http *h)
+{
+	if (h->is_hedged) {
+		h->is_hedged = 0;
+		http_cancel(h->hedge);
+	}
+
+	h->error = 0;
+	h->error_what = NULL;
+	http_attempt_done(h);
+	if ((h->parent != NULL) && (http_is_done(h) == 0))
+		http_trace(h, "hedge", h->timing.begin_at, time_now_ns(), "cancelled", 1);
+
+	if (h->h2 != NULL) {
+		h2_stream_cancel(h->h2, h);
+	} else {
+		if (h->conn != NULL)
+			http_release(h, 0);
+
+		h->state = HTTP_STATE_ERROR;
+	}
+
+	h->deadline = 0;
+	h->hedge_at = 0;
+}
+
+
+static void
+http_hedge_start(Http *h)
+{
+	const int is_race = h->pool->is_race && (h->pool->routes_len > 1);
+	if (http_pool_hedge_take(h->pool, is_race) == 0)
+		return;
+
+	if (h->hedge == NULL) {
+		ALLOC_SUB_BEGIN(ALLOC_SUB_HTTP);
+		Http *const hg = malloc(sizeof(*hg));
+		ALLOC_SUB_END();
+		if (hg == NULL)
+			return;
+
+		if (http_init(hg, h->pool) < 0) {
+			free(hg);
+			return;
+		}
+
+		h->hedge = hg;
+	}
+
+	/* the same request, on another connection (HTTP/1.1) or stream (HTTP/2) */
+	Http *const hg = h->hedge;
+	hg->backend = h->backend;
+	hg->host = h->host;
+	hg->port = h->port;
+	hg->is_tls = h->is_tls;
+	hg->is_h2 = h->is_h2;
+	hg->is_bulk = h->is_bulk;
+	hg->timeout = h->timeout;
+	hg->retries = 0;
+	hg->parent = h;
+	memcpy(hg->iovs, h->iovs, sizeof(h->iovs));
+	hg->req_len = h->req_len;
+	hg->chars = h->chars;
+
+	/* the router: built again for its own endpoint */
+	hg->type = h->type;
+	hg->sl = h->sl;
+	hg->tl = h->tl;
+	hg->hl = h->hl;
+	hg->text_enc = h->text_enc;
+	hg->api_key_enc = h->api_key_enc;
+	hg->text_len = h->text_len;
+	hg->route = h->route;
+
+	memset(&hg->timing, 0, sizeof(hg->timing));
+	hg->timing.begin_at = time_now_ns();
+	hg->req_id = h->req_id;
+
+	h->is_hedged = 1;
+	http_attempt(hg);
+}
+
+
+static void
+http_hedge_settle(Http *h)
+{
+	if (h->is_hedged == 0)
+		return;
+
+	Http *const hg = h->hedge;
+	const int is_done = (h->state == HTTP_STATE_DONE) || (h->state == HTTP_STATE_ERROR);
+	const int is_hg_done = (hg->state == HTTP_STATE_DONE) || (hg->state == HTTP_STATE_ERROR);
+	if (h->state == HTTP_STATE_DONE) {
+		h->is_hedged = 0;
+		if (is_hg_done == 0)
+			http_cancel(hg);
+
+		return;
+	}
+
+	/* a retryable status: not a reply */
+	if ((hg->state == HTTP_STATE_DONE) && (http_is_retryable(hg) == 0)) {
+		h->is_hedged = 0;
+		if (is_done == 0)
+			http_cancel(h);
+
+		/* the hedge won: take its response, and its endpoint's backend parses it */
+		h->backend = hg->backend;
+		h->host = hg->host;
+		h->port = hg->port;
+		h->route = hg->route;
+
+		const Buffer buffer = h->buffer;
+		h->buffer = hg->buffer;
+		hg->buffer = buffer;
+		h->buffer_len = hg->buffer_len;
+		h->head_len = hg->head_len;
+		h->body_len = hg->body_len;
+		h->status = hg->status;
+		h->state = HTTP_STATE_DONE;
+
+		/* the phases of the reply, the bytes of both */
+		const HttpTiming timing = h->timing;
+		h->timing = hg->timing;
+		h->timing.begin_at = timing.begin_at;
+		h->timing.total = time_now_ns() - timing.begin_at;
+		h->timing.sent += timing.sent;
+		h->timing.received += timing.received;
+		if (is_done == 0)
+			http_trace(h, "request", h->timing.begin_at, h->timing.begin_at + h->timing.total,
+				   "status", h->status);
+
+		pthread_mutex_lock(&h->pool->mutex);
+		h->pool->stats.hedge_wins++;
+		pthread_mutex_unlock(&h->pool->mutex);
+		return;
+	}
+
+	/* both failed, or only the hedge: the request goes on */
+	if (is_hg_done)
+		h->is_hedged = 0;
+}
+
+
+static int
+http_is_retryable(const Http *h)
+{
+	if (h->state == HTTP_STATE_DONE) {
+		switch (h->status) {
+		case 408:	/* Request Timeout */
+		case 429:	/* Too Many Requests */
+			return 1;
+		case 501:	/* Not Implemented */
+		case 505:	/* HTTP Version Not Supported */
+			return 0;
+		}
+
+		return (h->status >= 500) && (h->status < 600);
+	}
+
+	switch (h->error) {
+	case ECONNREFUSED:
+	case ECONNRESET:
+	case ECONNABORTED:
+	case EPIPE:
+	case ETIMEDOUT:
+	case EHOSTUNREACH:
+	case ENETUNREACH:
+	case ENETDOWN:
+		return 1;
+	}
+
+	return 0;
+}
+
+
+static int64_t
+http_retry_delay(Http *h)
+{
+	/* capped exponential backoff, "full jitter": uniform in [0, min(CAP, BASE * 2^attempt)] */
+	int64_t max = CONFIG_HTTP_RETRY_CAP;
+	if (h->attempt < 16)
+		max = MIN(max, (int64_t)CONFIG_HTTP_RETRY_BASE << h->attempt);
+
+	int64_t delay = (int64_t)rand_r(&h->seed) % (max + 1);
+	if (h->state != HTTP_STATE_DONE)
+		return delay;
+
+	const char *const val = http_head_field(h, "Retry-After");
+	if (val == NULL)
+		return delay;
+
+	/* the server says when, waiting any less is pointless */
+	const int64_t after = http_retry_after(val);
+	if (after > CONFIG_HTTP_RETRY_AFTER_MAX)
+		return -1;
+
+	return MAX(after, delay);
+}
+
+
+static int
+http_timeout(const Http *h)
+{
+	int64_t at = h->deadline;
+	if ((h->hedge_at != 0) && ((at == 0) || (h->hedge_at < at)))
+		at = h->hedge_at;
+
+	int ret = -1;
+	if (at != 0) {
+		const int64_t left = at - time_now_ns();
+		ret = (left <= 0) ? 0 : (int)MIN((left + 999999) / 1000000, INT32_MAX);
+	}
+
+	if (h->is_hedged) {
+		const int hedge = http_timeout(h->hedge);
+		if ((hedge >= 0) && ((ret < 0) || (hedge < ret)))
+			ret = hedge;
+	}
+
+	return ret;
+}
+
+
+static int
+http_fd(const Http *h)
+{
+	if (h->h2 != NULL)
+		return h2_fd(h->h2);
+
+	/* waiting for a connection: parked on the pool's eventfd */
+	if (h->conn == NULL)
+		return (h->state == HTTP_STATE_POOL) ? h->wake_fd : -1;
+
+	return h->conn->fd;
+}
+
+
+static short
+http_events(const Http *h)
+{
+	if (h->h2 != NULL)
+		return h2_events(h->h2);
+
+	switch (h->state) {
+	case HTTP_STATE_POOL:
+		return ((h->conn == NULL) && (h->wake_fd >= 0)) ? POLLIN : 0;
+	case HTTP_STATE_CONNECT:
+		return POLLOUT;
+	case HTTP_STATE_HANDSHAKE:
+	case HTTP_STATE_WRITE:
+		/* TLS may want the opposite direction, see tls_handshake() */
+		return (h->conn->events != 0) ? h->conn->events : POLLOUT;
+	case HTTP_STATE_READ:
+		return (h->conn->events != 0) ? h->conn->events : POLLIN;
+	}
+
+	return 0;
+}
+
+
+static int
+http_is_done(const Http *h)
+{
+	if (h->is_hedged)
+		return 0;
+
+	return (h->state == HTTP_STATE_DONE) || (h->state == HTTP_STATE_ERROR);
+}
+
+
+static int
+http_poll_set(const Http *h, struct pollfd pfds[HTTP_POLLFDS])
+{
+	const Http *const reqs[HTTP_POLLFDS] = { h, (h->is_hedged) ? h->hedge : NULL };
+	int is_pool = 0;
+	for (int i = 0; i < HTTP_POLLFDS; i++) {
+		pfds[i].fd = -1;
+		pfds[i].events = 0;
+		pfds[i].revents = 0;
+		if (reqs[i] == NULL)
+			continue;
+
+		pfds[i].fd = http_fd(reqs[i]);
+		pfds[i].events = http_events(reqs[i]);
+		is_pool |= (reqs[i]->state == HTTP_STATE_POOL) && (pfds[i].events == 0);
+	}
+
+	return is_pool;
+}
+
+
+static void
+http_poll_step(Http *h, const struct pollfd pfds[HTTP_POLLFDS])
+{
+	Http *const reqs[HTTP_POLLFDS] = { h, h->hedge };
+	for (int i = 0; i < HTTP_POLLFDS; i++) {
+		Http *const r = reqs[i];
+		if ((r == NULL) || ((r == h->hedge) && (h->is_hedged == 0)))
+			continue;
+
+		/* HTTP_STATE_QUEUE: a permit may have been given back meanwhile */
+		if (pfds[i].revents != 0)
+			http_step(r, pfds[i].revents);
+		else if ((r->state == HTTP_STATE_POOL) || (r->state == HTTP_STATE_QUEUE) ||
+			 (http_timeout(r) == 0))
+			http_step(r, 0);
+	}
+}
+
+
+static void
+http_step(Http *h, short revents)
+{
+	const int64_t now = time_now_ns();
+
+	/* allocations: charged to the phase of this request */
+	ALLOC_PHASE((h->state == HTTP_STATE_WRITE) ? HTTP_PHASE_WRITE :
+		    (h->state != HTTP_STATE_READ)  ? HTTP_PHASE_CONNECT :
+		    (h->buffer_len == 0)           ? HTTP_PHASE_TTFB : HTTP_PHASE_BODY);
+	if (h->state == HTTP_STATE_BACKOFF) {
+		if (now >= h->deadline) {
+			http_trace(h, "backoff", h->wait_at, now, "attempt", h->attempt);
+			http_attempt(h);
+		}
+
+		return;
+	}
+
+	if (h->state == HTTP_STATE_QUEUE) {
+		http_dequeue(h, 1);
+		return;
+	}
+
+	if (h->state == HTTP_STATE_REPLAY) {
+		if (now >= h->deadline) {
+			h->timing.received += h->head_len + h->body_len;
+			http_phase(h, HTTP_PHASE_TTFB);
+			http_end(h, HTTP_STATE_DONE);
+		}
+
+		return;
+	}
+
+	/* no reply yet, after the usual latency */
+	if ((h->hedge_at != 0) && (now >= h->hedge_at)) {
+		h->hedge_at = 0;
+		if ((h->state != HTTP_STATE_POOL) && (h->buffer_len == 0))
+			http_hedge_start(h);
+	}
+
+	if ((revents == 0) && (h->deadline != 0) && (now >= h->deadline)) {
+		/* not a stale connection */
+		h->is_reused = 0;
+		h->error = ETIMEDOUT;
+		h->error_what = "timeout";
+		if (h->h2 != NULL) {
+			h2_stream_cancel(h->h2, h);
+			return;
+		}
+
+		errno = ETIMEDOUT;
+		http_fail(h, "timeout");
+		return;
+	}
+
+	/* HTTP/2: the session drives all of its streams, this one included */
+	if (h->h2 != NULL) {
+		h2_step(h->h2, revents);
+		return;
+	}
+
+	switch (h->state) {
+	case HTTP_STATE_POOL:
+		http_acquire(h, 1);
+		return;
+	case HTTP_STATE_CONNECT:
+		if (revents == 0)
+			return;
+
+		if (net_tcp_connect_check(h->conn->fd) < 0) {
+			if (http_pool_reconnect(h->pool, h->conn) < 0) {
+				http_fail(h, NULL);
+				return;
+			}
+
+			if (h->conn->is_connecting)
+				return;
+		}
+
+		h->conn->is_connecting = 0;
+		h->state = HTTP_STATE_HANDSHAKE;
+		/* FALLTHROUGH */
+	case HTTP_STATE_HANDSHAKE:
+		switch (http_conn_handshake(h->pool, h->conn)) {
+		case 0:
+			break;
+		case 1:
+			return;
+		default:
+			http_fail(h, NULL);
+			return;
+		}
+
+		http_phase(h, HTTP_PHASE_CONNECT);
+		PROBE(connect, h->conn->id, http_host(h), http_port(h),
+		      h->timing.phases[HTTP_PHASE_DNS] + h->timing.phases[HTTP_PHASE_CONNECT]);
+		h->state = HTTP_STATE_WRITE;
+		/* FALLTHROUGH */
+	case HTTP_STATE_WRITE:
+		break;
+	case HTTP_STATE_READ:
+		goto read0;
+	default:
+		return;
+	}
+
+
+	/* write: skip the already written parts */
+	struct iovec iovs[HTTP_IOVS_SIZE];
+	size_t iovs_len = 0, skip = h->req_written;
+	for (size_t i = 0; i < LEN(h->iovs); i++) {
+		const size_t len = h->iovs[i].iov_len;
+		if (skip >= len) {
+			skip -= len;
+			continue;
+		}
+
+		iovs[iovs_len].iov_base = (char *)h->iovs[i].iov_base + skip;
+		iovs[iovs_len].iov_len = len - skip;
+		iovs_len++;
+		skip = 0;
+	}
+
+	const ssize_t written = http_conn_writev(h->conn, iovs, (int)iovs_len, &h->flat);
+	if (written < 0) {
+		/* EINPROGRESS: TCP Fast Open without a cookie, the SYN went out alone */
+		if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR) ||
+		    (errno == EINPROGRESS))
+			return;
+
+		http_fail(h, "write");
+		return;
+	}
+
+	h->req_written += (size_t)written;
+	h->timing.sent += (size_t)written;
+	if (h->req_written < h->req_len)
+		return;
+
+	http_phase(h, HTTP_PHASE_WRITE);
+	h->conn->events = 0;
+	h->state = HTTP_STATE_READ;
+	return;
+
+
+read0:
+	while (1) {
+		switch (buffer_check(&h->buffer, h->buffer_len + 1)) {
+		case 0:
+		case 1:
+			break;
+		default:
+			http_fail(h, "buffer_check");
+			return;
+		}
+
+		const size_t avail = h->buffer.size - h->buffer_len - 1;
+		const ssize_t rv = http_conn_read(h->conn, h->buffer.ptr + h->buffer_len, avail);
+		if (rv < 0) {
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR))
+				return;
+
+			http_fail(h, "recv");
+			return;
+		}
+
+		net_tcp_quickack(h->conn->fd, &h->pool->net_opts);
+
+		if (rv == 0) {
+			/* no framing: the body ends at EOF */
+			if ((h->head_len > 0) && (h->content_len == SIZE_MAX) && (h->is_chunked == 0))
+				break;
+
+			errno = ECONNRESET;
+			http_fail(h, "recv");
+			return;
+		}
+
+		if (h->buffer_len == 0) {
+			http_phase(h, HTTP_PHASE_TTFB);
+			PROBE(first_byte, h->req_id, h->conn->id, h->timing.phases[HTTP_PHASE_TTFB]);
+		}
+
+		h->buffer_len += (size_t)rv;
+		h->buffer.ptr[h->buffer_len] = '\0';
+		h->timing.received += (size_t)rv;
+
+		if (h->head_len == 0) {
+			const int ret = http_parse_head(h);
+			if (ret < 0) {
+				errno = EPROTO;
+				http_fail(h, "invalid response header");
+				return;
+			}
+
+			if (ret == 0)
+				continue;
+		}
+
+		if (h->is_chunked) {
+			const int ret = http_chunked_scan(h);
+			if (ret < 0) {
+				errno = EPROTO;
+				http_fail(h, "invalid chunked body");
+				return;
+			}
+
+			if (ret == 1) {
+				http_chunked_decode(h);
+				break;
+			}
+		} else if (h->content_len != SIZE_MAX) {
+			if ((h->buffer_len - h->head_len) >= h->content_len) {
+				h->body_len = h->content_len;
+				break;
+			}
+		}
+
+		if (((size_t)rv < avail) && (http_conn_pending(h->conn) == 0))
+			return;
+	}
+
+	if ((h->is_chunked == 0) && (h->content_len == SIZE_MAX))
+		h->body_len = h->buffer_len - h->head_len;
+
+	h->buffer.ptr[h->head_len + h->body_len] = '\0';
+	http_phase(h, HTTP_PHASE_BODY);
+	if (h->conn->is_fastopen)
+		http_pool_fastopen_done(h->pool, h->conn);
+
+	http_release(h, h->is_keep_alive);
+	http_end(h, HTTP_STATE_DONE);
+}
+
+
+static int
+http_parse_head(Http *h)
+{
+	char *const buffer = h->buffer.ptr;
+	const char *const end = strstr(buffer, "\r\n\r\n");
+	if (end == NULL)
+		return (h->buffer_len > CONFIG_BUFFER_SIZE * 4) ? -1 : 0;
+
+	if (strncmp(buffer, "HTTP/1.", 7) != 0)
+		return -1;
+
+	h->head_len = (size_t)(end - buffer) + 4;
+	h->content_len = SIZE_MAX;
+	h->chunk_pos = h->head_len;
+	h->is_chunked = 0;
+	h->is_keep_alive = (buffer[7] == '1');
+
+	for (const char *p = strstr(buffer, "\r\n") + 2; p < end; p = strstr(p, "\r\n") + 2) {
+		if (strncasecmp(p, "Content-Length:", 15) == 0) {
+			h->content_len = (size_t)strtoull(p + 15, NULL, 10);
+		} else if (strncasecmp(p, "Transfer-Encoding:", 18) == 0) {
+			const char *const val = cstr_trim_left_mut((char *)p + 18);
+			h->is_chunked = (strncasecmp(val, "chunked", 7) == 0);
+		} else if (strncasecmp(p, "Connection:", 11) == 0) {
+			const char *const val = cstr_trim_left_mut((char *)p + 11);
+			if (strncasecmp(val, "close", 5) == 0)
+				h->is_keep_alive = 0;
+			else if (strncasecmp(val, "keep-alive", 10) == 0)
+				h->is_keep_alive = 1;
+		}
+	}
+
+	/* the body will be read until EOF */
+	if ((h->is_chunked == 0) && (h->content_len == SIZE_MAX))
+		h->is_keep_alive = 0;
+
+	return 1;
+}
+
+
+static int
+http_status(const Http *h)
+{
+	/* "HTTP/1.1 200 OK", or "HTTP/2 200" */
+	const char *const buffer = h->buffer.ptr;
+	const char *const sp = strchr(buffer, ' ');
+	if ((h->head_len == 0) || (sp == NULL) || ((size_t)(sp - buffer) >= h->head_len))
+		return 0;
+
+	const long status = strtol(sp + 1, NULL, 10);
+	return ((status >= 100) && (status <= 999)) ? (int)status : 0;
+}
+
+
+static const char *
+http_head_field(const Http *h, const char name[])
+{
+	const char *const buffer = h->buffer.ptr;
+	const char *const end = buffer + h->head_len;
+	const size_t name_len = strlen(name);
+	for (const char *p = strstr(buffer, "\r\n"); p != NULL; p = strstr(p, "\r\n")) {
+		p += 2;
+		if (p >= end)
+			break;
+
+		if ((strncasecmp(p, name, name_len) != 0) || (p[name_len] != ':'))
+			continue;
+
+		p += name_len + 1;
+		while ((*p == ' ') || (*p == '\t'))
+			p++;
+
+		return p;
+	}
+
+	return NULL;
+}
+
+
+static int64_t
+http_retry_after(const char val[])
+{
+	if (isdigit((unsigned char)*val)) {
+		const long long secs = strtoll(val, NULL, 10);
+		return (secs > (INT64_MAX / 1000)) ? INT64_MAX : (secs * 1000);
+	}
+
+	/* IMF-fixdate: "Sun, 06 Nov 1994 08:49:37 GMT" */
+	const char *const months = "JanFebMarAprMayJunJulAugSepOctNovDec";
+	struct tm tm = { 0 };
+	char mon[4];
+	if (sscanf(val, "%*3s, %d %3s %d %d:%d:%d GMT", &tm.tm_mday, mon, &tm.tm_year,
+		   &tm.tm_hour, &tm.tm_min, &tm.tm_sec) != 6)
+		return -1;
+
+	const char *const m = strstr(months, mon);
+	if ((strlen(mon) != 3) || (m == NULL) || (((m - months) % 3) != 0))
+		return -1;
+
+	tm.tm_mon = (int)((m - months) / 3);
+	tm.tm_year -= 1900;
+
+	const time_t at = timegm(&tm);
+	const time_t now = time(NULL);
+	if (at == (time_t)-1)
+		return -1;
+
+	return (at > now) ? ((int64_t)(at - now) * 1000) : 0;
+}
+
+
+static int
+http_chunked_scan(Http *h)
+{
+	const char *const buffer = h->buffer.ptr;
+	while (h->chunk_pos < h->buffer_len) {
+		const char *const line = buffer + h->chunk_pos;
+		const char *const line_end = strstr(line, "\r\n");
+		if (line_end == NULL)
+			return 0;
+
+		char *num_end;
+		const unsigned long long size = strtoull(line, &num_end, 16);
+		if ((num_end == line) || (size >= CONFIG_BUFFER_MAX_SIZE))
+			return -1;
+
+		const size_t data = (size_t)(line_end - buffer) + 2;
+		if (size == 0) {
+			/* last chunk: skip the trailer fields */
+			const char *const trailer = buffer + data;
+			if (strncmp(trailer, "\r\n", 2) == 0)
+				return 1;
+
+			return (strstr(trailer, "\r\n\r\n") != NULL);
+		}
+
+		if ((data + size + 2) > h->buffer_len)
+			return 0;
+
+		h->chunk_pos = data + size + 2;
+	}
+
+	return 0;
+}
+
+
+static void
+http_chunked_decode(Http *h)
+{
+	char *const buffer = h->buffer.ptr;
+	size_t pos = h->head_len, len = 0;
+	while (1) {
+		char *line_end;
+		const size_t size = (size_t)strtoull(buffer + pos, &line_end, 16);
+		if (size == 0)
+			break;
+
+		line_end = strstr(line_end, "\r\n") + 2;
+		memmove(buffer + h->head_len + len, line_end, size);
+
+		len += size;
+		pos = (size_t)(line_end - buffer) + size + 2;
+	}
+
+	h->body_len = len;
+}
+
+
+static char *
+http_response_get_json(Http *h, size_t *ret_len)
+{
+	char *const buffer = h->buffer.ptr;
+	if ((h->state != HTTP_STATE_DONE) || (h->head_len == 0))
+		goto err0;
+
+	if (h->status != 200) {
+		LOG_ERR(COLOR_REGULAR_YELLOW("http_response_get_json: HTTP status %d") "\n",
+			h->status);
+		return NULL;
+	}
+
+	/* an array or an object, depending on the backend */
+	char *const json_start = strpbrk(buffer + h->head_len, "[{");
+	if (json_start == NULL)
+		goto err0;
+
+	char *const json_end = strrchr(json_start + 1, (*json_start == '[') ? ']' : '}');
+	if (json_end == NULL)
+		goto err0;
+
+	const size_t len = ((json_end + 1) - json_start);
+	json_end[1] = '\0';
+
+	*ret_len = len;
+	return json_start;
+
+err0:
+	LOG_ERR(COLOR_REGULAR_YELLOW("http_response_get_json: invalid reponse") "\n");
+	return NULL;
+}
+
+
+/*
+ * Http2
+ */
+static uint32_t
+h2_get_u32(const unsigned char p[])
+{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+
+static void
+h2_put_u32(unsigned char p[], uint32_t val)
+{
+	p[0] = (unsigned char)(val >> 24);
+	p[1] = (unsigned char)(val >> 16);
+	p[2] = (unsigned char)(val >> 8);
+	p[3] = (unsigned char)val;
+}
+
+
+static H2 *
+h2_new(HttpPool *p, HttpPoolHost *host)
+{
+	ALLOC_SUB_BEGIN(ALLOC_SUB_HTTP);
+	H2 *const s = calloc(1, sizeof(*s));
+	ALLOC_SUB_END();
+	if (s == NULL) {
+		LOG_ERRNO(COLOR_REGULAR_YELLOW("h2_new: calloc"));
+		return NULL;
+	}
+
+	Buffer *const buffers[] = { &s->out, &s->in, &s->block, &s->head, &s->scratch };
+	for (size_t i = 0; i < LEN(buffers); i++) {
+		if (buffer_init(buffers[i], CONFIG_BUFFER_SIZE) < 0) {
+			LOG_ERRNO(COLOR_REGULAR_YELLOW("h2_new: buffer_init"));
+			for (size_t j = 0; j < i; j++)
+				buffer_deinit(buffers[j]);
+
+			free(s);
+			return NULL;
+		}
+	}
+
+	s->pool = p;
+	s->host = host;
+	hpack_table_init(&s->dec);
+
+	/* "Name: value\r\n" lines: HTTP/2 wants lower case names and no connection headers */
+	int is_authority = 0;
+	memcpy(s->hdrs_buf, CONFIG_HTTP_HEADER, sizeof(s->hdrs_buf));
+	char *line = s->hdrs_buf, *end;
+	while (((end = strstr(line, "\r\n")) != NULL) && (end != line)) {
+		*end = '\0';
+		char *const sep = strchr(line, ':');
+		if ((sep == NULL) || (s->hdrs_len == LEN(s->hdrs)))
+			goto next;
+
+		*sep = '\0';
+		for (char *c = line; *c != '\0'; c++)
+			*c = (char)tolower((unsigned char)*c);
+
+		if ((strcmp(line, "connection") == 0) || (strcmp(line, "keep-alive") == 0) ||
+		    (strcmp(line, "transfer-encoding") == 0) || (strcmp(line, "upgrade") == 0))
+			goto next;
+
+		H2Header *const hdr = &s->hdrs[s->hdrs_len];
+		hdr->name = line;
+		hdr->name_len = (size_t)(sep - line);
+		hdr->value = cstr_trim_right_mut(cstr_trim_left_mut(sep + 1));
+		hdr->value_len = strlen(hdr->value);
+		if (strcmp(line, "host") == 0) {
+			hdr->name = ":authority";
+			hdr->name_len = 10;
+			is_authority = 1;
+		}
+
+		s->hdrs_len++;
+
+next:
+		line = end + 2;
+	}
+
+	if ((is_authority == 0) && (s->hdrs_len < LEN(s->hdrs))) {
+		H2Header *const hdr = &s->hdrs[s->hdrs_len++];
+		hdr->name = ":authority";
+		hdr->name_len = 10;
+		hdr->value = host->host;
+		hdr->value_len = strlen(host->host);
+	}
+
+	for (unsigned i = 0; i < s->hdrs_len; i++) {
+		int is_full;
+		const H2Header *const hdr = &s->hdrs[i];
+		hpack_static_find(hdr->name, hdr->name_len, hdr->value, hdr->value_len, &is_full);
+		if (is_full == 0)
+			s->enc_size += hdr->name_len + hdr->value_len + HPACK_ENTRY_OVERHEAD;
+	}
+
+	return s;
+}
+
+
+static void
+h2_free(H2 *s)
+{
+	if (s->state == H2_STATE_OPEN)
+		h2_goaway(s, H2_ERR_NONE);
+
+	h2_close(s, NULL);
+	hpack_table_deinit(&s->dec);
+	buffer_deinit(&s->scratch);
+	buffer_deinit(&s->head);
+	buffer_deinit(&s->block);
+	buffer_deinit(&s->in);
+	buffer_deinit(&s->out);
+	free(s);
+}
+
+
+static int
+h2_is_connected(const H2 *s)
+{
+	return (s->state != H2_STATE_IDLE);
+}
+
+
+static int
+h2_connect(H2 *s, int *wake_fd)
+{
+	int is_reused;
+	HttpConn *const c = http_pool_get(s->pool, s->host->host, s->host->port, s->host->is_tls, 1, 0,
+					  0, &is_reused, wake_fd);
+	if (c == NULL)
+		return -1;
+
+	s->conn = c;
+	s->state = (c->is_connecting) ? H2_STATE_CONNECT : H2_STATE_HANDSHAKE;
+	s->is_reused = is_reused;
+	s->is_goaway = 0;
+	s->next_id = 1;
+	s->peer_streams_max = UINT32_MAX;
+	s->recv_unacked = 0;
+	s->out_len = 0;
+	s->out_sent = 0;
+	s->in_len = 0;
+	s->block_id = 0;
+
+	hpack_table_deinit(&s->dec);
+	hpack_table_init(&s->dec);
+	s->enc_state = H2_ENC_NONE;
+	s->enc_size_max = HPACK_TABLE_SIZE;
+	s->is_enc_resize = 0;
+
+	if (h2_preface(s) < 0) {
+		h2_close(s, "h2_preface");
+		return -1;
+	}
+
+	return 0;
+}
+
+
+static void
+h2_close(H2 *s, const char what[])
+{
+	const int err = errno;
+	while (s->streams_len > 0) {
+		Http *const h = s->streams[0];
+
+		/* a stale connection, and nothing received: send the request again */
+		if ((what != NULL) && h->is_reused && (h->buffer_len == 0)) {
+			h->is_reused = 0;
+			h2_stream_end(s, h, HTTP_STATE_POOL);
+			continue;
+		}
+
+		if (what != NULL) {
+			h->error = err;
+			h->error_what = what;
+		}
+
+		h2_stream_end(s, h, HTTP_STATE_ERROR);
+	}
+
+	if (s->conn != NULL) {
+#ifdef WITH_TLS
+		/* without a close_notify, OpenSSL drops the session: the next connection (after a
+		 * GOAWAY) couldn't resume it */
+		if ((what == NULL) && (s->conn->ssl != NULL) && s->conn->is_ready)
+			SSL_shutdown(s->conn->ssl);
+#endif
+		http_pool_put(s->pool, s->conn, 0);
+		s->conn = NULL;
+	}
+
+	s->state = H2_STATE_IDLE;
+	s->is_goaway = 0;
+}
+
+
+static int
+h2_fd(const H2 *s)
+{
+	if (s->conn == NULL)
+		return -1;
+
+	return s->conn->fd;
+}
+
+
+static short
+h2_events(const H2 *s)
+{
+	switch (s->state) {
+	case H2_STATE_CONNECT:
+		return POLLOUT;
+	case H2_STATE_HANDSHAKE:
+		return (s->conn->events != 0) ? s->conn->events : POLLOUT;
+	case H2_STATE_OPEN:
+		/* TLS: a read may want to write */
+		if ((s->out_sent < s->out_len) || (s->conn->is_tls && (s->conn->events & POLLOUT)))
+			return POLLIN | POLLOUT;
+
+		return POLLIN;
+	}
+
+	return 0;
+}
+
+
+static void
+h2_step(H2 *s, short revents)
+{
+	switch (s->state) {
+	case H2_STATE_CONNECT:
+		if (revents == 0)
+			return;
+
+		if (net_tcp_connect_check(s->conn->fd) < 0) {
+			if (http_pool_reconnect(s->pool, s->conn) < 0) {
+				h2_close(s, "connect");
+				return;
+			}
+
+			if (s->conn->is_connecting)
+				return;
+		}
+
+		s->conn->is_connecting = 0;
+		s->state = H2_STATE_HANDSHAKE;
+		/* FALLTHROUGH */
+	case H2_STATE_HANDSHAKE:
+		switch (http_conn_handshake(s->pool, s->conn)) {
+		case 0:
+			break;
+		case 1:
+			return;
+		default:
+			errno = EPROTO;
+			h2_close(s, "handshake");
+			return;
+		}
+
+		if (h2_is_alpn_h2(s) == 0) {
+			LOG_ERR(COLOR_REGULAR_YELLOW("http_request: %s: no HTTP/2 support, "
+				"using HTTP/1.1") "\n", s->host->host);
+
+			s->is_refused = 1;
+			while (s->streams_len > 0) {
+				Http *const h = s->streams[0];
+				h->is_h2 = 0;
+				h2_stream_end(s, h, HTTP_STATE_POOL);
+			}
+
+			h2_close(s, NULL);
+			return;
+		}
+
+		s->conn->events = 0;
+		s->state = H2_STATE_OPEN;
+		/* FALLTHROUGH */
+	case H2_STATE_OPEN:
+		break;
+	default:
+		return;
+	}
+
+	if (h2_flush(s) < 0) {
+		h2_close(s, "send");
+		return;
+	}
+
+	if (h2_recv(s) < 0) {
+		h2_close(s, "recv");
+		return;
+	}
+
+	/* the replies: SETTINGS ACK, PING ACK, WINDOW_UPDATE */
+	if (h2_flush(s) < 0) {
+		h2_close(s, "send");
+		return;
+	}
+
+	if (s->is_goaway && (s->streams_len == 0))
+		h2_close(s, NULL);
+}
+
+
+static int
+h2_is_alpn_h2(const H2 *s)
+{
+#ifdef WITH_TLS
+	if (s->conn->ssl != NULL) {
+		const unsigned char *alpn;
+		unsigned alpn_len;
+		SSL_get0_alpn_selected(s->conn->ssl, &alpn, &alpn_len);
+		return ((alpn_len == 2) && (memcmp(alpn, "h2", 2) == 0));
+	}
+#else
+	(void)s;
+#endif
+
+	/* h2c: prior knowledge */
+	return 1;
+}
+
+
+static int
+h2_stream_open(H2 *s, Http *h)
+{
+	if (s->is_refused) {
+		errno = EPROTONOSUPPORT;
+		return -1;
+	}
+
+	if (s->is_goaway) {
+		/* wait for the remaining streams, then start over */
+		if (s->streams_len > 0) {
+			http_pool_wait(s->host, &h->wake_fd);
+			errno = EAGAIN;
+			return -1;
+		}
+
+		h2_close(s, NULL);
+	}
+
+	if ((s->state == H2_STATE_IDLE) && (h2_connect(s, &h->wake_fd) < 0))
+		return -1;
+
+	const uint32_t max = (s->peer_streams_max < LEN(s->streams)) ? s->peer_streams_max
+								     : LEN(s->streams);
+	/* woken up by the end of one (h2_stream_end()) */
+	if (s->streams_len >= max) {
+		http_pool_wait(s->host, &h->wake_fd);
+		errno = EAGAIN;
+		return -1;
+	}
+
+	const uint32_t id = s->next_id;
+	if (h2_headers_write(s, h, id) < 0)
+		return -1;
+
+	/* stream ids can't be reused: a new connection when they are exhausted */
+	s->next_id += 2;
+	if (s->next_id > H2_STREAM_ID_MAX) {
+		s->is_goaway = 1;
+		s->goaway_id = id;
+	}
+
+	s->streams[s->streams_len++] = h;
+	h->h2 = s;
+	h->stream_id = id;
+	h->is_reused = s->is_reused;
+
+	pthread_mutex_lock(&s->pool->mutex);
+	s->pool->stats.h2_streams++;
+	pthread_mutex_unlock(&s->pool->mutex);
+	return 0;
+}
+
+
+static void
+h2_stream_end(H2 *s, Http *h, int state)
+{
+	for (unsigned i = 0; i < s->streams_len; i++) {
+		if (s->streams[i] == h) {
+			s->streams[i] = s->streams[--s->streams_len];
+			http_pool_wake(s->host);
+			break;
+		}
+	}
+
+	h->h2 = NULL;
+	if (state == HTTP_STATE_POOL)
+		h->state = state;
+	else
+		http_end(h, state);
+}
+
+
+static void
+h2_stream_done(H2 *s, Http *h)
+{
+	h->body_len = h->buffer_len - h->head_len;
+	h->buffer.ptr[h->buffer_len] = '\0';
+	http_phase(h, HTTP_PHASE_BODY);
+	s->is_reused = 1;
+	h2_stream_end(s, h, HTTP_STATE_DONE);
+}
+
+
+static void
+h2_stream_cancel(H2 *s, Http *h)
+{
+	if (s->state == H2_STATE_OPEN) {
+		unsigned char payload[4];
+		h2_put_u32(payload, H2_ERR_CANCEL);
+		h2_frame_write(s, H2_FRAME_RST_STREAM, 0, h->stream_id, payload, sizeof(payload));
+	}
+
+	h2_stream_end(s, h, HTTP_STATE_ERROR);
+}
+
+
+static Http *
+h2_stream_find(const H2 *s, uint32_t id)
+{
+	for (unsigned i = 0; i < s->streams_len; i++) {
+		if (s->streams[i]->stream_id == id)
+			return s->streams[i];
+	}
+
+	return NULL;
+}
+
+
+static int
+h2_preface(H2 *s)
+{
+	const char preface[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+	const size_t preface_len = sizeof(preface) - 1;
+	if (buffer_check(&s->out, s->out_len + preface_len) < 0)
+		return -1;
+
+	memcpy(s->out.ptr + s->out_len, preface, preface_len);
+	s->out_len += preface_len;
+
+	/* no server push, the stream window: a response can't be bigger than the buffer anyway */
+	unsigned char settings[12] = { 0, H2_SETTINGS_ENABLE_PUSH, 0, 0, 0, 0,
+				       0, H2_SETTINGS_INITIAL_WINDOW_SIZE };
+	h2_put_u32(settings + 8, CONFIG_BUFFER_MAX_SIZE);
+	if (h2_frame_write(s, H2_FRAME_SETTINGS, 0, 0, settings, sizeof(settings)) < 0)
+		return -1;
+
+	unsigned char window[4];
+	h2_put_u32(window, H2_WINDOW_SIZE - H2_WINDOW_SIZE_DEFAULT);
+	return h2_frame_write(s, H2_FRAME_WINDOW_UPDATE, 0, 0, window, sizeof(window));
+}
+
+
+static int
+h2_goaway(H2 *s, uint32_t code)
+{
+	unsigned char payload[8];
+	h2_put_u32(payload, 0);
+	h2_put_u32(payload + 4, code);
+	if (h2_frame_write(s, H2_FRAME_GOAWAY, 0, 0, payload, sizeof(payload)) < 0)
+		return -1;
+
+	/* best effort */
+	return h2_flush(s);
+}
+
+
+static int
+h2_frame_write(H2 *s, unsigned type, unsigned flags, uint32_t id, const void *payload, size_t len)
+{
+	if (buffer_check(&s->out, s->out_len + H2_FRAME_HEAD_SIZE + len) < 0)
+		return -1;
+
+	unsigned char *const f = (unsigned char *)s->out.ptr + s->out_len;
+	f[0] = (unsigned char)(len >> 16);
+	f[1] = (unsigned char)(len >> 8);
+	f[2] = (unsigned char)len;
+	f[3] = (unsigned char)type;
+	f[4] = (unsigned char)flags;
+	h2_put_u32(f + 5, id);
+	if (len > 0)
+		memcpy(f + H2_FRAME_HEAD_SIZE, payload, len);
+
+	s->out_len += H2_FRAME_HEAD_SIZE + len;
+	return 0;
+}
+
+
+static int
+h2_headers_write(H2 *s, Http *h, uint32_t id)
+{
+	Buffer *const b = &s->scratch;
+	size_t len = 0;
+
+	if (s->is_enc_resize) {
+		/* the peer has shrunk its table: still fits, or give it up */
+		const size_t size = (s->enc_size <= s->enc_size_max) ? s->enc_size_max : 0;
+		if (hpack_int_encode(b, &len, 0x20, 5, size) < 0)
+			return -1;
+
+		if (size == 0)
+			s->enc_state = H2_ENC_OFF;
+
+		s->is_enc_resize = 0;
+	}
+
+	const int is_indexing = (s->enc_state == H2_ENC_NONE) && (s->enc_size <= s->enc_size_max);
+
+	/* the pseudo headers first */
+	const char *const method = h->iovs[HTTP_IOV_METHOD].iov_base;
+	const size_t method_len = cstr_trim_right(method, h->iovs[HTTP_IOV_METHOD].iov_len);
+	if (hpack_field_encode(b, &len, ":method", 7, method, method_len, 0) < 0)
+		return -1;
+
+	const char *const scheme = (h->is_tls) ? "https" : "http";
+	if (hpack_field_encode(b, &len, ":scheme", 7, scheme, strlen(scheme), 0) < 0)
+		return -1;
+
+	/* the path: from the request line, the url encoded text changes every time */
+	size_t path_len = 0;
+	for (int i = HTTP_IOV_PATH; i < HTTP_IOV_PROTOCOL; i++)
+		path_len += h->iovs[i].iov_len;
+
+	if (buffer_check(&h->flat, path_len) < 0)
+		return -1;
+
+	path_len = 0;
+	for (int i = HTTP_IOV_PATH; i < HTTP_IOV_PROTOCOL; i++) {
+		if (h->iovs[i].iov_len == 0)
+			continue;
+
+		memcpy(h->flat.ptr + path_len, h->iovs[i].iov_base, h->iovs[i].iov_len);
+		path_len += h->iovs[i].iov_len;
+	}
+
+	if (hpack_field_encode(b, &len, ":path", 5, h->flat.ptr, path_len, 0) < 0)
+		return -1;
+
+	/* the fixed ones: indexed by the peer after the first request, one or two bytes each */
+	H2Header *added[LEN(s->hdrs)];
+	unsigned added_len = 0;
+	for (int pass = 0; pass < 2; pass++) {
+		for (unsigned i = 0; i < s->hdrs_len; i++) {
+			H2Header *const hdr = &s->hdrs[i];
+			if ((hdr->name[0] == ':') != (pass == 0))
+				continue;
+
+			int ret;
+			if ((s->enc_state == H2_ENC_INDEXED) && (hdr->idx > 0)) {
+				ret = hpack_int_encode(b, &len, 0x80, 7, hdr->idx);
+			} else {
+				int is_full;
+				hpack_static_find(hdr->name, hdr->name_len, hdr->value, hdr->value_len,
+						  &is_full);
+				if (is_indexing && (is_full == 0))
+					added[added_len++] = hdr;
+
+				ret = hpack_field_encode(b, &len, hdr->name, hdr->name_len, hdr->value,
+							 hdr->value_len, is_indexing);
+			}
+
+			if (ret < 0)
+				return -1;
+		}
+	}
+
+	if (is_indexing) {
+		/* the dynamic table: the newest entry is 62 */
+		for (unsigned i = 0; i < added_len; i++)
+			added[i]->idx = (unsigned)(LEN(hpack_static) + added_len - i);
+
+		s->enc_state = H2_ENC_INDEXED;
+	}
+
+	/* HEADERS + CONTINUATION, no body */
+	size_t pos = 0;
+	unsigned type = H2_FRAME_HEADERS, flags = H2_FLAG_END_STREAM;
+	do {
+		const size_t size = ((len - pos) > H2_FRAME_SIZE) ? H2_FRAME_SIZE : (len - pos);
+		if ((pos + size) == len)
+			flags |= H2_FLAG_END_HEADERS;
+
+		if (h2_frame_write(s, type, flags, id, b->ptr + pos, size) < 0)
+			return -1;
+
+		pos += size;
+		type = H2_FRAME_CONTINUATION;
+		flags = 0;
+	} while (pos < len);
+
+	return 0;
+}
+
+
+static int
+h2_flush(H2 *s)
+{
+	while (s->out_sent < s->out_len) {
+		const struct iovec iov = {
+			.iov_base = s->out.ptr + s->out_sent,
+			.iov_len  = s->out_len - s->out_sent,
+		};
+
+		const ssize_t written = http_conn_writev(s->conn, &iov, 1, NULL);
+		if (written < 0) {
+			/* EINPROGRESS: TCP Fast Open without a cookie, the SYN went out alone */
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR) ||
+			    (errno == EINPROGRESS))
+				return 0;
+
+			return -1;
+		}
+
+		s->out_sent += (size_t)written;
+	}
+
+	s->out_len = 0;
+	s->out_sent = 0;
+	return 0;
+}
+
+
+static int
+h2_recv(H2 *s)
+{
+	while (1) {
+		if (buffer_check(&s->in, s->in_len + H2_FRAME_HEAD_SIZE + H2_FRAME_SIZE) < 0)
+			return -1;
+
+		const size_t avail = s->in.size - s->in_len;
+		const ssize_t rv = http_conn_read(s->conn, s->in.ptr + s->in_len, avail);
+		if (rv < 0) {
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR))
+				return 0;
+
+			return -1;
+		}
+
+		if (rv == 0) {
+			errno = ECONNRESET;
+			return -1;
+		}
+
+		net_tcp_quickack(s->conn->fd, &s->pool->net_opts);
+		if (s->conn->is_fastopen)
+			http_pool_fastopen_done(s->pool, s->conn);
+
+		s->in_len += (size_t)rv;
+
+		size_t pos = 0;
+		while ((s->in_len - pos) >= H2_FRAME_HEAD_SIZE) {
+			const unsigned char *const f = (const unsigned char *)s->in.ptr + pos;
+			const size_t len = ((size_t)f[0] << 16) | ((size_t)f[1] << 8) | f[2];
+			if (len > H2_FRAME_SIZE) {
+				h2_goaway(s, H2_ERR_FRAME_SIZE);
+				errno = EPROTO;
+				return -1;
+			}
+
+			if ((s->in_len - pos) < (H2_FRAME_HEAD_SIZE + len))
+				break;
+
+			const uint32_t id = h2_get_u32(f + 5) & H2_STREAM_ID_MAX;
+			if (h2_frame(s, f[3], f[4], id, f + H2_FRAME_HEAD_SIZE, len) < 0)
+				return -1;
+
+			pos += H2_FRAME_HEAD_SIZE + len;
+		}
+
+		s->in_len -= pos;
+		memmove(s->in.ptr, s->in.ptr + pos, s->in_len);
+
+		if (((size_t)rv < avail) && (http_conn_pending(s->conn) == 0))
+			return 0;
+	}
+}
+
+
+static int
+h2_frame(H2 *s, unsigned type, unsigned flags, uint32_t id, const unsigned char *payload,
+	 size_t len)
+{
+	Http *h;
+	size_t pad = 0;
+	uint32_t code = H2_ERR_PROTOCOL;
+
+	/* a header block can't be interleaved */
+	if ((s->block_id != 0) && (type != H2_FRAME_CONTINUATION))
+		goto err0;
+
+	switch (type) {
+	case H2_FRAME_DATA:
+		if (id == 0)
+			goto err0;
+
+		/* flow control: the padding counts too */
+		s->recv_unacked += (uint32_t)len;
+		if (s->recv_unacked >= (H2_WINDOW_SIZE / 2)) {
+			unsigned char window[4];
+			h2_put_u32(window, s->recv_unacked);
+			if (h2_frame_write(s, H2_FRAME_WINDOW_UPDATE, 0, 0, window, sizeof(window)) < 0)
+				return -1;
+
+			s->recv_unacked = 0;
+		}
+
+		if (flags & H2_FLAG_PADDED) {
+			if ((len == 0) || (payload[0] >= len))
+				goto err0;
+
+			len -= 1 + payload[0];
+			payload++;
+		}
+
+		/* NULL: cancelled */
+		if ((h = h2_stream_find(s, id)) == NULL)
+			return 0;
+
+		if (h->head_len == 0)
+			goto err0;
+
+		if (buffer_check(&h->buffer, h->buffer_len + len + 1) < 0) {
+			LOG_ERR(COLOR_REGULAR_YELLOW("http_request: response too large") "\n");
+			h2_stream_cancel(s, h);
+			return 0;
+		}
+
+		memcpy(h->buffer.ptr + h->buffer_len, payload, len);
+		h->buffer_len += len;
+		h->timing.received += len;
+		if (flags & H2_FLAG_END_STREAM)
+			h2_stream_done(s, h);
+
+		return 0;
+	case H2_FRAME_HEADERS:
+		if (id == 0)
+			goto err0;
+
+		if (flags & H2_FLAG_PADDED) {
+			if (len == 0)
+				goto err0;
+
+			pad = payload[0];
+			payload++;
+			len--;
+		}
+
+		if (flags & H2_FLAG_PRIORITY) {
+			if (len < 5)
+				goto err0;
+
+			payload += 5;
+			len -= 5;
+		}
+
+		if (pad > len)
+			goto err0;
+
+		s->block_len = 0;
+		s->block_id = id;
+		s->is_block_end = (flags & H2_FLAG_END_STREAM);
+		len -= pad;
+		/* FALLTHROUGH */
+	case H2_FRAME_CONTINUATION:
+		if ((id == 0) || (id != s->block_id))
+			goto err0;
+
+		if (buffer_check(&s->block, s->block_len + len) < 0)
+			return -1;
+
+		memcpy(s->block.ptr + s->block_len, payload, len);
+		s->block_len += len;
+		if (flags & H2_FLAG_END_HEADERS)
+			return h2_headers_done(s);
+
+		return 0;
+	case H2_FRAME_RST_STREAM:
+		if ((id == 0) || (len != 4))
+			goto err0;
+
+		if ((h = h2_stream_find(s, id)) == NULL)
+			return 0;
+
+		/* not processed by the server */
+		code = h2_get_u32(payload);
+		if (code == H2_ERR_REFUSED_STREAM) {
+			h2_stream_end(s, h, HTTP_STATE_POOL);
+			return 0;
+		}
+
+		h->error = ECONNRESET;
+		h->error_what = "stream reset";
+		h2_stream_end(s, h, HTTP_STATE_ERROR);
+		return 0;
+	case H2_FRAME_SETTINGS:
+		if (id != 0)
+			goto err0;
+
+		code = H2_ERR_FRAME_SIZE;
+		if (flags & H2_FLAG_ACK) {
+			if (len != 0)
+				goto err0;
+
+			return 0;
+		}
+
+		if ((len % 6) != 0)
+			goto err0;
+
+		for (size_t i = 0; i < len; i += 6) {
+			const unsigned param = ((unsigned)payload[i] << 8) | payload[i + 1];
+			const uint32_t val = h2_get_u32(payload + i + 2);
+			switch (param) {
+			case H2_SETTINGS_HEADER_TABLE_SIZE:
+				if (val < s->enc_size_max) {
+					s->enc_size_max = val;
+					s->is_enc_resize = 1;
+				}
+				break;
+			case H2_SETTINGS_MAX_CONCURRENT_STREAMS:
+				s->peer_streams_max = val;
+				break;
+			case H2_SETTINGS_INITIAL_WINDOW_SIZE:
+				code = H2_ERR_FLOW_CONTROL;
+				if (val > H2_WINDOW_SIZE_MAX)
+					goto err0;
+				break;
+			case H2_SETTINGS_MAX_FRAME_SIZE:
+				code = H2_ERR_PROTOCOL;
+				if ((val < H2_FRAME_SIZE) || (val > 0xffffff))
+					goto err0;
+				break;
+			}
+		}
+
+		return h2_frame_write(s, H2_FRAME_SETTINGS, H2_FLAG_ACK, 0, NULL, 0);
+	case H2_FRAME_PING:
+		if (id != 0)
+			goto err0;
+
+		if (len != 8) {
+			code = H2_ERR_FRAME_SIZE;
+			goto err0;
+		}
+
+		if (flags & H2_FLAG_ACK)
+			return 0;
+
+		return h2_frame_write(s, H2_FRAME_PING, H2_FLAG_ACK, 0, payload, len);
+	case H2_FRAME_GOAWAY:
+		if ((id != 0) || (len < 8))
+			goto err0;
+
+		s->is_goaway = 1;
+		s->goaway_id = h2_get_u32(payload) & H2_STREAM_ID_MAX;
+
+		/* the later ones were not processed: send them again on a new connection */
+		for (unsigned i = 0; i < s->streams_len;) {
+			h = s->streams[i];
+			if (h->stream_id > s->goaway_id)
+				h2_stream_end(s, h, HTTP_STATE_POOL);
+			else
+				i++;
+		}
+
+		return 0;
+	case H2_FRAME_WINDOW_UPDATE:
+		/* no request body, nothing to wait for */
+		if (len != 4) {
+			code = H2_ERR_FRAME_SIZE;
+			goto err0;
+		}
+
+		return 0;
+	case H2_FRAME_PUSH_PROMISE:
+		/* disabled in our SETTINGS */
+		goto err0;
+	}
+
+	/* PRIORITY, and the unknown ones */
+	return 0;
+
+err0:
+	LOG_ERR(COLOR_REGULAR_YELLOW("http_request: HTTP/2: invalid frame: type: %u") "\n",
+		type);
+	h2_goaway(s, code);
+	errno = EPROTO;
+	return -1;
+}
+
+
+static int
+h2_headers_done(H2 *s)
+{
+	const uint32_t id = s->block_id;
+	size_t head_len = 0;
+
+	s->block_id = 0;
+	if ((hpack_decode(&s->dec, (const unsigned char *)s->block.ptr, s->block_len, &s->head,
+			  &head_len, &s->scratch) < 0) || (buffer_check(&s->head, head_len) < 0)) {
+		LOG_ERR(COLOR_REGULAR_YELLOW("http_request: HTTP/2: invalid header block")
+			"\n");
+		h2_goaway(s, H2_ERR_COMPRESSION);
+		errno = EPROTO;
+		return -1;
+	}
+
+	Http *const h = h2_stream_find(s, id);
+	if (h == NULL)
+		return 0;
+
+	/* trailers: not interested */
+	if (h->head_len > 0)
+		goto out0;
+
+	/* ":status: XXX\r\n" first, rewritten as "HTTP/2 XXX\r\n" */
+	char *const head = s->head.ptr;
+	head[head_len] = '\0';
+	if ((strncmp(head, ":status: ", 9) != 0) || (head_len < 14) ||
+	    (head_len > (CONFIG_BUFFER_SIZE * 4))) {
+		LOG_ERR(COLOR_REGULAR_YELLOW("http_request: HTTP/2: invalid response header")
+			"\n");
+		h2_stream_cancel(s, h);
+		return 0;
+	}
+
+	/* 1xx: informational, the real one follows */
+	if (head[9] == '1')
+		return 0;
+
+	const char *const fields = strstr(head, "\r\n") + 2;
+	const size_t status_len = (size_t)(fields - (head + 9));
+	const size_t fields_len = head_len - (size_t)(fields - head);
+	const size_t len = 7 + status_len + fields_len + 2;
+	if (buffer_check(&h->buffer, len) < 0) {
+		h2_stream_cancel(s, h);
+		return 0;
+	}
+
+	char *const buffer = h->buffer.ptr;
+	memcpy(buffer, "HTTP/2 ", 7);
+	memcpy(buffer + 7, head + 9, status_len);
+	memcpy(buffer + 7 + status_len, fields, fields_len);
+	memcpy(buffer + len - 2, "\r\n", 2);
+	buffer[len] = '\0';
+	h->head_len = len;
+	h->buffer_len = len;
+	h->timing.received += len;
+	http_phase(h, HTTP_PHASE_TTFB);
+	PROBE(first_byte, h->req_id, s->conn->id, h->timing.phases[HTTP_PHASE_TTFB]);
+
+out0:
+	if (s->is_block_end)
+		h2_stream_done(s, h);
+
+	return 0;
+}
+
+
+
+/*
+ * Json
+ */
+static json_value_t *
+json_array_index(json_array_t *arr, size_t index)
+{
+	if (arr != NULL) {
+		size_t i = 0;
+		for (json_array_element_t *e = arr->start; e != NULL; e = e->next) {
+			if (i == index)
+				return e->value;
+
+			i++;
+		}
+	}
+
+	return NULL;
+}
+
+
+static json_array_t *
+json_value_as_array_wrp(json_value_t *val)
+{
+	if (val != NULL)
+		return json_value_as_array(val);
+
+	return NULL;
+}
+
+
+static json_string_t *
+json_value_as_string_wrp(json_value_t *val)
+{
+	if (val != NULL)
+		return json_value_as_string(val);
+
+	return NULL;
+}
+
+
+static size_t
+json_array_fills(json_value_t *values[], size_t size, json_array_t *arr)
+{
+	size_t i = 0;
+	if (arr != NULL) {
+		for (json_array_element_t *e = arr->start; (e != NULL) && (i < size); e = e->next) {
+			values[i] = e->value;
+			i++;
+		}
+	}
+
+	for (size_t j = i; j < size; j++)
+		values[j] = NULL;
+
+	return i;
+}
+
+
+static json_value_t *
+json_object_get(json_value_t *val, const char name[])
+{
+	json_object_t *const obj = (val != NULL) ? json_value_as_object(val) : NULL;
+	if (obj == NULL)
+		return NULL;
+
+	const size_t name_len = strlen(name);
+	for (json_object_element_t *e = obj->start; e != NULL; e = e->next) {
+		if ((e->name->string_size == name_len) && (memcmp(e->name->string, name, name_len) == 0))
+			return e->value;
+	}
+
+	return NULL;
+}
+
+
+/*
+ * Backend
+ */
+static const Backend *
+backend_get(const char name[])
+{
+	for (size_t i = 0; i < LEN(backends); i++) {
+		if (strcmp(backends[i].name, name) == 0)
+			return &backends[i];
+	}
+
+	return NULL;
+}
+
+
+static int
+backend_is_capable(const Backend *b, int type)
+{
+	switch (type) {
+	case RESULT_TYPE_SIMPLE: return (b->caps & BACKEND_CAP_SIMPLE) != 0;
+	case RESULT_TYPE_DETAIL: return (b->caps & BACKEND_CAP_DETAIL) != 0;
+	case RESULT_TYPE_LANG:   return (b->caps & BACKEND_CAP_LANG) != 0;
+	}
+
+	return 0;
+}
+
+
+static void
+backend_google_build(Http *h, int type, const char sl[], const char tl[], const char hl[],
+		     const char text[], size_t text_len)
+{
+	/*
+	 * GET path base
+	 *     specific path
+	 *     source lang key + val
+	 *     target lang key + val
+	 *     highlight lang key + val
+	 *     text key + val
+	 */
+	http_iov_set(h, HTTP_IOV_METHOD, CONFIG_HTTP_METHOD, sizeof(CONFIG_HTTP_METHOD) - 1);
+	http_iov_set(h, HTTP_IOV_PATH, CONFIG_HTTP_PATH_BASE, sizeof(CONFIG_HTTP_PATH_BASE) - 1);
+	http_iov_set(h, HTTP_IOV_PATH + 8, CONFIG_HTTP_QUERY_TXT, sizeof(CONFIG_HTTP_QUERY_TXT) - 1);
+	http_iov_set(h, HTTP_IOV_PATH + 9, text, text_len);
+
+	switch (type) {
+	case RESULT_TYPE_LANG:
+		http_iov_set(h, HTTP_IOV_PATH + 1, CONFIG_HTTP_PATH_LANG, sizeof(CONFIG_HTTP_PATH_LANG) - 1);
+		break;
+	case RESULT_TYPE_DETAIL:
+		http_iov_set(h, HTTP_IOV_PATH + 1, CONFIG_HTTP_PATH_DETAIL,
+			     sizeof(CONFIG_HTTP_PATH_DETAIL) - 1);
+		http_iov_set(h, HTTP_IOV_PATH + 6, CONFIG_HTTP_QUERY_HL, sizeof(CONFIG_HTTP_QUERY_HL) - 1);
+		http_iov_set(h, HTTP_IOV_PATH + 7, hl, strlen(hl));
+
+		/* FALLTHROUGH */
+	case RESULT_TYPE_SIMPLE:
+		if (type == RESULT_TYPE_SIMPLE) {
+			http_iov_set(h, HTTP_IOV_PATH + 1, CONFIG_HTTP_PATH_SIMPLE,
+				     sizeof(CONFIG_HTTP_PATH_SIMPLE) - 1);
+		}
+
+		http_iov_set(h, HTTP_IOV_PATH + 2, CONFIG_HTTP_QUERY_SL, sizeof(CONFIG_HTTP_QUERY_SL) - 1);
+		http_iov_set(h, HTTP_IOV_PATH + 3, sl, strlen(sl));
+		http_iov_set(h, HTTP_IOV_PATH + 4, CONFIG_HTTP_QUERY_TL, sizeof(CONFIG_HTTP_QUERY_TL) - 1);
+		http_iov_set(h, HTTP_IOV_PATH + 5, tl, strlen(tl));
+		break;
+	}
+}
+
+
+static int
+backend_google_parse(json_value_t *json, int type, Result *res)
+{
+	json_value_t *root_v[14];
+	if (json_array_fills(root_v, LEN(root_v), json_value_as_array(json)) == 0)
+		return -1;
+
+	/* source language */
+	res->lang = json_value_as_string_wrp(root_v[2]);
+	if (type == RESULT_TYPE_LANG)
+		return 0;
+
+	/* target text: one segment per sentence, the last one may be the spellings */
+	json_array_t *const text_a = json_value_as_array_wrp(root_v[0]);
+	if (text_a == NULL)
+		return 0;
+
+	for (json_array_element_t *e = text_a->start; e != NULL; e = e->next) {
+		json_array_t *const arr = json_value_as_array(e->value);
+		json_string_t *const str = json_value_as_string_wrp(json_array_index(arr, 0));
+		if ((str != NULL) && (result_text_add(res, str->string, str->string_size) < 0))
+			return -1;
+	}
+
+	if (type == RESULT_TYPE_SIMPLE)
+		return 0;
+
+	json_value_t *splls_v[4];
+	json_array_t *splls_a = NULL;
+	if (text_a->length > 1)
+		splls_a = json_value_as_array_wrp(json_array_index(text_a, (text_a->length - 1)));
+
+	json_array_fills(splls_v, LEN(splls_v), splls_a);
+	res->trg_spelling = json_value_as_string_wrp(splls_v[2]);
+	res->src_spelling = json_value_as_string_wrp(splls_v[3]);
+
+	json_array_t *const src_cor_a = json_value_as_array_wrp(root_v[7]);
+	res->correction = json_value_as_string_wrp(json_array_index(src_cor_a, 1));
+
+	res->synonyms = json_value_as_array_wrp(root_v[1]);
+	res->defs = json_value_as_array_wrp(root_v[12]);
+	res->examples = json_value_as_array_wrp(root_v[13]);
+	return 0;
+}
+
+
+static void
+backend_libre_build(Http *h, int type, const char sl[], const char tl[], const char hl[],
+		    const char text[], size_t text_len)
+{
+	/*
+	 * POST /translate or /detect
+	 * body: q=text[&source=sl&target=tl&format=text][&api_key=key]
+	 */
+	int i = HTTP_IOV_BODY;
+
+	(void)hl;
+	http_iov_set(h, HTTP_IOV_METHOD, CONFIG_LIBRE_METHOD, sizeof(CONFIG_LIBRE_METHOD) - 1);
+	http_iov_set(h, i++, CONFIG_LIBRE_QUERY_TXT, sizeof(CONFIG_LIBRE_QUERY_TXT) - 1);
+	http_iov_set(h, i++, text, text_len);
+
+	if (type == RESULT_TYPE_LANG) {
+		http_iov_set(h, HTTP_IOV_PATH, CONFIG_LIBRE_PATH_DETECT,
+			     sizeof(CONFIG_LIBRE_PATH_DETECT) - 1);
+	} else {
+		http_iov_set(h, HTTP_IOV_PATH, CONFIG_LIBRE_PATH_TRANSLATE,
+			     sizeof(CONFIG_LIBRE_PATH_TRANSLATE) - 1);
+		http_iov_set(h, i++, CONFIG_LIBRE_QUERY_SL, sizeof(CONFIG_LIBRE_QUERY_SL) - 1);
+		http_iov_set(h, i++, sl, strlen(sl));
+		http_iov_set(h, i++, CONFIG_LIBRE_QUERY_TL, sizeof(CONFIG_LIBRE_QUERY_TL) - 1);
+		http_iov_set(h, i++, tl, strlen(tl));
+		http_iov_set(h, i++, CONFIG_LIBRE_QUERY_FORMAT, sizeof(CONFIG_LIBRE_QUERY_FORMAT) - 1);
+	}
+
+	if (h->api_key_enc[0] != '\0') {
+		http_iov_set(h, i++, CONFIG_LIBRE_QUERY_KEY, sizeof(CONFIG_LIBRE_QUERY_KEY) - 1);
+		http_iov_set(h, i++, h->api_key_enc, strlen(h->api_key_enc));
+	}
+}
+
+
+static int
+backend_libre_parse(json_value_t *json, int type, Result *res)
+{
+	/*
+	 * /translate: {"translatedText": "...", "detectedLanguage": {"confidence": 90, "language": "en"}}
+	 * /detect:    [{"confidence": 90, "language": "en"}, ...]
+	 */
+	json_value_t *lang_v = json;
+	if (type == RESULT_TYPE_LANG) {
+		lang_v = json_array_index(json_value_as_array(json), 0);
+	} else {
+		json_string_t *const str = json_value_as_string_wrp(json_object_get(json,
+										     "translatedText"));
+		if (str == NULL)
+			return -1;
+
+		if (result_text_add(res, str->string, str->string_size) < 0)
+			return -1;
+
+		lang_v = json_object_get(json, "detectedLanguage");
+	}
+
+	res->lang = json_value_as_string_wrp(json_object_get(lang_v, "language"));
+
+	json_value_t *const conf_v = json_object_get(lang_v, "confidence");
+	json_number_t *const conf_n = (conf_v != NULL) ? json_value_as_number(conf_v) : NULL;
+	if (conf_n != NULL)
+		res->confidence = (int)strtod(conf_n->number, NULL);
+
+	return ((type == RESULT_TYPE_LANG) && (res->lang == NULL)) ? -1 : 0;
+}
+
+
+static void
+result_reset(Result *res)
+{
+	Buffer text = res->text;
+
+	memset(res, 0, sizeof(*res));
+	res->text = text;
+	res->confidence = -1;
+}
+
+
+static int
+result_text_add(Result *res, const char str[], size_t len)
+{
+	if (buffer_check(&res->text, res->text_len + len + 1) < 0)
+		return -1;
+
+	memcpy(res->text.ptr + res->text_len, str, len);
+	res->text_len += len;
+	res->text.ptr[res->text_len] = '\0';
+	return 0;
+}
+
+
+/*
+ * MoeTr
+ */
+static int
+moetr_init(MoeTr *m, char default_result_type, const Lang *default_langs[2])
+{
+	memset(m, 0, sizeof(*m));
+	m->backend = CONFIG_BACKEND;
+	m->endpoints = "";
+	m->is_stats = CONFIG_STATS;
+	m->langs[0] = default_langs[0];
+	m->langs[1] = default_langs[1];
+
+	if (moetr_set_result_type(m, default_result_type) < 0)
+		return -1;
+
+	if (http_pool_init(&m->pool) < 0)
+		return -1;
+
+	if (http_init(&m->http, &m->pool) < 0) {
+		http_pool_deinit(&m->pool);
+		return -1;
+	}
+
+	if (buffer_init(&m->result.text, CONFIG_BUFFER_SIZE) < 0) {
+		LOG_ERRNO(COLOR_REGULAR_YELLOW("moetr_init: buffer_init"));
+		http_deinit(&m->http);
+		http_pool_deinit(&m->pool);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+static void
+moetr_deinit(MoeTr *m)
+{
+	free(m->json);
+	buffer_deinit(&m->result.text);
+	http_deinit(&m->http);
+	http_pool_deinit(&m->pool);
+}
+
+
+static int
+moetr_http_init(MoeTr *m, Http *h)
+{
+	if (http_init(h, &m->pool) < 0)
+		return -1;
+
+	h->backend = m->http.backend;
+	h->host = m->http.host;
+	h->port = m->http.port;
+	h->api_key = m->http.api_key;
+	h->is_tls = m->http.is_tls;
+	h->is_h2 = m->http.is_h2;
+	h->retries = m->http.retries;
+	h->timeout = m->http.timeout;
+	h->hedge_pct = m->http.hedge_pct;
+	return 0;
+}
+
+
+static int
+moetr_set_langs(MoeTr *m, const char keys[])
+{
+	const int ret = lang_parse(m->langs, keys);
+	switch (ret) {
+	case -1:
+		LOG_ERR(COLOR_REGULAR_YELLOW("moetr_set_langs: invalid keys format") "\n");
+		break;
+	case -2:
+		LOG_ERR(COLOR_REGULAR_YELLOW("moetr_set_langs: invalid source lang") "\n");
+		break;
+	case -3:
+		LOG_ERR(COLOR_REGULAR_YELLOW("moetr_set_langs: invalid target lang") "\n");
+		break;
+	case -4:
+		LOG_ERR(COLOR_REGULAR_YELLOW("moetr_set_langs: invalid source and target langs") "\n");
+		break;
+	}
+
+	return ret;
+}
+
+
+static int
+moetr_set_result_type(MoeTr *m, int type)
+{
+	switch (type) {
+	case 's':
+		m->result_type = RESULT_TYPE_SIMPLE;
+		break;
+	case 'd':
+		m->result_type = RESULT_TYPE_DETAIL;
+		break;
+	case 'l':
+		m->result_type = RESULT_TYPE_LANG;
+		break;
+	default:
+		LOG_ERR(COLOR_REGULAR_YELLOW("moetr_set_result_type: invalid result type") "\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+
+static int
+moetr_set_opt(MoeTr *m, const char opt[])
+{
+	const struct {
+		const char  *name;
+		int         *value;
+		const char **str;
+		const char  *desc;
+	} opts[] = {
+		{ "backend",      NULL, &m->backend, "Translation backend: google, libre" },
+		{ "endpoints",    NULL, &m->endpoints, "Router: [BACKEND@]HOST[:PORT],..." },
+		{ "race",         &m->pool.is_race, NULL, "Router: the best two at once, first reply wins" },
+		{ "host",         NULL, &m->http.host, "Server host name" },
+		{ "port",         NULL, &m->http.port, "Server port" },
+		{ "tls",          &m->http.is_tls, NULL, "Use HTTPS (0/1)" },
+		{ "http2",        &m->http.is_h2, NULL, "Use HTTP/2, h2c without tls (0/1)" },
+		{ "api_key",      NULL, &m->http.api_key, "LibreTranslate API key" },
+		{ "retries",      &m->http.retries, NULL, "Max retries of a transient failure" },
+		{ "timeout",      &m->http.timeout, NULL, "Request timeout (milliseconds), 0: none" },
+		{ "hedge",        &m->http.hedge_pct, NULL, "Hedge after this latency percentile, 0: off" },
+		{ "hedge_rate",   &m->pool.hedge_rate, NULL, "Max hedges, percent of the requests" },
+		{ "limit",        &m->pool.is_limit, NULL, "Adaptive concurrency limit (0/1)" },
+		{ "limit_max",    &m->pool.limit_max, NULL, "Max concurrent requests of the limit" },
+		{ "rps",          &m->pool.rps, NULL, "Max requests per second, 0: no limit" },
+		{ "cps",          &m->pool.cps, NULL, "Max characters per second, 0: no limit" },
+		{ "breaker",      &m->pool.is_breaker, NULL, "Circuit breaker, fail fast while down (0/1)" },
+		{ "breaker_cooldown", &m->pool.breaker_cooldown, NULL,
+		  "Open circuit: probe again after (milliseconds)" },
+		{ "tls_verify",   &m->pool.net_opts.tls_verify, NULL, "Verify the server certificate (0/1)" },
+		{ "tls_session_cache", &m->pool.net_opts.tls_session_cache, NULL,
+		  "Keep TLS sessions across runs (0/1)" },
+		{ "tcp_nodelay",  &m->pool.net_opts.tcp_nodelay, NULL, "Disable Nagle's algorithm (0/1)" },
+		{ "tcp_fastopen", &m->pool.net_opts.tcp_fastopen, NULL, "Send the request with the SYN (0/1)" },
+		{ "tcp_quickack", &m->pool.net_opts.tcp_quickack, NULL, "ACK the response right away (0/1)" },
+		{ "rcvbuf",       &m->pool.net_opts.rcvbuf, NULL, "Socket receive buffer size, 0: default" },
+		{ "record",       NULL, &m->pool.record_dir, "Save the request/response pairs in DIR" },
+		{ "replay",       NULL, &m->pool.replay_dir, "Replay the pairs of DIR, no network" },
+		{ "replay_timed", &m->pool.is_replay_timed, NULL, "Replay: with the recorded latencies (0/1)" },
+		{ "stats",        &m->is_stats, NULL, "Time the phases of the requests, print them (0/1)" },
+		{ "trace",        NULL, &m->pool.trace.path, "Write a timeline of the requests to FILE" },
+	};
+
+	/* the front end's, no stdio in the library: moetranslate_set_opt() refuses it */
+#ifndef MOETR_LIB
+	if (strcmp(opt, "help") == 0) {
+		for (size_t i = 0; i < LEN(opts); i++) {
+			if (opts[i].str != NULL) {
+				const char *str = *opts[i].str;
+				if (opts[i].str == &m->http.host)
+					str = http_host(&m->http);
+				else if (opts[i].str == &m->http.port)
+					str = http_port(&m->http);
+
+				printf(COLOR_REGULAR_GREEN("%-18s") "%-26s%s\n", opts[i].name, str,
+				       opts[i].desc);
+			} else {
+				printf(COLOR_REGULAR_GREEN("%-18s") "%-26d%s\n", opts[i].name, *opts[i].value,
+				       opts[i].desc);
+			}
+		}
+
+		return 1;
+	}
+#endif
+
+	const char *const sep = strchr(opt, '=');
+	if (sep != NULL) {
+		const size_t name_len = (size_t)(sep - opt);
+		for (size_t i = 0; i < LEN(opts); i++) {
+			if ((strlen(opts[i].name) != name_len) || (strncmp(opts[i].name, opt, name_len) != 0))
+				continue;
+
+			if (opts[i].str != NULL) {
+				if (sep[1] == '\0')
+					break;
+
+				/* parsed, the string is kept for "help" */
+				if ((opts[i].str == &m->backend) && (moetr_set_backend(m, sep + 1) < 0))
+					return -1;
+
+				if ((opts[i].str == &m->endpoints) && (moetr_set_endpoints(m, sep + 1) < 0))
+					return -1;
+
+				if ((opts[i].str == &m->pool.record_dir) && (mkdir(sep + 1, 0755) < 0) &&
+				    (errno != EEXIST)) {
+					LOG_ERRNO(COLOR_REGULAR_YELLOW("moetr_set_opt: record: mkdir"));
+					return -1;
+				}
+
+				*opts[i].str = sep + 1;
+				return 0;
+			}
+
+			char *end;
+			const long val = strtol(sep + 1, &end, 10);
+			if ((end == (sep + 1)) || (*end != '\0') || (val < 0) || (val > INT32_MAX))
+				break;
+
+			*opts[i].value = (int)val;
+			return 0;
+		}
+	}
+
+	LOG_ERR(COLOR_REGULAR_YELLOW("moetr_set_opt: invalid option: \"%s\"") "\n", opt);
+	return -1;
+}
+
+
+static int
+moetr_set_backend(MoeTr *m, const char name[])
+{
+	const Backend *const b = backend_get(name);
+	if (b == NULL) {
+		LOG_ERR(COLOR_REGULAR_YELLOW("moetr_set_backend: unknown backend: \"%s\"") "\n",
+			name);
+		return -1;
+	}
+
+	m->http.backend = b;
+	return 0;
+}
+
+
+static int
+moetr_set_endpoints(MoeTr *m, const char list[])
+{
+	char spec[CONFIG_HTTP_POOL_HOST_SIZE + 32];
+	const char *p = list;
+	while (*p != '\0') {
+		const size_t len = strcspn(p, ",");
+		if (len >= sizeof(spec)) {
+			LOG_ERR(COLOR_REGULAR_YELLOW("moetr_set_endpoints: too long: \"%.*s\"") "\n",
+				(int)len, p);
+			return -1;
+		}
+
+		memcpy(spec, p, len);
+		spec[len] = '\0';
+		if (http_pool_route_add(&m->pool, spec, m->http.backend) < 0)
+			return -1;
+
+		p += len + (p[len] == ',');
+	}
+
+	return 0;
+}
+
+
+static void
+moetr_print_simple(const Result *res, FILE *out)
+{
+	fprintf(out, "%.*s\n", (int)res->text_len, res->text.ptr);
+}
+
+
+static void
+moetr_print_detail_synonyms(const json_array_t *synonyms_a, FILE *out)
+{
+	json_array_t *arr;
+	json_string_t *str;
+	json_value_t *values[3];
+
+
+	fprintf(out, "\n------------------------");
+	for (json_array_element_t *e = synonyms_a->start; e != NULL; e = e->next) {
+		arr = json_value_as_array(e->value);
+		if (arr == NULL)
+			continue;
+
+		if (json_array_fills(values, LEN(values), arr) == 0)
+			continue;
+
+
+		/* verbs, nouns, etc. */
+		str = json_value_as_string_wrp(values[0]);
+		if (str != NULL) {
+			/* no label */
+			if (str->string_size == 0) {
+				fprintf(out, "\n" COLOR_BOLD_BLUE("[?]"));
+			} else {
+				fprintf(out, "\n" COLOR_BOLD_BLUE("[%c%.*s]"), toupper(str->string[0]),
+				       (int)str->string_size - 1, &str->string[1]);
+			}
+		}
+
+
+		/* target alternative(s) */
+		arr = json_value_as_array_wrp(values[2]);
+		if (arr == NULL)
+			continue;
+
+		int iter = 1;
+		for (json_array_element_t *ee = arr->start; ee != NULL; ee = ee->next) {
+			if (json_array_fills(values, LEN(values), json_value_as_array(ee->value)) == 0)
+				continue;
+
+			str = json_value_as_string_wrp(values[0]);
+			if (str == NULL)
+				continue;
+
+			fprintf(out, "\n" COLOR_BOLD_WHITE("%d. %c%.*s:") "\n   "
+			       COLOR_REGULAR_YELLOW("-> "), iter, toupper(str->string[0]),
+			       (int)str->string_size, &str->string[1]);
+
+			/* source alternatives */
+			arr = json_value_as_array_wrp(values[1]);
+			if (arr == NULL)
+				continue;
+
+			int _len = (int)arr->length;
+			for (json_array_element_t *eee = arr->start; eee != NULL; eee = eee->next) {
+				str = json_value_as_string(eee->value);
+				if (str == NULL)
+					continue;
+
+				fprintf(out, "%.*s", (int)str->string_size, str->string);
+
+				if (_len-- > 1)
+					fprintf(out, ", ");
+			}
+
+			if (_len == 0)
+				fprintf(out, ".");
+
+			if (iter == CONFIG_SYN_LINES_MAX)
+				break;
+
+			iter++;
+		}
+		fputc('\n', out);
+	}
+	fputc('\n', out);
+}
+
+
+static void
+moetr_print_detail_defs(const json_array_t *defs_a, FILE *out)
+{
+	json_array_t *arr;
+	json_string_t *str;
+	json_value_t *values[4];
+
+
+	fprintf(out, "\n------------------------");
+	for (json_array_element_t *e = defs_a->start; e != NULL; e = e->next) {
+		arr = json_value_as_array(e->value);
+		if (arr == NULL)
+			continue;
+
+		if (json_array_fills(values, LEN(values), arr) == 0)
+			continue;
+
+		/* verbs, nouns, etc. */
+		str = json_value_as_string_wrp(values[0]);
+		if (str != NULL) {
+			/* no label */
+			if (str->string_size == 0) {
+				fprintf(out, "\n" COLOR_BOLD_YELLOW("[?]"));
+			} else {
+				fprintf(out, "\n" COLOR_BOLD_YELLOW("[%c%.*s]"), toupper(str->string[0]),
+				       (int)str->string_size - 1, &str->string[1]);
+			}
+		}
+
+		arr = json_value_as_array_wrp(values[1]);
+		if (arr == NULL)
+			continue;
+
+		int iter = 1;
+		for (json_array_element_t *ee = arr->start; ee != NULL; ee = ee->next) {
+			if (json_array_fills(values, LEN(values), json_value_as_array(ee->value)) == 0)
+				continue;
+
+			str = json_value_as_string_wrp(values[0]);
+			if (str == NULL)
+				continue;
+
+			fprintf(out, "\n" COLOR_BOLD_WHITE("%d. %c%.*s"), iter, toupper(str->string[0]),
+			       (int)str->string_size, &str->string[1]);
+
+			arr = json_value_as_array_wrp(values[3]);
+			if (arr != NULL) {
+				arr = json_value_as_array_wrp(json_array_index(arr, 0));
+				str = json_value_as_string_wrp(json_array_index(arr, 0));
+				if (str != NULL)
+					fprintf(out, COLOR_REGULAR_GREEN(" [%.*s] "), (int)str->string_size, str->string);
+			}
+
+			str = json_value_as_string_wrp(values[2]);
+			if (str != NULL) {
+				fprintf(out, "\n" COLOR_REGULAR_YELLOW("   ->") " %c%.*s.",
+				       toupper(str->string[0]), (int)str->string_size, &str->string[1]);
+			}
+
+			if (iter == CONFIG_DEF_LINES_MAX)
+				break;
+
+			iter++;
+		}
+		fputc('\n', out);
+	}
+	fputc('\n', out);
+}
+
+
+static void
+moetr_print_detail_examples(json_array_t *examples_a, FILE *out)
+{
+	char buffer[CONFIG_EXM_BUFFER_SIZE];
+
+
+	fprintf(out, "\n------------------------\n");
+	for (json_array_element_t *e = examples_a->start; e != NULL; e = e->next) {
+		json_array_t *arr = json_value_as_array(e->value);
+		if (arr == NULL)
+			continue;
+
+		int iter = 1;
+		for (json_array_element_t *ee = arr->start; ee != NULL; ee = ee->next) {
+			arr = json_value_as_array(ee->value);
+			if (arr == NULL)
+				continue;
+
+			json_string_t *const str = json_value_as_string_wrp(json_array_index(arr, 0));
+			if (str == NULL)
+				continue;
+
+			const size_t len = str->string_size;
+			if (len >= sizeof(buffer))
+				continue;
+
+			memcpy(buffer, str->string, len);
+			buffer[len] = '\0';
+
+			char *const res = cstr_skip_html_tags(buffer, len);
+			res[0] = toupper(res[0]);
+
+			fprintf(out, "%d. " COLOR_REGULAR_YELLOW("%s.") "\n", iter, res);
+
+			if (iter == CONFIG_EXM_LINES_MAX)
+				break;
+
+			iter++;
+		}
+
+		fputc('\n', out);
+	}
+}
+
+
+static void
+moetr_print_detail(const MoeTr *m, const Result *res, const char src_text[], FILE *out)
+{
+	/* bufferred print */
+	char buffer[CONFIG_PRINT_BUFFER_SIZE];
+	const int buffer_set = (out == stdout) ? setvbuf(out, buffer, _IOFBF, sizeof(buffer)) : -1;
+	/* bufferred print */
+
+
+	/* source: correction */
+	const json_string_t *const src_cor_s = res->correction;
+	if (src_cor_s != NULL) {
+		fprintf(out, COLOR_BOLD_GREEN("Did you mean: ") "\"%.*s\" " COLOR_BOLD_GREEN("?") "\n\n",
+		       (int)src_cor_s->string_size, src_cor_s->string);
+	}
+
+
+	/* source: text */
+	fprintf(out, COLOR_REGULAR_YELLOW("%s") "\n", src_text);
+
+
+	/* source: spelling */
+	const json_string_t *const src_splls_s = res->src_spelling;
+	if (src_splls_s != NULL) {
+		fprintf(out, "(" COLOR_REGULAR_GREEN("%.*s") ")\n", (int)src_splls_s->string_size,
+		       src_splls_s->string);
+	}
+
+
+	/* source: language */
+	const json_string_t *const src_lang_s = res->lang;
+	if ((src_lang_s != NULL) && (strcasecmp("auto", m->langs[0]->key) == 0)) {
+		const Lang *lang = NULL;
+		const char *lang_val = "Unknown";
+		if (lang_get_from_key_s(src_lang_s->string, src_lang_s->string_size, &lang) == 0)
+			lang_val = lang->value;
+
+		fprintf(out, COLOR_BOLD_GREEN("[%.*s]:") COLOR_BOLD_WHITE(" %s") "\n",
+		       (int)src_lang_s->string_size, src_lang_s->string, lang_val);
+	}
+	fprintf(out, "\n------------------------\n");
+
+
+	/* target: text */
+	fprintf(out, "%.*s\n", (int)res->text_len, res->text.ptr);
+
+
+	/* target: spelling */
+	const json_string_t *const trg_splls_s = res->trg_spelling;
+	if (trg_splls_s != NULL)
+		fprintf(out, "( " COLOR_REGULAR_GREEN("%.*s") " )\n", (int)trg_splls_s->string_size, trg_splls_s->string);
+
+
+	/* synonyms */
+	if ((res->synonyms != NULL) && (CONFIG_SYN_LINES_MAX != 0))
+		moetr_print_detail_synonyms(res->synonyms, out);
+
+
+	/* definitions */
+	if ((res->defs != NULL) && (CONFIG_DEF_LINES_MAX != 0))
+		moetr_print_detail_defs(res->defs, out);
+
+
+	/* examples */
+	if ((res->examples != NULL) && (CONFIG_EXM_LINES_MAX != 0))
+		moetr_print_detail_examples(res->examples, out);
+
+
+	/* bufferred print */
+	if (buffer_set == 0) {
+		fflush(out);
+		setvbuf(out, NULL, _IOLBF, 0);
+	}
+	/* bufferred print */
+}
+
+
+static void
+moetr_print_detect_lang(const Result *res, FILE *out)
+{
+	const json_string_t *const str = res->lang;
+	if (str == NULL)
+		return;
+
+	const Lang *lang = NULL;
+	const char *lang_val = "Unknown";
+	if (lang_get_from_key_s(str->string, str->string_size, &lang) == 0)
+		lang_val = lang->value;
+
+	if (res->confidence >= 0)
+		fprintf(out, "%.*s (%s) %d%%\n", (int)str->string_size, str->string, lang_val, res->confidence);
+	else
+		fprintf(out, "%.*s (%s)\n", (int)str->string_size, str->string, lang_val);
+}
+
+
+static int
+moetr_print_response(MoeTr *m, Http *h, const char text[], FILE *out)
+{
+	const int64_t start = time_now_ns();
+	ALLOC_PHASE(HTTP_PHASE_PARSE);
+	size_t len;
+	char *const res = http_response_get_json(h, &len);
+	if (res == NULL)
+		goto err0;
+
+	PROBE(parse_start, h->req_id, len);
+	ALLOC_SUB_BEGIN(ALLOC_SUB_JSON);
+	json_value_t *const json = json_parse(res, len);
+	ALLOC_SUB_END();
+	if (json == NULL) {
+		LOG_ERR(COLOR_REGULAR_YELLOW("moetr_print_response: json_parse: failed to parse") "\n");
+		goto err0;
+	}
+
+	result_reset(&m->result);
+	if (h->backend->parse(json, m->result_type, &m->result) < 0) {
+		LOG_ERR(COLOR_REGULAR_YELLOW("moetr_print_response: %s: unexpected response") "\n",
+			h->backend->name);
+		free(json);
+		goto err0;
+	}
+
+	const int64_t parsed = time_now_ns();
+	PROBE(parse_end, h->req_id, parsed - start, m->result_type);
+	ALLOC_PHASE(HTTP_PHASE_RENDER);
+	switch (m->result_type) {
+	case RESULT_TYPE_SIMPLE:
+		moetr_print_simple(&m->result, out);
+		break;
+	case RESULT_TYPE_DETAIL:
+		moetr_print_detail(m, &m->result, text, out);
+		break;
+	case RESULT_TYPE_LANG:
+		moetr_print_detect_lang(&m->result, out);
+		break;
+	}
+
+	free(m->json);
+	m->json = json;
+	const int64_t end = time_now_ns();
+	h->timing.phases[HTTP_PHASE_PARSE] = parsed - start;
+	h->timing.phases[HTTP_PHASE_RENDER] = end - parsed;
+	http_trace(h, http_phase_str[HTTP_PHASE_PARSE], start, parsed, "bytes", (long)len);
+	http_trace(h, http_phase_str[HTTP_PHASE_RENDER], parsed, end, NULL, 0);
+	moetr_stats_add(m, &h->timing);
+	ALLOC_PHASE(HTTP_PHASES_SIZE);
+	return 0;
+
+err0:
+	ALLOC_PHASE(HTTP_PHASES_SIZE);
+	m->stats.failed++;
+	return -1;
+}
+
+
+static int
+moetr_translate(MoeTr *m, const char text[], FILE *out)
+{
+	const char *const src = m->langs[0]->key;
+	const char *const trg = m->langs[1]->key;
+	if (http_request(&m->http, m->result_type, src, trg, trg, text) < 0) {
+		m->stats.failed++;
+		return -1;
+	}
+
+	return moetr_print_response(m, &m->http, text, out);
+}
+
+
+static void
+moetr_stats_add(MoeTr *m, const HttpTiming *t)
+{
+	MoeTrStats *const st = &m->stats;
+	for (int i = 0; i < HTTP_PHASES_SIZE; i++)
+		moetr_stats_hist_add(&st->phases[i], t->phases[i]);
+
+	moetr_stats_hist_add(&st->total, t->total);
+	st->requests++;
+	st->reused += (t->is_reused != 0);
+	st->sent += t->sent;
+	st->received += t->received;
+}
+
+
+static void
+moetr_stats_hist_add(MoeTrHist *hist, int64_t ns)
+{
+	unsigned idx = 0;
+	for (int64_t us = ns / 1000; (us > 1) && (idx < (LEN(hist->buckets) - 1)); us >>= 1)
+		idx++;
+
+	hist->buckets[idx]++;
+	hist->count++;
+	hist->sum += ns;
+	if (ns > hist->max)
+		hist->max = ns;
+}
+
+
+#ifndef MOETR_LIB
+static int64_t
+moetr_stats_hist_pct(const MoeTrHist *hist, double pct)
+{
+	if (hist->count == 0)
+		return 0;
+
+	const unsigned long rank = (unsigned long)((pct * (double)hist->count) / 100.0);
+	unsigned long seen = 0;
+	for (size_t i = 0; i < LEN(hist->buckets); i++) {
+		seen += hist->buckets[i];
+		if (seen > rank) {
+			const int64_t upper = ((int64_t)2 << i) * 1000;
+			return MIN(upper, hist->max);
+		}
+	}
+
+	return hist->max;
+}
+
+
+static void
+moetr_stats_print_request(const HttpTiming *t)
+{
+	int64_t rest = t->total;
+	fprintf(stderr, "stats:");
+	for (int i = 0; i < HTTP_PHASES_SIZE; i++) {
+		fprintf(stderr, " %s %.3f ms |", http_phase_str[i], (double)t->phases[i] / 1e6);
+		if (i < HTTP_PHASE_PARSE)
+			rest -= t->phases[i];
+	}
+
+	/* parse and render: after the request */
+	fprintf(stderr, " wait %.3f ms | total %.3f ms\n", (double)MAX(rest, 0) / 1e6,
+		(double)(t->total + t->phases[HTTP_PHASE_PARSE] + t->phases[HTTP_PHASE_RENDER]) / 1e6);
+	fprintf(stderr, "stats: sent %zu bytes, received %zu bytes | connection: %s | attempts: %d\n",
+		t->sent, t->received, (t->is_reused) ? "reused" : "new", t->attempts);
+}
+
+
+static void
+moetr_stats_print_alloc(const MoeTr *m, FILE *out)
+{
+	struct rusage ru;
+	if (getrusage(RUSAGE_SELF, &ru) == 0)
+		fprintf(out, "memory: peak rss %ld KiB\n", ru.ru_maxrss);
+
+	AllocStats st;
+	alloc_get_stats(&st);
+	if (st.total.allocs == 0)
+		return;
+
+	/* the requests, in the phases, and the setup outside of them */
+	const unsigned long reqs = MAX(m->stats.requests, 1ul);
+	fprintf(out, "%-8s %12s %14s %14s\n", "phase", "allocs", "bytes", "per request");
+	for (int i = 0; i <= HTTP_PHASES_SIZE; i++) {
+		const AllocCounter *const c = &st.phases[i];
+		if (i < HTTP_PHASES_SIZE) {
+			fprintf(out, "%-8s %12lu %14llu %7.1f %6.0f\n", http_phase_str[i], c->allocs,
+				c->bytes, (double)c->allocs / reqs, (double)c->bytes / reqs);
+		} else {
+			fprintf(out, "%-8s %12lu %14llu\n", "(none)", c->allocs, c->bytes);
+		}
+	}
+
+	fprintf(out, "%-8s %12s %14s %14s %14s\n", "subsys", "allocs", "bytes", "live", "peak");
+	for (int i = 0; i <= ALLOC_SUBS_SIZE; i++) {
+		const AllocCounter *const c = (i < ALLOC_SUBS_SIZE) ? &st.subs[i] : &st.total;
+		fprintf(out, "%-8s %12lu %14llu %14zu %14zu\n",
+			(i < ALLOC_SUBS_SIZE) ? alloc_sub_str[i] : "total", c->allocs, c->bytes, c->live,
+			c->peak);
+	}
+
+	if (st.untracked > 0)
+		fprintf(out, "memory: %lu allocations untracked (table full)\n", st.untracked);
+}
+
+
+static void
+moetr_stats_print(const MoeTr *m, FILE *out)
+{
+	const MoeTrStats *const st = &m->stats;
+	fprintf(out, "stats: %lu requests, %lu failed | connection reuse: %lu (%.1f%%) | sent %llu "
+		"bytes, received %llu bytes\n", st->requests, st->failed, st->reused,
+		(st->requests > 0) ? ((100.0 * st->reused) / st->requests) : 0.0, st->sent,
+		st->received);
+
+	moetr_stats_print_alloc(m, out);
+	if (st->requests == 0)
+		return;
+
+	fprintf(out, "%-8s %10s %10s %10s %10s %10s  (ms)\n", "phase", "mean", "p50", "p90", "p99",
+		"max");
+	for (int i = 0; i <= HTTP_PHASES_SIZE; i++) {
+		const MoeTrHist *const hist = (i < HTTP_PHASES_SIZE) ? &st->phases[i] : &st->total;
+		fprintf(out, "%-8s %10.3f %10.3f %10.3f %10.3f %10.3f\n",
+			(i < HTTP_PHASES_SIZE) ? http_phase_str[i] : "request",
+			((double)hist->sum / (double)hist->count) / 1e6,
+			(double)moetr_stats_hist_pct(hist, 50) / 1e6,
+			(double)moetr_stats_hist_pct(hist, 90) / 1e6,
+			(double)moetr_stats_hist_pct(hist, 99) / 1e6, (double)hist->max / 1e6);
+	}
+
+	/* the requests, without parse and render */
+	size_t first = LEN(st->total.buckets), last = 0;
+	unsigned long peak = 0;
+	for (size_t i = 0; i < LEN(st->total.buckets); i++) {
+		if (st->total.buckets[i] == 0)
+			continue;
+
+		first = MIN(first, i);
+		last = i;
+		peak = MAX(peak, st->total.buckets[i]);
+	}
+
+	fprintf(out, "request latency:\n");
+	for (size_t i = first; i <= last; i++) {
+		const unsigned long count = st->total.buckets[i];
+		const int width = (int)((40 * count + peak - 1) / peak);
+		fprintf(out, "  %9.3f - %9.3f ms %-40.*s %lu\n", (i == 0) ? 0.0 : ((double)((int64_t)1 << i) / 1e3),
+			(double)((int64_t)2 << i) / 1e3, width, "########################################", count);
+	}
+}
+
+
+static void
+moetr_batch(MoeTr *m, FILE *input, unsigned concurrency)
+{
+	/*
+	 * One line, one text. Up to `concurrency` requests are in flight, sharing the
+	 * connection pool, the results are printed in the input order.
+	 */
+	struct {
+		Http  http;
+		char *line;
+	} *slots;
+
+	struct pollfd *pfds;
+	unsigned long count = 0, failed = 0, retries = 0;
+	unsigned head = 0, inflight = 0, slots_len = 0;
+	int is_eof = 0;
+
+	const char *const src = m->langs[0]->key;
+	const char *const trg = m->langs[1]->key;
+
+
+	if (concurrency == 0)
+		concurrency = 1;
+
+	ALLOC_SUB_BEGIN(ALLOC_SUB_HTTP);
+	slots = calloc(concurrency, sizeof(*slots));
+	pfds = calloc(concurrency * HTTP_POLLFDS, sizeof(*pfds));
+	ALLOC_SUB_END();
+	if ((slots == NULL) || (pfds == NULL)) {
+		perror(COLOR_REGULAR_YELLOW("moetr_batch: calloc"));
+		goto out0;
+	}
+
+	for (; slots_len < concurrency; slots_len++) {
+		if (moetr_http_init(m, &slots[slots_len].http) < 0)
+			goto out0;
+	}
+
+	while ((is_eof == 0) || (inflight > 0)) {
+		/* fill */
+		while ((is_eof == 0) && (inflight < concurrency)) {
+			char *line = NULL;
+			size_t line_size = 0;
+			if (getline(&line, &line_size, input) < 0) {
+				free(line);
+				is_eof = 1;
+				break;
+			}
+
+			char *const text = cstr_trim_right_mut(cstr_trim_left_mut(line));
+			if (*text == '\0') {
+				free(line);
+				continue;
+			}
+
+			const unsigned idx = (head + inflight) % concurrency;
+			memmove(line, text, strlen(text) + 1);
+			slots[idx].line = line;
+			http_begin(&slots[idx].http, m->result_type, src, trg, trg, line);
+			inflight++;
+		}
+
+		/* print the finished ones, in order */
+		while ((inflight > 0) && http_is_done(&slots[head].http)) {
+			if (moetr_print_response(m, &slots[head].http, slots[head].line, stdout) < 0) {
+				fprintf(stderr, COLOR_REGULAR_YELLOW("moetr_batch: failed: \"%s\"") "\n",
+					slots[head].line);
+				failed++;
+			}
+
+			count++;
+			retries += (unsigned long)slots[head].http.attempt;
+			free(slots[head].line);
+			slots[head].line = NULL;
+			head = (head + 1) % concurrency;
+			inflight--;
+		}
+
+		if (inflight == 0)
+			continue;
+
+		/* poll, until the nearest timeout, or the end of a backoff */
+		nfds_t pfds_len = 0;
+		int timeout = -1, is_pool = 0;
+		for (unsigned i = 0; i < inflight; i++) {
+			const Http *const h = &slots[(head + i) % concurrency].http;
+			const int t = http_timeout(h);
+			if ((t >= 0) && ((timeout < 0) || (t < timeout)))
+				timeout = t;
+
+			struct pollfd *const pfd = &pfds[i * HTTP_POLLFDS];
+			is_pool |= http_poll_set(h, pfd);
+			for (unsigned k = 0; k < HTTP_POLLFDS; k++) {
+				if ((pfd[k].fd < 0) || (pfd[k].events == 0))
+					continue;
+
+				/* HTTP/2: the streams share the connection, one of them is enough */
+				for (struct pollfd *p = pfds; (p < &pfd[k]) && http_is_h2(h); p++) {
+					if ((p->fd == pfd[k].fd) && (p->events != 0))
+						pfd[k].fd = -1;
+				}
+
+				if (pfd[k].fd >= 0)
+					pfds_len = (i * HTTP_POLLFDS) + k + 1;
+			}
+		}
+
+		/* nothing to poll: waiting for the pool, or only sleeping */
+		if ((pfds_len > 0) || (is_pool == 0)) {
+			if ((poll(pfds, pfds_len, timeout) < 0) && (errno != EINTR)) {
+				perror(COLOR_REGULAR_YELLOW("moetr_batch: poll"));
+				break;
+			}
+		}
+
+		for (unsigned i = 0; i < inflight; i++)
+			http_poll_step(&slots[(head + i) % concurrency].http, &pfds[i * HTTP_POLLFDS]);
+	}
+
+	HttpPoolStats stats;
+	http_pool_get_stats(&m->pool, &stats);
+	fprintf(stderr, "moetr_batch: %lu translated, %lu failed | pool: %lu connects, %lu reuses "
+		"(%.1f%%), %lu waits, %lu dead, %lu reaped | tfo: %lu/%lu | tls resumed: %lu/%lu | "
+		"h2 streams: %lu | retries: %lu | hedges: %lu (%lu won) | limit: %lu, %lu cuts, "
+		"%lu queued | breaker: %s, %lu trips, %lu rejected\n",
+		count - failed, failed, stats.new_connects, stats.reuses,
+		(stats.checkouts > 0) ? ((100.0 * stats.reuses) / stats.checkouts) : 0.0,
+		stats.waits, stats.dead, stats.reaped, stats.tfo_used, stats.tfo_attempts,
+		stats.tls_resumed, stats.tls_handshakes, stats.h2_streams, retries, stats.hedges,
+		stats.hedge_wins, stats.limit_window, stats.limit_cuts, stats.limit_queued,
+		http_pool_breaker_str[stats.breaker], stats.breaker_trips, stats.breaker_rejects);
+
+	for (unsigned i = 0; i < m->pool.routes_len; i++) {
+		const HttpPoolRoute *const r = &m->pool.routes[i];
+		fprintf(stderr, "moetr_batch: route %s@%s%s%s: %lu picks, %lu failed | latency: %.1f ms, "
+			"errors: %.1f%%\n", r->backend->name, r->host, (r->port[0] != '\0') ? ":" : "",
+			r->port, r->picks, r->fails, r->lat / 1e6, r->err * 100.0);
+	}
+
+	if (m->is_stats)
+		moetr_stats_print(m, stderr);
+
+out0:
+	for (unsigned i = 0; i < slots_len; i++) {
+		free(slots[i].line);
+		http_deinit(&slots[i].http);
+	}
+
+	free(pfds);
+	free(slots);
+}
+
+
+static void
+moetr_interactive_banner(const MoeTr *m)
+{
+	printf(COLOR_BOLD_WHITE("---[ Moetranslate ]---") "\n"
+	       COLOR_BOLD_GREEN("Languages:         ") "%s (%s) -> %s (%s)\n"
+	       COLOR_BOLD_GREEN("Result type:       ") "%s (%s)\n"
+	       COLOR_BOLD_GREEN("Show command list: ") "Type '/' and [Enter]\n\n",
+	       m->langs[0]->value, m->langs[0]->key, m->langs[1]->value, m->langs[1]->key,
+	       result_type_str[m->result_type][0], result_type_str[m->result_type][1]);
+}
+
+
+static void
+moetr_interactive_help(void)
+{
+	printf(COLOR_BOLD_GREEN("Change languages: ") COLOR_REGULAR_YELLOW("/c") " [SOURCE]:[TARGET]\n"
+	       COLOR_BOLD_GREEN("Result type:      ") COLOR_REGULAR_YELLOW("/r") " [TYPE]\n"
+	                        "                      %s = %s\n"
+	                        "                      %s = %s\n"
+	                        "                      %s = %s\n"
+	       COLOR_BOLD_GREEN("Show languages:   ") COLOR_REGULAR_YELLOW("/l") " [NUM]\n"
+	       COLOR_BOLD_GREEN("Show stats:       ") COLOR_REGULAR_YELLOW("/stats") "\n"
 	       COLOR_BOLD_GREEN("Quit:             ") COLOR_REGULAR_YELLOW("/q") "\n\n",
 	       result_type_str[RESULT_TYPE_SIMPLE][0],
 	       result_type_str[RESULT_TYPE_SIMPLE][1],
@@ -1334,272 +8219,2922 @@ moetr_interactive_help(void)
 }
 
 
-static int
-moetr_interactive_parse(char *cmd[])
+static int
+moetr_interactive_parse(char *cmd[])
+{
+	char *_cmd = *cmd;
+	if (*_cmd == '\0')
+		return MOETR_INTR_CODE_NOP;
+
+	/*
+	 * escape '/' character by adding '\' prefix:
+	 * example: \/q
+	 */
+	if ((*_cmd == '\\') && (*(_cmd + 1) == '/')) {
+		*cmd = _cmd + 1;
+		return MOETR_INTR_CODE_TRANSLATE;
+	}
+
+	if (*(_cmd++) != '/')
+		return MOETR_INTR_CODE_TRANSLATE;
+
+	switch (tolower(*_cmd)) {
+	case 'c':
+		*cmd = _cmd + 1;
+		return MOETR_INTR_CODE_CHANGE_LANGS;
+	case 'r':
+		_cmd = cstr_trim_right_mut(cstr_trim_left_mut(_cmd + 1));
+		if (strlen(_cmd) > 1)
+			break;
+
+		*cmd = _cmd;
+		return MOETR_INTR_CODE_CHANGE_RESTYPE;
+	case 'l':
+		if (*(_cmd + 1) == '\0')
+			*cmd = "2";
+		else
+			*cmd = _cmd + 1;
+
+		return MOETR_INTR_CODE_LANG_LIST;
+	case '\0':
+		return MOETR_INTR_CODE_HELP;
+	case 's':
+		if (strcasecmp(_cmd, "stats") != 0)
+			break;
+
+		return MOETR_INTR_CODE_STATS;
+	case 'q':
+		return MOETR_INTR_CODE_QUIT;
+	}
+
+	return MOETR_INTR_CODE_INVAL;
+}
+
+
+static void
+moetr_interactive_set_prompt(MoeTr *m)
+{
+	snprintf(m->prompt, sizeof(m->prompt), COLOR_BOLD_WHITE("[%s:%s][%s]->") " ",
+		 m->langs[0]->key, m->langs[1]->key, result_type_str[m->result_type][0]);
+}
+
+
+static void
+moetr_interactive_prewarm(MoeTr *m)
+{
+	Http *const h = &m->http;
+	const int idx = http_pool_route_peek(&m->pool, m->result_type);
+	if (idx < 0) {
+		http_pool_prewarm(&m->pool, http_host(h), http_port(h), h->is_tls, http_is_h2(h));
+		return;
+	}
+
+	const HttpPoolRoute *const r = &m->pool.routes[idx];
+	const char *port = (h->is_tls) ? r->backend->tls_port : r->backend->port;
+	if (r->port[0] != '\0')
+		port = r->port;
+
+	http_pool_prewarm(&m->pool, r->host, port, h->is_tls,
+			  h->is_h2 && (r->backend->caps & BACKEND_CAP_H2));
+}
+
+
+static void
+moetr_interactive(MoeTr *m, const char text[])
+{
+#ifdef WNO_INTERACTIVE_MODE
+	puts("Interactive input mode: Not supported!\nPlease rebuild without \"-DWNO_INTERACTIVE_MODE\" flag");
+
+	(void)m;
+	(void)text;
+	(void)moetr_interactive_banner;
+	(void)moetr_interactive_help;
+	(void)moetr_interactive_parse;
+	(void)moetr_interactive_set_prompt;
+#else
+	setlocale(LC_CTYPE, "");
+	stifle_history(CONFIG_INTERACTIVE_HISTORY_SIZE);
+	moetr_interactive_set_prompt(m);
+	moetr_interactive_banner(m);
+
+	/* hide DNS + TCP handshake behind the user's typing */
+	moetr_interactive_prewarm(m);
+
+	if (text != NULL) {
+		moetr_translate(m, text, stdout);
+		moetr_interactive_prewarm(m);
+	}
+
+	int is_alive = 1;
+	while (is_alive) {
+		char *const res = readline(m->prompt);
+		if (res == NULL)
+			break;
+
+		char *cmd = cstr_trim_right_mut(cstr_trim_left_mut(res));
+		switch (moetr_interactive_parse(&cmd)) {
+		case MOETR_INTR_CODE_TRANSLATE:
+			puts("------------------------");
+			moetr_translate(m, cmd, stdout);
+			puts("------------------------");
+			moetr_interactive_prewarm(m);
+			break;
+		case MOETR_INTR_CODE_CHANGE_LANGS:
+			if (moetr_set_langs(m, cmd) == 0)
+				moetr_interactive_set_prompt(m);
+
+			cmd = res;
+			break;
+		case MOETR_INTR_CODE_CHANGE_RESTYPE:
+			if (moetr_set_result_type(m, *cmd) == 0)
+				moetr_interactive_set_prompt(m);
+
+			cmd = res;
+			break;
+		case MOETR_INTR_CODE_NOP:
+			break;
+		case MOETR_INTR_CODE_LANG_LIST:
+			lang_show_list(atoi(cmd));
+			cmd = res;
+			break;
+		case MOETR_INTR_CODE_HELP:
+			moetr_interactive_help();
+			break;
+		case MOETR_INTR_CODE_STATS:
+			moetr_stats_print(m, stdout);
+			break;
+		case MOETR_INTR_CODE_QUIT:
+			is_alive = 0;
+			break;
+		default:
+			puts("Invalid command!");
+			break;
+		}
+
+		if (*cmd != '\0')
+			add_history(cmd);
+
+		free(res);
+	}
+
+	if (m->is_stats)
+		moetr_stats_print(m, stdout);
+#endif
+}
+
+
+/*
+ * Cache
+ */
+static int
+cache_init(Cache *c, size_t size, int64_t ttl)
+{
+	memset(c, 0, sizeof(*c));
+	c->size = size;
+	c->ttl = ttl;
+	if (size == 0)
+		return 0;
+
+	c->buckets_len = 1;
+	while (c->buckets_len < size)
+		c->buckets_len <<= 1;
+
+	c->buckets = calloc(c->buckets_len, sizeof(*c->buckets));
+	if (c->buckets == NULL) {
+		LOG_ERRNO(COLOR_REGULAR_YELLOW("cache_init: calloc"));
+		return -1;
+	}
+
+	return 0;
+}
+
+
+static void
+cache_deinit(Cache *c)
+{
+	while (c->lru_head != NULL)
+		cache_remove(c, c->lru_head);
+
+	free(c->buckets);
+}
+
+
+static uint64_t
+cache_hash(const char key[], size_t len)
+{
+	uint64_t hash = 0xcbf29ce484222325ull;
+	for (size_t i = 0; i < len; i++)
+		hash = (hash ^ (unsigned char)key[i]) * 0x100000001b3ull;
+
+	return hash;
+}
+
+
+static const MoeTranslateResult *
+cache_get(Cache *c, const char key[], size_t len, uint64_t hash)
+{
+	if (c->size == 0)
+		return NULL;
+
+	CacheEntry *e = c->buckets[hash & (c->buckets_len - 1)];
+	for (; e != NULL; e = e->next) {
+		if ((e->hash == hash) && (e->key_len == len) && (memcmp(e->key, key, len) == 0))
+			break;
+	}
+
+	if ((e != NULL) && (time_now_ns() >= e->expires)) {
+		cache_remove(c, e);
+		e = NULL;
+	}
+
+	if (e == NULL) {
+		c->misses++;
+		return NULL;
+	}
+
+	/* the most recent one */
+	cache_lru_unlink(c, e);
+	cache_lru_push(c, e);
+
+	c->hits++;
+	return &e->result;
+}
+
+
+static int
+cache_put(Cache *c, const char key[], size_t len, uint64_t hash, MoeTranslateResult *res)
+{
+	if (c->size == 0)
+		return -1;
+
+	CacheEntry **const bucket = &c->buckets[hash & (c->buckets_len - 1)];
+	for (CacheEntry *e = *bucket; e != NULL; e = e->next) {
+		if ((e->hash == hash) && (e->key_len == len) && (memcmp(e->key, key, len) == 0)) {
+			cache_remove(c, e);
+			break;
+		}
+	}
+
+	if (c->len == c->size) {
+		cache_remove(c, c->lru_tail);
+		c->evictions++;
+	}
+
+	CacheEntry *const e = malloc(sizeof(*e) + len);
+	if (e == NULL)
+		return -1;
+
+	e->hash = hash;
+	e->expires = time_now_ns() + c->ttl;
+	e->result = *res;
+	e->key_len = len;
+	memcpy(e->key, key, len);
+
+	e->next = *bucket;
+	*bucket = e;
+	cache_lru_push(c, e);
+	c->len++;
+	return 0;
+}
+
+
+static void
+cache_remove(Cache *c, CacheEntry *e)
+{
+	CacheEntry **pp = &c->buckets[e->hash & (c->buckets_len - 1)];
+	while (*pp != e)
+		pp = &(*pp)->next;
+
+	*pp = e->next;
+	cache_lru_unlink(c, e);
+	c->len--;
+
+	moetranslate_result_free(&e->result);
+	free(e);
+}
+
+
+static void
+cache_lru_push(Cache *c, CacheEntry *e)
+{
+	e->lru_prev = NULL;
+	e->lru_next = c->lru_head;
+	if (c->lru_head != NULL)
+		c->lru_head->lru_prev = e;
+	else
+		c->lru_tail = e;
+
+	c->lru_head = e;
+}
+
+
+static void
+cache_lru_unlink(Cache *c, CacheEntry *e)
+{
+	if (e->lru_prev != NULL)
+		e->lru_prev->lru_next = e->lru_next;
+	else
+		c->lru_head = e->lru_next;
+
+	if (e->lru_next != NULL)
+		e->lru_next->lru_prev = e->lru_prev;
+	else
+		c->lru_tail = e->lru_prev;
+}
+
+
+/*
+ * Server
+ */
+static volatile sig_atomic_t server_is_stopping;
+
+
+static int
+server_addr(struct sockaddr_un *addr, int is_daemon)
+{
+	const char *const dir = getenv("XDG_RUNTIME_DIR");
+	const size_t size = sizeof(addr->sun_path);
+	int ret;
+
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+	if (CONFIG_DAEMON_SOCKET[0] != '\0') {
+		ret = snprintf(addr->sun_path, size, "%s", CONFIG_DAEMON_SOCKET);
+	} else if ((dir != NULL) && (dir[0] != '\0')) {
+		ret = snprintf(addr->sun_path, size, "%s/moetranslate.sock", dir);
+	} else {
+		/* anyone can create in /tmp: the socket of another user is never trusted */
+		ret = snprintf(addr->sun_path, size, "/tmp/moetranslate-%u", (unsigned)getuid());
+		if ((ret < 0) || ((size_t)ret >= size))
+			goto err0;
+
+		if (is_daemon && (mkdir(addr->sun_path, 0700) < 0) && (errno != EEXIST))
+			return -1;
+
+		struct stat st;
+		if (lstat(addr->sun_path, &st) < 0)
+			return -1;
+
+		if ((S_ISDIR(st.st_mode) == 0) || (st.st_uid != getuid()) ||
+		    ((st.st_mode & 0077) != 0)) {
+			errno = EPERM;
+			return -1;
+		}
+
+		ret = snprintf(addr->sun_path, size, "/tmp/moetranslate-%u/daemon.sock",
+			       (unsigned)getuid());
+	}
+
+	if ((ret < 0) || ((size_t)ret >= size))
+		goto err0;
+
+	return 0;
+
+err0:
+	errno = ENAMETOOLONG;
+	return -1;
+}
+
+
+static int
+server_connect(const struct sockaddr_un *addr)
+{
+	/* struct ucred wants _GNU_SOURCE: the same layout (Linux) */
+	struct {
+		pid_t pid;
+		uid_t uid;
+		gid_t gid;
+	} cred;
+
+	const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+
+	if (connect(fd, (const struct sockaddr *)addr, sizeof(*addr)) < 0)
+		goto err0;
+
+	/* its replies go to the terminal: a daemon of the user only */
+	socklen_t cred_len = sizeof(cred);
+	if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &cred_len) < 0)
+		goto err0;
+
+	if ((cred_len != sizeof(cred)) || (cred.uid != getuid())) {
+		errno = EPERM;
+		goto err0;
+	}
+
+	return fd;
+
+err0:
+	close(fd);
+	return -1;
+}
+
+
+static int
+server_listen_tcp(const char addr[])
+{
+	char host[256];
+	const char *const sep = strrchr(addr, ':');
+	if ((sep == NULL) || (sep[1] == '\0') || ((size_t)(sep - addr) >= sizeof(host))) {
+		LOG_ERR(COLOR_REGULAR_YELLOW("server_listen_tcp: \"%s\": expected ADDR:PORT") "\n",
+			addr);
+		return -1;
+	}
+
+	/* "[::1]:8080" */
+	size_t host_len = (size_t)(sep - addr);
+	const char *host_p = addr;
+	if ((host_len >= 2) && (addr[0] == '[') && (addr[host_len - 1] == ']')) {
+		host_p++;
+		host_len -= 2;
+	}
+
+	memcpy(host, host_p, host_len);
+	host[host_len] = '\0';
+
+	const struct addrinfo hints = {
+		.ai_family = AF_UNSPEC,
+		.ai_socktype = SOCK_STREAM,
+		.ai_flags = AI_PASSIVE,
+	};
+
+	struct addrinfo *ai;
+	const int ret = getaddrinfo((host[0] != '\0') ? host : NULL, sep + 1, &hints, &ai);
+	if (ret != 0) {
+		LOG_ERR(COLOR_REGULAR_YELLOW("server_listen_tcp: getaddrinfo: %s") "\n",
+			gai_strerror(ret));
+		return -1;
+	}
+
+	int fd = -1;
+	for (struct addrinfo *a = ai; a != NULL; a = a->ai_next) {
+		fd = socket(a->ai_family, a->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, a->ai_protocol);
+		if (fd < 0)
+			continue;
+
+		const int val = 1;
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &val, sizeof(val));
+		if ((bind(fd, a->ai_addr, a->ai_addrlen) == 0) && (listen(fd, SOMAXCONN) == 0))
+			break;
+
+		close(fd);
+		fd = -1;
+	}
+
+	if (fd < 0)
+		LOG_ERRNO(COLOR_REGULAR_YELLOW("server_listen_tcp: bind"));
+
+	freeaddrinfo(ai);
+	return fd;
+}
+
+
+static int
+server_init(Server *s, MoeTranslate *ctx, int is_daemon, const char serve[])
+{
+	memset(s, 0, sizeof(*s));
+	s->ctx = ctx;
+	s->epfd = -1;
+	s->listen_fd = -1;
+	s->http_fd = -1;
+
+	if (is_daemon) {
+		if (server_addr(&s->addr, 1) < 0) {
+			LOG_ERRNO(COLOR_REGULAR_YELLOW("server_init: server_addr"));
+			return -1;
+		}
+
+		/* one daemon per socket, the socket of a dead one is replaced */
+		const int fd = server_connect(&s->addr);
+		if (fd >= 0) {
+			close(fd);
+			LOG_ERR(COLOR_REGULAR_YELLOW("server_init: %s: a daemon is running already")
+				"\n", s->addr.sun_path);
+			return -1;
+		}
+
+		/* nothing else is replaced: a socket of the user only */
+		struct stat st;
+		if ((lstat(s->addr.sun_path, &st) == 0) &&
+		    ((S_ISSOCK(st.st_mode) == 0) || (st.st_uid != getuid()))) {
+			LOG_ERR(COLOR_REGULAR_YELLOW("server_init: %s: not a socket of the user")
+				"\n", s->addr.sun_path);
+			return -1;
+		}
+	}
+
+	if ((serve != NULL) && ((s->http_fd = server_listen_tcp(serve)) < 0))
+		return -1;
+
+	s->clients = calloc(CONFIG_DAEMON_CLIENTS_MAX, sizeof(*s->clients));
+	if (s->clients == NULL) {
+		LOG_ERRNO(COLOR_REGULAR_YELLOW("server_init: calloc"));
+		goto err0;
+	}
+
+	for (unsigned i = 0; i < CONFIG_DAEMON_CLIENTS_MAX; i++)
+		s->clients[i].fd = -1;
+
+	if (cache_init(&s->cache, CONFIG_CACHE_SIZE, (int64_t)CONFIG_CACHE_TTL * 1000000000) < 0)
+		goto err1;
+
+	/* before the worker of the async API, which owns the connections then */
+	moetr_interactive_prewarm(&ctx->moe);
+
+	const int async_fd = moetranslate_fd(ctx);
+	if (async_fd < 0)
+		goto err2;
+
+	s->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (s->epfd < 0) {
+		LOG_ERRNO(COLOR_REGULAR_YELLOW("server_init: epoll_create1"));
+		goto err2;
+	}
+
+	struct epoll_event ev = { .events = EPOLLIN, .data.u64 = SERVER_EV_ASYNC };
+	if (epoll_ctl(s->epfd, EPOLL_CTL_ADD, async_fd, &ev) < 0) {
+		LOG_ERRNO(COLOR_REGULAR_YELLOW("server_init: epoll_ctl"));
+		goto err3;
+	}
+
+	ev.data.u64 = SERVER_EV_HTTP;
+	if ((s->http_fd >= 0) && (epoll_ctl(s->epfd, EPOLL_CTL_ADD, s->http_fd, &ev) < 0)) {
+		LOG_ERRNO(COLOR_REGULAR_YELLOW("server_init: epoll_ctl"));
+		goto err3;
+	}
+
+	if (is_daemon == 0)
+		return 0;
+
+	s->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (s->listen_fd < 0) {
+		LOG_ERRNO(COLOR_REGULAR_YELLOW("server_init: socket"));
+		goto err3;
+	}
+
+	unlink(s->addr.sun_path);
+
+	/* the owner only */
+	const mode_t mask = umask(0177);
+	const int ret = bind(s->listen_fd, (struct sockaddr *)&s->addr, sizeof(s->addr));
+	umask(mask);
+	if (ret < 0) {
+		LOG_ERRNO(COLOR_REGULAR_YELLOW("server_init: bind"));
+		goto err4;
+	}
+
+	if (listen(s->listen_fd, SOMAXCONN) < 0) {
+		LOG_ERRNO(COLOR_REGULAR_YELLOW("server_init: listen"));
+		goto err5;
+	}
+
+	ev.data.u64 = SERVER_EV_LISTEN;
+	if (epoll_ctl(s->epfd, EPOLL_CTL_ADD, s->listen_fd, &ev) < 0) {
+		LOG_ERRNO(COLOR_REGULAR_YELLOW("server_init: epoll_ctl"));
+		goto err5;
+	}
+
+	return 0;
+
+err5:
+	unlink(s->addr.sun_path);
+err4:
+	close(s->listen_fd);
+err3:
+	close(s->epfd);
+err2:
+	cache_deinit(&s->cache);
+err1:
+	free(s->clients);
+err0:
+	if (s->http_fd >= 0)
+		close(s->http_fd);
+
+	return -1;
+}
+
+
+static void
+server_deinit(Server *s)
+{
+	for (unsigned i = 0; i < CONFIG_DAEMON_CLIENTS_MAX; i++) {
+		if (s->clients[i].fd >= 0)
+			server_close(s, &s->clients[i]);
+	}
+
+	/* still in the queues of the context: it's freed later, without them */
+	for (ServerTag *t = s->inflight, *next; t != NULL; t = next) {
+		next = t->next;
+		for (ServerTag *w = t->waiters, *w_next; w != NULL; w = w_next) {
+			w_next = w->next;
+			free(w);
+		}
+
+		free(t);
+	}
+
+	if (s->listen_fd >= 0) {
+		unlink(s->addr.sun_path);
+		close(s->listen_fd);
+	}
+
+	if (s->http_fd >= 0)
+		close(s->http_fd);
+
+	close(s->epfd);
+	cache_deinit(&s->cache);
+	free(s->clients);
+}
+
+
+static int
+server_run(MoeTranslate *ctx, int is_daemon, const char serve[])
+{
+	struct epoll_event evs[64];
+	Server s;
+
+	if (server_init(&s, ctx, is_daemon, serve) < 0)
+		return -1;
+
+	const struct sigaction act = { .sa_handler = server_on_signal };
+	sigaction(SIGINT, &act, NULL);
+	sigaction(SIGTERM, &act, NULL);
+
+	if (s.listen_fd >= 0)
+		printf("moetranslate: daemon: %s\n", s.addr.sun_path);
+	if (s.http_fd >= 0)
+		printf("moetranslate: gateway: http://%s\n", serve);
+
+	fflush(stdout);
+
+	/* a look for the idle clients and the expired requests every second */
+	while (server_is_stopping == 0) {
+		const int ret = epoll_wait(s.epfd, evs, LEN(evs), 1000);
+		if ((ret < 0) && (errno != EINTR)) {
+			LOG_ERRNO(COLOR_REGULAR_YELLOW("server_run: epoll_wait"));
+			break;
+		}
+
+		for (int i = 0; i < ret; i++) {
+			const uint64_t data = evs[i].data.u64;
+			if (data == SERVER_EV_LISTEN) {
+				server_accept(&s, s.listen_fd, SERVER_PROTO_MSG);
+				continue;
+			}
+
+			if (data == SERVER_EV_HTTP) {
+				server_accept(&s, s.http_fd, SERVER_PROTO_HTTP);
+				continue;
+			}
+
+			if (data == SERVER_EV_ASYNC) {
+				server_drain(&s);
+				continue;
+			}
+
+			/* closed and reused earlier in this round: not its events */
+			ServerClient *const c = &s.clients[data & UINT32_MAX];
+			if ((c->fd < 0) || (c->gen != (data >> 32)))
+				continue;
+
+			const uint32_t events = evs[i].events;
+			if ((events & EPOLLIN) && (server_read(&s, c) < 0)) {
+				server_close(&s, c);
+				continue;
+			}
+
+			if ((events & EPOLLOUT) && (server_flush(&s, c) < 0)) {
+				server_close(&s, c);
+				continue;
+			}
+
+			if ((events & (EPOLLIN | EPOLLOUT)) == 0)
+				server_close(&s, c);
+		}
+
+		const int64_t now = time_now_ns();
+		server_dispatch(&s, now);
+		server_expire(&s, now);
+	}
+
+	const Cache *const cache = &s.cache;
+	printf("daemon: %lu requests (%lu HTTP), %lu failed, %lu expired, %lu coalesced, %lu refused "
+	       "clients | cache: %lu hits (%.1f%%), %lu misses, %lu evictions, %zu entries\n",
+	       s.requests, s.http_requests, s.errors, s.dropped, s.coalesced, s.refused, cache->hits,
+	       (s.requests > 0) ? ((100.0 * cache->hits) / s.requests) : 0.0, cache->misses,
+	       cache->evictions, cache->len);
+
+	if (ctx->moe.is_stats)
+		moetr_stats_print(&ctx->moe, stdout);
+
+	server_deinit(&s);
+	return 0;
+}
+
+
+static void
+server_on_signal(int sig)
+{
+	(void)sig;
+	server_is_stopping = 1;
+}
+
+
+static void
+server_accept(Server *s, int listen_fd, int proto)
+{
+	for (;;) {
+		const int fd = accept(listen_fd, NULL, NULL);
+		if (fd < 0) {
+			if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR))
+				LOG_ERRNO(COLOR_REGULAR_YELLOW("server_accept: accept"));
+
+			return;
+		}
+
+		ServerClient *c = NULL;
+		for (unsigned i = 0; i < CONFIG_DAEMON_CLIENTS_MAX; i++) {
+			if (s->clients[i].fd < 0) {
+				c = &s->clients[i];
+				break;
+			}
+		}
+
+		if (c == NULL) {
+			s->refused++;
+			close(fd);
+			continue;
+		}
+
+		if ((fcntl(fd, F_SETFL, O_NONBLOCK) < 0) || (fcntl(fd, F_SETFD, FD_CLOEXEC) < 0)) {
+			LOG_ERRNO(COLOR_REGULAR_YELLOW("server_accept: fcntl"));
+			close(fd);
+			continue;
+		}
+
+		if (proto == SERVER_PROTO_HTTP) {
+			const int val = 1;
+			setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &val, sizeof(val));
+		}
+
+		if (buffer_init(&c->in, CONFIG_BUFFER_SIZE) < 0) {
+			LOG_ERRNO(COLOR_REGULAR_YELLOW("server_accept: buffer_init"));
+			close(fd);
+			continue;
+		}
+
+		if (buffer_init(&c->out, CONFIG_BUFFER_SIZE) < 0) {
+			LOG_ERRNO(COLOR_REGULAR_YELLOW("server_accept: buffer_init"));
+			buffer_deinit(&c->in);
+			close(fd);
+			continue;
+		}
+
+		struct epoll_event ev = {
+			.events = EPOLLIN,
+			.data.u64 = ((uint64_t)c->gen << 32) | (uint64_t)(c - s->clients),
+		};
+
+		if (epoll_ctl(s->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+			LOG_ERRNO(COLOR_REGULAR_YELLOW("server_accept: epoll_ctl"));
+			buffer_deinit(&c->in);
+			buffer_deinit(&c->out);
+			close(fd);
+			continue;
+		}
+
+		c->fd = fd;
+		c->proto = proto;
+		c->is_writing = 0;
+		c->is_closing = 0;
+		c->is_continued = 0;
+		c->active = time_now_ns();
+		c->in_len = 0;
+		c->out_len = 0;
+		c->out_off = 0;
+		c->reqs = NULL;
+		c->reqs_tail = &c->reqs;
+		for (int prio = 0; prio < SERVER_PRIO_SIZE; prio++) {
+			c->flows[prio].head = NULL;
+			c->flows[prio].tail = &c->flows[prio].head;
+			c->flows[prio].finish = 0;
+			c->flows[prio].weight = 1;
+		}
+	}
+}
+
+
+static void
+server_close(Server *s, ServerClient *c)
+{
+	epoll_ctl(s->epfd, EPOLL_CTL_DEL, c->fd, NULL);
+	close(c->fd);
+	buffer_deinit(&c->in);
+	buffer_deinit(&c->out);
+	for (ServerHttpReq *r = c->reqs, *next; r != NULL; r = next) {
+		next = r->next;
+		server_http_req_free(r);
+	}
+
+	for (int prio = 0; prio < SERVER_PRIO_SIZE; prio++) {
+		for (ServerTag *t = c->flows[prio].head, *next; t != NULL; t = next) {
+			next = t->next;
+			s->queued[prio]--;
+			free(t);
+		}
+
+		c->flows[prio].head = NULL;
+	}
+
+	c->reqs = NULL;
+	c->fd = -1;
+	c->gen++;
+}
+
+
+static void
+server_expire(Server *s, int64_t now)
+{
+	if ((now - s->expired) < 1000000000)
+		return;
+
+	s->expired = now;
+	for (unsigned i = 0; i < CONFIG_DAEMON_CLIENTS_MAX; i++) {
+		ServerClient *const c = &s->clients[i];
+		if ((c->fd < 0) || (c->proto != SERVER_PROTO_HTTP) || (c->reqs != NULL) ||
+		    (c->out_len > 0))
+			continue;
+
+		if ((now - c->active) >= ((int64_t)CONFIG_SERVE_IDLE_TIMEOUT * 1000000))
+			server_close(s, c);
+	}
+
+	/* out of the queues first: a failed delivery closes the client, with its queues */
+	ServerTag *expired = NULL;
+	for (unsigned i = 0; i < CONFIG_DAEMON_CLIENTS_MAX; i++) {
+		for (int prio = 0; prio < SERVER_PRIO_SIZE; prio++) {
+			ServerFlow *const f = &s->clients[i].flows[prio];
+			if (s->clients[i].fd < 0)
+				continue;
+
+			for (ServerTag **pp = &f->head; *pp != NULL;) {
+				ServerTag *const t = *pp;
+				if ((t->deadline == 0) || (now < t->deadline)) {
+					pp = &t->next;
+					continue;
+				}
+
+				*pp = t->next;
+				if (f->tail == &t->next)
+					f->tail = pp;
+
+				s->queued[prio]--;
+				t->next = expired;
+				expired = t;
+			}
+		}
+	}
+
+	/* coalesced: on their own deadlines, the one they wait on may have a later one */
+	for (ServerTag *l = s->inflight; l != NULL; l = l->next) {
+		for (ServerTag **pp = &l->waiters; *pp != NULL;) {
+			ServerTag *const w = *pp;
+			if ((w->deadline == 0) || (now < w->deadline)) {
+				pp = &w->next;
+				continue;
+			}
+
+			*pp = w->next;
+			w->next = expired;
+			expired = w;
+		}
+	}
+
+	for (ServerTag *t = expired, *next; t != NULL; t = next) {
+		next = t->next;
+		s->dropped++;
+		server_sched_drop(s, t, "deadline exceeded");
+	}
+}
+
+
+static int
+server_read(Server *s, ServerClient *c)
+{
+	/* a NUL after the data: the HTTP head is searched with strstr() */
+	if (buffer_check(&c->in, c->in_len + 2) < 0)
+		return -1;
+
+	const ssize_t ret = recv(c->fd, c->in.ptr + c->in_len, c->in.size - c->in_len - 1, 0);
+	if (ret == 0)
+		return -1;
+
+	if (ret < 0)
+		return ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR)) ? 0 : -1;
+
+	c->in_len += (size_t)ret;
+	c->in.ptr[c->in_len] = '\0';
+	c->active = time_now_ns();
+
+	/* pipelined: all the complete ones */
+	size_t off = 0;
+	while ((c->is_closing == 0) && (off < c->in_len)) {
+		const char *const buf = c->in.ptr + off;
+		const size_t len = c->in_len - off;
+		const long size = (c->proto == SERVER_PROTO_MSG) ? server_on_msg(s, c, buf, len)
+								 : server_on_http(s, c, buf, len);
+		if (size < 0)
+			return -1;
+		if (size == 0)
+			break;
+
+		off += (size_t)size;
+	}
+
+	/* after the last reply: the rest is not read */
+	if (c->is_closing)
+		off = c->in_len;
+
+	c->in_len -= off;
+	memmove(c->in.ptr, c->in.ptr + off, c->in_len + 1);
+	return 0;
+}
+
+
+static long
+server_on_msg(Server *s, ServerClient *c, const char buf[], size_t len)
+{
+	if (len < SERVER_MSG_REQ_HDR)
+		return 0;
+
+	uint32_t msg_len, id;
+	memcpy(&msg_len, buf, sizeof(msg_len));
+	memcpy(&id, buf + 4, sizeof(id));
+	if ((msg_len < SERVER_MSG_REQ_HDR) || (msg_len >= CONFIG_BUFFER_MAX_SIZE))
+		return -1;
+
+	if (len < msg_len)
+		return 0;
+
+	const unsigned version = (unsigned char)buf[8];
+	const unsigned type = (unsigned char)buf[9];
+	const size_t sl_len = (unsigned char)buf[10];
+	const size_t tl_len = (unsigned char)buf[11];
+	if ((version != SERVER_MSG_VERSION) || (type > MOETRANSLATE_TYPE_LANG) ||
+	    ((SERVER_MSG_REQ_HDR + sl_len + tl_len) > msg_len))
+		return -1;
+
+	const char *const sl = buf + SERVER_MSG_REQ_HDR;
+	const char *const tl = sl + sl_len;
+	const char *const text = tl + tl_len;
+	const size_t text_len = msg_len - (SERVER_MSG_REQ_HDR + sl_len + tl_len);
+	/* the one-shot invocations: interactive */
+	ServerTag w = { .id = id, .prio = SERVER_PRIO_INTERACTIVE };
+	if (CONFIG_SCHED_DEADLINE_INTERACTIVE > 0)
+		w.deadline = time_now_ns() + ((int64_t)CONFIG_SCHED_DEADLINE_INTERACTIVE * 1000000);
+
+	if (server_submit(s, c, &w, (int)type, sl, sl_len, tl, tl_len, text, text_len) < 0)
+		return -1;
+
+	return (long)msg_len;
+}
+
+
+static long
+server_on_http(Server *s, ServerClient *c, const char buf[], size_t len)
+{
+	const char *const end = strstr(buf, "\r\n\r\n");
+	if (end == NULL) {
+		if (len < CONFIG_SERVE_HEAD_MAX)
+			return 0;
+
+		c->is_closing = 1;
+		return server_http_status(s, c, 431, 0, "request header fields too large");
+	}
+
+	/* METHOD PATH HTTP/1.x */
+	char method[16], path[256];
+	const size_t head_len = (size_t)(end - buf) + 4;
+	const char *p = buf;
+	size_t i;
+	for (i = 0; (p < end) && (*p != ' ') && (i < (sizeof(method) - 1)); i++)
+		method[i] = *(p++);
+
+	method[i] = '\0';
+	for (p++, i = 0; (p < end) && (*p != ' ') && (*p != '?') && (i < (sizeof(path) - 1)); i++)
+		path[i] = *(p++);
+
+	path[i] = '\0';
+	p = strchr(p, ' ');
+	if ((p == NULL) || (p > end) || (strncmp(p + 1, "HTTP/1.", 7) != 0)) {
+		c->is_closing = 1;
+		return server_http_status(s, c, 400, 0, "invalid request line");
+	}
+
+	int is_keep_alive = (p[8] == '1');
+	int is_expecting = 0;
+	int is_chunked = 0;
+	size_t content_len = 0;
+	for (p = strstr(buf, "\r\n") + 2; p < end; p = strstr(p, "\r\n") + 2) {
+		if (strncasecmp(p, "Content-Length:", 15) == 0) {
+			content_len = (size_t)strtoull(p + 15, NULL, 10);
+		} else if (strncasecmp(p, "Transfer-Encoding:", 18) == 0) {
+			is_chunked = 1;
+		} else if (strncasecmp(p, "Expect:", 7) == 0) {
+			is_expecting = 1;
+		} else if (strncasecmp(p, "Connection:", 11) == 0) {
+			const char *const val = cstr_trim_left_mut((char *)p + 11);
+			if (strncasecmp(val, "close", 5) == 0)
+				is_keep_alive = 0;
+			else if (strncasecmp(val, "keep-alive", 10) == 0)
+				is_keep_alive = 1;
+		}
+	}
+
+	if (is_chunked) {
+		c->is_closing = 1;
+		return server_http_status(s, c, 501, 0, "chunked bodies are not supported");
+	}
+
+	if (content_len >= (CONFIG_BUFFER_MAX_SIZE / 2)) {
+		c->is_closing = 1;
+		return server_http_status(s, c, 413, 0, "body too large");
+	}
+
+	if ((len - head_len) < content_len) {
+		/* curl waits a second for it; after the replies of the previous ones only */
+		if (is_expecting && (c->is_continued == 0) && (c->reqs == NULL)) {
+			static const char cont[] = "HTTP/1.1 100 Continue\r\n\r\n";
+			if (buffer_check(&c->out, c->out_len + sizeof(cont)) < 0)
+				return -1;
+
+			memcpy(c->out.ptr + c->out_len, cont, sizeof(cont) - 1);
+			c->out_len += sizeof(cont) - 1;
+			c->is_continued = 1;
+			if (server_flush(s, c) < 0)
+				return -1;
+		}
+
+		return 0;
+	}
+
+	c->is_continued = 0;
+	if (is_keep_alive == 0)
+		c->is_closing = 1;
+
+	s->http_requests++;
+	if (server_http_request(s, c, method, path, buf + head_len, content_len, is_keep_alive) < 0)
+		return -1;
+
+	return (long)(head_len + content_len);
+}
+
+
+static int
+server_http_request(Server *s, ServerClient *c, const char method[], const char path[],
+		    const char body[], size_t body_len, int is_keep_alive)
+{
+	static const char *const apis[] = {
+		[SERVER_API_TRANSLATE] = "/translate",
+		[SERVER_API_DETECT]    = "/detect",
+		[SERVER_API_BATCH]     = "/batch",
+	};
+
+	if (strcmp(path, "/stats") == 0) {
+		if (strcmp(method, "GET") != 0)
+			return server_http_status(s, c, 405, is_keep_alive, "expected GET");
+
+		char stats[768];
+		const Cache *const cache = &s->cache;
+		pthread_mutex_lock(&s->ctx->lock);
+		const MoeTrStats st = s->ctx->moe.stats;
+		pthread_mutex_unlock(&s->ctx->lock);
+
+		snprintf(stats, sizeof(stats), "{\"requests\":%lu,\"http_requests\":%lu,\"failed\":%lu,"
+			 "\"expired\":%lu,\"coalesced\":%lu,\"refused\":%lu,"
+			 "\"queued\":{\"interactive\":%u,\"bulk\":%u},"
+			 "\"cache\":{\"hits\":%lu,\"misses\":%lu,\"evictions\":%lu,\"entries\":%zu},"
+			 "\"upstream\":{\"requests\":%lu,\"failed\":%lu,\"reused\":%lu,\"sent\":%llu,"
+			 "\"received\":%llu}}", s->requests, s->http_requests, s->errors, s->dropped,
+			 s->coalesced, s->refused, s->queued[SERVER_PRIO_INTERACTIVE], s->queued[SERVER_PRIO_BULK],
+			 cache->hits, cache->misses, cache->evictions, cache->len, st.requests, st.failed,
+			 st.reused, st.sent, st.received);
+
+		return server_http_status(s, c, 200, is_keep_alive, stats);
+	}
+
+	int api = SERVER_API_NONE;
+	for (size_t i = 0; i < LEN(apis); i++) {
+		if (strcmp(path, apis[i]) == 0)
+			api = (int)i;
+	}
+
+	if (api == SERVER_API_NONE)
+		return server_http_status(s, c, 404, is_keep_alive, "not found");
+	if (strcmp(method, "POST") != 0)
+		return server_http_status(s, c, 405, is_keep_alive, "expected POST");
+
+	json_value_t *const json = json_parse(body, body_len);
+	if ((json == NULL) || (json_value_as_object(json) == NULL)) {
+		free(json);
+		return server_http_status(s, c, 400, is_keep_alive, "expected a JSON object");
+	}
+
+	/* the defaults: those of the daemon */
+	const MoeTr *const moe = &s->ctx->moe;
+	const json_string_t *const sl_s = json_value_as_string_wrp(json_object_get(json, "sl"));
+	const json_string_t *const tl_s = json_value_as_string_wrp(json_object_get(json, "tl"));
+	const json_string_t *const type_s = json_value_as_string_wrp(json_object_get(json, "type"));
+	const json_string_t *const text_s = json_value_as_string_wrp(json_object_get(json, "text"));
+	json_array_t *const texts_a = json_value_as_array_wrp(json_object_get(json, "texts"));
+	const json_string_t *const prio_s = json_value_as_string_wrp(json_object_get(json, "priority"));
+	json_value_t *const deadline_v = json_object_get(json, "deadline");
+	json_value_t *const weight_v = json_object_get(json, "weight");
+	json_number_t *const deadline_n = (deadline_v != NULL) ? json_value_as_number(deadline_v) : NULL;
+	json_number_t *const weight_n = (weight_v != NULL) ? json_value_as_number(weight_v) : NULL;
+
+	const char *error = NULL;
+	int type = MOETRANSLATE_TYPE_SIMPLE;
+	if (api == SERVER_API_DETECT)
+		type = MOETRANSLATE_TYPE_LANG;
+	else if ((type_s != NULL) && (strcmp(type_s->string, "detail") == 0))
+		type = MOETRANSLATE_TYPE_DETAIL;
+	else if ((type_s != NULL) && (strcmp(type_s->string, "simple") != 0))
+		error = "\"type\": expected \"simple\" or \"detail\"";
+
+	char keys[64];
+	const Lang *langs[2] = { moe->langs[0], moe->langs[1] };
+	snprintf(keys, sizeof(keys), "%s:%s", (sl_s != NULL) ? sl_s->string : moe->langs[0]->key,
+		 (tl_s != NULL) ? tl_s->string : moe->langs[1]->key);
+	if (lang_parse(langs, keys) < 0)
+		error = "invalid \"sl\" or \"tl\"";
+
+	if ((api == SERVER_API_BATCH) && (texts_a == NULL))
+		error = "\"texts\": expected an array of strings";
+	else if ((api != SERVER_API_BATCH) && (text_s == NULL))
+		error = "\"text\": expected a string";
+
+	/* the defaults: a batch is bulk work, the rest is someone waiting */
+	ServerTag w = { .prio = SERVER_PRIO_INTERACTIVE };
+	if (api == SERVER_API_BATCH)
+		w.prio = SERVER_PRIO_BULK;
+
+	if ((prio_s != NULL) && (strcmp(prio_s->string, "bulk") == 0))
+		w.prio = SERVER_PRIO_BULK;
+	else if ((prio_s != NULL) && (strcmp(prio_s->string, "interactive") == 0))
+		w.prio = SERVER_PRIO_INTERACTIVE;
+	else if (prio_s != NULL)
+		error = "\"priority\": expected \"interactive\" or \"bulk\"";
+
+	const int64_t deadlines[] = {
+		[SERVER_PRIO_INTERACTIVE] = CONFIG_SCHED_DEADLINE_INTERACTIVE,
+		[SERVER_PRIO_BULK]        = CONFIG_SCHED_DEADLINE_BULK,
+	};
+
+	double deadline = (double)deadlines[w.prio];
+	if (deadline_n != NULL)
+		deadline = strtod(deadline_n->number, NULL);
+	if ((deadline_v != NULL) && ((deadline_n == NULL) || !(deadline >= 0) || (deadline > INT32_MAX)))
+		error = "\"deadline\": expected milliseconds";
+	else if (deadline > 0)
+		w.deadline = time_now_ns() + (int64_t)(MAX(deadline, 1.0) * 1000000);
+
+	/* the share of this connection, kept for its next requests */
+	const double weight = (weight_n != NULL) ? strtod(weight_n->number, NULL) : 0;
+	if ((weight_v != NULL) && (!(weight >= 1) || (weight > CONFIG_SCHED_WEIGHT_MAX)))
+		error = "\"weight\": expected a number, 1 up to the max of the daemon";
+
+	/* C strings from here on: a NUL ("\u0000") would cut the text, not its cache key */
+	const json_string_t *const strs[] = { sl_s, tl_s, type_s, text_s, prio_s };
+	for (size_t i = 0; i < LEN(strs); i++) {
+		if ((strs[i] != NULL) && (memchr(strs[i]->string, '\0', strs[i]->string_size) != NULL))
+			error = "unexpected NUL in a string";
+	}
+
+	for (json_array_element_t *e = (texts_a != NULL) ? texts_a->start : NULL; e != NULL;
+	     e = e->next) {
+		const json_string_t *const str = json_value_as_string(e->value);
+		if ((str != NULL) && (memchr(str->string, '\0', str->string_size) != NULL))
+			error = "unexpected NUL in a string";
+	}
+
+	if (error != NULL) {
+		free(json);
+		return server_http_status(s, c, 400, is_keep_alive, error);
+	}
+
+	if (weight_v != NULL)
+		c->flows[w.prio].weight = (unsigned)weight;
+
+	const size_t items_len = (api == SERVER_API_BATCH) ? texts_a->length : 1;
+	ServerHttpReq *const r = server_http_req_new(c, api, items_len, is_keep_alive);
+	if (r == NULL) {
+		free(json);
+		return -1;
+	}
+
+	const char *const sl = langs[0]->key;
+	const char *const tl = langs[1]->key;
+	json_array_element_t *e = (texts_a != NULL) ? texts_a->start : NULL;
+	for (size_t i = 0; i < items_len; i++) {
+		const json_string_t *str = text_s;
+		if (api == SERVER_API_BATCH) {
+			str = json_value_as_string(e->value);
+			e = e->next;
+		}
+
+		int ret;
+		if (str == NULL) {
+			const MoeTranslateResult res = { .error = "expected a string", .confidence = -1 };
+			const ServerTag t = { .req = r, .item = i };
+			ret = server_deliver(s, c, &t, &res);
+		} else {
+			w.req = r;
+			w.item = i;
+			ret = server_submit(s, c, &w, type, sl, strlen(sl), tl, strlen(tl), str->string,
+					    str->string_size);
+		}
+
+		/* closed: `r` is freed with the others */
+		if (ret < 0) {
+			free(json);
+			return -1;
+		}
+	}
+
+	free(json);
+
+	/* an empty batch */
+	if (items_len == 0)
+		return server_http_reply(s, c);
+
+	return 0;
+}
+
+
+static int
+server_http_status(Server *s, ServerClient *c, int status, int is_keep_alive, const char body[])
+{
+	ServerHttpReq *const r = server_http_req_new(c, SERVER_API_NONE, 1, is_keep_alive);
+	if (r == NULL)
+		return -1;
+
+	r->status = status;
+	r->items_left = 0;
+	if (status == 200) {
+		r->items[0].json = strdup(body);
+		r->items[0].len = strlen(body);
+	} else {
+		const MoeTranslateResult res = { .error = (char *)body, .confidence = -1 };
+		server_http_item(&r->items[0], SERVER_API_NONE, &res);
+	}
+
+	if (r->items[0].json == NULL)
+		return -1;
+
+	return server_http_reply(s, c);
+}
+
+
+static ServerHttpReq *
+server_http_req_new(ServerClient *c, int api, size_t items_len, int is_keep_alive)
+{
+	ServerHttpReq *const r = calloc(1, sizeof(*r) + (items_len * sizeof(r->items[0])));
+	if (r == NULL) {
+		LOG_ERRNO(COLOR_REGULAR_YELLOW("server_http_req_new: calloc"));
+		return NULL;
+	}
+
+	r->api = api;
+	r->status = 200;
+	r->is_keep_alive = is_keep_alive;
+	r->items_len = items_len;
+	r->items_left = items_len;
+
+	*c->reqs_tail = r;
+	c->reqs_tail = &r->next;
+	return r;
+}
+
+
+static void
+server_http_req_free(ServerHttpReq *r)
+{
+	for (size_t i = 0; i < r->items_len; i++)
+		free(r->items[i].json);
+
+	free(r);
+}
+
+
+static int
+server_http_reply(Server *s, ServerClient *c)
+{
+	static const char results[] = "{\"results\":[";
+
+	while ((c->reqs != NULL) && (c->reqs->items_left == 0)) {
+		ServerHttpReq *const r = c->reqs;
+		const int is_wrapped = (r->api == SERVER_API_BATCH);
+
+		/* the items, a newline; wrapped: with the commas and "]}" */
+		size_t body_len = 1;
+		for (size_t i = 0; i < r->items_len; i++)
+			body_len += r->items[i].len;
+
+		if (is_wrapped)
+			body_len += (sizeof(results) - 1) + 2 + ((r->items_len > 0) ? r->items_len - 1 : 0);
+
+		char head[256];
+		const int head_len = snprintf(head, sizeof(head), "HTTP/1.1 %d %s\r\n"
+					      "Content-Type: application/json\r\n"
+					      "Content-Length: %zu\r\n%s\r\n", r->status,
+					      server_http_reason(r->status), body_len,
+					      (r->is_keep_alive) ? "" : "Connection: close\r\n");
+
+		if (buffer_check(&c->out, c->out_len + (size_t)head_len + body_len) < 0)
+			return -1;
+
+		char *p = c->out.ptr + c->out_len;
+		memcpy(p, head, (size_t)head_len);
+		p += head_len;
+		if (is_wrapped) {
+			memcpy(p, results, sizeof(results) - 1);
+			p += sizeof(results) - 1;
+		}
+
+		for (size_t i = 0; i < r->items_len; i++) {
+			if (is_wrapped && (i > 0))
+				*(p++) = ',';
+
+			memcpy(p, r->items[i].json, r->items[i].len);
+			p += r->items[i].len;
+		}
+
+		if (is_wrapped) {
+			*(p++) = ']';
+			*(p++) = '}';
+		}
+
+		*(p++) = '\n';
+		c->out_len = (size_t)(p - c->out.ptr);
+
+		c->reqs = r->next;
+		if (c->reqs == NULL)
+			c->reqs_tail = &c->reqs;
+
+		server_http_req_free(r);
+	}
+
+	return server_flush(s, c);
+}
+
+
+static const char *
+server_http_reason(int status)
+{
+	switch (status) {
+	case 200: return "OK";
+	case 400: return "Bad Request";
+	case 404: return "Not Found";
+	case 405: return "Method Not Allowed";
+	case 413: return "Payload Too Large";
+	case 431: return "Request Header Fields Too Large";
+	case 501: return "Not Implemented";
+	case 502: return "Bad Gateway";
+	}
+
+	return "Error";
+}
+
+
+static int
+server_http_item(ServerHttpItem *item, int api, const MoeTranslateResult *res)
+{
+	FILE *const out = open_memstream(&item->json, &item->len);
+	if (out == NULL) {
+		LOG_ERRNO(COLOR_REGULAR_YELLOW("server_http_item: open_memstream"));
+		return -1;
+	}
+
+	if (res->error != NULL) {
+		fputs("{\"error\":", out);
+		server_json_str(out, res->error);
+		fputc('}', out);
+		return (fclose(out) == 0) ? 0 : -1;
+	}
+
+	const struct {
+		const char *name;
+		const char *value;
+	} strs[] = {
+		{ "text", (api != SERVER_API_DETECT) ? res->text : NULL },
+		{ "lang", res->lang },
+		{ "correction", res->correction },
+		{ "src_spelling", res->src_spelling },
+		{ "trg_spelling", res->trg_spelling },
+	};
+
+	const char *sep = "";
+	fputc('{', out);
+	for (size_t i = 0; i < LEN(strs); i++) {
+		if (strs[i].value == NULL)
+			continue;
+
+		fprintf(out, "%s\"%s\":", sep, strs[i].name);
+		server_json_str(out, strs[i].value);
+		sep = ",";
+	}
+
+	if (res->confidence >= 0)
+		fprintf(out, "%s\"confidence\":%d", sep, res->confidence);
+
+	fputc('}', out);
+	return (fclose(out) == 0) ? 0 : -1;
+}
+
+
+static void
+server_json_str(FILE *out, const char str[])
+{
+	fputc('"', out);
+	for (const unsigned char *p = (const unsigned char *)str; *p != '\0'; p++) {
+		switch (*p) {
+		case '"':  fputs("\\\"", out); break;
+		case '\\': fputs("\\\\", out); break;
+		case '\n': fputs("\\n", out); break;
+		case '\r': fputs("\\r", out); break;
+		case '\t': fputs("\\t", out); break;
+		default:
+			if (*p < 0x20)
+				fprintf(out, "\\u%04x", *p);
+			else
+				fputc(*p, out);
+		}
+	}
+
+	fputc('"', out);
+}
+
+
+static int
+server_submit(Server *s, ServerClient *c, const ServerTag *w, int type, const char sl[],
+	      size_t sl_len, const char tl[], size_t tl_len, const char text[], size_t text_len)
+{
+	const size_t key_len = 1 + sl_len + 1 + tl_len + 1 + text_len;
+	ServerTag *const t = malloc(sizeof(*t) + key_len + 1);
+	if (t == NULL) {
+		LOG_ERRNO(COLOR_REGULAR_YELLOW("server_submit: malloc"));
+		return -1;
+	}
+
+	char *const k_sl = t->key + 1;
+	char *const k_tl = k_sl + sl_len + 1;
+	char *const k_text = k_tl + tl_len + 1;
+	t->key[0] = (char)type;
+	memcpy(k_sl, sl, sl_len);
+	k_sl[sl_len] = '\0';
+	memcpy(k_tl, tl, tl_len);
+	k_tl[tl_len] = '\0';
+	memcpy(k_text, text, text_len);
+	k_text[text_len] = '\0';
+
+	t->client = (uint32_t)(c - s->clients);
+	t->gen = c->gen;
+	t->id = w->id;
+	t->req = w->req;
+	t->item = w->item;
+	t->prio = w->prio;
+	t->deadline = w->deadline;
+	t->waiters = NULL;
+	t->key_len = key_len;
+	t->hash = cache_hash(t->key, key_len);
+	s->requests++;
+
+	const MoeTranslateResult *const res = cache_get(&s->cache, t->key, key_len, t->hash);
+	if (res != NULL) {
+		PROBE(cache_hit, "result", k_text);
+		const int ret = server_deliver(s, c, t, res);
+		free(t);
+		return ret;
+	}
+
+	PROBE(cache_miss, "result", k_text);
+
+	ServerTag *const l = server_flight_get(s, t);
+	if (l != NULL) {
+		t->next = l->waiters;
+		l->waiters = t;
+		return 0;
+	}
+
+	server_sched_push(s, c, t);
+	return 0;
+}
+
+
+static void
+server_dispatch(Server *s, int64_t now)
+{
+	const unsigned bulk_slots = MIN(CONFIG_SCHED_BULK_SLOTS, CONFIG_ASYNC_CONCURRENCY);
+	while ((s->running[SERVER_PRIO_INTERACTIVE] + s->running[SERVER_PRIO_BULK]) <
+	       CONFIG_ASYNC_CONCURRENCY) {
+		int prio = SERVER_PRIO_INTERACTIVE;
+		if (s->queued[prio] == 0) {
+			prio = SERVER_PRIO_BULK;
+			if ((s->queued[prio] == 0) || (s->running[prio] >= bulk_slots))
+				return;
+		}
+
+		ServerFlow *const f = server_sched_pick(s, prio);
+		ServerTag *const t = f->head;
+		f->head = t->next;
+		if (f->head == NULL)
+			f->tail = &f->head;
+
+		s->queued[prio]--;
+		s->vtime[prio] = t->finish;
+		if ((t->deadline != 0) && (now >= t->deadline)) {
+			s->dropped++;
+			server_sched_drop(s, t, "deadline exceeded");
+			continue;
+		}
+
+		/* queued while another one went: waits on it */
+		ServerTag *const l = server_flight_get(s, t);
+		if (l != NULL) {
+			t->next = l->waiters;
+			l->waiters = t;
+			continue;
+		}
+
+		/* rounded up: it doesn't fail before its deadline */
+		int deadline = 0;
+		if (t->deadline != 0)
+			deadline = (int)MIN((t->deadline - now + 999999) / 1000000, INT32_MAX);
+
+		const char *const sl = t->key + 1;
+		const char *const tl = sl + strlen(sl) + 1;
+		const char *const text = tl + strlen(tl) + 1;
+		/* the engine serves the interactive ones first too */
+		const int type = t->key[0] | ((prio == SERVER_PRIO_BULK) ? MOETRANSLATE_BULK : 0);
+		if (moetranslate_submit(s->ctx, type, sl, tl, text, deadline, t) == 0) {
+			s->errors++;
+			server_sched_drop(s, t, moetranslate_error(s->ctx));
+			continue;
+		}
+
+		t->prev = NULL;
+		t->next = s->inflight;
+		if (t->next != NULL)
+			t->next->prev = t;
+
+		s->inflight = t;
+		s->running[prio]++;
+	}
+}
+
+
+static ServerTag *
+server_flight_get(Server *s, const ServerTag *t)
+{
+	/* at most CONFIG_ASYNC_CONCURRENCY of them */
+	for (ServerTag *l = s->inflight; l != NULL; l = l->next) {
+		if ((l->hash == t->hash) && (l->key_len == t->key_len) &&
+		    (memcmp(l->key, t->key, t->key_len) == 0))
+			return l;
+	}
+
+	return NULL;
+}
+
+
+static ServerFlow *
+server_sched_pick(Server *s, int prio)
+{
+	ServerFlow *best = NULL;
+	for (unsigned i = 0; i < CONFIG_DAEMON_CLIENTS_MAX; i++) {
+		ServerFlow *const f = &s->clients[i].flows[prio];
+		if ((s->clients[i].fd < 0) || (f->head == NULL))
+			continue;
+
+		if ((best == NULL) || (f->head->finish < best->head->finish))
+			best = f;
+	}
+
+	return best;
+}
+
+
+static void
+server_sched_push(Server *s, ServerClient *c, ServerTag *t)
+{
+	/* the virtual finish time: after the last one of its flow, or now */
+	ServerFlow *const f = &c->flows[t->prio];
+	t->finish = MAX(s->vtime[t->prio], f->finish) + (SERVER_SCHED_COST / f->weight);
+	f->finish = t->finish;
+
+	t->next = NULL;
+	*f->tail = t;
+	f->tail = &t->next;
+	s->queued[t->prio]++;
+}
+
+
+static void
+server_sched_drop(Server *s, ServerTag *t, const char error[])
+{
+	const MoeTranslateResult res = { .error = (char *)error, .confidence = -1 };
+	server_sched_done(s, t, &res);
+}
+
+
+static void
+server_sched_done(Server *s, ServerTag *t, const MoeTranslateResult *res)
+{
+	ServerClient *const c = &s->clients[t->client];
+	if ((c->fd >= 0) && (c->gen == t->gen) && (server_deliver(s, c, t, res) < 0))
+		server_close(s, c);
+
+	free(t);
+}
+
+
+static int
+server_deliver(Server *s, ServerClient *c, const ServerTag *t, const MoeTranslateResult *res)
+{
+	if (c->proto == SERVER_PROTO_MSG) {
+		if (res->error != NULL)
+			return server_reply(s, c, t->id, SERVER_MSG_STATUS_ERR, res->error,
+					    strlen(res->error));
+
+		return server_reply(s, c, t->id, SERVER_MSG_STATUS_OK, res->output, res->output_len);
+	}
+
+	ServerHttpReq *const r = t->req;
+	if (server_http_item(&r->items[t->item], r->api, res) < 0)
+		return -1;
+
+	/* one text: its failure is the request's */
+	if ((res->error != NULL) && (r->api != SERVER_API_BATCH))
+		r->status = 502;
+
+	if (--r->items_left > 0)
+		return 0;
+
+	return server_http_reply(s, c);
+}
+
+
+static int
+server_reply(Server *s, ServerClient *c, uint32_t id, int status, const char payload[], size_t len)
+{
+	const size_t size = SERVER_MSG_RES_HDR + len;
+	if ((size >= CONFIG_BUFFER_MAX_SIZE) || (buffer_check(&c->out, c->out_len + size) < 0))
+		return -1;
+
+	char *const msg = c->out.ptr + c->out_len;
+	const uint32_t msg_len = (uint32_t)size;
+	memcpy(msg, &msg_len, sizeof(msg_len));
+	memcpy(msg + 4, &id, sizeof(id));
+	msg[8] = (char)status;
+	memcpy(msg + SERVER_MSG_RES_HDR, payload, len);
+
+	c->out_len += size;
+	return server_flush(s, c);
+}
+
+
+static int
+server_flush(Server *s, ServerClient *c)
+{
+	while (c->out_off < c->out_len) {
+		const ssize_t ret = send(c->fd, c->out.ptr + c->out_off, c->out_len - c->out_off,
+					 MSG_NOSIGNAL);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+				break;
+
+			return -1;
+		}
+
+		c->out_off += (size_t)ret;
+	}
+
+	if (c->out_off == c->out_len) {
+		c->out_off = 0;
+		c->out_len = 0;
+
+		/* "Connection: close", or a broken request: all replied */
+		if (c->is_closing && (c->reqs == NULL))
+			return -1;
+	}
+
+	/* the rest: when the socket is writable */
+	const int is_writing = (c->out_len > 0);
+	if (is_writing == c->is_writing)
+		return 0;
+
+	struct epoll_event ev = {
+		.events = EPOLLIN | (is_writing ? EPOLLOUT : 0),
+		.data.u64 = ((uint64_t)c->gen << 32) | (uint64_t)(c - s->clients),
+	};
+
+	if (epoll_ctl(s->epfd, EPOLL_CTL_MOD, c->fd, &ev) < 0)
+		return -1;
+
+	c->is_writing = is_writing;
+	return 0;
+}
+
+
+static void
+server_drain(Server *s)
+{
+	MoeTranslateCompletion comps[CONFIG_ASYNC_CONCURRENCY];
+	size_t len;
+	while ((len = moetranslate_drain(s->ctx, comps, LEN(comps))) > 0) {
+		for (size_t i = 0; i < len; i++) {
+			ServerTag *const t = (ServerTag *)comps[i].udata;
+			MoeTranslateResult *const res = &comps[i].result;
+
+			if (t->prev != NULL)
+				t->prev->next = t->next;
+			else
+				s->inflight = t->next;
+			if (t->next != NULL)
+				t->next->prev = t->prev;
+
+			s->running[t->prio]--;
+
+			/* failed on its own deadline: the waiters with time left go again */
+			const int64_t now = time_now_ns();
+			const int is_late = (res->error != NULL) && (t->deadline != 0) &&
+					    (now >= t->deadline);
+			for (ServerTag *w = t->waiters, *next; w != NULL; w = next) {
+				next = w->next;
+				ServerClient *const c = &s->clients[w->client];
+				if (is_late && (c->fd >= 0) && (c->gen == w->gen) &&
+				    ((w->deadline == 0) || (now < w->deadline))) {
+					server_sched_push(s, c, w);
+					continue;
+				}
+
+				if (res->error != NULL)
+					s->errors++;
+
+				s->coalesced++;
+				server_sched_done(s, w, res);
+			}
+
+			/* the client may be gone, the result is cached anyway */
+			ServerClient *const c = &s->clients[t->client];
+			if ((c->fd >= 0) && (c->gen == t->gen) && (server_deliver(s, c, t, res) < 0))
+				server_close(s, c);
+
+			if (res->error != NULL)
+				s->errors++;
+
+			if ((res->error != NULL) || (cache_put(&s->cache, t->key, t->key_len, t->hash, res) < 0))
+				moetranslate_result_free(res);
+
+			free(t);
+		}
+	}
+}
+
+
+static int
+server_forward(const MoeTr *m, const char text[])
+{
+	struct sockaddr_un addr;
+	if (server_addr(&addr, 0) < 0)
+		return -1;
+
+	const int fd = server_connect(&addr);
+	if (fd < 0)
+		return -1;
+
+	/* a daemon that doesn't reply in time: direct */
+	const struct timeval tv = {
+		.tv_sec = CONFIG_DAEMON_TIMEOUT / 1000,
+		.tv_usec = (CONFIG_DAEMON_TIMEOUT % 1000) * 1000,
+	};
+
+	int ret = -1;
+	char *msg = NULL;
+	if ((setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) < 0) ||
+	    (setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)) < 0))
+		goto out0;
+
+	const char *const sl = m->langs[0]->key;
+	const char *const tl = m->langs[1]->key;
+	const size_t sl_len = strlen(sl);
+	const size_t tl_len = strlen(tl);
+	const size_t text_len = strlen(text);
+	const size_t size = SERVER_MSG_REQ_HDR + sl_len + tl_len + text_len;
+	if ((size >= CONFIG_BUFFER_MAX_SIZE) || (sl_len > UINT8_MAX) || (tl_len > UINT8_MAX))
+		goto out0;
+
+	msg = malloc(size);
+	if (msg == NULL)
+		goto out0;
+
+	const uint32_t msg_len = (uint32_t)size;
+	const uint32_t id = 1;
+	memcpy(msg, &msg_len, sizeof(msg_len));
+	memcpy(msg + 4, &id, sizeof(id));
+	msg[8] = SERVER_MSG_VERSION;
+	msg[9] = (char)m->result_type;
+	msg[10] = (char)sl_len;
+	msg[11] = (char)tl_len;
+	memcpy(msg + SERVER_MSG_REQ_HDR, sl, sl_len);
+	memcpy(msg + SERVER_MSG_REQ_HDR + sl_len, tl, tl_len);
+	memcpy(msg + SERVER_MSG_REQ_HDR + sl_len + tl_len, text, text_len);
+
+	/* the reply: the header, then the payload */
+	char hdr[SERVER_MSG_RES_HDR];
+	uint32_t res_len, res_id;
+	if ((server_send_all(fd, msg, size) < 0) || (server_recv_all(fd, hdr, sizeof(hdr)) < 0))
+		goto out0;
+
+	memcpy(&res_len, hdr, sizeof(res_len));
+	memcpy(&res_id, hdr + 4, sizeof(res_id));
+	if ((res_id != id) || (res_len < SERVER_MSG_RES_HDR) || (res_len >= CONFIG_BUFFER_MAX_SIZE) ||
+	    ((unsigned char)hdr[8] > SERVER_MSG_STATUS_ERR))
+		goto out0;
+
+	const size_t payload_len = res_len - SERVER_MSG_RES_HDR;
+	free(msg);
+	msg = malloc(payload_len + 1);
+	if ((msg == NULL) || (server_recv_all(fd, msg, payload_len) < 0))
+		goto out0;
+
+	if (hdr[8] == SERVER_MSG_STATUS_OK) {
+		fwrite(msg, 1, payload_len, stdout);
+		ret = 0;
+	} else {
+		fprintf(stderr, "%.*s\n", (int)payload_len, msg);
+		ret = 1;
+	}
+
+out0:
+	free(msg);
+	close(fd);
+	return ret;
+}
+
+
+static int
+server_send_all(int fd, const char buf[], size_t len)
+{
+	for (size_t off = 0; off < len;) {
+		const ssize_t ret = send(fd, buf + off, len - off, MSG_NOSIGNAL);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+
+			return -1;
+		}
+
+		off += (size_t)ret;
+	}
+
+	return 0;
+}
+
+
+static int
+server_recv_all(int fd, char buf[], size_t len)
+{
+	for (size_t off = 0; off < len;) {
+		const ssize_t ret = recv(fd, buf + off, len - off, 0);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+
+			return -1;
+		}
+
+		if (ret == 0)
+			return -1;
+
+		off += (size_t)ret;
+	}
+
+	return 0;
+}
+
+
+/*
+ * Main
+ */
+static void
+moetr_help(const char name[])
+{
+	printf("%s - A simple language translator\n\n"
+		"Usage: moetranslate -[s/d/l/i/b/o/L/h] [SOURCE:TARGET] [TEXT]\n"
+		"       moetranslate [--daemon] [--serve ADDR:PORT] [-o NAME=VAL]\n"
+		"   -s            Simple mode\n"
+		"   -d            Detail mode\n"
+		"   -l            Detect language\n"
+		"   -L            Language list\n"
+		"   -i            Interactive mode\n"
+		"   -b            Batch mode: translate each line of stdin\n"
+		"   -j NUM        Batch mode: concurrent requests\n"
+		"   -o NAME=VAL   Set a tunable, \"-o help\" shows the list\n"
+		"   -h            Show help\n"
+		"   --daemon      Serve the one-shot requests on a Unix socket, with a cache\n"
+		"   --serve ADDR:PORT  Serve a JSON API over HTTP, with the same cache\n\n"
+		"Examples:\n"
+		"   Simple Mode:   %s -s en:id \"Hello world\"\n"
+		"   Detail Mode:   %s -d id:en Halo\n"
+		"   Auto Lang:     %s -d auto:en こんにちは\n"
+		"   Detect Lang:   %s -l 你好\n"
+		"   Language list: %s -L [NUM]\n"
+		"   Interactive:   %s -i\n"
+		"                  %s -i -d auto:en\n"
+		"                  %s -i -d :en hello\n"
+		"   Batch:         %s -b -j 8 -s en:id < lines.txt\n"
+		"   Tunables:      %s -o tcp_fastopen=0 -s en:id hello\n"
+		"   Daemon:        %s --daemon &\n"
+		"                  %s -s en:id hello\n"
+		"   Gateway:       %s --serve 127.0.0.1:8080\n",
+		name, name, name, name, name, name, name, name, name, name, name, name, name, name
+	);
+}
+
+
+static void
+moetr_load_default_opts(char *type, const Lang *langs[2])
+{
+	if (CONFIG_BUFFER_SIZE > CONFIG_BUFFER_MAX_SIZE) {
+		fprintf(stderr, COLOR_REGULAR_YELLOW("config: invalid buffer size!") "\n");
+		exit(1);
+	}
+
+	if ((CONFIG_LANG_INDEX_SRC < 0) || (CONFIG_LANG_INDEX_SRC > (LEN(lang_pack) - 1))) {
+		fprintf(stderr, COLOR_REGULAR_YELLOW("config: invalid source lang!") "\n");
+		exit(1);
+	}
+
+	if ((CONFIG_LANG_INDEX_TRG <= 0) || (CONFIG_LANG_INDEX_TRG > (LEN(lang_pack) - 1))) {
+		fprintf(stderr, COLOR_REGULAR_YELLOW("config: invalid target lang!") "\n");
+		exit(1);
+	}
+
+	if ((CONFIG_RESULT_TYPE < RESULT_TYPE_SIMPLE) || (CONFIG_RESULT_TYPE > RESULT_TYPE_LANG)) {
+		fprintf(stderr, COLOR_REGULAR_YELLOW("config: invalid result type!") "\n");
+		exit(1);
+	}
+
+	langs[0] = &lang_pack[CONFIG_LANG_INDEX_SRC];
+	langs[1] = &lang_pack[CONFIG_LANG_INDEX_TRG];
+	*type = result_type_str[CONFIG_RESULT_TYPE][0][0];
+}
+
+
+int
+main(int argc, char *argv[])
+{
+	int ret = EXIT_FAILURE;
+	int lang_list_max_col = 0;
+	int is_interactive = 0;
+	int is_detect_lang = 0;
+	int is_batch = 0;
+	int is_daemon = 0;
+	int is_forwardable = 1;
+	const char *serve = NULL;
+	unsigned concurrency = CONFIG_BATCH_CONCURRENCY;
+	char result_type;
+	char *text = NULL;
+	const Lang *langs[2];
+	MoeTranslate *ctx;
+	MoeTr *moe;
+
+
+	/* a keep-alive connection may be closed by the server at any time */
+	signal(SIGPIPE, SIG_IGN);
+
+	/* the front end of the library: its context */
+	moetr_load_default_opts(&result_type, langs);
+	ctx = moetranslate_new();
+	if (ctx == NULL)
+		return ret;
+
+	moe = &ctx->moe;
+	moe->langs[0] = langs[0];
+	moe->langs[1] = langs[1];
+	moetr_set_result_type(moe, result_type);
+
+	static const struct option long_opts[] = {
+		{ "daemon", no_argument, NULL, 'D' },
+		{ "serve", required_argument, NULL, 'S' },
+		{ NULL, 0, NULL, 0 },
+	};
+
+	int opt;
+	while ((opt = getopt_long(argc, argv, "s:d:l:ibj:o:Lh", long_opts, NULL)) != -1) {
+		switch (opt) {
+		case 's':
+			moetr_set_result_type(moe, opt);
+			if (moetr_set_langs(moe, cstr_trim_left_mut(argv[optind - 1])) < 0)
+				goto out0;
+			break;
+		case 'd':
+			moetr_set_result_type(moe, opt);
+			if (moetr_set_langs(moe, cstr_trim_left_mut(argv[optind - 1])) < 0)
+				goto out0;
+			break;
+		case 'l':
+			moetr_set_result_type(moe, opt);
+			is_detect_lang = 1;
+			break;
+		case 'i':
+			is_interactive = 1;
+			break;
+		case 'b':
+			is_batch = 1;
+			break;
+		case 'j':
+			if (atoi(optarg) <= 0)
+				goto out0;
+
+			concurrency = (unsigned)atoi(optarg);
+			break;
+		case 'D':
+			is_daemon = 1;
+			break;
+		case 'S':
+			serve = optarg;
+			break;
+		case 'o':
+			/* the daemon has its own settings */
+			is_forwardable = 0;
+			switch (moetr_set_opt(moe, optarg)) {
+			case 0:
+				break;
+			case 1:
+				ret = EXIT_SUCCESS;
+				goto out1;
+			default:
+				goto out0;
+			}
+			break;
+		case 'L':
+			if (optind < argc) {
+				if (argv[optind][0] == '-')
+					lang_list_max_col = atoi(&argv[optind][2]);
+				else
+					lang_list_max_col = atoi(argv[optind]);
+			}
+
+			lang_show_list(lang_list_max_col);
+			ret = EXIT_SUCCESS;
+			goto out0;
+		case 'h':
+			moetr_help(argv[0]);
+			ret = EXIT_SUCCESS;
+			goto out0;
+		default:
+			goto out0;
+		}
+	}
+
+
+	if (is_detect_lang)
+		text = cstr_trim_right_mut(cstr_trim_left_mut(argv[optind - 1]));
+	else if (optind < argc)
+		text = cstr_trim_right_mut(cstr_trim_left_mut(argv[optind]));
+
+	if (is_daemon || (serve != NULL)) {
+		if (server_run(ctx, is_daemon, serve) < 0)
+			goto out1;
+	} else if (is_interactive) {
+		moetr_interactive(moe, text);
+	} else if (is_batch) {
+		moetr_batch(moe, stdin, concurrency);
+	} else if (text != NULL) {
+		/* a daemon is running: its warm connections and cache */
+		switch (is_forwardable ? server_forward(moe, text) : -1) {
+		case 0:
+			ret = EXIT_SUCCESS;
+			goto out1;
+		case 1:
+			goto out1;
+		}
+
+		const int res = moetr_translate(moe, text, stdout);
+		if (moe->is_stats) {
+			moetr_stats_print_request(&moe->http.timing);
+			moetr_stats_print_alloc(moe, stderr);
+		}
+
+		if (res < 0)
+			goto out1;
+	} else {
+		goto out0;
+	}
+
+	ret = EXIT_SUCCESS;
+
+out0:
+	if (ret == EXIT_FAILURE) {
+		fprintf(stderr, COLOR_REGULAR_YELLOW("Error: invalid argument!") "\n\n");
+		moetr_help(argv[0]);
+	}
+
+out1:
+	moetranslate_free(ctx);
+	return ret;
+}
+#endif
+
+
+/*
+ * Lib
+ */
+static __thread char moetr_error[512];
+
+
+static void
+moetr_error_set(int is_errno, const char fmt[], ...)
+{
+	const int errnum = errno;
+	va_list args;
+	va_start(args, fmt);
+	const int ret = vsnprintf(moetr_error, sizeof(moetr_error), fmt, args);
+	va_end(args);
+	if (ret < 0)
+		return;
+
+	size_t len = MIN((size_t)ret, sizeof(moetr_error) - 1);
+	while ((len > 0) && (moetr_error[len - 1] == '\n'))
+		moetr_error[--len] = '\0';
+
+	if (is_errno)
+		snprintf(moetr_error + len, sizeof(moetr_error) - len, ": %s", strerror(errnum));
+
+#ifndef MOETR_LIB
+	fprintf(stderr, "%s\n", moetr_error);
+
+	/* the colors are for the terminal: not in the results of the daemon */
+	size_t pos = 0;
+	for (size_t i = 0; moetr_error[i] != '\0'; i++) {
+		/* "\033[00;33m" */
+		if (moetr_error[i] == '\033') {
+			while ((moetr_error[i + 1] != '\0') && (moetr_error[i] != 'm'))
+				i++;
+
+			continue;
+		}
+
+		moetr_error[pos++] = moetr_error[i];
+	}
+
+	moetr_error[pos] = '\0';
+#endif
+}
+
+
+static int
+moetr_result_render(MoeTranslate *m, Http *h, int type, const Lang *langs[2], const char text[],
+		    MoeTranslateResult *res)
+{
+	MoeTr *const moe = &m->moe;
+
+	/* MOETRANSLATE_TYPE_*: RESULT_TYPE_* */
+	moe->result_type = type;
+	moe->langs[0] = langs[0];
+	moe->langs[1] = langs[1];
+
+	FILE *const out = open_memstream(&res->output, &res->output_len);
+	if (out == NULL) {
+		LOG_ERRNO(COLOR_REGULAR_YELLOW("moetr_result_render: open_memstream"));
+		return -1;
+	}
+
+	const int ret = moetr_print_response(moe, h, text, out);
+	if (fclose(out) != 0) {
+		LOG_ERRNO(COLOR_REGULAR_YELLOW("moetr_result_render: fclose"));
+		return -1;
+	}
+
+	if (ret < 0)
+		return -1;
+
+	if (moetr_result_copy(res, &moe->result, type) < 0) {
+		LOG_ERRNO(COLOR_REGULAR_YELLOW("moetr_result_render: strndup"));
+		return -1;
+	}
+
+	return 0;
+}
+
+
+static int
+moetr_langs_get(const char sl[], const char tl[], const Lang *langs[2])
+{
+	char keys[64];
+	if ((size_t)snprintf(keys, sizeof(keys), "%s:%s", sl, tl) >= sizeof(keys)) {
+		LOG_ERR(COLOR_REGULAR_YELLOW("moetr_langs_get: invalid keys") "\n");
+		return -1;
+	}
+
+	switch (lang_parse(langs, keys)) {
+	case 0:
+		return 0;
+	case -2:
+		LOG_ERR(COLOR_REGULAR_YELLOW("moetr_langs_get: invalid source lang") "\n");
+		break;
+	case -3:
+		LOG_ERR(COLOR_REGULAR_YELLOW("moetr_langs_get: invalid target lang") "\n");
+		break;
+	default:
+		LOG_ERR(COLOR_REGULAR_YELLOW("moetr_langs_get: invalid langs") "\n");
+		break;
+	}
+
+	return -1;
+}
+
+
+static int
+moetr_result_copy(MoeTranslateResult *res, const Result *result, int type)
+{
+	const json_string_t *const strs[] = {
+		result->lang, result->correction, result->src_spelling, result->trg_spelling,
+	};
+	char **const dsts[] = { &res->lang, &res->correction, &res->src_spelling, &res->trg_spelling };
+
+	for (size_t i = 0; i < LEN(strs); i++) {
+		if (strs[i] == NULL)
+			continue;
+
+		*dsts[i] = strndup(strs[i]->string, strs[i]->string_size);
+		if (*dsts[i] == NULL)
+			return -1;
+	}
+
+	if (type != RESULT_TYPE_LANG) {
+		res->text = strndup(result->text.ptr, result->text_len);
+		if (res->text == NULL)
+			return -1;
+
+		res->text_len = result->text_len;
+	}
+
+	res->confidence = result->confidence;
+	return 0;
+}
+
+
+static MoeTrAsync *
+moetr_async_get(MoeTranslate *m)
+{
+	if (m->async != NULL)
+		return m->async;
+
+	MoeTrAsync *const a = calloc(1, sizeof(*a));
+	if (a == NULL) {
+		LOG_ERRNO(COLOR_REGULAR_YELLOW("moetr_async_get: calloc"));
+		return NULL;
+	}
+
+	a->fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	a->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if ((a->fd < 0) || (a->wake_fd < 0)) {
+		LOG_ERRNO(COLOR_REGULAR_YELLOW("moetr_async_get: eventfd"));
+		goto err0;
+	}
+
+	if (pthread_mutex_init(&a->mutex, NULL) != 0) {
+		LOG_ERR(COLOR_REGULAR_YELLOW("moetr_async_get: pthread_mutex_init: failed") "\n");
+		goto err0;
+	}
+
+	a->pending_tail = &a->pending;
+	a->done_tail = &a->done;
+
+	pthread_mutex_lock(&m->lock);
+	for (; a->slots_len < LEN(a->slots); a->slots_len++) {
+		if (moetr_http_init(&m->moe, &a->slots[a->slots_len].http) < 0)
+			break;
+	}
+	pthread_mutex_unlock(&m->lock);
+
+	if (a->slots_len < LEN(a->slots))
+		goto err1;
+
+	m->async = a;
+	if (pthread_create(&a->worker, NULL, moetr_async_thrd, m) != 0) {
+		LOG_ERR(COLOR_REGULAR_YELLOW("moetr_async_get: pthread_create: failed") "\n");
+		m->async = NULL;
+		goto err1;
+	}
+
+	return a;
+
+err1:
+	for (unsigned i = 0; i < a->slots_len; i++)
+		http_deinit(&a->slots[i].http);
+
+	pthread_mutex_destroy(&a->mutex);
+err0:
+	if (a->fd >= 0)
+		close(a->fd);
+	if (a->wake_fd >= 0)
+		close(a->wake_fd);
+
+	free(a);
+	return NULL;
+}
+
+
+static void
+moetr_async_free(MoeTranslate *m)
+{
+	MoeTrAsync *const a = m->async;
+	if (a == NULL)
+		return;
+
+	pthread_mutex_lock(&a->mutex);
+	a->is_stopping = 1;
+	pthread_mutex_unlock(&a->mutex);
+
+	moetr_async_signal(a->wake_fd);
+	pthread_join(a->worker, NULL);
+
+	for (unsigned i = 0; i < a->slots_len; i++) {
+		MoeTrAsyncSlot *const s = &a->slots[i];
+		if ((s->req != NULL) && s->is_begun && (http_is_done(&s->http) == 0))
+			http_cancel(&s->http);
+
+		if (s->req != NULL)
+			moetr_async_req_free(s->req);
+
+		http_deinit(&s->http);
+	}
+
+	MoeTrAsyncReq *const lists[] = { a->pending, a->done };
+	for (size_t i = 0; i < LEN(lists); i++) {
+		for (MoeTrAsyncReq *r = lists[i], *next; r != NULL; r = next) {
+			next = r->next;
+			moetr_async_req_free(r);
+		}
+	}
+
+	close(a->fd);
+	close(a->wake_fd);
+	pthread_mutex_destroy(&a->mutex);
+	free(a);
+	m->async = NULL;
+}
+
+
+static void *
+moetr_async_thrd(void *udata)
+{
+	MoeTranslate *const m = (MoeTranslate *)udata;
+	MoeTrAsync *const a = m->async;
+	const char *stops[CONFIG_ASYNC_CONCURRENCY];
+	struct pollfd pfds[1 + (CONFIG_ASYNC_CONCURRENCY * HTTP_POLLFDS)];
+
+	pthread_mutex_lock(&m->lock);
+	for (;;) {
+		const int64_t now = time_now_ns();
+
+		/* the new ones, and the cancelled or expired ones of the slots */
+		pthread_mutex_lock(&a->mutex);
+		if (a->is_stopping) {
+			pthread_mutex_unlock(&a->mutex);
+			break;
+		}
+
+		moetr_async_dispatch(a, now);
+		for (unsigned i = 0; i < a->slots_len; i++) {
+			const MoeTrAsyncReq *const r = a->slots[i].req;
+			stops[i] = NULL;
+			if (r == NULL)
+				continue;
+
+			if (r->is_cancelled)
+				stops[i] = "cancelled";
+			else if ((r->deadline != 0) && (now >= r->deadline))
+				stops[i] = "deadline exceeded";
+		}
+
+		int64_t at = a->pending_deadline;
+		pthread_mutex_unlock(&a->mutex);
+
+		/* begin, stop, or finish */
+		for (unsigned i = 0; i < a->slots_len; i++) {
+			MoeTrAsyncSlot *const s = &a->slots[i];
+			MoeTrAsyncReq *const r = s->req;
+			if (r == NULL)
+				continue;
+
+			if (stops[i] != NULL) {
+				if (s->is_begun && (http_is_done(&s->http) == 0))
+					http_cancel(&s->http);
+
+				moetr_async_finish(m, r, NULL, stops[i]);
+				s->req = NULL;
+				continue;
+			}
+
+			if (s->is_begun == 0) {
+				s->is_begun = 1;
+				moetr_error[0] = '\0';
+				s->http.is_bulk = r->is_bulk;
+				http_begin(&s->http, r->type, r->langs[0]->key, r->langs[1]->key,
+					   r->langs[1]->key, r->text);
+			}
+
+			/* HTTP/2: a stream may be ended by the others */
+			if (http_is_done(&s->http)) {
+				moetr_async_finish(m, r, &s->http, NULL);
+				s->req = NULL;
+			}
+		}
+
+		/* poll: the wake up, the requests; until the nearest timer, or deadline */
+		int is_pool = 0;
+		nfds_t pfds_len = 1;
+		pfds[0].fd = a->wake_fd;
+		pfds[0].events = POLLIN;
+		pfds[0].revents = 0;
+		for (unsigned i = 0; i < a->slots_len; i++) {
+			const MoeTrAsyncSlot *const s = &a->slots[i];
+			struct pollfd *const pfd = &pfds[1 + (i * HTTP_POLLFDS)];
+			if (s->req == NULL) {
+				for (unsigned k = 0; k < HTTP_POLLFDS; k++)
+					pfd[k] = (struct pollfd) { .fd = -1 };
+
+				continue;
+			}
+
+			is_pool |= http_poll_set(&s->http, pfd);
+			for (unsigned k = 0; k < HTTP_POLLFDS; k++) {
+				if ((pfd[k].fd < 0) || (pfd[k].events == 0))
+					continue;
+
+				/* HTTP/2: the streams share the connection, one of them is enough */
+				for (struct pollfd *p = &pfds[1]; (p < &pfd[k]) && http_is_h2(&s->http); p++) {
+					if ((p->fd == pfd[k].fd) && (p->events != 0))
+						pfd[k].fd = -1;
+				}
+
+				if (pfd[k].fd >= 0)
+					pfds_len = 1 + (i * HTTP_POLLFDS) + k + 1;
+			}
+
+			if ((s->req->deadline != 0) && ((at == 0) || (s->req->deadline < at)))
+				at = s->req->deadline;
+		}
+
+		int timeout = -1;
+		if (at != 0)
+			timeout = (int)MIN(MAX((at - now + 999999) / 1000000, 0), INT32_MAX);
+
+		for (unsigned i = 0; i < a->slots_len; i++) {
+			const int t = (a->slots[i].req != NULL) ? http_timeout(&a->slots[i].http) : -1;
+			if ((t >= 0) && ((timeout < 0) || (t < timeout)))
+				timeout = t;
+		}
+
+		/* sent again right away: no sleep (the pool waiters poll its eventfd) */
+		if (is_pool)
+			timeout = 0;
+
+		pthread_mutex_unlock(&m->lock);
+		const int ret = poll(pfds, pfds_len, timeout);
+		pthread_mutex_lock(&m->lock);
+		if ((ret < 0) && (errno != EINTR)) {
+			LOG_ERRNO(COLOR_REGULAR_YELLOW("moetr_async_thrd: poll"));
+			continue;
+		}
+
+		if (pfds[0].revents & POLLIN) {
+			uint64_t val;
+			if (read(a->wake_fd, &val, sizeof(val)) < 0) {
+				/* EAGAIN: read already */
+			}
+		}
+
+		for (unsigned i = 0; i < a->slots_len; i++) {
+			MoeTrAsyncSlot *const s = &a->slots[i];
+			if (s->req == NULL)
+				continue;
+
+			moetr_error[0] = '\0';
+			http_poll_step(&s->http, &pfds[1 + (i * HTTP_POLLFDS)]);
+			if (http_is_done(&s->http)) {
+				moetr_async_finish(m, s->req, &s->http, NULL);
+				s->req = NULL;
+			}
+		}
+	}
+
+	pthread_mutex_unlock(&m->lock);
+	return NULL;
+}
+
+
+static void
+moetr_async_finish(MoeTranslate *m, MoeTrAsyncReq *r, Http *h, const char error[])
+{
+	MoeTrAsync *const a = m->async;
+	if (h != NULL) {
+		int ret = -1;
+		if (h->state == HTTP_STATE_DONE)
+			ret = moetr_result_render(m, h, r->type, r->langs, r->text, &r->result);
+		else
+			m->moe.stats.failed++;
+
+		if (ret < 0)
+			error = (moetr_error[0] != '\0') ? moetr_error : "moetr_async_finish: failed";
+	}
+
+	if (error != NULL)
+		r->result.error = strdup(error);
+
+	pthread_mutex_lock(&a->mutex);
+	moetr_async_done(a, r);
+	pthread_mutex_unlock(&a->mutex);
+}
+
+
+static void
+moetr_async_dispatch(MoeTrAsync *a, int64_t now)
+{
+	/* the slots are full: only the expired ones, if any */
+	const int is_expiring = (a->pending_deadline != 0) && (now >= a->pending_deadline);
+	int64_t nearest = 0;
+	unsigned idx = 0;
+	MoeTrAsyncReq **pp = &a->pending;
+	while (*pp != NULL) {
+		MoeTrAsyncReq *const r = *pp;
+		const int is_expired = (r->deadline != 0) && (now >= r->deadline);
+		while ((idx < a->slots_len) && (a->slots[idx].req != NULL))
+			idx++;
+
+		if ((is_expired == 0) && (idx == a->slots_len)) {
+			if (is_expiring == 0)
+				return;
+
+			if ((r->deadline != 0) && ((nearest == 0) || (r->deadline < nearest)))
+				nearest = r->deadline;
+
+			pp = &r->next;
+			continue;
+		}
+
+		*pp = r->next;
+		if (a->pending_tail == &r->next)
+			a->pending_tail = pp;
+
+		if (is_expired) {
+			r->result.error = strdup("deadline exceeded");
+			moetr_async_done(a, r);
+		} else {
+			a->slots[idx].req = r;
+			a->slots[idx].is_begun = 0;
+		}
+	}
+
+	a->pending_deadline = nearest;
+}
+
+
+static void
+moetr_async_done(MoeTrAsync *a, MoeTrAsyncReq *r)
+{
+	r->next = NULL;
+	*a->done_tail = r;
+	a->done_tail = &r->next;
+	moetr_async_signal(a->fd);
+}
+
+
+static void
+moetr_async_req_free(MoeTrAsyncReq *r)
+{
+	moetranslate_result_free(&r->result);
+	free(r->text);
+	free(r);
+}
+
+
+static void
+moetr_async_signal(int fd)
+{
+	const uint64_t val = 1;
+	if (write(fd, &val, sizeof(val)) < 0) {
+		/* EAGAIN: the counter is full, readable anyway */
+	}
+}
+
+
+MoeTranslate *
+moetranslate_new(void)
+{
+	MoeTranslate *const m = calloc(1, sizeof(*m));
+	if (m == NULL)
+		return NULL;
+
+	const Lang *langs[2] = { &lang_pack[CONFIG_LANG_INDEX_SRC], &lang_pack[CONFIG_LANG_INDEX_TRG] };
+	if (moetr_init(&m->moe, result_type_str[RESULT_TYPE_SIMPLE][0][0], langs) < 0)
+		goto err0;
+
+	if (pthread_mutex_init(&m->lock, NULL) != 0) {
+		moetr_deinit(&m->moe);
+		goto err0;
+	}
+
+	return m;
+
+err0:
+	free(m);
+	return NULL;
+}
+
+
+void
+moetranslate_free(MoeTranslate *m)
 {
-	char *_cmd = *cmd;
-	if (*_cmd == '\0')
-		return MOETR_INTR_CODE_NOP;
+	if (m == NULL)
+		return;
 
-	/*
-	 * escape '/' character by adding '\' prefix:
-	 * example: \/q
-	 */
-	if ((*_cmd == '\\') && (*(_cmd + 1) == '/')) {
-		*cmd = _cmd + 1;
-		return MOETR_INTR_CODE_TRANSLATE;
-	}
+	moetr_async_free(m);
+	moetr_deinit(&m->moe);
+	pthread_mutex_destroy(&m->lock);
+	for (size_t i = 0; i < m->opts_len; i++)
+		free(m->opts[i]);
 
-	if (*(_cmd++) != '/')
-		return MOETR_INTR_CODE_TRANSLATE;
+	free(m->opts);
+	free(m);
+}
 
-	switch (tolower(*_cmd)) {
-	case 'c':
-		*cmd = _cmd + 1;
-		return MOETR_INTR_CODE_CHANGE_LANGS;
-	case 'r':
-		_cmd = cstr_trim_right_mut(cstr_trim_left_mut(_cmd + 1));
-		if (strlen(_cmd) > 1)
-			break;
 
-		*cmd = _cmd;
-		return MOETR_INTR_CODE_CHANGE_RESTYPE;
-	case 'l':
-		if (*(_cmd + 1) == '\0')
-			*cmd = "2";
-		else
-			*cmd = _cmd + 1;
+int
+moetranslate_set_opt(MoeTranslate *m, const char opt[])
+{
+	moetr_error[0] = '\0';
+	if (strcmp(opt, "help") == 0) {
+		LOG_ERR(COLOR_REGULAR_YELLOW("moetranslate_set_opt: \"help\": see "
+			"\"moetranslate -o help\"") "\n");
+		goto err0;
+	}
 
-		return MOETR_INTR_CODE_LANG_LIST;
-	case '\0':
-		return MOETR_INTR_CODE_HELP;
-	case 'q':
-		return MOETR_INTR_CODE_QUIT;
+	char **const opts = realloc(m->opts, (m->opts_len + 1) * sizeof(*opts));
+	if (opts == NULL) {
+		LOG_ERRNO(COLOR_REGULAR_YELLOW("moetranslate_set_opt: realloc"));
+		goto err0;
 	}
 
-	return MOETR_INTR_CODE_INVAL;
+	m->opts = opts;
+	char *const dup = strdup(opt);
+	if (dup == NULL) {
+		LOG_ERRNO(COLOR_REGULAR_YELLOW("moetranslate_set_opt: strdup"));
+		goto err0;
+	}
+
+	m->opts[m->opts_len++] = dup;
+	pthread_mutex_lock(&m->lock);
+	const int ret = moetr_set_opt(&m->moe, dup);
+	pthread_mutex_unlock(&m->lock);
+	if (ret < 0)
+		goto err0;
+
+	m->error[0] = '\0';
+	return 0;
+
+err0:
+	memcpy(m->error, moetr_error, sizeof(m->error));
+	return -1;
 }
 
 
-static void
-moetr_interactive_set_prompt(MoeTr *m)
+const char *
+moetranslate_error(const MoeTranslate *m)
 {
-	snprintf(m->prompt, sizeof(m->prompt), COLOR_BOLD_WHITE("[%s:%s][%s]->") " ",
-		 m->langs[0]->key, m->langs[1]->key, result_type_str[m->result_type][0]);
+	return m->error;
 }
 
 
-static void
-moetr_interactive(MoeTr *m, const char text[])
+int
+moetranslate_translate(MoeTranslate *m, int type, const char sl[], const char tl[], const char text[],
+		       MoeTranslateResult *res)
 {
-#ifdef WNO_INTERACTIVE_MODE
-	puts("Interactive input mode: Not supported!\nPlease rebuild without \"-DWNO_INTERACTIVE_MODE\" flag");
+	const Lang *langs[2];
 
-	(void)m;
-	(void)text;
-	(void)moetr_interactive_banner;
-	(void)moetr_interactive_help;
-	(void)moetr_interactive_parse;
-	(void)moetr_interactive_set_prompt;
-#else
-	setlocale(LC_CTYPE, "");
-	stifle_history(CONFIG_INTERACTIVE_HISTORY_SIZE);
-	moetr_interactive_set_prompt(m);
-	moetr_interactive_banner(m);
+	memset(res, 0, sizeof(*res));
+	res->confidence = -1;
+	moetr_error[0] = '\0';
 
-	if (text != NULL)
-		moetr_translate(m, text);
+	if ((type < MOETRANSLATE_TYPE_SIMPLE) || (type > MOETRANSLATE_TYPE_LANG)) {
+		LOG_ERR(COLOR_REGULAR_YELLOW("moetranslate_translate: invalid result type") "\n");
+		goto err0;
+	}
 
-	int is_alive = 1;
-	while (is_alive) {
-		char *const res = readline(m->prompt);
-		if (res == NULL)
-			return;
+	if (moetr_langs_get(sl, tl, langs) < 0)
+		goto err0;
 
-		char *cmd = cstr_trim_right_mut(cstr_trim_left_mut(res));
-		switch (moetr_interactive_parse(&cmd)) {
-		case MOETR_INTR_CODE_TRANSLATE:
-			puts("------------------------");
-			moetr_translate(m, cmd);
-			puts("------------------------");
-			break;
-		case MOETR_INTR_CODE_CHANGE_LANGS:
-			if (moetr_set_langs(m, cmd) == 0)
-				moetr_interactive_set_prompt(m);
+	pthread_mutex_lock(&m->lock);
+	Http *const h = &m->moe.http;
+	int ret = http_request(h, type, langs[0]->key, langs[1]->key, langs[1]->key, text);
+	if (ret < 0)
+		m->moe.stats.failed++;
+	else
+		ret = moetr_result_render(m, h, type, langs, text, res);
+	pthread_mutex_unlock(&m->lock);
 
-			cmd = res;
-			break;
-		case MOETR_INTR_CODE_CHANGE_RESTYPE:
-			if (moetr_set_result_type(m, *cmd) == 0)
-				moetr_interactive_set_prompt(m);
+	if (ret < 0)
+		goto err0;
 
-			cmd = res;
-			break;
-		case MOETR_INTR_CODE_NOP:
-			break;
-		case MOETR_INTR_CODE_LANG_LIST:
-			lang_show_list(atoi(cmd));
-			cmd = res;
-			break;
-		case MOETR_INTR_CODE_HELP:
-			moetr_interactive_help();
-			break;
-		case MOETR_INTR_CODE_QUIT:
-			is_alive = 0;
-			break;
-		default:
-			puts("Invalid command!");
-			break;
-		}
+	m->error[0] = '\0';
+	return 0;
 
-		if (*cmd != '\0')
-			add_history(cmd);
+err0:
+	if (moetr_error[0] == '\0')
+		LOG_ERR(COLOR_REGULAR_YELLOW("moetranslate_translate: failed") "\n");
 
-		free(res);
-	}
-#endif
+	memcpy(m->error, moetr_error, sizeof(m->error));
+	res->error = strdup(moetr_error);
+	return -1;
 }
 
 
-/*
- * Main
- */
-static void
-moetr_help(const char name[])
+void
+moetranslate_result_free(MoeTranslateResult *res)
 {
-	printf("%s - A simple language translator\n\n"
-		"Usage: moetranslate -[s/d/l/i/L/h] [SOURCE:TARGET] [TEXT]\n"
-		"   -s            Simple mode\n"
-		"   -d            Detail mode\n"
-		"   -l            Detect language\n"
-		"   -L            Language list\n"
-		"   -i            Interactive mode\n"
-		"   -h            Show help\n\n"
-		"Examples:\n"
-		"   Simple Mode:   %s -s en:id \"Hello world\"\n"
-		"   Detail Mode:   %s -d id:en Halo\n"
-		"   Auto Lang:     %s -d auto:en こんにちは\n"
-		"   Detect Lang:   %s -l 你好\n"
-		"   Language list: %s -L [NUM]\n"
-		"   Interactive:   %s -i\n"
-		"                  %s -i -d auto:en\n"
-		"                  %s -i -d :en hello\n",
-		name, name, name, name, name, name, name, name, name
-	);
+	free(res->text);
+	free(res->lang);
+	free(res->correction);
+	free(res->src_spelling);
+	free(res->trg_spelling);
+	free(res->output);
+	free(res->error);
+	memset(res, 0, sizeof(*res));
+	res->confidence = -1;
 }
 
 
-static void
-moetr_load_default_opts(char *type, const Lang *langs[2])
+int
+moetranslate_fd(MoeTranslate *m)
 {
-	if (CONFIG_BUFFER_SIZE > CONFIG_BUFFER_MAX_SIZE) {
-		fprintf(stderr, COLOR_REGULAR_YELLOW("config: invalid buffer size!") "\n");
-		exit(1);
+	moetr_error[0] = '\0';
+	const MoeTrAsync *const a = moetr_async_get(m);
+	if (a == NULL) {
+		memcpy(m->error, moetr_error, sizeof(m->error));
+		return -1;
 	}
 
-	if ((CONFIG_LANG_INDEX_SRC < 0) || (CONFIG_LANG_INDEX_SRC > (LEN(lang_pack) - 1))) {
-		fprintf(stderr, COLOR_REGULAR_YELLOW("config: invalid source lang!") "\n");
-		exit(1);
+	return a->fd;
+}
+
+
+unsigned long
+moetranslate_submit(MoeTranslate *m, int type, const char sl[], const char tl[], const char text[],
+		    int deadline, void *udata)
+{
+	MoeTrAsyncReq *r = NULL;
+	MoeTrAsync *a;
+
+	moetr_error[0] = '\0';
+	const int is_bulk = ((type & MOETRANSLATE_BULK) != 0);
+	type &= ~MOETRANSLATE_BULK;
+	if ((type < MOETRANSLATE_TYPE_SIMPLE) || (type > MOETRANSLATE_TYPE_LANG)) {
+		LOG_ERR(COLOR_REGULAR_YELLOW("moetranslate_submit: invalid result type") "\n");
+		goto err0;
 	}
 
-	if ((CONFIG_LANG_INDEX_TRG <= 0) || (CONFIG_LANG_INDEX_TRG > (LEN(lang_pack) - 1))) {
-		fprintf(stderr, COLOR_REGULAR_YELLOW("config: invalid target lang!") "\n");
-		exit(1);
+	r = calloc(1, sizeof(*r));
+	if (r == NULL) {
+		LOG_ERRNO(COLOR_REGULAR_YELLOW("moetranslate_submit: calloc"));
+		goto err0;
 	}
 
-	if ((CONFIG_RESULT_TYPE < RESULT_TYPE_SIMPLE) || (CONFIG_RESULT_TYPE > RESULT_TYPE_LANG)) {
-		fprintf(stderr, COLOR_REGULAR_YELLOW("config: invalid result type!") "\n");
-		exit(1);
+	if (moetr_langs_get(sl, tl, r->langs) < 0)
+		goto err0;
+
+	r->text = strdup(text);
+	if (r->text == NULL) {
+		LOG_ERRNO(COLOR_REGULAR_YELLOW("moetranslate_submit: strdup"));
+		goto err0;
 	}
 
-	langs[0] = &lang_pack[CONFIG_LANG_INDEX_SRC];
-	langs[1] = &lang_pack[CONFIG_LANG_INDEX_TRG];
-	*type = result_type_str[CONFIG_RESULT_TYPE][0][0];
+	a = moetr_async_get(m);
+	if (a == NULL)
+		goto err0;
+
+	r->udata = udata;
+	r->type = type;
+	r->is_bulk = is_bulk;
+	r->result.confidence = -1;
+	if (deadline > 0)
+		r->deadline = time_now_ns() + ((int64_t)deadline * 1000000);
+
+	pthread_mutex_lock(&a->mutex);
+	r->id = ++a->ids;
+	*a->pending_tail = r;
+	a->pending_tail = &r->next;
+	if ((r->deadline != 0) && ((a->pending_deadline == 0) || (r->deadline < a->pending_deadline)))
+		a->pending_deadline = r->deadline;
+
+	const unsigned long id = r->id;
+	pthread_mutex_unlock(&a->mutex);
+
+	moetr_async_signal(a->wake_fd);
+	return id;
+
+err0:
+	if (r != NULL) {
+		free(r->text);
+		free(r);
+	}
+
+	memcpy(m->error, moetr_error, sizeof(m->error));
+	return 0;
 }
 
 
 int
-main(int argc, char *argv[])
+moetranslate_cancel(MoeTranslate *m, unsigned long id)
 {
-	int ret = EXIT_FAILURE;
-	int lang_list_max_col = 0;
-	int is_interactive = 0;
-	int is_detect_lang = 0;
-	char result_type;
-	char *text = NULL;
-	const Lang *langs[2];
-	MoeTr moe;
+	MoeTrAsync *const a = m->async;
+	if (a == NULL)
+		return -1;
 
+	int ret = -1;
+	pthread_mutex_lock(&a->mutex);
+	for (MoeTrAsyncReq **pp = &a->pending; *pp != NULL; pp = &(*pp)->next) {
+		MoeTrAsyncReq *const r = *pp;
+		if (r->id != id)
+			continue;
 
-	moetr_load_default_opts(&result_type, langs);
-	if (moetr_init(&moe, result_type, langs) < 0)
-		return ret;
+		*pp = r->next;
+		if (a->pending_tail == &r->next)
+			a->pending_tail = pp;
 
-	int opt;
-	while ((opt = getopt(argc, argv, "s:d:l:iLh")) != -1) {
-		switch (opt) {
-		case 's':
-			moetr_set_result_type(&moe, opt);
-			if (moetr_set_langs(&moe, cstr_trim_left_mut(argv[optind - 1])) < 0)
-				goto out0;
-			break;
-		case 'd':
-			moetr_set_result_type(&moe, opt);
-			if (moetr_set_langs(&moe, cstr_trim_left_mut(argv[optind - 1])) < 0)
-				goto out0;
-			break;
-		case 'l':
-			moetr_set_result_type(&moe, opt);
-			is_detect_lang = 1;
-			break;
-		case 'i':
-			is_interactive = 1;
-			break;
-		case 'L':
-			if (optind < argc) {
-				if (argv[optind][0] == '-')
-					lang_list_max_col = atoi(&argv[optind][2]);
-				else
-					lang_list_max_col = atoi(argv[optind]);
-			}
+		r->result.error = strdup("cancelled");
+		moetr_async_done(a, r);
+		ret = 0;
+		goto out0;
+	}
 
-			lang_show_list(lang_list_max_col);
-			ret = EXIT_SUCCESS;
-			goto out0;
-		case 'h':
-			moetr_help(argv[0]);
-			ret = EXIT_SUCCESS;
-			goto out0;
-		default:
-			goto out0;
+	/* in flight: stopped by the worker */
+	for (unsigned i = 0; i < a->slots_len; i++) {
+		MoeTrAsyncReq *const r = a->slots[i].req;
+		if ((r != NULL) && (r->id == id) && (r->is_cancelled == 0)) {
+			r->is_cancelled = 1;
+			ret = 0;
+			break;
 		}
 	}
 
+out0:
+	pthread_mutex_unlock(&a->mutex);
+	if (ret == 0)
+		moetr_async_signal(a->wake_fd);
 
-	if (is_detect_lang)
-		text = cstr_trim_right_mut(cstr_trim_left_mut(argv[optind - 1]));
-	else if (optind < argc)
-		text = cstr_trim_right_mut(cstr_trim_left_mut(argv[optind]));
+	return ret;
+}
 
-	if (is_interactive) {
-		moetr_interactive(&moe, text);
-	} else if (text != NULL) {
-		if (moetr_translate(&moe, text) < 0)
-			goto out1;
-	} else {
-		goto out0;
-	}
 
-	ret = EXIT_SUCCESS;
+size_t
+moetranslate_drain(MoeTranslate *m, MoeTranslateCompletion out[], size_t size)
+{
+	MoeTrAsync *const a = m->async;
+	if (a == NULL)
+		return 0;
 
-out0:
-	if (ret == EXIT_FAILURE) {
-		fprintf(stderr, COLOR_REGULAR_YELLOW("Error: invalid argument!") "\n\n");
-		moetr_help(argv[0]);
+	size_t len = 0;
+	uint64_t val;
+	pthread_mutex_lock(&a->mutex);
+	if (read(a->fd, &val, sizeof(val)) < 0) {
+		/* EAGAIN: nothing signaled, there may be some left by a short `out` */
 	}
 
-out1:
-	moetr_deinit(&moe);
-	return ret;
-}
+	while ((len < size) && (a->done != NULL)) {
+		MoeTrAsyncReq *const r = a->done;
+		a->done = r->next;
+		out[len].id = r->id;
+		out[len].udata = r->udata;
+		out[len].result = r->result;
+		free(r->text);
+		free(r);
+		len++;
+	}
 
+	if (a->done == NULL)
+		a->done_tail = &a->done;
+	else
+		moetr_async_signal(a->fd);
+
+	pthread_mutex_unlock(&a->mutex);
+	return len;
+}
@@ -0,0 +1,109 @@
+/* MIT License
+ *
+ * Copyright (c) 2026 Arthur Lapz (rLapz)
+ *
+ * See LICENSE file for license details
+ */
+
+#ifndef MOETRANSLATE_H
+#define MOETRANSLATE_H
+
+#include <stddef.h>
+
+
+/*
+ * libmoetranslate: the engine of moetranslate ("make lib"), without its front end.
+ *
+ * No global state and no stdio: a context per thread, each one with its own connection pool,
+ * the errors are returned in the result. The options are those of "moetranslate -o".
+ *
+ * TLS: a write to a closed connection raises SIGPIPE, ignore it.
+ */
+typedef struct MoeTranslate MoeTranslate;
+
+#ifdef __GNUC__
+	#define MOETRANSLATE_API __attribute__((visibility("default")))
+#else
+	#define MOETRANSLATE_API
+#endif
+
+enum {
+	MOETRANSLATE_TYPE_SIMPLE = 0,
+	MOETRANSLATE_TYPE_DETAIL,
+	MOETRANSLATE_TYPE_LANG,	/* detect the language */
+};
+
+/* the strings are owned by the result, NULL: not in the response */
+typedef struct {
+	char   *text;		/* the translation */
+	size_t  text_len;
+	char   *lang;		/* the detected source language */
+	int     confidence;	/* percent, -1: unknown */
+
+	/* MOETRANSLATE_TYPE_DETAIL */
+	char   *correction;
+	char   *src_spelling;
+	char   *trg_spelling;
+
+	/* rendered as the output of moetranslate, without colors */
+	char   *output;
+	size_t  output_len;
+
+	char   *error;		/* set on failure */
+} MoeTranslateResult;
+
+/* ret: NULL -> failed to allocate */
+MOETRANSLATE_API MoeTranslate *moetranslate_new(void);
+MOETRANSLATE_API void          moetranslate_free(MoeTranslate *m);
+
+/* "NAME=VALUE", ret: -1 -> invalid, moetranslate_error() tells why */
+MOETRANSLATE_API int           moetranslate_set_opt(MoeTranslate *m, const char opt[]);
+
+/* the last error of `m`, "": none */
+MOETRANSLATE_API const char   *moetranslate_error(const MoeTranslate *m);
+
+/* sl, tl: language keys ("auto", "en", ...), a blocking request
+ * ret: -1 -> failed, res->error tells why; the result is always freed by the caller
+ */
+MOETRANSLATE_API int           moetranslate_translate(MoeTranslate *m, int type, const char sl[],
+						      const char tl[], const char text[],
+						      MoeTranslateResult *res);
+MOETRANSLATE_API void          moetranslate_result_free(MoeTranslateResult *res);
+
+
+/*
+ * Async: no blocking, a worker thread of the context drives the requests, the finished ones
+ * are drained when moetranslate_fd() is readable. The blocking calls above may be mixed with
+ * them, the options are set before the first request.
+ */
+typedef struct {
+	unsigned long      id;
+	void              *udata;
+	MoeTranslateResult result;	/* moetranslate_result_free() */
+} MoeTranslateCompletion;
+
+/* an eventfd, readable when there are completions, ret: -1 -> failed */
+MOETRANSLATE_API int           moetranslate_fd(MoeTranslate *m);
+
+/* OR'd into the type of moetranslate_submit(): a background request, the others of the
+ * context go first for its concurrency window and connections
+ */
+enum {
+	MOETRANSLATE_BULK = 0x100,
+};
+
+/* deadline: milliseconds, 0: none, the request fails when it has no reply by then
+ * ret: the id of the request, 0 -> failed, moetranslate_error() tells why
+ */
+MOETRANSLATE_API unsigned long moetranslate_submit(MoeTranslate *m, int type, const char sl[],
+						   const char tl[], const char text[], int deadline,
+						   void *udata);
+
+/* the request completes with the error "cancelled", ret: -1 -> not found, or done already */
+MOETRANSLATE_API int           moetranslate_cancel(MoeTranslate *m, unsigned long id);
+
+/* the finished requests, up to `size`, in completion order, ret: how many (0: none yet) */
+MOETRANSLATE_API size_t        moetranslate_drain(MoeTranslate *m, MoeTranslateCompletion out[],
+						  size_t size);
+
+#endif
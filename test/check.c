@@ -0,0 +1,980 @@
+/* MIT License
+ *
+ * Copyright (c) 2026 Arthur Lapz (rLapz)
+ *
+ * See LICENSE file for license details
+ */
+
+/*
+ * test/check: moetranslate against the local mock server, "make check"
+ *
+ * Each case starts its own mock server, runs moetranslate and checks its output: one-shot,
+ * batch, retries on faults, Retry-After, HTTP/2 (h2c; h2 over TLS and the resumed sessions
+ * with WITH_TLS), the daemon and its cache, the gateway, the prewarm of interactive mode on
+ * a route that doesn't answer. XDG_RUNTIME_DIR, XDG_CACHE_HOME and
+ * HOME point to a fresh directory: no daemon nor session cache of the user is involved.
+ *
+ * Output: one line per case, on stderr; the exit status is the number of failed cases.
+ *
+ * Usage: test/check [-b BIN] [-m MOCK] [-p PORT] [CASE...]
+ *   PORT: of the mock server, PORT + 1: of the gateway, or of a listener that never accepts
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+
+#define LEN(X) ((sizeof(X)) / (sizeof(*X)))
+
+#define CHECK_BIN      "./moetranslate"
+#define CHECK_MOCK     "./mockserver"
+#define CHECK_PORT     "18199"
+#define CHECK_LINES    (200)
+#define CHECK_ARGS_MAX (64)
+#define CHECK_TIMEOUT  (30000)
+
+
+typedef struct opts {
+	const char *bin;
+	const char *mock;
+	const char *port;
+	char        gateway[16];	/* port + 1 */
+	char        dir[64];		/* XDG_RUNTIME_DIR, XDG_CACHE_HOME and HOME */
+} Opts;
+
+/* a finished process */
+typedef struct output {
+	int     status;		/* exit status, -1: killed or not run */
+	double  elapsed;	/* seconds */
+	char   *out;
+	char   *err;
+} Output;
+
+static Opts opts;
+
+static int64_t time_now_ns(void);
+static char   *file_read(FILE *file);
+static int     dir_remove(const char path[]);
+static void    fail(const char name[], const char fmt[], ...);
+
+/* argv: moetranslate's, -o host= -o port= with `is_direct`, then `extra`, NULL-terminated */
+static int     args_build(char *argv[], int argv_size, int is_direct, const char *const extra[]);
+
+/* runs argv with `in` as stdin, until it exits, or CHECK_TIMEOUT */
+static int     proc_run(char *const argv[], const char in[], Output *o);
+static void    output_free(Output *o);
+
+/* a server in the background, until proc_stop(), its stdout to `out` if not NULL */
+static pid_t   proc_start(char *const argv[], FILE *out);
+static int     proc_stop(pid_t pid);
+
+static pid_t   mock_start(const char args[]);
+static int     tcp_wait(const char port[]);
+static int     tcp_exchange(const char port[], const char req[], char res[], size_t size);
+
+#ifndef WNO_INTERACTIVE_MODE
+/* a listener with its accept queue full: the connects to it hang; fds[0]: the listener */
+static int     tcp_listen_full(const char port[], int fds[], unsigned fds_len);
+#endif
+
+/* "moetr_batch: ... | NAME: N ..." */
+static long    batch_stat(const char err[], const char name[]);
+/* `o_len` runs, one after the other, on the same mock server */
+static int     batch_run(const char mock_args[], const char *const extra[], Output o[],
+			 unsigned o_len);
+static int     batch_check(const char name[], const Output *o);
+
+static int     check_oneshot(const char name[]);
+static int     check_batch(const char name[]);
+static int     check_retry(const char name[]);
+static int     check_retry_after(const char name[]);
+static int     check_h2c(const char name[]);
+#ifdef WITH_TLS
+static int     check_tls(const char name[]);
+#endif
+static int     check_daemon(const char name[]);
+static int     check_gateway(const char name[]);
+#ifndef WNO_INTERACTIVE_MODE
+static int     check_prewarm(const char name[]);
+#endif
+
+
+
+static int64_t
+time_now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((int64_t)ts.tv_sec * 1000000000) + ts.tv_nsec;
+}
+
+
+static char *
+file_read(FILE *file)
+{
+	if (fseek(file, 0, SEEK_END) < 0)
+		return NULL;
+
+	const long size = ftell(file);
+	char *const ret = malloc((size_t)((size > 0) ? size : 0) + 1);
+	if (ret == NULL)
+		return NULL;
+
+	rewind(file);
+	const size_t len = fread(ret, 1, (size_t)((size > 0) ? size : 0), file);
+	ret[len] = '\0';
+	return ret;
+}
+
+
+static int
+dir_remove(const char path[])
+{
+	DIR *const d = opendir(path);
+	if (d == NULL)
+		return unlink(path);
+
+	char sub[1024];
+	struct dirent *ent;
+	while ((ent = readdir(d)) != NULL) {
+		if ((strcmp(ent->d_name, ".") == 0) || (strcmp(ent->d_name, "..") == 0))
+			continue;
+
+		snprintf(sub, sizeof(sub), "%s/%s", path, ent->d_name);
+		dir_remove(sub);
+	}
+
+	closedir(d);
+	return rmdir(path);
+}
+
+
+static void
+fail(const char name[], const char fmt[], ...)
+{
+	va_list va;
+	fprintf(stderr, "check: %s: FAILED: ", name);
+	va_start(va, fmt);
+	vfprintf(stderr, fmt, va);
+	va_end(va);
+	fputc('\n', stderr);
+}
+
+
+static int
+args_build(char *argv[], int argv_size, int is_direct, const char *const extra[])
+{
+	static char host[] = "host=127.0.0.1";
+	static char port[64];
+	snprintf(port, sizeof(port), "port=%s", opts.port);
+
+	int argc = 0;
+	argv[argc++] = (char *)opts.bin;
+	if (is_direct) {
+		argv[argc++] = "-o";
+		argv[argc++] = host;
+		argv[argc++] = "-o";
+		argv[argc++] = port;
+	}
+
+	for (; *extra != NULL; extra++) {
+		if (argc == (argv_size - 1))
+			return -1;
+
+		argv[argc++] = (char *)*extra;
+	}
+
+	argv[argc] = NULL;
+	return argc;
+}
+
+
+static int
+proc_run(char *const argv[], const char in[], Output *o)
+{
+	memset(o, 0, sizeof(*o));
+	o->status = -1;
+
+	FILE *const files[3] = { tmpfile(), tmpfile(), tmpfile() };
+	if ((files[0] == NULL) || (files[1] == NULL) || (files[2] == NULL)) {
+		perror("check: tmpfile");
+		goto out0;
+	}
+
+	fputs(in, files[0]);
+	fflush(files[0]);
+	rewind(files[0]);
+
+	const int64_t start = time_now_ns();
+	const pid_t pid = fork();
+	if (pid < 0) {
+		perror("check: fork");
+		goto out0;
+	}
+
+	if (pid == 0) {
+		dup2(fileno(files[0]), STDIN_FILENO);
+		dup2(fileno(files[1]), STDOUT_FILENO);
+		dup2(fileno(files[2]), STDERR_FILENO);
+		execv(argv[0], argv);
+		_exit(127);
+	}
+
+	int status;
+	pid_t ret;
+	while ((ret = waitpid(pid, &status, WNOHANG)) == 0) {
+		if ((time_now_ns() - start) > ((int64_t)CHECK_TIMEOUT * 1000000)) {
+			kill(pid, SIGKILL);
+			waitpid(pid, NULL, 0);
+			ret = -1;
+			break;
+		}
+
+		usleep(5000);
+	}
+
+	o->elapsed = (double)(time_now_ns() - start) / 1e9;
+	if ((ret > 0) && WIFEXITED(status))
+		o->status = WEXITSTATUS(status);
+
+	o->out = file_read(files[1]);
+	o->err = file_read(files[2]);
+
+out0:
+	for (size_t i = 0; i < LEN(files); i++) {
+		if (files[i] != NULL)
+			fclose(files[i]);
+	}
+
+	if ((o->out == NULL) || (o->err == NULL)) {
+		output_free(o);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+static void
+output_free(Output *o)
+{
+	free(o->out);
+	free(o->err);
+	o->out = o->err = NULL;
+}
+
+
+static pid_t
+proc_start(char *const argv[], FILE *out)
+{
+	const pid_t pid = fork();
+	if (pid < 0) {
+		perror("check: fork");
+		return -1;
+	}
+
+	if (pid == 0) {
+		const int fd = open("/dev/null", O_RDWR);
+		dup2(fd, STDIN_FILENO);
+		dup2((out != NULL) ? fileno(out) : fd, STDOUT_FILENO);
+		dup2(fd, STDERR_FILENO);
+		execv(argv[0], argv);
+		_exit(127);
+	}
+
+	return pid;
+}
+
+
+static int
+proc_stop(pid_t pid)
+{
+	int status;
+	kill(pid, SIGTERM);
+	if (waitpid(pid, &status, 0) < 0)
+		return -1;
+
+	return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+
+static pid_t
+mock_start(const char args[])
+{
+	static char buffer[1024];
+	char *argv[CHECK_ARGS_MAX];
+	int argc = 0;
+	argv[argc++] = (char *)opts.mock;
+	argv[argc++] = "-p";
+	argv[argc++] = (char *)opts.port;
+
+	snprintf(buffer, sizeof(buffer), "%s", args);
+	char *save;
+	for (char *p = strtok_r(buffer, " ", &save); p != NULL; p = strtok_r(NULL, " ", &save)) {
+		if (argc == ((int)LEN(argv) - 1))
+			return -1;
+
+		argv[argc++] = p;
+	}
+
+	argv[argc] = NULL;
+
+	const pid_t pid = proc_start(argv, NULL);
+	if (pid < 0)
+		return -1;
+
+	if (tcp_wait(opts.port) < 0) {
+		fprintf(stderr, "check: %s: not listening on %s\n", opts.mock, opts.port);
+		proc_stop(pid);
+		return -1;
+	}
+
+	return pid;
+}
+
+
+static int
+tcp_wait(const char port[])
+{
+	struct sockaddr_in addr = { .sin_family = AF_INET };
+	addr.sin_port = htons((uint16_t)atoi(port));
+	inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+
+	for (int i = 0; i < 250; i++) {
+		const int fd = socket(AF_INET, SOCK_STREAM, 0);
+		if (fd < 0)
+			return -1;
+
+		const int ret = connect(fd, (struct sockaddr *)&addr, sizeof(addr));
+		close(fd);
+		if (ret == 0)
+			return 0;
+
+		usleep(20000);
+	}
+
+	return -1;
+}
+
+
+static int
+tcp_exchange(const char port[], const char req[], char res[], size_t size)
+{
+	struct sockaddr_in addr = { .sin_family = AF_INET };
+	addr.sin_port = htons((uint16_t)atoi(port));
+	inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+
+	const int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0)
+		return -1;
+
+	if ((connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) ||
+	    (write(fd, req, strlen(req)) != (ssize_t)strlen(req)))
+		goto err0;
+
+	/* until the server closes it: the last request has "Connection: close" */
+	size_t len = 0;
+	while (len < (size - 1)) {
+		struct pollfd pfd = { .fd = fd, .events = POLLIN };
+		if (poll(&pfd, 1, CHECK_TIMEOUT) <= 0)
+			goto err0;
+
+		const ssize_t rd = read(fd, res + len, size - len - 1);
+		if (rd < 0)
+			goto err0;
+
+		if (rd == 0)
+			break;
+
+		len += (size_t)rd;
+	}
+
+	res[len] = '\0';
+	close(fd);
+	return 0;
+
+err0:
+	close(fd);
+	return -1;
+}
+
+
+#ifndef WNO_INTERACTIVE_MODE
+static int
+tcp_listen_full(const char port[], int fds[], unsigned fds_len)
+{
+	struct sockaddr_in addr = { .sin_family = AF_INET };
+	addr.sin_port = htons((uint16_t)atoi(port));
+	inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+
+	const int opt = 1;
+	fds[0] = socket(AF_INET, SOCK_STREAM, 0);
+	if ((fds[0] < 0) || (setsockopt(fds[0], SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) ||
+	    (bind(fds[0], (struct sockaddr *)&addr, sizeof(addr)) < 0) || (listen(fds[0], 0) < 0)) {
+		perror("check: listen");
+		return -1;
+	}
+
+	/* never accepted: the queue fills up, the next SYNs are dropped */
+	for (unsigned i = 1; i < fds_len; i++) {
+		fds[i] = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+		if (fds[i] >= 0)
+			connect(fds[i], (struct sockaddr *)&addr, sizeof(addr));
+	}
+
+	usleep(100000);
+	return 0;
+}
+#endif
+
+
+static long
+batch_stat(const char err[], const char name[])
+{
+	const char *p = strstr(err, "moetr_batch: ");
+	if (p == NULL)
+		return -1;
+
+	char key[64];
+	snprintf(key, sizeof(key), "%s: ", name);
+	p = strstr(p, key);
+	return (p != NULL) ? strtol(p + strlen(key), NULL, 10) : -1;
+}
+
+
+static int
+batch_run(const char mock_args[], const char *const extra[], Output o[], unsigned o_len)
+{
+	char *argv[CHECK_ARGS_MAX];
+	if (args_build(argv, (int)LEN(argv), 1, extra) < 0)
+		return -1;
+
+	char *const in = malloc(CHECK_LINES * 32);
+	if (in == NULL)
+		return -1;
+
+	size_t len = 0;
+	for (unsigned i = 0; i < CHECK_LINES; i++)
+		len += (size_t)sprintf(in + len, "%u line of text\n", i);
+
+	int ret = -1;
+	const pid_t mock = mock_start(mock_args);
+	if (mock < 0)
+		goto out0;
+
+	for (unsigned i = 0; i < o_len; i++) {
+		ret = proc_run(argv, in, &o[i]);
+		if (ret < 0) {
+			while (i-- > 0)
+				output_free(&o[i]);
+
+			break;
+		}
+	}
+
+	proc_stop(mock);
+
+out0:
+	free(in);
+	return ret;
+}
+
+
+static int
+batch_check(const char name[], const Output *o)
+{
+	if (o->status != 0) {
+		fail(name, "exit status %d: %.200s", o->status, o->err);
+		return 1;
+	}
+
+	/* the translations, in the order of the lines */
+	const char *p = o->out;
+	for (unsigned i = 0; i < CHECK_LINES; i++) {
+		char line[64];
+		const int len = snprintf(line, sizeof(line), "%u LINE OF TEXT\n", i);
+		if (strncmp(p, line, (size_t)len) != 0) {
+			fail(name, "line %u: \"%.*s\"", i, (int)strcspn(p, "\n"), p);
+			return 1;
+		}
+
+		p += len;
+	}
+
+	const char *const stats = strstr(o->err, "moetr_batch: ");
+	char expect[64];
+	snprintf(expect, sizeof(expect), "moetr_batch: %u translated, 0 failed", CHECK_LINES);
+	if ((stats == NULL) || (strncmp(stats, expect, strlen(expect)) != 0)) {
+		fail(name, "%.200s", (stats != NULL) ? stats : o->err);
+		return 1;
+	}
+
+	return 0;
+}
+
+
+static int
+check_oneshot(const char name[])
+{
+	char *argv[CHECK_ARGS_MAX];
+	const char *const extra[] = { "-s", "en:id", "hello world", NULL };
+	if (args_build(argv, (int)LEN(argv), 1, extra) < 0)
+		return 1;
+
+	const pid_t mock = mock_start("");
+	if (mock < 0)
+		return 1;
+
+	int ret = 1;
+	Output o;
+	if (proc_run(argv, "", &o) < 0)
+		goto out0;
+
+	if ((o.status != 0) || (strcmp(o.out, "HELLO WORLD\n") != 0))
+		fail(name, "exit status %d: \"%s\" %.200s", o.status, o.out, o.err);
+	else
+		ret = 0;
+
+	output_free(&o);
+
+out0:
+	proc_stop(mock);
+	return ret;
+}
+
+
+static int
+check_batch(const char name[])
+{
+	const char *const extra[] = { "-b", "-j", "8", "-s", "en:id", NULL };
+	Output o;
+	if (batch_run("-l uniform:0:5", extra, &o, 1) < 0)
+		return 1;
+
+	const int ret = batch_check(name, &o);
+	output_free(&o);
+	return ret;
+}
+
+
+static int
+check_retry(const char name[])
+{
+	/* 503s, 429s without Retry-After and dropped connections: all of them retried; the
+	 * breaker could open on an unlucky run of them */
+	const char *const extra[] = {
+		"-o", "retries=8", "-o", "breaker=0", "-b", "-j", "8", "-s", "en:id", NULL
+	};
+	Output o;
+	if (batch_run("-e 10 -r 10 -R 0 -d 5", extra, &o, 1) < 0)
+		return 1;
+
+	int ret = batch_check(name, &o);
+	if ((ret == 0) && (batch_stat(o.err, "retries") <= 0)) {
+		fail(name, "no retries: %.200s", o.err);
+		ret = 1;
+	}
+
+	output_free(&o);
+	return ret;
+}
+
+
+static int
+check_retry_after(const char name[])
+{
+	/* always 429, "Retry-After: 2": one retry, 2s later, then the error */
+	char *argv[CHECK_ARGS_MAX];
+	const char *const extra[] = { "-o", "retries=1", "-s", "en:id", "hello", NULL };
+	if (args_build(argv, (int)LEN(argv), 1, extra) < 0)
+		return 1;
+
+	const pid_t mock = mock_start("-r 100 -R 2");
+	if (mock < 0)
+		return 1;
+
+	int ret = 1;
+	Output o;
+	if (proc_run(argv, "", &o) < 0)
+		goto out0;
+
+	if ((o.status == 0) || (strstr(o.err, "429") == NULL))
+		fail(name, "exit status %d: %.200s", o.status, o.err);
+	else if ((o.elapsed < 1.9) || (o.elapsed > 10))
+		fail(name, "%.2fs, Retry-After: 2", o.elapsed);
+	else
+		ret = 0;
+
+	output_free(&o);
+
+out0:
+	proc_stop(mock);
+	return ret;
+}
+
+
+static int
+check_h2c(const char name[])
+{
+	const char *const extra[] = {
+		"-o", "http2=1", "-o", "retries=8", "-b", "-j", "16", "-s", "en:id", NULL
+	};
+	Output o;
+	if (batch_run("-2 -l uniform:0:5 -e 5", extra, &o, 1) < 0)
+		return 1;
+
+	int ret = batch_check(name, &o);
+	if ((ret == 0) && (batch_stat(o.err, "h2 streams") < CHECK_LINES)) {
+		fail(name, "not over HTTP/2: %.200s", o.err);
+		ret = 1;
+	}
+
+	output_free(&o);
+	return ret;
+}
+
+
+#ifdef WITH_TLS
+static int
+check_tls(const char name[])
+{
+	/* twice: the second run resumes the sessions of the first, from the session cache; the
+	 * mock server's ticket keys last for as long as it runs */
+	char mock_args[256], cert[128];
+	snprintf(cert, sizeof(cert), "%s/mock.crt", opts.dir);
+	snprintf(mock_args, sizeof(mock_args), "-2 -t %s:%s/mock.key -l uniform:0:5", cert,
+		 opts.dir);
+	setenv("SSL_CERT_FILE", cert, 1);
+
+	const char *const extra[] = {
+		"-o", "host=localhost", "-o", "tls=1", "-o", "http2=1", "-b", "-j", "8", "-s",
+		"en:id", NULL
+	};
+
+	int ret = 1;
+	Output o[2];
+	if (batch_run(mock_args, extra, o, LEN(o)) < 0)
+		goto out0;
+
+	if ((batch_check(name, &o[0]) != 0) || (batch_check(name, &o[1]) != 0))
+		ret = 1;
+	else if (batch_stat(o[0].err, "h2 streams") < CHECK_LINES)
+		fail(name, "not over h2: %.200s", o[0].err);
+	else if (batch_stat(o[1].err, "tls resumed") <= 0)
+		fail(name, "no session resumed: %.200s", o[1].err);
+	else
+		ret = 0;
+
+	for (unsigned i = 0; i < LEN(o); i++)
+		output_free(&o[i]);
+
+out0:
+	unsetenv("SSL_CERT_FILE");
+	return ret;
+}
+#endif
+
+
+static int
+check_daemon(const char name[])
+{
+	/* a miss, through the mock server, then a hit: the mock server is gone by then */
+	char *argv[CHECK_ARGS_MAX], *daemon_argv[CHECK_ARGS_MAX];
+	const char *const extra[] = { "-s", "en:id", "hello daemon", NULL };
+	const char *const daemon_extra[] = { "--daemon", NULL };
+	if ((args_build(argv, (int)LEN(argv), 0, extra) < 0) ||
+	    (args_build(daemon_argv, (int)LEN(daemon_argv), 1, daemon_extra) < 0))
+		return 1;
+
+	FILE *const out = tmpfile();
+	if (out == NULL) {
+		perror("check: tmpfile");
+		return 1;
+	}
+
+	int ret = 1;
+	const pid_t mock = mock_start("");
+	if (mock < 0)
+		goto out0;
+
+	const pid_t daemon = proc_start(daemon_argv, out);
+	if (daemon < 0) {
+		proc_stop(mock);
+		goto out0;
+	}
+
+	char sock[128];
+	struct stat st;
+	snprintf(sock, sizeof(sock), "%s/moetranslate.sock", opts.dir);
+	for (int i = 0; (i < 250) && (stat(sock, &st) < 0); i++)
+		usleep(20000);
+
+	Output o;
+	unsigned runs = 0;
+	for (; runs < 2; runs++) {
+		if (proc_run(argv, "", &o) < 0)
+			break;
+
+		const int is_ok = (o.status == 0) && (strcmp(o.out, "HELLO DAEMON\n") == 0);
+		if (is_ok == 0) {
+			fail(name, "run %u: exit status %d: \"%s\" %.200s", runs + 1, o.status,
+			     o.out, o.err);
+		}
+
+		output_free(&o);
+		if (is_ok == 0)
+			break;
+
+		if (runs == 0)
+			proc_stop(mock);
+	}
+
+	if (runs == 0)
+		proc_stop(mock);
+
+	/* "daemon: 2 requests (...) | cache: 1 hits (50.0%), ..." */
+	proc_stop(daemon);
+	char *const summary = file_read(out);
+	if (runs == 2) {
+		if ((summary == NULL) || (strstr(summary, "cache: 1 hits") == NULL))
+			fail(name, "not from the cache: %.200s", (summary != NULL) ? summary : "");
+		else
+			ret = 0;
+	}
+
+	free(summary);
+
+out0:
+	fclose(out);
+	return ret;
+}
+
+
+static int
+check_gateway(const char name[])
+{
+	char *argv[CHECK_ARGS_MAX], addr[32];
+	snprintf(addr, sizeof(addr), "127.0.0.1:%s", opts.gateway);
+	const char *const extra[] = { "--serve", addr, "-s", "en:id", NULL };
+	if (args_build(argv, (int)LEN(argv), 1, extra) < 0)
+		return 1;
+
+	const pid_t mock = mock_start("");
+	if (mock < 0)
+		return 1;
+
+	int ret = 1;
+	const pid_t gateway = proc_start(argv, NULL);
+	if ((gateway < 0) || (tcp_wait(opts.gateway) < 0)) {
+		fail(name, "not listening on %s", addr);
+		goto out0;
+	}
+
+	/* pipelined, the replies in order; then a hit, on another connection */
+	static const char req0[] =
+		"POST /translate HTTP/1.1\r\nHost: check\r\nContent-Length: 17\r\n\r\n"
+		"{\"text\": \"hello\"}"
+		"POST /batch HTTP/1.1\r\nHost: check\r\nContent-Length: 25\r\n\r\n"
+		"{\"texts\": [\"a b\", \"c d\"]}"
+		"POST /translate HTTP/1.1\r\nHost: check\r\nContent-Length: 9\r\n\r\n"
+		"{\"text\":}"
+		"GET /stats HTTP/1.1\r\nHost: check\r\nConnection: close\r\n\r\n";
+	static const char req1[] =
+		"POST /translate HTTP/1.1\r\nHost: check\r\nContent-Length: 17\r\n\r\n"
+		"{\"text\": \"hello\"}"
+		"GET /stats HTTP/1.1\r\nHost: check\r\nConnection: close\r\n\r\n";
+
+	static const char *const expects[][4] = {
+		{
+			"HTTP/1.1 200 OK\r\n",
+			"{\"text\":\"HELLO\",\"lang\":\"en\"}",
+			"{\"results\":[{\"text\":\"A B\",\"lang\":\"en\"},"
+			"{\"text\":\"C D\",\"lang\":\"en\"}]}",
+			"HTTP/1.1 400 ",
+		},
+		{
+			"HTTP/1.1 200 OK\r\n",
+			"{\"text\":\"HELLO\",\"lang\":\"en\"}",
+			"\"cache\":{\"hits\":1,",
+			"\"requests\":4,",
+		},
+	};
+
+	const char *const reqs[] = { req0, req1 };
+	char res[8192];
+	for (size_t i = 0; i < LEN(reqs); i++) {
+		if (tcp_exchange(opts.gateway, reqs[i], res, sizeof(res)) < 0) {
+			fail(name, "exchange %zu: %s", i + 1, strerror(errno));
+			goto out0;
+		}
+
+		const char *p = res;
+		for (size_t j = 0; j < LEN(expects[i]); j++) {
+			const char *const q = strstr(p, expects[i][j]);
+			if (q == NULL) {
+				fail(name, "exchange %zu: no %s in: %s", i + 1, expects[i][j], res);
+				goto out0;
+			}
+
+			/* the replies of the pipelined requests in order */
+			if (i == 0)
+				p = q;
+		}
+	}
+
+	ret = 0;
+
+out0:
+	if (gateway > 0)
+		proc_stop(gateway);
+
+	proc_stop(mock);
+	return ret;
+}
+
+
+#ifndef WNO_INTERACTIVE_MODE
+static int
+check_prewarm(const char name[])
+{
+	/* simple: the first route is prewarmed, its warmer hangs on the connect; detail: only the
+	 * second one can, it's prewarmed after the reply: the prompt must go on, "/q" be read */
+	char endpoints[128];
+	snprintf(endpoints, sizeof(endpoints), "endpoints=libre@127.0.0.1:%s,google@127.0.0.1:%s",
+		 opts.gateway, opts.port);
+
+	const char *const extra[] = { "-o", endpoints, "-i", "-s", "en:id", NULL };
+	char *argv[CHECK_ARGS_MAX];
+	if (args_build(argv, (int)LEN(argv), 0, extra) < 0)
+		return 1;
+
+	int fds[4];
+	for (size_t i = 0; i < LEN(fds); i++)
+		fds[i] = -1;
+
+	int ret = 1;
+	const pid_t mock = mock_start("-k 1");
+	if (mock < 0)
+		return 1;
+
+	if (tcp_listen_full(opts.gateway, fds, LEN(fds)) < 0)
+		goto out0;
+
+	Output o;
+	if (proc_run(argv, "/r d\nhello\n/q\n", &o) < 0)
+		goto out0;
+
+	if (o.status != 0)
+		fail(name, "exit status %d (%.2fs): %.200s", o.status, o.elapsed, o.err);
+	else if (strstr(o.out, "HELLO") == NULL)
+		fail(name, "no reply: %.200s", o.out);
+	else
+		ret = 0;
+
+	output_free(&o);
+
+out0:
+	for (size_t i = 0; i < LEN(fds); i++) {
+		if (fds[i] >= 0)
+			close(fds[i]);
+	}
+
+	proc_stop(mock);
+	return ret;
+}
+#endif
+
+
+int
+main(int argc, char *argv[])
+{
+	opts.bin = CHECK_BIN;
+	opts.mock = CHECK_MOCK;
+	opts.port = CHECK_PORT;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "b:m:p:")) != -1) {
+		switch (opt) {
+		case 'b': opts.bin = optarg; break;
+		case 'm': opts.mock = optarg; break;
+		case 'p': opts.port = optarg; break;
+		default:
+			fprintf(stderr, "Usage: %s [-b BIN] [-m MOCK] [-p PORT] [CASE...]\n",
+				argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	snprintf(opts.gateway, sizeof(opts.gateway), "%d", atoi(opts.port) + 1);
+
+	const struct {
+		const char *name;
+		int       (*run)(const char name[]);
+	} cases[] = {
+		{ "oneshot",     check_oneshot     },
+		{ "batch",       check_batch       },
+		{ "retry",       check_retry       },
+		{ "retry_after", check_retry_after },
+		{ "h2c",         check_h2c         },
+#ifdef WITH_TLS
+		{ "tls",         check_tls         },
+#endif
+		{ "daemon",      check_daemon      },
+		{ "gateway",     check_gateway     },
+#ifndef WNO_INTERACTIVE_MODE
+		{ "prewarm",     check_prewarm     },
+#endif
+	};
+
+	/* a directory of the user only, for the daemon's socket */
+	snprintf(opts.dir, sizeof(opts.dir), "/tmp/moetranslate-check-XXXXXX");
+	if (mkdtemp(opts.dir) == NULL) {
+		perror("check: mkdtemp");
+		return EXIT_FAILURE;
+	}
+
+	setenv("XDG_RUNTIME_DIR", opts.dir, 1);
+	setenv("XDG_CACHE_HOME", opts.dir, 1);
+	setenv("HOME", opts.dir, 1);
+	signal(SIGPIPE, SIG_IGN);
+
+	int failed = 0;
+	for (size_t i = 0; i < LEN(cases); i++) {
+		int is_selected = (optind == argc);
+		for (int j = optind; j < argc; j++)
+			is_selected |= (strcmp(argv[j], cases[i].name) == 0);
+
+		if (is_selected == 0)
+			continue;
+
+		const int64_t start = time_now_ns();
+		const int ret = cases[i].run(cases[i].name);
+		if (ret == 0) {
+			fprintf(stderr, "check: %s: ok (%.2fs)\n", cases[i].name,
+				(double)(time_now_ns() - start) / 1e9);
+		}
+
+		failed += ret;
+	}
+
+	dir_remove(opts.dir);
+	fprintf(stderr, "check: %d failed\n", failed);
+	return failed;
+}
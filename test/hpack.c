@@ -0,0 +1,390 @@
+/* MIT License
+ *
+ * Copyright (c) 2026 Arthur Lapz (rLapz)
+ *
+ * See LICENSE file for license details
+ */
+
+/*
+ * test/hpack: the HPACK decoder and encoder on the examples of RFC 7541, Appendix C, and on
+ * the invalid inputs they must refuse, "make check"
+ *
+ * moetranslate.c is included: its static functions are reachable, its main() is renamed.
+ *
+ * Output: one line per failed case, on stderr; the exit status is the number of them.
+ */
+
+#define main moetranslate_main
+#include "../moetranslate.c"
+#undef main
+
+
+/* the decoder: a run of blocks on one table, table_max != 0 starts a new one */
+static const struct {
+	const char *name;
+	size_t      table_max;
+	const char *hex;
+	const char *headers;	/* "name: value\r\n" each */
+	size_t      table_size;	/* after the block */
+} decode_cases[] = {
+	/* C.2: literals and indexed, one block each */
+	{ "C.2.1", 4096,
+	  "400a 6375 7374 6f6d 2d6b 6579 0d63 7573 746f 6d2d 6865 6164 6572",
+	  "custom-key: custom-header\r\n", 55 },
+	{ "C.2.2", 4096,
+	  "040c 2f73 616d 706c 652f 7061 7468",
+	  ":path: /sample/path\r\n", 0 },
+	{ "C.2.3", 4096,
+	  "1008 7061 7373 776f 7264 0673 6563 7265 74",
+	  "password: secret\r\n", 0 },
+	{ "C.2.4", 4096,
+	  "82",
+	  ":method: GET\r\n", 0 },
+
+	/* C.3: requests, without Huffman */
+	{ "C.3.1", 4096,
+	  "8286 8441 0f77 7777 2e65 7861 6d70 6c65 2e63 6f6d",
+	  ":method: GET\r\n:scheme: http\r\n:path: /\r\n:authority: www.example.com\r\n", 57 },
+	{ "C.3.2", 0,
+	  "8286 84be 5808 6e6f 2d63 6163 6865",
+	  ":method: GET\r\n:scheme: http\r\n:path: /\r\n:authority: www.example.com\r\n"
+	  "cache-control: no-cache\r\n", 110 },
+	{ "C.3.3", 0,
+	  "8287 85bf 400a 6375 7374 6f6d 2d6b 6579 0c63 7573 746f 6d2d 7661 6c75 65",
+	  ":method: GET\r\n:scheme: https\r\n:path: /index.html\r\n"
+	  ":authority: www.example.com\r\ncustom-key: custom-value\r\n", 164 },
+
+	/* C.4: the same, with Huffman */
+	{ "C.4.1", 4096,
+	  "8286 8441 8cf1 e3c2 e5f2 3a6b a0ab 90f4 ff",
+	  ":method: GET\r\n:scheme: http\r\n:path: /\r\n:authority: www.example.com\r\n", 57 },
+	{ "C.4.2", 0,
+	  "8286 84be 5886 a8eb 1064 9cbf",
+	  ":method: GET\r\n:scheme: http\r\n:path: /\r\n:authority: www.example.com\r\n"
+	  "cache-control: no-cache\r\n", 110 },
+	{ "C.4.3", 0,
+	  "8287 85bf 4088 25a8 49e9 5ba9 7d7f 8925 a849 e95b b8e8 b4bf",
+	  ":method: GET\r\n:scheme: https\r\n:path: /index.html\r\n"
+	  ":authority: www.example.com\r\ncustom-key: custom-value\r\n", 164 },
+
+	/* C.5: responses, without Huffman, a 256 bytes table: the evictions */
+	{ "C.5.1", 256,
+	  "4803 3330 3258 0770 7269 7661 7465 611d 4d6f 6e2c 2032 3120 4f63 7420 3230 3133"
+	  "2032 303a 3133 3a32 3120 474d 546e 1768 7474 7073 3a2f 2f77 7777 2e65 7861 6d70"
+	  "6c65 2e63 6f6d",
+	  ":status: 302\r\ncache-control: private\r\ndate: Mon, 21 Oct 2013 20:13:21 GMT\r\n"
+	  "location: https://www.example.com\r\n", 222 },
+	{ "C.5.2", 0,
+	  "4803 3330 37c1 c0bf",
+	  ":status: 307\r\ncache-control: private\r\ndate: Mon, 21 Oct 2013 20:13:21 GMT\r\n"
+	  "location: https://www.example.com\r\n", 222 },
+	{ "C.5.3", 0,
+	  "88c1 611d 4d6f 6e2c 2032 3120 4f63 7420 3230 3133 2032 303a 3133 3a32 3220 474d"
+	  "54c0 5a04 677a 6970 7738 666f 6f3d 4153 444a 4b48 514b 425a 584f 5157 454f 5049"
+	  "5541 5851 5745 4f49 553b 206d 6178 2d61 6765 3d33 3630 303b 2076 6572 7369 6f6e"
+	  "3d31",
+	  ":status: 200\r\ncache-control: private\r\ndate: Mon, 21 Oct 2013 20:13:22 GMT\r\n"
+	  "location: https://www.example.com\r\ncontent-encoding: gzip\r\n"
+	  "set-cookie: foo=ASDJKHQKBZXOQWEOPIUAXQWEOIU; max-age=3600; version=1\r\n", 215 },
+
+	/* C.6: the same, with Huffman */
+	{ "C.6.1", 256,
+	  "4882 6402 5885 aec3 771a 4b61 96d0 7abe 9410 54d4 44a8 2005 9504 0b81 66e0 82a6"
+	  "2d1b ff6e 919d 29ad 1718 63c7 8f0b 97c8 e9ae 82ae 43d3",
+	  ":status: 302\r\ncache-control: private\r\ndate: Mon, 21 Oct 2013 20:13:21 GMT\r\n"
+	  "location: https://www.example.com\r\n", 222 },
+	{ "C.6.2", 0,
+	  "4883 640e ffc1 c0bf",
+	  ":status: 307\r\ncache-control: private\r\ndate: Mon, 21 Oct 2013 20:13:21 GMT\r\n"
+	  "location: https://www.example.com\r\n", 222 },
+	{ "C.6.3", 0,
+	  "88c1 6196 d07a be94 1054 d444 a820 0595 040b 8166 e084 a62d 1bff c05a 839b d9ab"
+	  "77ad 94e7 821d d7f2 e6c7 b335 dfdf cd5b 3960 d5af 2708 7f36 72c1 ab27 0fb5 291f"
+	  "9587 3160 65c0 03ed 4ee5 b106 3d50 07",
+	  ":status: 200\r\ncache-control: private\r\ndate: Mon, 21 Oct 2013 20:13:22 GMT\r\n"
+	  "location: https://www.example.com\r\ncontent-encoding: gzip\r\n"
+	  "set-cookie: foo=ASDJKHQKBZXOQWEOPIUAXQWEOIU; max-age=3600; version=1\r\n", 215 },
+};
+
+/* refused by the decoder, on an empty table */
+static const struct {
+	const char *name;
+	const char *hex;
+} invalid_cases[] = {
+	{ "index 0",                   "80" },
+	{ "index out of the table",    "be" },
+	{ "integer overflow",          "ff ff ff ff ff ff 01" },
+	{ "integer truncated",         "ff" },
+	{ "string truncated",          "40 0a 63 75 73 74" },
+	{ "table size above the max",  "3f e1 3f" },
+	{ "huffman: EOS",              "40 84 ff ff ff ff 00" },
+	{ "huffman: padding of zeros", "40 81 00 00" },
+	{ "huffman: 8 bits padding",   "40 82 f1 ff 00" },
+};
+
+/* C.1: integers */
+static const struct {
+	const char *name;
+	size_t      value;
+	unsigned    bits;
+	const char *hex;
+} int_cases[] = {
+	{ "C.1.1", 10,   5, "0a" },
+	{ "C.1.2", 1337, 5, "1f 9a 0a" },
+	{ "C.1.3", 42,   8, "2a" },
+};
+
+/* C.4: the Huffman strings */
+static const struct {
+	const char *str;
+	const char *hex;
+} huff_cases[] = {
+	{ "www.example.com", "f1e3 c2e5 f23a 6ba0 ab90 f4ff" },
+	{ "no-cache",        "a8eb 1064 9cbf" },
+	{ "custom-key",      "25a8 49e9 5ba9 7d7f" },
+	{ "custom-value",    "25a8 49e9 5bb8 e8b4 bf" },
+	{ "private",         "aec3 771a 4b" },
+	{ "gzip",            "9bd9 ab" },
+};
+
+
+static size_t hex_decode(const char hex[], unsigned char out[], size_t size);
+static int    check_decode(void);
+static int    check_invalid(void);
+static int    check_int(void);
+static int    check_huff(void);
+
+/* C.4.1 again, through hpack_field_encode() */
+static int    check_encode(void);
+static int    fail(const char name[], const char what[]);
+
+
+
+static size_t
+hex_decode(const char hex[], unsigned char out[], size_t size)
+{
+	size_t len = 0;
+	for (const char *p = hex; (p[0] != '\0') && (len < size); ) {
+		if (p[0] == ' ') {
+			p++;
+			continue;
+		}
+
+		const char byte[3] = { p[0], p[1], '\0' };
+		out[len++] = (unsigned char)strtoul(byte, NULL, 16);
+		p += 2;
+	}
+
+	return len;
+}
+
+
+static int
+check_decode(void)
+{
+	int ret = 0;
+	unsigned char in[256];
+	Buffer out, scratch;
+	HpackTable t;
+
+	if ((buffer_init(&out, 256) < 0) || (buffer_init(&scratch, 256) < 0)) {
+		perror("test/hpack: buffer_init");
+		return 1;
+	}
+
+	hpack_table_init(&t);
+	for (size_t i = 0; i < LEN(decode_cases); i++) {
+		if (decode_cases[i].table_max != 0) {
+			hpack_table_deinit(&t);
+			hpack_table_init(&t);
+			t.size_max = decode_cases[i].table_max;
+		}
+
+		const size_t in_len = hex_decode(decode_cases[i].hex, in, sizeof(in));
+		size_t out_len = 0;
+		if (hpack_decode(&t, in, in_len, &out, &out_len, &scratch) < 0) {
+			ret += fail(decode_cases[i].name, "refused");
+			continue;
+		}
+
+		const char *const headers = decode_cases[i].headers;
+		if ((out_len != strlen(headers)) || (memcmp(out.ptr, headers, out_len) != 0)) {
+			fprintf(stderr, "test/hpack: %s: got \"%.*s\"\n", decode_cases[i].name,
+				(int)out_len, out.ptr);
+			ret += fail(decode_cases[i].name, "wrong headers");
+		} else if (t.size != decode_cases[i].table_size) {
+			fprintf(stderr, "test/hpack: %s: table size: %zu, not %zu\n",
+				decode_cases[i].name, t.size, decode_cases[i].table_size);
+			ret += fail(decode_cases[i].name, "wrong table");
+		}
+	}
+
+	hpack_table_deinit(&t);
+	buffer_deinit(&scratch);
+	buffer_deinit(&out);
+	return ret;
+}
+
+
+static int
+check_invalid(void)
+{
+	int ret = 0;
+	unsigned char in[64];
+	Buffer out, scratch;
+
+	if ((buffer_init(&out, 256) < 0) || (buffer_init(&scratch, 256) < 0)) {
+		perror("test/hpack: buffer_init");
+		return 1;
+	}
+
+	for (size_t i = 0; i < LEN(invalid_cases); i++) {
+		HpackTable t;
+		hpack_table_init(&t);
+
+		const size_t in_len = hex_decode(invalid_cases[i].hex, in, sizeof(in));
+		size_t out_len = 0;
+		if (hpack_decode(&t, in, in_len, &out, &out_len, &scratch) == 0)
+			ret += fail(invalid_cases[i].name, "accepted");
+
+		hpack_table_deinit(&t);
+	}
+
+	buffer_deinit(&scratch);
+	buffer_deinit(&out);
+	return ret;
+}
+
+
+static int
+check_int(void)
+{
+	int ret = 0;
+	unsigned char expect[16];
+	Buffer b;
+
+	if (buffer_init(&b, 64) < 0) {
+		perror("test/hpack: buffer_init");
+		return 1;
+	}
+
+	for (size_t i = 0; i < LEN(int_cases); i++) {
+		const size_t expect_len = hex_decode(int_cases[i].hex, expect, sizeof(expect));
+		size_t len = 0;
+		if ((hpack_int_encode(&b, &len, 0, int_cases[i].bits, int_cases[i].value) < 0) ||
+		    (len != expect_len) || (memcmp(b.ptr, expect, len) != 0)) {
+			ret += fail(int_cases[i].name, "wrong encoding");
+			continue;
+		}
+
+		const unsigned char *p = expect;
+		size_t value;
+		if ((hpack_int_decode(&p, expect + expect_len, int_cases[i].bits, &value) < 0) ||
+		    (value != int_cases[i].value) || (p != (expect + expect_len)))
+			ret += fail(int_cases[i].name, "wrong decoding");
+	}
+
+	buffer_deinit(&b);
+	return ret;
+}
+
+
+static int
+check_huff(void)
+{
+	int ret = 0;
+	unsigned char expect[64], out[64];
+	Buffer b;
+
+	if (buffer_init(&b, 64) < 0) {
+		perror("test/hpack: buffer_init");
+		return 1;
+	}
+
+	for (size_t i = 0; i < LEN(huff_cases); i++) {
+		const char *const str = huff_cases[i].str;
+		const size_t str_len = strlen(str);
+		const size_t expect_len = hex_decode(huff_cases[i].hex, expect, sizeof(expect));
+		if ((hpack_huff_len(str, str_len) != expect_len)) {
+			ret += fail(str, "wrong Huffman length");
+			continue;
+		}
+
+		hpack_huff_encode(out, str, str_len);
+		if (memcmp(out, expect, expect_len) != 0)
+			ret += fail(str, "wrong Huffman encoding");
+
+		size_t len = 0;
+		if ((hpack_huff_decode(&b, &len, expect, expect_len) < 0) || (len != str_len) ||
+		    (memcmp(b.ptr, str, len) != 0))
+			ret += fail(str, "wrong Huffman decoding");
+	}
+
+	buffer_deinit(&b);
+	return ret;
+}
+
+
+static int
+check_encode(void)
+{
+	const struct {
+		const char *name;
+		const char *value;
+		int         is_indexing;
+	} fields[] = {
+		{ ":method",    "GET",             0 },
+		{ ":scheme",    "http",            0 },
+		{ ":path",      "/",               0 },
+		{ ":authority", "www.example.com", 1 },
+	};
+
+	unsigned char expect[64];
+	const size_t expect_len = hex_decode("8286 8441 8cf1 e3c2 e5f2 3a6b a0ab 90f4 ff", expect,
+					     sizeof(expect));
+	Buffer b;
+	size_t len = 0;
+
+	if (buffer_init(&b, 64) < 0) {
+		perror("test/hpack: buffer_init");
+		return 1;
+	}
+
+	int ret = 0;
+	for (size_t i = 0; i < LEN(fields); i++) {
+		if (hpack_field_encode(&b, &len, fields[i].name, strlen(fields[i].name),
+				       fields[i].value, strlen(fields[i].value),
+				       fields[i].is_indexing) < 0) {
+			ret = fail("C.4.1 (encoder)", "failed");
+			goto out0;
+		}
+	}
+
+	if ((len != expect_len) || (memcmp(b.ptr, expect, len) != 0))
+		ret = fail("C.4.1 (encoder)", "wrong block");
+
+out0:
+	buffer_deinit(&b);
+	return ret;
+}
+
+
+static int
+fail(const char name[], const char what[])
+{
+	fprintf(stderr, "test/hpack: %s: %s\n", name, what);
+	return 1;
+}
+
+
+int
+main(void)
+{
+	const int failed = check_int() + check_huff() + check_decode() + check_invalid() +
+			   check_encode();
+	const size_t total = LEN(int_cases) + LEN(huff_cases) + LEN(decode_cases) +
+			     LEN(invalid_cases) + 1;
+
+	printf("test/hpack: %zu cases, %d failed\n", total, failed);
+	return failed;
+}